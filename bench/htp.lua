@@ -0,0 +1,118 @@
+#!../out/bin/lua
+
+---
+-- \file    bench/htp.lua
+-- \brief   benchmark T.Http.Server with T.Http.Bench
+-- Starts a T.Http.Server in a child process and runs the load scenarios
+-- against it one after another.  Only the server is measured, not the load
+-- generator: the server counts its own system calls in loop:stats() (polling,
+-- epoll_ctl, accept, setsockopt, recv, writev, sendfile, close) and reports
+-- them on /stats; CPU time per request gets taken from /proc/<pid>/stat.
+--
+--    lua htp.lua [port [duration in ms]]
+
+local t    = require't'
+local fmt  = string.format
+local port = tonumber( arg[ 1 ] == 'server' and arg[ 2 ] or arg[ 1 ] ) or 8000
+local dur  = tonumber( arg[ 2 ] ) or 5000
+local body = 'Hello World\n'
+
+-- the server side; gets started by the benchmark below
+if 'server' == arg[ 1 ] then
+	local l = t.Loop( 2048 )
+	local h = t.Http.Server( l, function( s )
+		if '/quit' == s.url then
+			s:finish( 'bye\n' )
+			l:stop( )
+		elseif '/stats' == s.url then
+			s:finish( tostring( l:stats( ).syscalls ) )
+		else
+			s:finish( body )
+		end
+	end )
+	h:listen( port, 1024 )
+	local f = io.open( '/proc/self/stat' )
+	io.write( f:read( 'n' ), '\n' )
+	io.flush( )
+	f:close( )
+	l:stats( true )
+	l:run( )
+	return
+end
+
+
+local scenarios = {
+	  { name='keep-alive', connections=16, pipeline=1 }
+	, { name='pipelined',  connections=16, pipeline=16 }
+	, { name='churn',      connections=16, requests=1 }
+	-- open loop at half the keep-alive throughput; latency counts from when
+	-- a request was due, so stalls show up in the tail
+	, { name='open-loop',  connections=16, pipeline=16, load=0.5 }
+}
+
+local p   = io.popen( fmt( '%s %s server %d', arg[ -1 ], arg[ 0 ], port ) )
+local pid = p:read( 'l' )
+local l   = t.Loop( 2048 )
+local cli = t.Http.Client( l, 1 )
+local i   = 0
+local rps = 0
+local sc, ck
+
+-- syscalls as counted by the server and CPU time (in clock ticks, 100/s) it
+-- has used so far; handed to done( syscalls, ticks )
+local usage = function( done )
+	local b = { }
+	cli:request( { host='127.0.0.1', port=port, path='/stats' }, function( r )
+		r:onBody( function( r, d )
+			if d then b[ #b+1 ] = d return end
+			local f, c = io.open( '/proc/' .. pid .. '/stat' ), { }
+			for v in f:read( 'a' ):match( '%) (.*)' ):gmatch( '%S+' ) do c[ #c+1 ] = v end
+			f:close( )
+			-- utime and stime are fields 14 and 15; counting starts after the name
+			done( tonumber( table.concat( b ) ) or 0, tonumber( c[ 12 ] ) + tonumber( c[ 13 ] ) )
+		end )
+	end )
+end
+
+print( fmt( 'T.Http.Server on 127.0.0.1:%d (pid %s), %d ms per scenario', port, pid, dur ) )
+print( fmt( '%-11s %10s %9s %9s %9s %9s %7s %8s %11s',
+   'scenario', 'req/s', 'p50 ms', 'p99 ms', 'p999 ms', 'max ms', 'errors', 'sys/req', 'cpu us/req' ) )
+
+local quit = function( )
+	cli:request( { host='127.0.0.1', port=port, path='/quit' }, function( r )
+		l:stop( )
+	end )
+end
+
+local nxt
+nxt = function( b, r )
+	if b then
+		return usage( function( n, c )
+			local s = scenarios[ i ]
+			local q = math.max( r.requests, 1 )
+			print( fmt( '%-11s %10.0f %9.3f %9.3f %9.3f %9.3f %7d %8.2f %11.1f',
+			   s.name, r.rps, r.p50, r.p99, r.p999, r.max, r.errors + r.failed,
+			   (n - sc) / q, (c - ck) * 10000 / q ) )
+			if 1 == i then rps = r.rps end
+			nxt( )
+		end )
+	end
+	i = i + 1
+	local s = scenarios[ i ]
+	if not s then return quit( ) end
+	usage( function( n, c )
+		sc, ck = n, c
+		t.Http.Bench( l, {
+			  port        = port
+			, duration    = dur
+			, connections = s.connections
+			, pipeline    = s.pipeline
+			, requests    = s.requests
+			, rate        = s.load and math.floor( rps * s.load ) or nil
+		} ):run( nxt )
+	end )
+end
+
+nxt( )
+l:run( )
+p:close( )
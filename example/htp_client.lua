@@ -0,0 +1,30 @@
+#!../out/bin/lua
+t=require't'
+
+-- fetches the same page a couple of times over at most 2 keep-alive
+-- connections; start example/htp_hello.lua first.
+local l = t.Loop( 100 )
+local c = t.Http.Client( l, 2 )
+local n = 10
+
+for i=1,n do
+	c:request( { host='127.0.0.1', port=8000, path='/' }, function( r, err )
+		if not r then
+			print( i, 'failed:', err )
+			n = n - 1
+			if 0 == n then l:stop( ) end
+			return
+		end
+		local body = { }
+		r:onBody( function( r, data, err )
+			if data then
+				body[ #body+1 ] = data
+			else
+				print( i, r.status, r.version, err or #table.concat( body ) )
+				n = n - 1
+				if 0 == n then l:stop( ) end
+			end
+		end )
+	end )
+end
+l:run( )
@@ -0,0 +1,7 @@
+#!../out/bin/lua
+t=require't'
+
+-- one worker per CPU, each with its own T.Loop and lua_State; the kernel
+-- distributes connections on port 8000 via SO_REUSEPORT; join() blocks until
+-- the workers stopped
+t.Http.Server.cluster( 0, 'htp_hello', 8000, 128 ):join( )
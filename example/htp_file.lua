@@ -0,0 +1,16 @@
+#!../out/bin/lua
+t=require't'
+
+-- serves files below the current directory; the content goes out via
+-- sendfile() and Range requests (e.g. curl -r 0-99) get a 206 response
+local l = t.Loop( 1200 )
+local h = t.Http.Server( l, function( msg )
+	local path = '.' .. msg.url:gsub( '%?.*', '' ):gsub( '%.%.', '' )
+	local ok, err = pcall( msg.sendFile, msg, path )
+	if not ok then
+		msg:writeHead( 404, #err )
+		msg:finish( err )
+	end
+end )
+h:listen( 8000, 128 )
+l:run()
@@ -0,0 +1,21 @@
+#!../out/bin/lua
+t=require't'
+
+-- serves the files below a directory with sendfile(); repeated requests with
+-- If-None-Match/If-Modified-Since get a 304.  Keeps up to 16MB of files
+-- no larger than 1MB each open; larger files get opened per request.
+local l = t.Loop( 1200 )
+local f = t.Http.Files( arg[1] or '.', 16*1024*1024, 1024*1024 )
+local r = t.Http.Router( )
+
+r:add( 'GET', '/static/*path', function( s, path )
+	f( s, path )
+end )
+r:add( 'GET', '/', function( s )
+	f( s )        -- index.html of the root
+end )
+
+print( f, #f )
+local h = t.Http.Server( l, r )
+h:listen( 8000, 128 )
+l:run()
@@ -0,0 +1,7 @@
+-- request handler module for htp_cluster.lua; each worker loads its own copy
+local body = "Hello from a T.Http.Server cluster worker\n"
+
+return function( msg )
+	msg:writeHead( 200, #body )
+	msg:finish( body )
+end
@@ -0,0 +1,30 @@
+#!../out/bin/lua
+t=require't'
+
+-- dispatches requests natively; captured segments are passed to the handlers
+-- after the stream.  Requests without a route get a 404 (or a 405 if only
+-- the method doesn't match).
+local l = t.Loop( 1200 )
+local r = t.Http.Router( )
+
+r:add( 'GET', '/', function( s )
+	s:finish( 'index\n' )
+end )
+r:add( 'GET', '/users/:id', function( s, id )
+	s:finish( 'user ' .. id .. '\n' )
+end )
+r:add( 'DELETE', '/users/:id', function( s, id )
+	s:writeHead( 204, 0 )
+	s:finish( '' )
+end )
+r:add( 'GET', '/users/:id/files/*path', function( s, id, path )
+	s:finish( 'file ' .. path .. ' of user ' .. id .. '\n' )
+end )
+r:add( '*', '/echo', function( s )
+	s:finish( s.method .. ' ' .. s.url .. '\n' )
+end )
+
+print( r, #r, r:match( 'GET', '/users/7' ) )
+local h = t.Http.Server( l, r )
+h:listen( 8000, 128 )
+l:run()
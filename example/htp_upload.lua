@@ -0,0 +1,27 @@
+#!../out/bin/lua
+t=require't'
+
+-- stores request bodies in upload.bin as they arrive; works for Content-Length
+-- and chunked uploads (e.g. curl -T big.iso http://localhost:8000/) alike.
+-- Every 64 pieces the reading pauses for 10ms to demonstrate backpressure.
+local l = t.Loop( 1200 )
+local h = t.Http.Server( l, function( msg )
+	local f, n = io.open( 'upload.bin', 'wb' ), 0
+	msg:onBody( function( s, data )
+		if data then
+			f:write( data )
+			n = n + 1
+			if 0 == n % 64 then
+				l:addTimer( t.Time( 10 ), function( ) s:resume( ) end )
+				return false
+			end
+		else
+			f:close( )
+			local r = 'stored ' .. n .. ' pieces\n'
+			s:writeHead( 200, #r )
+			s:finish( r )
+		end
+	end )
+end )
+h:listen( 8000, 128 )
+l:run()
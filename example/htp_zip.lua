@@ -0,0 +1,24 @@
+#!../out/bin/lua
+t=require't'
+
+-- responses get gzip/deflate compressed if the client accepts it.  The small
+-- body is compressed once and served from the cache afterwards; the streamed
+-- one is compressed chunk by chunk as it gets written.
+local l = t.Loop( 1200 )
+local row  = '{"id":%d,"name":"row %d","tags":["a","b","c"]},\n'
+local rows = { }
+for i=1,1000 do rows[ i ] = row:format( i, i ) end
+local json = '[' .. table.concat( rows ) .. '{}]\n'
+
+local h = t.Http.Server( l, function( s )
+	if s.url == '/stream' then
+		s:writeHead( 200, { ['Content-Type'] = 'application/json' } )
+		for i=1,200 do s:write( json ) end
+		s:finish( )
+	else
+		s:finish( json )
+	end
+end )
+h:compress( 6, 1024, 4*1024*1024 )
+h:listen( 8000, 128 )
+l:run()
@@ -32,7 +32,7 @@ function r( s )
 	end
 end
 
-l   = t.Loop( 3 )      ---< Loop with n slots for filehandles
+l   = t.Loop( 3 )      ---< size hint for handle table; grows as needed
 for i=1,n do
 	table.insert( tm, t.Time( math.random( n*35, n*3000 ) ) )
 	print( tm[i] )
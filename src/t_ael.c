@@ -15,63 +15,170 @@
 #include "t.h"
 #include <stdlib.h>               // malloc, free
 #include <string.h>               // memset
+#include <limits.h>               // INT_MAX
 #include "t_ael.h"
 
 
 /**----------------------------------------------------------------------------
- * Slot in a timer event into the loops timer event list.
- * \detail  Ordered insert; walks down linked list and inserts before the next
- *          bigger * timer
+ * Swap two timers in the loops timer heap and keep their index current.
  * \param   t_ael    Loop Struct.
+ * \param   size_t   index of first timer.
+ * \param   size_t   index of second timer.
  * \return  void.
  * --------------------------------------------------------------------------*/
 static inline void
+t_ael_swaptimer( struct t_ael *ael, size_t a, size_t b )
+{
+	TSWAP( struct t_ael_tm *, ael->tm_heap[ a ], ael->tm_heap[ b ] );
+	ael->tm_heap[ a ]->idx = a;
+	ael->tm_heap[ b ]->idx = b;
+}
+
+
+/**----------------------------------------------------------------------------
+ * Restore heap order by moving a timer up towards the root.
+ * \param   t_ael    Loop Struct.
+ * \param   size_t   index of the timer to move.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_ael_uptimer( struct t_ael *ael, size_t i )
+{
+	size_t p;
+
+	while (i > 0)
+	{
+		p = (i-1) / 2;
+		if (! t_tim_cmp( &ael->tm_heap[ i ]->dl, &ael->tm_heap[ p ]->dl, < ))
+			break;
+		t_ael_swaptimer( ael, i, p );
+		i = p;
+	}
+}
+
+
+/**----------------------------------------------------------------------------
+ * Restore heap order by moving a timer down towards the leafs.
+ * \param   t_ael    Loop Struct.
+ * \param   size_t   index of the timer to move.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_ael_downtimer( struct t_ael *ael, size_t i )
+{
+	size_t c;
+
+	while ((c = 2*i + 1) < ael->tm_cnt)
+	{
+		// pick the earlier of both children
+		if (c+1 < ael->tm_cnt &&
+		    t_tim_cmp( &ael->tm_heap[ c+1 ]->dl, &ael->tm_heap[ c ]->dl, < ))
+			c++;
+		if (! t_tim_cmp( &ael->tm_heap[ c ]->dl, &ael->tm_heap[ i ]->dl, < ))
+			break;
+		t_ael_swaptimer( ael, i, c );
+		i = c;
+	}
+}
+
+
+/**----------------------------------------------------------------------------
+ * Slot in a timer event into the loops timer heap.
+ * \detail  O(log n) insert keyed on the absolute deadline te->dl.  Grows the
+ *          heap array if necessary.
+ * \param   t_ael    Loop Struct.
+ * \param   t_ael_tm Timer to insert.
+ * \return  int      0 on success, -1 if the heap could not be grown.
+ * --------------------------------------------------------------------------*/
+static int
 t_ael_instimer( struct t_ael *ael, struct t_ael_tm *te )
 {
-	struct t_ael_tm *tr;
+	struct t_ael_tm **h;
+	size_t            sz;
 
-	if (NULL == ael->tm_head || t_tim_cmp( ael->tm_head->tv, te->tv, > ))
+	if (ael->tm_cnt == ael->tm_sz)
 	{
-#if PRINT_DEBUGS == 1
-		printf( "Make HEAD   {%2ld:%6ld}\t PRE{%2ld:%6ld}\n",
-			te->tv->tv_sec,  te->tv->tv_usec,
-			(NULL != ael->tm_head) ? ael->tm_head->tv->tv_sec  : 0,
-			(NULL != ael->tm_head) ? ael->tm_head->tv->tv_usec : 0);
-#endif
-		te->nxt     = ael->tm_head;
-		ael->tm_head = te;
+		sz = (ael->tm_sz) ? ael->tm_sz*2 : 16;
+		h  = (struct t_ael_tm **) realloc( ael->tm_heap, sz * sizeof( struct t_ael_tm * ) );
+		if (NULL == h)
+			return -1;
+		ael->tm_heap = h;
+		ael->tm_sz   = sz;
 	}
-	else
+	te->idx                     = ael->tm_cnt;
+	ael->tm_heap[ ael->tm_cnt++ ] = te;
+	t_ael_uptimer( ael, te->idx );
+	return 0;
+}
+
+
+/**----------------------------------------------------------------------------
+ * Remove a timer event from the loops timer heap.
+ * \detail  O(log n); moves the last timer into the gap and restores order.
+ * \param   t_ael    Loop Struct.
+ * \param   t_ael_tm Timer to remove.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_ael_deltimer( struct t_ael *ael, struct t_ael_tm *te )
+{
+	size_t i = te->idx;
+
+	if (i != --ael->tm_cnt)
 	{
-		tr = ael->tm_head;
-		while (NULL != tr->nxt && t_tim_cmp( tr->nxt->tv, te->tv, < ))
-			tr = tr->nxt;
-#if PRINT_DEBUGS == 1
-		printf( "Make NODE   {%2ld:%6ld}\tPAST{%2ld:%6ld}\n",
-			te->tv->tv_sec,  te->tv->tv_usec,
-			tr->tv->tv_sec,  tr->tv->tv_usec);
-#endif
-		te->nxt = tr->nxt;
-		tr->nxt = te;
+		t_ael_swaptimer( ael, i, ael->tm_cnt );
+		t_ael_downtimer( ael, i );
+		t_ael_uptimer( ael, i );
 	}
 }
 
 
-/**--------------------------------------------------------------------------
- * Adjust amount of time in the loops timer event list.
- *          substract ta from each timer in the list.
+/**----------------------------------------------------------------------------
+ * Add or remove a timer from the T.Time -> timer lookup table.
+ * \param   L        The lua state.
  * \param   t_ael    Loop Struct.
+ * \param   t_ael_tm Timer to add or remove.
+ * \param   int      boolean; if true add, else remove.
  * \return  void.
  * --------------------------------------------------------------------------*/
-static inline void
-t_ael_adjusttimer( struct t_ael *ael, struct timeval *ta )
+static void
+t_ael_maptimer( lua_State *L, struct t_ael *ael, struct t_ael_tm *te, int add )
 {
-	struct t_ael_tm *tr = ael->tm_head;
-	while (NULL != tr)
+	lua_rawgeti( L, LUA_REGISTRYINDEX, ael->tmR );
+	lua_pushlightuserdata( L, te->tv );
+	if (add)
+		lua_pushlightuserdata( L, te );
+	else
+		lua_pushnil( L );
+	lua_rawset( L, -3 );
+	lua_pop( L, 1 );
+}
+
+
+/**----------------------------------------------------------------------------
+ * Calculate the time left until the next timer is due.
+ * \detail  While deferred tasks are pending the loop must not block, so the
+ *          remaining time is zero.
+ * \param   t_ael    Loop Struct.
+ * \param   timeval  struct to be filled with the remaining time.
+ * \return  timeval  pointer to tv or NULL if there is no timer in the loop.
+ * --------------------------------------------------------------------------*/
+struct timeval
+*t_ael_nexttimer( struct t_ael *ael, struct timeval *tv )
+{
+	struct timeval nw;
+
+	if (0 == ael->tm_cnt && 0 == ael->df_cnt)
+		return NULL;
+	t_tim_mono( &nw );
+	if (0 == ael->df_cnt && t_tim_cmp( &ael->tm_heap[ 0 ]->dl, &nw, > ))
+		t_tim_sub( &ael->tm_heap[ 0 ]->dl, &nw, tv );
+	else
 	{
-		t_tim_sub( tr->tv, ta, tr->tv );
-		tr = tr->nxt;
+		tv->tv_sec  = 0;
+		tv->tv_usec = 0;
 	}
+	return tv;
 }
 
 
@@ -98,40 +205,216 @@ t_ael_getfunc( lua_State *L, int refPos )
 
 
 /**--------------------------------------------------------------------------
- * Executes a timer function and reorganizes the timer linked list
+ * Release the reference of a handler removed from the loop.
+ * \detail  Keeps the statistics from attributing the slowest handler
+ *          entries to whichever handler gets the reference next.
+ * \param   L             The lua state.
+ * \param   struct t_ael  Loop struct.
+ * \param   int           reference of func/arg table or native owner.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_unref( lua_State *L, struct t_ael *ael, int ref )
+{
+	if (NULL != ael->sts)
+		t_ael_sts_release( ael->sts, ref );
+	luaL_unref( L, LUA_REGISTRYINDEX, ref );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Executes all due timer functions and reorganizes the timer heap
+ * \detail  All timers whose deadline has passed get fired in one batch.  If
+ *          a function returns a T.Time the timer gets rescheduled with that
+ *          value as interval relative to its previous deadline, so periodic
+ *          timers don't drift.  Native timers get rescheduled with their own
+ *          interval if cf returns non-zero.  If the loop fell behind by more
+ *          than one interval the new deadline is measured from now instead.
+ *          Timers rescheduled into the past fire in the next batch, not in
+ *          this one.  The T.Time instances are never modified.
  * \param   L         The lua state.
  * \param   struct xp_lp  Loop struct.
  * \lparam  userdata      T.Loop.
  * \return  void.
  * --------------------------------------------------------------------------*/
 void
-t_ael_executetimer( lua_State *L, struct t_ael *ael, struct timeval *rt )
+t_ael_executetimer( lua_State *L, struct t_ael *ael )
 {
 	struct timeval  *tv;                  ///< timer returned by execution -> if there is
-	
-	struct t_ael_tm *te = ael->tm_head;   ///< timer to execute is tm_head, ALWAYS
+	struct timeval   nw;                  ///< current time; fixed for the batch
+	struct timeval   us = { 0, 1 };       ///< smallest step past nw
+	struct t_ael_tm *te;                  ///< timer to execute is heap root, ALWAYS
+	struct t_ael_sts *sts;                ///< statistics as of the start of the call
+	struct timeval   t0;                  ///< start of the call
 	int    n;                             ///< length of arguments to call
+	int    top = lua_gettop( L );
 
-	ael->tm_head = ael->tm_head->nxt;
-	n = t_ael_getfunc( L, te->fR );
-	lua_call( L, n, 1 );
-	t_tim_since( rt );
-	t_ael_adjusttimer( ael, rt );
-	tv = t_tim_check_ud( L, -1, 0 );
-	// reorganize linked timer list
-	if (NULL == tv)
+	t_tim_mono( &nw );
+	while (ael->tm_cnt > 0 && ! t_tim_cmp( &ael->tm_heap[ 0 ]->dl, &nw, > ))
 	{
-		luaL_unref( L, LUA_REGISTRYINDEX, te->fR );
-		luaL_unref( L, LUA_REGISTRYINDEX, te->tR );
-		free (te);
+		te = ael->tm_heap[ 0 ];
+		t_ael_deltimer( ael, te );
+		// while executing te is not part of the loop, so removeTimer() can't hit it
+		t_ael_maptimer( L, ael, te, 0 );
+		if (NULL != (sts = ael->sts))
+			t_tim_mono( &t0 );
+		if (NULL != te->cf)
+		{
+			lua_rawgeti( L, LUA_REGISTRYINDEX, te->fR );
+			tv = (te->cf( L, te->ud )) ? te->tv : NULL;
+		}
+		else
+		{
+			n = t_ael_getfunc( L, te->fR );
+			lua_call( L, n, 1 );
+			tv = t_tim_check_ud( L, -1, 0 );
+		}
+		if (NULL != sts && sts == ael->sts)
+			t_ael_sts_handler( sts, te->fR, -1, T_AEL_NO, &t0 );
+		if (NULL != tv)
+		{
+			t_tim_add( &te->dl, tv, &te->dl );
+			if (! t_tim_cmp( &te->dl, &nw, > ))      // fell behind -> skip ahead
+				t_tim_add( &nw, tv, &te->dl );
+			if (! t_tim_cmp( &te->dl, &nw, > ))      // zero interval -> next batch
+				t_tim_add( &nw, &us, &te->dl );
+		}
+		// reorganize timer heap
+		if (NULL == tv || 0 != t_ael_instimer( ael, te ))
+		{
+			t_ael_unref( L, ael, te->fR );
+			luaL_unref( L, LUA_REGISTRYINDEX, te->tR );
+			free (te);
+		}
+		else
+			t_ael_maptimer( L, ael, te, 1 );
+		lua_settop( L, top );   // drop the reference table and returned value
+	}
+}
+
+
+/**----------------------------------------------------------------------------
+ * Append a task to the loops deferred queue.
+ * \detail  The queue is a ring buffer which doubles when full, so deferring
+ *          is amortized O(1) and doesn't allocate once the loop warmed up.
+ * \param   t_ael    Loop Struct.
+ * \param   int      fR - func/arg table or owner reference.
+ * \param   t_ael_cfn cf - native task; NULL for Lua tasks.
+ * \param   void*    ud - context handed to cf.
+ * \return  int      0 on success, -1 if the queue could not be grown.
+ * --------------------------------------------------------------------------*/
+static int
+t_ael_insdefer( struct t_ael *ael, int fR, t_ael_cfn cf, void *ud )
+{
+	struct t_ael_dfr *d;
+	size_t            sz;
+
+	if (ael->df_cnt == ael->df_sz)
+	{
+		sz = (ael->df_sz) ? ael->df_sz*2 : T_AEL_DF_SZ;
+		d  = (struct t_ael_dfr *) realloc( ael->df_buf, sz * sizeof( struct t_ael_dfr ) );
+		if (NULL == d)
+			return -1;
+		// tasks which wrapped around the old end move behind it
+		if (ael->df_hd + ael->df_cnt > ael->df_sz)
+			memcpy( &d[ ael->df_sz ], &d[ 0 ],
+			        (ael->df_hd + ael->df_cnt - ael->df_sz) * sizeof( struct t_ael_dfr ) );
+		ael->df_buf = d;
+		ael->df_sz  = sz;
+	}
+	d     = &ael->df_buf[ (ael->df_hd + ael->df_cnt++) % ael->df_sz ];
+	d->fR = fR;
+	d->cf = cf;
+	d->ud = ud;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Executes the tasks deferred to the end of the loop iteration.
+ * \detail  Runs in FIFO order after I/O and timers got dispatched.  Only the
+ *          tasks queued when the drain starts get executed; tasks deferred by
+ *          those run in the next iteration, so a task re-deferring itself
+ *          can't starve I/O.
+ * \param   L             The lua state.
+ * \param   struct t_ael  Loop struct.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_executedefer( lua_State *L, struct t_ael *ael )
+{
+	struct t_ael_dfr d;
+	size_t           c = ael->df_cnt;     ///< tasks queued before the drain
+	int              n;
+
+	while (c-- > 0 && ael->df_cnt > 0)
+	{
+		d           = ael->df_buf[ ael->df_hd ];
+		ael->df_hd  = (ael->df_hd + 1) % ael->df_sz;
+		ael->df_cnt--;
+		if (NULL != d.cf)
+		{
+			n = lua_gettop( L );
+			lua_rawgeti( L, LUA_REGISTRYINDEX, d.fR );
+			d.cf( L, d.ud );
+			lua_settop( L, n );
+		}
+		else
+		{
+			n = t_ael_getfunc( L, d.fR );
+			lua_call( L, n, 0 );
+			lua_pop( L, 1 );             // remove the table
+		}
+		luaL_unref( L, LUA_REGISTRYINDEX, d.fR );
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Executes a single handler of a file/socket handle.
+ * \detail  Native handlers get called directly with the owner of their
+ *          context anchored on the stack.  Lua handlers get unfolded from
+ *          their func/arg table.
+ * \param   L         The lua state.
+ * \param   struct t_ael  Loop struct.
+ * \param   int           fd.
+ * \param   enum t_ael_t  t - either T_AEL_RD or T_AEL_WR.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static inline void
+t_ael_callhandle( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t )
+{
+	struct t_ael_fd  *f   = ael->fd_set[ fd ];
+	int               ref = (T_AEL_RD == t) ? f->rR  : f->wR;
+	t_ael_cfn         cf  = (T_AEL_RD == t) ? f->rCf : f->wCf;
+	void             *ud  = (T_AEL_RD == t) ? f->rUd : f->wUd;
+	struct t_ael_sts *sts = ael->sts;   ///< statistics as of the start of the call
+	struct timeval    t0;
+	int               n;
+
+	if (NULL != sts)
+		t_tim_mono( &t0 );
+	if (NULL != cf)
+	{
+		n = lua_gettop( L );
+		lua_rawgeti( L, LUA_REGISTRYINDEX, ref );
+		cf( L, ud );
+		lua_settop( L, n );
 	}
 	else
 	{
-		*te->tv = *tv;
-		t_ael_instimer( ael, te );
+		n = t_ael_getfunc( L, ref );
+		lua_call( L, n , 0 );
+		lua_pop( L, 1 );             // remove the table
+	}
+	if (NULL != sts && sts == ael->sts)
+	{
+		// the handler may have removed itself; its reference is free for reuse
+		f = ael->fd_set[ fd ];
+		if (NULL == f || ref != ((T_AEL_RD == t) ? f->rR : f->wR))
+			ref = LUA_NOREF;
+		t_ael_sts_handler( sts, ref, fd, t, &t0 );
 	}
-	lua_pop( L, 2 );   // pop the one value that lua_call allows to be
-	                   // returned and the original reference table
 }
 
 
@@ -145,22 +428,44 @@ t_ael_executetimer( lua_State *L, struct t_ael *ael, struct timeval *rt )
 void
 t_ael_executehandle( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t )
 {
-	int n;
-
-	//printf( "%d    %d    %d    %d\n", fd,  ael->fd_set[ fd ]->rR ,  ael->fd_set[ fd ]->wR, t );
 	if( t & T_AEL_RD )
-	{
-		n = t_ael_getfunc( L, ael->fd_set[ fd ]->rR );
-		lua_call( L, n , 0 );
-		lua_pop( L, 1 );             // remove the table
-	}
+		t_ael_callhandle( L, ael, fd, T_AEL_RD );
 	// since read func can gc the socket, fd_set[fd] can be NULL
 	if( NULL != ael->fd_set[ fd ] && t & T_AEL_WR )
-	{
-		n = t_ael_getfunc( L, ael->fd_set[ fd ]->wR );
-		lua_call( L, n , 0 );
-		lua_pop( L, 1 );             // remove the table
-	}
+		t_ael_callhandle( L, ael, fd, T_AEL_WR );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Make sure the handle table of the loop has a slot for fd.
+ * \detail  Grows fd_set by at least doubling, so adding descriptors in
+ *          ascending order is amortized O(1).  New slots are NULL.
+ * \param   struct t_ael*.
+ * \param   int        fd  descriptor which needs a slot.
+ * \return  int        0 on success, -1 if fd is negative or memory could not
+ *                     be allocated.
+ * --------------------------------------------------------------------------*/
+static int
+t_ael_growfd( struct t_ael *ael, int fd )
+{
+	struct t_ael_fd **fs;
+	size_t            sz;
+	size_t            n;
+
+	if (fd < 0)
+		return -1;
+	if ((size_t) fd < ael->fd_sz)
+		return 0;
+	sz = (ael->fd_sz > 0) ? ael->fd_sz*2 : T_AEL_FD_SZ;
+	while (sz <= (size_t) fd)
+		sz *= 2;
+	fs = (struct t_ael_fd **) realloc( ael->fd_set, sz * sizeof( struct t_ael_fd * ) );
+	if (NULL == fs)
+		return -1;
+	for (n=ael->fd_sz; n<sz; n++) fs[ n ] = NULL;
+	ael->fd_set = fs;
+	ael->fd_sz  = sz;
+	return 0;
 }
 
 
@@ -168,14 +473,17 @@ t_ael_executehandle( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t )
  * Construct a t.Loop and return it.
  * \param   L  The lua state.
  * \lparam  CLASS table t.Loop.
+ * \lparam  int   expected number of handles (optional, table grows anyway).
  * \lreturn struct t_ael userdata.
  * \return  #stack items returned by function call.
  * --------------------------------------------------------------------------*/
 static int lt_ael__Call( lua_State *L )
 {
-	size_t                                 sz  = luaL_checkinteger( L, -1 );
-	struct t_ael __attribute__ ((unused)) *ael = t_ael_create_ud( L, sz );
+	lua_Integer                            sz  = luaL_optinteger( L, 2, T_AEL_FD_SZ );
+	struct t_ael __attribute__ ((unused)) *ael;
 
+	luaL_argcheck( L, sz > 0 && sz <= INT_MAX, 2, "number of handles must be positive" );
+	ael = t_ael_create_ud( L, (size_t) sz );
 	return 1;
 }
 
@@ -183,24 +491,45 @@ static int lt_ael__Call( lua_State *L )
 /**--------------------------------------------------------------------------
  * Create a new t_ael userdata and push to LuaStack.
  * \param   L  The lua state.
- * \param   size_t  how many slots for file/socket events to be created.
+ * \param   size_t  initial number of slots for file/socket events.
  * \return  struct t_ael * pointer to new userdata on Lua Stack
  * --------------------------------------------------------------------------*/
 struct t_ael
 *t_ael_create_ud( lua_State *L, size_t sz )
 {
 	struct t_ael    *ael;
-	size_t           n;
 
 	ael = (struct t_ael *) lua_newuserdata( L, sizeof( struct t_ael ) );
-	ael->fd_sz   = sz;
+	ael->fd_sz   = 0;
 	ael->max_fd  = 0;
-	ael->tm_head = NULL;
-	ael->fd_set  = (struct t_ael_fd **) malloc( (ael->fd_sz+1) * sizeof( struct t_ael_fd * ) );
-	for (n=0; n<=ael->fd_sz; n++) ael->fd_set[ n ] = NULL;
-	t_ael_create_ud_impl( ael );
+	ael->tm_heap = NULL;
+	ael->tm_cnt  = 0;
+	ael->tm_sz   = 0;
+	ael->fd_set  = NULL;
+	ael->ste     = NULL;
+	ael->sts     = NULL;
+	ael->df_buf  = NULL;
+	ael->df_hd   = 0;
+	ael->df_cnt  = 0;
+	ael->df_sz   = 0;
+	ael->wk_rd   = -1;
+	ael->wk_wr   = -1;
+	ael->jb_head = NULL;
+	if (0 != t_ael_growfd( ael, (sz > 0) ? (int) sz-1 : 0 ) || 0 != t_ael_create_ud_impl( ael ))
+	{
+		free( ael->fd_set );
+		t_push_error( L, "Failed to initialize "T_AEL_TYPE );
+	}
 	luaL_getmetatable( L, T_AEL_TYPE );
 	lua_setmetatable( L, -2 );
+	lua_newtable( L );
+	ael->tmR     = luaL_ref( L, LUA_REGISTRYINDEX );
+	// known to t_ael_closefd() until collected
+	luaL_getsubtable( L, LUA_REGISTRYINDEX, T_AEL_ALL );
+	lua_pushlightuserdata( L, ael );
+	lua_pushboolean( L, 1 );
+	lua_rawset( L, -3 );
+	lua_pop( L, 1 );
 	return ael;
 }
 
@@ -221,6 +550,82 @@ struct t_ael
 }
 
 
+/**--------------------------------------------------------------------------
+ * Get the descriptor of a file or socket on the stack.
+ * \param   L    The lua state.
+ * \param   int  position of the handle on the stack.
+ * \return  int  descriptor or 0 if the value is neither file nor socket.
+ * --------------------------------------------------------------------------*/
+static int
+t_ael_getfd( lua_State *L, int pos )
+{
+	luaL_Stream   *lS = (luaL_Stream *) luaL_testudata( L, pos, LUA_FILEHANDLE );
+	struct t_net  *sc = t_net_check_ud( L, pos, 0 );
+
+	if (NULL != sc)
+		return sc->fd;
+	if (NULL != lS)
+		return fileno( lS->f );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Observe a handle for events of type t.
+ * \detail  Creates the t_ael_fd for the handle on first use and keeps a
+ *          reference to the handle so it doesn't get collected while it is
+ *          part of the loop.
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   int      position of the handle on the stack; 0 if the loop owns
+ *                   the descriptor itself.
+ * \param   int      descriptor of the handle.
+ * \param   enum t_ael_t  t - direction of handle to be observed.
+ * \return  struct t_ael_fd*  or NULL on failure.
+ * --------------------------------------------------------------------------*/
+static struct t_ael_fd
+*t_ael_sethandle( lua_State *L, struct t_ael *ael, int pos, int fd, enum t_ael_t t )
+{
+	struct t_ael_fd *f;
+
+	if (0 != t_ael_growfd( ael, fd ))
+		return NULL;
+	if (NULL == (f = ael->fd_set[ fd ]))
+	{
+		f = (struct t_ael_fd *) malloc( sizeof( struct t_ael_fd ) );
+		if (NULL == f)
+			return NULL;
+		f->t   = T_AEL_NO;
+		f->fd  = fd;
+		f->rR  = LUA_NOREF;
+		f->wR  = LUA_NOREF;
+		f->hR  = LUA_NOREF;
+		f->rCf = NULL;
+		f->wCf = NULL;
+		f->rUd = NULL;
+		f->wUd = NULL;
+		ael->fd_set[ fd ] = f;
+	}
+	if (0 != t_ael_addhandle_impl( ael, fd, t ))
+	{
+		if (T_AEL_NO == f->t)
+		{
+			free( f );
+			ael->fd_set[ fd ] = NULL;
+		}
+		return NULL;
+	}
+	if (LUA_NOREF == f->hR && 0 != pos)
+	{
+		lua_pushvalue( L, pos );
+		f->hR = luaL_ref( L, LUA_REGISTRYINDEX ); // keep ref to handle so it doesnt gc
+	}
+	ael->max_fd = (fd > ael->max_fd) ? fd : ael->max_fd;
+	f->t |= t;
+	return f;
+}
+
+
 /**--------------------------------------------------------------------------
  * Add an File/Socket event handler to the T.Loop.
  * \param   L  The lua state.
@@ -234,35 +639,17 @@ struct t_ael
 int
 lt_ael_addhandle( lua_State *L )
 {
-	luaL_Stream   *lS;
-	struct t_net  *sc;
-	int            fd  = 0;
-	int            n   = lua_gettop( L ) + 1;    ///< iterator for arguments
-	struct t_ael  *ael = t_ael_check_ud( L, 1, 1 );
-	enum t_ael_t   t   = lua_toboolean( L, 3 ) ? T_AEL_RD :T_AEL_WR;
+	struct t_ael_fd *f;
+	int              fd  = t_ael_getfd( L, 2 );
+	int              n   = lua_gettop( L ) + 1;    ///< iterator for arguments
+	struct t_ael    *ael = t_ael_check_ud( L, 1, 1 );
+	enum t_ael_t     t   = lua_toboolean( L, 3 ) ? T_AEL_RD :T_AEL_WR;
 
 	luaL_checktype( L, 4, LUA_TFUNCTION );
-	lS = (luaL_Stream *) luaL_testudata( L, 2, LUA_FILEHANDLE );
-	if (NULL != lS)
-		fd = fileno( lS->f );
-
-	sc = t_net_check_ud( L, 2, 0 );
-	if (NULL != sc)
-		fd = sc->fd;
-
 	if (0 == fd)
 		return t_push_error( L, "Argument to addHandle must be file or socket" );
-
-	if (NULL == ael->fd_set[ fd ])
-	{
-		ael->fd_set[ fd ] = (struct t_ael_fd *) malloc( sizeof( struct t_ael_fd ) );
-		ael->fd_set[ fd ]->t = T_AEL_NO;
-	}
-
-	ael->fd_set[ fd ]->t |= t;
-
-	ael->max_fd = (fd > ael->max_fd) ? fd : ael->max_fd;
-	t_ael_addhandle_impl( ael, fd, t );
+	if (NULL == (f = t_ael_sethandle( L, ael, 2, fd, t )))
+		return t_push_error( L, "Failed to add handle to "T_AEL_TYPE );
 
 	lua_createtable( L, n-4, 0 );  // create function/parameter table
 	lua_insert( L, 4 );
@@ -271,16 +658,299 @@ lt_ael_addhandle( lua_State *L )
 		lua_rawseti( L, 4, (n--)-4 );   // add arguments and function (pops each item)
 	// pop the function reference table and assign as read or write function
 	if (T_AEL_RD & t)
-		ael->fd_set[ fd ]->rR = luaL_ref( L, LUA_REGISTRYINDEX );
+	{
+		t_ael_unref( L, ael, f->rR );
+		f->rR  = luaL_ref( L, LUA_REGISTRYINDEX );
+		f->rCf = NULL;
+		f->rUd = NULL;
+	}
 	else
-		ael->fd_set[ fd ]->wR = luaL_ref( L, LUA_REGISTRYINDEX );
-	lua_pop( L, 1 ); // pop the read write boolean
-	ael->fd_set[ fd ]->hR = luaL_ref( L, LUA_REGISTRYINDEX );      // keep ref to handle so it doesnt gc
+	{
+		t_ael_unref( L, ael, f->wR );
+		f->wR  = luaL_ref( L, LUA_REGISTRYINDEX );
+		f->wCf = NULL;
+		f->wUd = NULL;
+	}
 
 	return  0;
 }
 
 
+/**--------------------------------------------------------------------------
+ * Register a native handler for a descriptor.
+ * \detail  The value owning ud must be on top of the stack; it gets popped
+ *          and referenced for as long as the handler is registered.
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   int      absolute position of the handle on the stack or 0.
+ * \param   int      descriptor.
+ * \param   enum t_ael_t  t - direction(s) of handle to be observed.
+ * \param   t_ael_cfn cf - native handler.
+ * \param   void*    ud - context handed to cf.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_ael_setnative( lua_State *L, struct t_ael *ael, int pos, int fd, enum t_ael_t t,
+                 t_ael_cfn cf, void *ud )
+{
+	struct t_ael_fd *f;
+
+	if (NULL == (f = t_ael_sethandle( L, ael, pos, fd, t )))
+		t_push_error( L, "Failed to add handle to "T_AEL_TYPE );
+
+	if (T_AEL_RD & t)
+	{
+		lua_pushvalue( L, -1 );
+		t_ael_unref( L, ael, f->rR );
+		f->rR  = luaL_ref( L, LUA_REGISTRYINDEX );
+		f->rCf = cf;
+		f->rUd = ud;
+	}
+	if (T_AEL_WR & t)
+	{
+		lua_pushvalue( L, -1 );
+		t_ael_unref( L, ael, f->wR );
+		f->wR  = luaL_ref( L, LUA_REGISTRYINDEX );
+		f->wCf = cf;
+		f->wUd = ud;
+	}
+	lua_pop( L, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Add a native File/Socket event handler to the T.Loop.
+ * \detail  Fast path for C modules.  Instead of unfolding a func/arg table
+ *          on each event cf gets called directly with ud.  The value owning
+ *          ud must be on top of the stack; it gets popped and referenced
+ *          for as long as the handler is registered.
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   int      position of the handle (file or socket) on the stack.
+ * \param   enum t_ael_t  t - direction(s) of handle to be observed.
+ * \param   t_ael_cfn cf - native handler.
+ * \param   void*    ud - context handed to cf.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_addhandle_cf( lua_State *L, struct t_ael *ael, int pos, enum t_ael_t t,
+                    t_ael_cfn cf, void *ud )
+{
+	int fd;
+
+	pos = lua_absindex( L, pos );
+	if (0 == (fd = t_ael_getfd( L, pos )))
+		t_push_error( L, "Argument to addHandle must be file or socket" );
+	t_ael_setnative( L, ael, pos, fd, t, cf, ud );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Add a native event handler for a descriptor which has no Lua handle.
+ * \detail  For descriptors the loop (or a C module) owns itself, eg. the
+ *          wakeup descriptor.  Same contract as t_ael_addhandle_cf().
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   int      descriptor.
+ * \param   enum t_ael_t  t - direction(s) of descriptor to be observed.
+ * \param   t_ael_cfn cf - native handler.
+ * \param   void*    ud - context handed to cf.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_addfd_cf( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t,
+                t_ael_cfn cf, void *ud )
+{
+	t_ael_setnative( L, ael, 0, fd, t, cf, ud );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Start or stop observing a descriptor which is part of the loop.
+ * \detail  For C modules which toggle directions of their handles, eg. wait
+ *          for writability only while output is pending.  The handlers stay
+ *          registered either way.
+ * \param   t_ael    Loop Struct.
+ * \param   int      descriptor.
+ * \param   enum t_ael_t  t - direction(s) to (un)observe.
+ * \param   int      boolean; observe?
+ * \return  int      0 on success; -1 if fd isn't part of the loop or the
+ *                   backend failed.
+ * --------------------------------------------------------------------------*/
+int
+t_ael_watch( struct t_ael *ael, int fd, enum t_ael_t t, int on )
+{
+	struct t_ael_fd *f;
+
+	if (fd < 0 || (size_t) fd >= ael->fd_sz || NULL == (f = ael->fd_set[ fd ]))
+		return -1;
+	if (on && (t & ~f->t))
+	{
+		if (0 != t_ael_addhandle_impl( ael, fd, t & ~f->t ))
+			return -1;
+		f->t |= t;
+	}
+	else if (! on && (t & f->t))
+	{
+		t_ael_removehandle_impl( ael, fd, t & f->t );
+		f->t &= ~t;
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Set or clear the native handler of a descriptor without observing it.
+ * \detail  The descriptor must be part of the loop already.  If cf is set
+ *          the value owning ud must be on top of the stack; it gets popped
+ *          and referenced for as long as the handler is registered.  A NULL
+ *          cf clears the handler and expects nothing on the stack.
+ *          Whether the direction is observed is up to t_ael_watch().
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   int      descriptor.
+ * \param   enum t_ael_t  t - T_AEL_RD or T_AEL_WR.
+ * \param   t_ael_cfn cf - native handler; NULL to clear.
+ * \param   void*    ud - context handed to cf.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_sethandler_cf( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t,
+                     t_ael_cfn cf, void *ud )
+{
+	struct t_ael_fd *f;
+	int              ref = LUA_NOREF;
+
+	if (fd < 0 || (size_t) fd >= ael->fd_sz || NULL == (f = ael->fd_set[ fd ]))
+		t_push_error( L, "Descriptor %d is not part of "T_AEL_TYPE, fd );
+	if (NULL != cf)
+		ref = luaL_ref( L, LUA_REGISTRYINDEX );
+	if (T_AEL_RD == t)
+	{
+		t_ael_unref( L, ael, f->rR );
+		f->rR  = ref;
+		f->rCf = cf;
+		f->rUd = ud;
+	}
+	else
+	{
+		t_ael_unref( L, ael, f->wR );
+		f->wR  = ref;
+		f->wCf = cf;
+		f->wUd = ud;
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Push the value owning the handler of a descriptor onto the stack.
+ * \detail  That is the func/arg table or the owner of a native handler.
+ *          Lets C modules anchor their context, eg. for t_ael_defer_cf().
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   int      descriptor.
+ * \param   enum t_ael_t  t - T_AEL_RD or T_AEL_WR.
+ * \return  int      type of the pushed value; LUA_TNIL if there is none.
+ * --------------------------------------------------------------------------*/
+int
+t_ael_pushhandler( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t )
+{
+	struct t_ael_fd *f;
+
+	if (fd < 0 || (size_t) fd >= ael->fd_sz || NULL == (f = ael->fd_set[ fd ]))
+	{
+		lua_pushnil( L );
+		return LUA_TNIL;
+	}
+	return lua_rawgeti( L, LUA_REGISTRYINDEX, (T_AEL_RD == t) ? f->rR : f->wR );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Take a descriptor out of the loop.
+ * \detail  Stops observing it and drops handlers and handle as
+ *          removeHandle() does for both directions.  Does nothing if the
+ *          descriptor isn't part of the loop.
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   int      descriptor.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_removefd( lua_State *L, struct t_ael *ael, int fd )
+{
+	struct t_ael_fd *f;
+
+	if (fd < 0 || (size_t) fd >= ael->fd_sz || NULL == (f = ael->fd_set[ fd ]))
+		return;
+	if (T_AEL_NO != f->t)
+		t_ael_removehandle_impl( ael, fd, f->t );
+	ael->fd_set[ fd ] = NULL;
+	t_ael_unref( L, ael, f->rR );
+	t_ael_unref( L, ael, f->wR );
+	luaL_unref( L, LUA_REGISTRYINDEX, f->hR );
+	free( f );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Defer a native task to the end of the current loop iteration.
+ * \detail  Fast path for C modules to coalesce work, eg. flush buffers once
+ *          per iteration instead of once per event.  The value owning ud must
+ *          be on top of the stack; it gets popped and referenced until cf ran.
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   t_ael_cfn cf - native task.
+ * \param   void*    ud - context handed to cf.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_defer_cf( lua_State *L, struct t_ael *ael, t_ael_cfn cf, void *ud )
+{
+	int fR = luaL_ref( L, LUA_REGISTRYINDEX );
+
+	if (0 != t_ael_insdefer( ael, fR, cf, ud ))
+	{
+		luaL_unref( L, LUA_REGISTRYINDEX, fR );
+		t_push_error( L, "Failed to defer task in "T_AEL_TYPE );
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Defer a function to the end of the current loop iteration.
+ * \detail  Deferred functions run in FIFO order once I/O and timers of the
+ *          iteration got dispatched.  Cheaper than a zero length timer and
+ *          the loop doesn't block while functions are pending.
+ * \param   L    Lua state.
+ * \lparam  ud   T.Loop userdata instance.                   // 1
+ * \lparam  func to be executed.                             // 2
+ * \lparam  ...  parameters to function when executed.       // 3 ...
+ * \return  int  #stack items returned by function call.
+ * --------------------------------------------------------------------------*/
+static int
+lt_ael_defer( lua_State *L )
+{
+	struct t_ael    *ael = t_ael_check_ud( L, 1, 1 );
+	int              n   = lua_gettop( L ) + 1;    ///< iterator for arguments
+	int              fR;
+
+	luaL_checktype( L, 2, LUA_TFUNCTION );
+	lua_createtable( L, n-2, 0 );  // create function/parameter table
+	lua_insert( L, 2 );
+	// Stack: ael,TABLE,func,...
+	while (n > 2)
+		lua_rawseti( L, 2, (n--)-2 );            // add arguments and function (pops each item)
+	fR = luaL_ref( L, LUA_REGISTRYINDEX );      // pop the function/parameter table
+	if (0 != t_ael_insdefer( ael, fR, NULL, NULL ))
+	{
+		luaL_unref( L, LUA_REGISTRYINDEX, fR );
+		return t_push_error( L, "Failed to defer function in "T_AEL_TYPE );
+	}
+	return 0;
+}
+
+
 /**--------------------------------------------------------------------------
  * Remove a Handle event handler from the T.Loop.
  * \param   L    The lua state.
@@ -293,30 +963,29 @@ lt_ael_addhandle( lua_State *L )
 int
 lt_ael_removehandle( lua_State *L )
 {
-	luaL_Stream   *lS;
-	struct t_net  *sc;
-	int            fd  = 0;
+	int            fd  = t_ael_getfd( L, 2 );
 	struct t_ael  *ael = t_ael_check_ud( L, 1, 1 );
 	luaL_checktype( L, 3, LUA_TBOOLEAN );
 	enum t_ael_t   t   = lua_toboolean( L, 3 ) ? T_AEL_RD :T_AEL_WR;
 
-	lS = (luaL_Stream *) luaL_testudata( L, 2, LUA_FILEHANDLE );
-	if (NULL != lS)
-		fd = fileno( lS->f );
-
-	sc = t_net_check_ud( L, 2, 0 );
-	if (NULL != sc)
-		fd = sc->fd;
-
 	if (0 == fd)
 		return t_push_error( L, "Argument to addHandle must be file or socket" );
+	// not observed by this loop
+	if ((size_t) fd >= ael->fd_sz || NULL == ael->fd_set[ fd ])
+		return 0;
 	// remove function
 	if (T_AEL_RD & t)
 	{
-		luaL_unref( L, LUA_REGISTRYINDEX, ael->fd_set[ fd ]->rR );
+		t_ael_unref( L, ael, ael->fd_set[ fd ]->rR );
+		ael->fd_set[ fd ]->rR  = LUA_NOREF;
+		ael->fd_set[ fd ]->rCf = NULL;
 	}
 	else
-		luaL_unref( L, LUA_REGISTRYINDEX, ael->fd_set[ fd ]->wR );
+	{
+		t_ael_unref( L, ael, ael->fd_set[ fd ]->wR );
+		ael->fd_set[ fd ]->wR  = LUA_NOREF;
+		ael->fd_set[ fd ]->wCf = NULL;
+	}
 	t_ael_removehandle_impl( ael, fd, t );
 	// remove from mask
 	ael->fd_set[ fd ]->t = ael->fd_set[ fd ]-> t & (~t);
@@ -332,8 +1001,70 @@ lt_ael_removehandle( lua_State *L )
 }
 
 
+/**--------------------------------------------------------------------------
+ * Find the timer scheduled for a T.Time and take it out of the loop.
+ * \detail  O(1) lookup via the tmR table plus O(log n) heap removal.
+ * \param   L    Lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   timeval  T.Time which identifies the timer.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_ael_canceltimer( lua_State *L, struct t_ael *ael, struct timeval *tv )
+{
+	struct t_ael_tm *te;
+
+	lua_rawgeti( L, LUA_REGISTRYINDEX, ael->tmR );
+	lua_pushlightuserdata( L, tv );
+	lua_rawget( L, -2 );
+	te = (struct t_ael_tm *) lua_touserdata( L, -1 );
+	lua_pop( L, 2 );
+
+	if (NULL != te)
+	{
+		t_ael_deltimer( ael, te );
+		t_ael_maptimer( L, ael, te, 0 );
+		t_ael_unref( L, ael, te->fR );
+		luaL_unref( L, LUA_REGISTRYINDEX, te->tR );
+		free( te );
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Take a descriptor which is about to be closed out of all loops.
+ * \detail  Called by t_net_close().  A handle closed without removeHandle()
+ *          would otherwise stay registered with the backend, which then
+ *          observes whatever the next accept() or socket() gets under the
+ *          same number.  Handlers and handle get dropped as removeHandle()
+ *          does for both directions.
+ * \param   L    The lua state.
+ * \param   int  descriptor.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_closefd( lua_State *L, int fd )
+{
+	if (LUA_TTABLE != lua_getfield( L, LUA_REGISTRYINDEX, T_AEL_ALL ))
+	{
+		lua_pop( L, 1 );
+		return;
+	}
+	lua_pushnil( L );
+	while (lua_next( L, -2 ))
+	{
+		lua_pop( L, 1 );
+		t_ael_removefd( L, (struct t_ael *) lua_touserdata( L, -1 ), fd );
+	}
+	lua_pop( L, 1 );
+}
+
+
 /**--------------------------------------------------------------------------
  * Add a Timer event handler to the T.Loop.
+ * \detail  The timer fires once the duration of the T.Time has elapsed.  The
+ *          T.Time instance identifies the timer for removeTimer(); adding the
+ *          same instance again reschedules the timer.
  * \param   L    Lua state.
  * \lparam  ud   T.Loop userdata instance.                   // 1
  * \lparam  ud   T.Time userdata instance.                   // 2
@@ -348,12 +1079,24 @@ lt_ael_addtimer( lua_State *L )
 	struct timeval  *tv  = t_tim_check_ud( L, 2, 1 );
 	int              n   = lua_gettop( L ) + 1;    ///< iterator for arguments
 	struct t_ael_tm *te;
+	struct timeval   nw;
 
 	luaL_checktype( L, 3, LUA_TFUNCTION );
+	t_ael_canceltimer( L, ael, tv );               // drop previous schedule
 	// Build up the timer element
 	te = (struct t_ael_tm *) malloc( sizeof( struct t_ael_tm ) );
+	if (NULL == te)
+		return t_push_error( L, "Failed to add timer to "T_AEL_TYPE );
 	te->tv =  tv;
-	//t_ael_addtimer_impl( ael, tv );
+	te->cf =  NULL;
+	te->ud =  NULL;
+	t_tim_mono( &nw );
+	t_tim_add( &nw, tv, &te->dl );
+	if (0 != t_ael_instimer( ael, te ))
+	{
+		free( te );
+		return t_push_error( L, "Failed to add timer to "T_AEL_TYPE );
+	}
 	lua_createtable( L, n-3, 0 );  // create function/parameter table
 	lua_insert( L, 3 );
 	// Stack: ael,tv,TABLE,func,...
@@ -362,52 +1105,72 @@ lt_ael_addtimer( lua_State *L )
 	te->fR = luaL_ref( L, LUA_REGISTRYINDEX );  // pop the function/parameter table
 	// making the time val part of lua registry guarantees the gc can't destroy it
 	te->tR = luaL_ref( L, LUA_REGISTRYINDEX );  // pop the timeval
-	// insert into ordered linked list of time events
-	t_ael_instimer( ael, te );
+	t_ael_maptimer( L, ael, te, 1 );
 
 	return 1;
 }
 
 
+/**--------------------------------------------------------------------------
+ * Add a native timer to the T.Loop.
+ * \detail  Fires once the interval tv has elapsed and again after each
+ *          interval for as long as cf returns non-zero.  tv is owned by the
+ *          caller, must stay valid until the timer got dropped and identifies
+ *          the timer; adding it again reschedules the timer.  The value owning
+ *          ud must be on top of the stack; it gets popped and referenced for
+ *          as long as the timer is scheduled.
+ * \param   L    The lua state.
+ * \param   t_ael    Loop Struct.
+ * \param   timeval  interval.
+ * \param   t_ael_cfn cf - native timer.
+ * \param   void*    ud - context handed to cf.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_addtimer_cf( lua_State *L, struct t_ael *ael, struct timeval *tv,
+                   t_ael_cfn cf, void *ud )
+{
+	struct t_ael_tm *te;
+	struct timeval   nw;
+
+	t_ael_canceltimer( L, ael, tv );
+	te = (struct t_ael_tm *) malloc( sizeof( struct t_ael_tm ) );
+	if (NULL == te)
+	{
+		t_push_error( L, "Failed to add timer to "T_AEL_TYPE );
+		return;
+	}
+	te->tv = tv;
+	te->tR = LUA_NOREF;
+	te->cf = cf;
+	te->ud = ud;
+	t_tim_mono( &nw );
+	t_tim_add( &nw, tv, &te->dl );
+	if (0 != t_ael_instimer( ael, te ))
+	{
+		free( te );
+		t_push_error( L, "Failed to add timer to "T_AEL_TYPE );
+		return;
+	}
+	te->fR = luaL_ref( L, LUA_REGISTRYINDEX );
+	t_ael_maptimer( L, ael, te, 1 );
+}
+
+
 /**--------------------------------------------------------------------------
  * Remove a Timer event handler from the T.Loop.
  * \param   L    Lua state.
  * \lparam  ud   T.Loop userdata instance.                   // 1
  * \lparam  ud   T.Time userdata instance.                   // 2
  * \return  int  #stack items returned by function call.
- * TODO: optimize!
  * --------------------------------------------------------------------------*/
 static int
 lt_ael_removetimer( lua_State *L )
 {
 	struct t_ael    *ael = t_ael_check_ud( L, 1, 1 );
 	struct timeval  *tv  = t_tim_check_ud( L, 2, 1 );
-	struct t_ael_tm *tp  = ael->tm_head;
-	struct t_ael_tm *te  = tp->nxt;       ///< previous Timer event
-
-	// if head is node in question
-	if (NULL != tp  &&  tp->tv == tv)
-	{
-		ael->tm_head = te;
-		luaL_unref( L, LUA_REGISTRYINDEX, tp->fR );
-		luaL_unref( L, LUA_REGISTRYINDEX, tp->tR );
-		free( tp );
-		return 0;
-	}
-	while (NULL != te && te->tv != tv)
-	{
-		tp = te;
-		te = te->nxt;
-	}
-
-	if (NULL!=te && te->tv == tv)
-	{
-		tp->nxt = te->nxt;
-		luaL_unref( L, LUA_REGISTRYINDEX, te->fR );
-		luaL_unref( L, LUA_REGISTRYINDEX, tp->tR );
-		free( te );
-	}
 
+	t_ael_canceltimer( L, ael, tv );
 	return 0;
 }
 
@@ -422,19 +1185,33 @@ static int
 lt_ael__gc( lua_State *L )
 {
 	struct t_ael    *ael     = t_ael_check_ud( L, 1, 1 );
-	struct t_ael_tm *tf, *tr = ael->tm_head;
+	struct t_ael_tm *tf;
 	size_t           i;       ///< the iterator for all fields
 
-	while (NULL != tr)
+	if (LUA_TTABLE == lua_getfield( L, LUA_REGISTRYINDEX, T_AEL_ALL ))
 	{
-		tf = tr;
-		//printf( "Start  %p   %d   %d    %p\n", tf, tf->fR, tf->tR, tf->nxt );
+		lua_pushlightuserdata( L, ael );
+		lua_pushnil( L );
+		lua_rawset( L, -3 );
+	}
+	lua_pop( L, 1 );
+	t_ael_wak_close( L, ael );
+	for (i=0; i < ael->tm_cnt; i++)
+	{
+		tf = ael->tm_heap[ i ];
 		luaL_unref( L, LUA_REGISTRYINDEX, tf->fR ); // remove func/arg table from registry
 		luaL_unref( L, LUA_REGISTRYINDEX, tf->tR ); // remove timeval ref from registry
-		tr = tr->nxt;
-		//printf( "Free   %p   %d   %d    %p\n", tf, tf->fR, tf->tR, tf->nxt );
 		free( tf );
 	}
+	free( ael->tm_heap );
+	ael->tm_heap = NULL;
+	ael->tm_cnt  = 0;
+	luaL_unref( L, LUA_REGISTRYINDEX, ael->tmR );
+	for (i=0; i < ael->df_cnt; i++)
+		luaL_unref( L, LUA_REGISTRYINDEX, ael->df_buf[ (ael->df_hd + i) % ael->df_sz ].fR );
+	free( ael->df_buf );
+	ael->df_buf = NULL;
+	ael->df_cnt = 0;
 	//printf("---------");
 	for (i=0; i < ael->fd_sz; i++)
 	{
@@ -446,6 +1223,12 @@ lt_ael__gc( lua_State *L )
 			free( ael->fd_set[ i ] );
 		}
 	}
+	free( ael->fd_set );
+	ael->fd_set = NULL;
+	ael->fd_sz  = 0;
+	free( ael->sts );
+	ael->sts    = NULL;
+	t_ael_free_impl( ael );
 	return 0;
 }
 
@@ -459,17 +1242,27 @@ lt_ael__gc( lua_State *L )
 static int
 lt_ael_run( lua_State *L )
 {
-	struct t_ael    *ael = t_ael_check_ud( L, 1, 1 );
+	struct t_ael     *ael = t_ael_check_ud( L, 1, 1 );
+	struct t_ael_sts *sts;                ///< statistics as of the start of the iteration
+	struct timeval    t0;                 ///< start of the iteration
+	unsigned long long cus = 0;           ///< handler time before the iteration
 	ael->run = 1;
 
 	while (ael->run)
 	{
+		if (NULL != (sts = ael->sts))
+		{
+			t_tim_mono( &t0 );
+			cus = sts->cus;
+		}
 		if (t_ael_poll_impl( L, ael ) < 0)
 		{
 			return t_push_error( L, "Failed to continue" );
 		}
+		if (NULL != sts && sts == ael->sts)
+			t_ael_sts_iteration( sts, &t0, cus );
 		// if there are no events left in the loop stop processing
-		ael->run = (NULL==ael->tm_head && ael->max_fd<1) ? 0 : ael->run;
+		ael->run = (0==ael->tm_cnt && ael->max_fd<1 && 0==ael->df_cnt) ? 0 : ael->run;
 	}
 
 	return 0;
@@ -517,20 +1310,28 @@ int
 lt_ael_showloop( lua_State *L )
 {
 	struct t_ael    *ael = t_ael_check_ud( L, 1, 1 );
-	struct t_ael_tm *tr  = ael->tm_head;
+	struct t_ael_tm *tr;
+	struct timeval   nw, tv;
 	int              i   = 0;
 	int              n   = lua_gettop( L );
 	printf( T_AEL_TYPE" %p TIMER LIST:\n", ael );
-	while (NULL != tr)
+	t_tim_mono( &nw );
+	for (i=0; i < (int) ael->tm_cnt; i++)  // heap order; [1] is due next
 	{
-		printf( "\t%d\t{%2ld:%6ld}\t%p   ", ++i,
-			tr->tv->tv_sec,  tr->tv->tv_usec,
+		tr = ael->tm_heap[ i ];
+		t_tim_sub( &tr->dl, &nw, &tv );
+		printf( "\t%d\t{%2ld:%6ld}\t%p   ", i+1,
+			tv.tv_sec,  tv.tv_usec,
 			tr->tv );
-		t_ael_getfunc( L, tr->fR );
-		t_stackPrint( L, n+1, lua_gettop( L ), 1 );
-		lua_pop( L, lua_gettop( L ) - n );
+		if (NULL != tr->cf)
+			printf( "native: %p", tr->ud );
+		else
+		{
+			t_ael_getfunc( L, tr->fR );
+			t_stackPrint( L, n+1, lua_gettop( L ), 1 );
+			lua_pop( L, lua_gettop( L ) - n );
+		}
 		printf( "\n" );
-		tr = tr->nxt;
 	}
 	printf( T_AEL_TYPE" %p HANDLE LIST:\n", ael );
 	for( i=0; i<ael->max_fd+1; i++)
@@ -540,17 +1341,27 @@ lt_ael_showloop( lua_State *L )
 		if (T_AEL_RD & ael->fd_set[i]->t)
 		{
 			printf( "%5d  [R]  ", i );
-			t_ael_getfunc( L, ael->fd_set[i]->rR );
-			t_stackPrint( L, n+2, lua_gettop( L ), 1 );
-			lua_pop( L, lua_gettop( L ) - n );
+			if (NULL != ael->fd_set[i]->rCf)
+				printf( "native: %p", ael->fd_set[i]->rUd );
+			else
+			{
+				t_ael_getfunc( L, ael->fd_set[i]->rR );
+				t_stackPrint( L, n+2, lua_gettop( L ), 1 );
+				lua_pop( L, lua_gettop( L ) - n );
+			}
 			printf( "\n" );
 		}
 		if (T_AEL_WR & ael->fd_set[i]->t)
 		{
 			printf( "%5d  [W]  ", i );
-			t_ael_getfunc( L, ael->fd_set[i]->wR );
-			t_stackPrint( L, n+2, lua_gettop( L ), 1 );
-			lua_pop( L, lua_gettop( L ) - n );
+			if (NULL != ael->fd_set[i]->wCf)
+				printf( "native: %p", ael->fd_set[i]->wUd );
+			else
+			{
+				t_ael_getfunc( L, ael->fd_set[i]->wR );
+				t_stackPrint( L, n+2, lua_gettop( L ), 1 );
+				lua_pop( L, lua_gettop( L ) - n );
+			}
 			printf( "\n" );
 		}
 	}
@@ -583,11 +1394,13 @@ static const struct luaL_Reg t_ael_m [] = {
 	// instance methods
 	, { "addTimer",       lt_ael_addtimer }
 	, { "removeTimer",    lt_ael_removetimer }
+	, { "defer",          lt_ael_defer }
 	, { "addHandle",      lt_ael_addhandle }
 	, { "removeHandle",   lt_ael_removehandle }
 	, { "run",            lt_ael_run }
 	, { "stop",           lt_ael_stop }
 	, { "show",           lt_ael_showloop }
+	, { "stats",          lt_ael_stats }
 	, { NULL,   NULL }
 };
 
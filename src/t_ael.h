@@ -11,6 +11,12 @@
 #include "t_net.h"
 #include "t_tim.h"
 
+#define T_AEL_FD_SZ   16     ///< initial number of slots in the handle table
+#define T_AEL_DF_SZ   16     ///< initial number of slots in the deferred queue
+#define T_AEL_STS_BKT 128    ///< buckets in the handler duration histogram
+#define T_AEL_STS_TOP 8      ///< number of slowest handlers tracked
+#define T_AEL_ALL     T_AEL_TYPE".all"  ///< registry table of the loops of a Lua state
+
 enum t_ael_t {
 	// 00000000
 	T_AEL_NO = 0x00,        ///< not set
@@ -23,51 +29,161 @@ enum t_ael_t {
 };
 
 
+/// native event handler; gets called with the value owning ud on top of the
+/// stack.  The loop restores the stack afterwards.
+typedef int (*t_ael_cfn) ( lua_State *L, void *ud );
+
+
+/// if rCf/wCf is set rR/wR reference the value owning rUd/wUd instead of a
+/// func/arg table
 struct t_ael_fd {
 	enum t_ael_t       t;     ///< mask, for unset, readable, writable
 	int                fd;    ///< descriptor
 	int                rR;    ///< func/arg table reference for read  event in LUA_REGISTRYINDEX
 	int                wR;    ///< func/arg table reference for write event in LUA_REGISTRYINDEX
 	int                hR;    ///< handle   reference in LUA_REGISTRYINDEX (T.Net.* or Lua file handle)
+	t_ael_cfn          rCf;   ///< native read  handler; NULL for Lua handlers
+	t_ael_cfn          wCf;   ///< native write handler; NULL for Lua handlers
+	void              *rUd;   ///< context passed to rCf
+	void              *wUd;   ///< context passed to wCf
 };
 
 
+/// if cf is set fR references the value owning ud instead of a func/arg table
+/// and tv points to an interval owned by the C module
 struct t_ael_tm {
 	int                fR;    ///< func/arg table reference in LUA_REGISTRYINDEX
 	int                tR;    ///< T.Time  reference in LUA_REGISTRYINDEX
-	struct timeval    *tv;    ///< time to elapse until fire (timval to work with)
-	struct t_ael_tm   *nxt;   ///< next pointer for linked list
+	struct timeval    *tv;    ///< T.Time handed to addTimer (identifies timer)
+	struct timeval     dl;    ///< absolute deadline on the monotonic clock
+	size_t             idx;   ///< position in the loops timer heap
+	t_ael_cfn          cf;    ///< native timer; NULL for Lua timers
+	void              *ud;    ///< context passed to cf
+};
+
+
+/// task deferred to the end of a loop iteration; if cf is set fR references
+/// the value owning ud instead of a func/arg table
+struct t_ael_dfr {
+	int                fR;    ///< func/arg table reference in LUA_REGISTRYINDEX
+	t_ael_cfn          cf;    ///< native task; NULL for Lua tasks
+	void              *ud;    ///< context passed to cf
+};
+
+
+/// job posted to a loop from another thread; owned by the poster which must
+/// keep it alive until cf ran on the loop thread
+struct t_ael_job {
+	struct t_ael_job  *nxt;   ///< next job; managed by the loop
+	t_ael_cfn          cf;    ///< native job; called on the loop thread
+	void              *ud;    ///< context passed to cf
+};
+
+
+/// one of the slowest handlers seen by T.Loop:stats()
+struct t_ael_sts_top {
+	int                ref;   ///< func/arg table (or native owner) reference in LUA_REGISTRYINDEX
+	int                fd;    ///< descriptor; -1 for timers
+	enum t_ael_t       t;     ///< event; T_AEL_NO for timers
+	unsigned long long us;    ///< longest execution in microseconds
+};
+
+
+/// opt-in runtime statistics of a loop; all times in microseconds
+struct t_ael_sts {
+	size_t             itr;   ///< loop iterations
+	unsigned long long wus;   ///< time spent waiting for events
+	unsigned long long cus;   ///< time spent in handlers
+	size_t             fdc;   ///< fired handle events
+	size_t             tmc;   ///< fired timer events
+	size_t             sys;   ///< system calls issued by the loop and native handlers
+	size_t             hst[ T_AEL_STS_BKT ];     ///< log-linear histogram of handler durations
+	struct t_ael_sts_top top[ T_AEL_STS_TOP ];  ///< slowest handlers; longest first
 };
 
 
-/// t_ael implementation for select based loops
+/// implementation specific loop state; defined by t_ael_(impl).c
+struct t_ael_ste;
+
+
+/// t_ael generic part; backend specific data is kept in ->ste
 struct t_ael {
-	fd_set             rfds;
-	fd_set             wfds;
-	fd_set             rfds_w;   ///<
-	fd_set             wfds_w;   ///<
 	int                run;      ///< boolean indicator to start/stop the loop
 	int                max_fd;   ///< max fd
-	size_t             fd_sz;    ///< how many fd to handle
-	struct t_ael_tm   *tm_head;
-	struct t_ael_fd  **fd_set;   ///< array with pointers to fd_events indexed by fd
+	size_t             fd_sz;    ///< number of slots allocated for fd_set
+	struct t_ael_tm  **tm_heap;  ///< binary min-heap of timers ordered by ->dl
+	size_t             tm_cnt;   ///< number of timers in tm_heap
+	size_t             tm_sz;    ///< number of slots allocated for tm_heap
+	int                tmR;      ///< lookup table T.Time -> timer in LUA_REGISTRYINDEX
+	struct t_ael_fd  **fd_set;   ///< fd_events indexed by fd; grows on demand
+	struct t_ael_dfr  *df_buf;   ///< ring buffer of deferred tasks; FIFO
+	size_t             df_hd;    ///< index of the oldest deferred task
+	size_t             df_cnt;   ///< number of deferred tasks in df_buf
+	size_t             df_sz;    ///< number of slots allocated for df_buf
+	int                wk_rd;    ///< wakeup descriptor observed by the loop; -1 if closed
+	int                wk_wr;    ///< wakeup descriptor written by other threads; atomic
+	struct t_ael_job  *jb_head;  ///< jobs posted by other threads; lock-free LIFO
+	struct t_ael_ste  *ste;      ///< state of select()/epoll() implementation
+	struct t_ael_sts  *sts;      ///< runtime statistics; NULL unless enabled
 };
 
 
+/// account for n system calls in the statistics of ael; no-op unless enabled
+#define T_AEL_STS_SYS( ael, n ) \
+	do { if (NULL != (ael)->sts) (ael)->sts->sys += (n); } while (0)
+
+
 // t_ael.c
 struct t_ael *t_ael_check_ud ( lua_State *L, int pos, int check );
 struct t_ael *t_ael_create_ud( lua_State *L, size_t sz );
 int   lt_ael_addhandle       ( lua_State *L );
+void  t_ael_addhandle_cf     ( lua_State *L, struct t_ael *ael, int pos, enum t_ael_t t,
+                               t_ael_cfn cf, void *ud );
+void  t_ael_addfd_cf         ( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t,
+                               t_ael_cfn cf, void *ud );
+int   t_ael_watch            ( struct t_ael *ael, int fd, enum t_ael_t t, int on );
+void  t_ael_sethandler_cf    ( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t,
+                               t_ael_cfn cf, void *ud );
+int   t_ael_pushhandler      ( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t );
+void  t_ael_removefd         ( lua_State *L, struct t_ael *ael, int fd );
 int   lt_ael_removehandle    ( lua_State *L );
+void  t_ael_closefd          ( lua_State *L, int fd );
+void  t_ael_defer_cf         ( lua_State *L, struct t_ael *ael, t_ael_cfn cf, void *ud );
+void  t_ael_addtimer_cf      ( lua_State *L, struct t_ael *ael, struct timeval *tv,
+                               t_ael_cfn cf, void *ud );
 int   lt_ael_showloop        ( lua_State *L );
+void  t_ael_unref            ( lua_State *L, struct t_ael *ael, int ref );
 
-void t_ael_executetimer     ( lua_State *L, struct t_ael *ael, struct timeval *rt );
+struct timeval *t_ael_nexttimer( struct t_ael *ael, struct timeval *tv );
+void t_ael_executetimer     ( lua_State *L, struct t_ael *ael );
 void t_ael_executehandle    ( lua_State *L, struct t_ael *ael, int fd, enum t_ael_t t );
+void t_ael_executedefer     ( lua_State *L, struct t_ael *ael );
+
+// t_ael_sts.c
+void t_ael_sts_handler      ( struct t_ael_sts *sts, int ref, int fd, enum t_ael_t t,
+                              struct timeval *t0 );
+void t_ael_sts_release      ( struct t_ael_sts *sts, int ref );
+void t_ael_sts_iteration    ( struct t_ael_sts *sts, struct timeval *t0,
+                              unsigned long long cus );
+int  lt_ael_stats           ( lua_State *L );
+
+// t_ael_wak.c
+int  t_ael_wak_open         ( lua_State *L, struct t_ael *ael );
+void t_ael_wak_close        ( lua_State *L, struct t_ael *ael );
+int  t_ael_post             ( struct t_ael *ael, struct t_ael_job *jb );
 
 
 // t_ael_(impl).c   (Implementation specific functions) INTERFACE
-void t_ael_create_ud_impl   ( struct t_ael *ael );
-void t_ael_addhandle_impl   ( struct t_ael *ael, int fd, enum t_ael_t t );
+// The backend gets chosen at build time (src/Makefile T_AEL_IMPL).
+// t_ael_(add|remove)handle_impl() must be called BEFORE ael->fd_set[fd]->t
+// gets updated so the implementation can see the previous event mask.
+// t_ael_addhandle_impl() returns 0 on success and -1 if the backend can't
+// observe fd.
+// Modules outside of T.Loop don't call these; they go through t_ael_watch(),
+// t_ael_sethandler_cf() and t_ael_removefd() which keep fd_set consistent.
+int  t_ael_create_ud_impl   ( struct t_ael *ael );
+void t_ael_free_impl        ( struct t_ael *ael );
+int  t_ael_addhandle_impl   ( struct t_ael *ael, int fd, enum t_ael_t t );
 void t_ael_removehandle_impl( struct t_ael *ael, int fd, enum t_ael_t t );
 void t_ael_addtimer_impl    ( struct t_ael *ael, struct timeval *tv );
 int  t_ael_poll_impl        ( lua_State *L, struct t_ael *ael );
@@ -0,0 +1,220 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_ael_epo.c
+ * \brief     epoll() specific implementation for T.Loop.
+ * Handles    implmentation specific functions such as registreing events and
+ *            executing the loop
+ *            Linux only.  Unlike select() there is no FD_SETSIZE limit and a
+ *            wakeup only returns the descriptors which are actually ready, so
+ *            the cost per poll does not grow with the number of idle handles.
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+#include "t.h"
+#include "t_ael.h"
+
+#include <stdlib.h>           // malloc, free
+#include <limits.h>           // INT_MAX
+#include <unistd.h>           // close
+#include <errno.h>            // errno
+#include <sys/epoll.h>
+
+#define T_AEL_EPO_EVS_MIN   64    ///< initial size of the epoll_event array
+#define T_AEL_EPO_EVS_MAX   4096  ///< max size of the epoll_event array
+
+
+/// epoll() specific state of the loop
+struct t_ael_ste {
+	int                 epfd;    ///< epoll instance descriptor
+	int                 evsz;    ///< number of slots in evs
+	struct epoll_event *evs;     ///< ready events filled by epoll_wait()
+};
+
+
+/**--------------------------------------------------------------------------
+ * Translate a T.Loop event mask into an epoll event mask.
+ * \param   enum t_ael_t t  mask of events to observe.
+ * \return  uint32_t        epoll events.
+ * --------------------------------------------------------------------------*/
+static inline uint32_t
+t_ael_epo_mask( enum t_ael_t t )
+{
+	return ((t & T_AEL_RD) ? EPOLLIN  : 0) |
+	       ((t & T_AEL_WR) ? EPOLLOUT : 0);
+}
+
+
+/**--------------------------------------------------------------------------
+ * Register the mask for fd with the kernel.
+ * \detail  Sockets closed from Lua without removing them from the loop first
+ *          silently vanish from the epoll set, so a failed MOD gets retried as
+ *          ADD and vice versa.
+ * \param   struct t_ael*.
+ * \param   int           fd.
+ * \param   enum t_ael_t  o - mask currently registered.
+ * \param   enum t_ael_t  n - mask to be registered.
+ * \return  int           0 on success, -1 on failure.
+ * --------------------------------------------------------------------------*/
+static int
+t_ael_epo_ctl( struct t_ael *ael, int fd, enum t_ael_t o, enum t_ael_t n )
+{
+	struct epoll_event ev;
+	int                r;
+
+	ev.events  = t_ael_epo_mask( n );
+	ev.data.fd = fd;
+
+	T_AEL_STS_SYS( ael, 1 );
+	if (T_AEL_NO == n)
+		r = epoll_ctl( ael->ste->epfd, EPOLL_CTL_DEL, fd, &ev );
+	else if (T_AEL_NO == o)
+	{
+		if (-1 == (r = epoll_ctl( ael->ste->epfd, EPOLL_CTL_ADD, fd, &ev )) && EEXIST == errno)
+			r = epoll_ctl( ael->ste->epfd, EPOLL_CTL_MOD, fd, &ev );
+	}
+	else
+	{
+		if (-1 == (r = epoll_ctl( ael->ste->epfd, EPOLL_CTL_MOD, fd, &ev )) && ENOENT == errno)
+			r = epoll_ctl( ael->ste->epfd, EPOLL_CTL_ADD, fd, &ev );
+	}
+	return r;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Epoll() specific initialization of t_ael.
+ * \param   struct t_ael * pointer to new userdata on Lua Stack
+ * \return  int   0 on success, -1 on failure.
+ * --------------------------------------------------------------------------*/
+int
+t_ael_create_ud_impl( struct t_ael *ael )
+{
+	ael->ste = (struct t_ael_ste *) malloc( sizeof( struct t_ael_ste ) );
+	if (NULL == ael->ste)
+		return -1;
+	ael->ste->evsz = T_AEL_EPO_EVS_MIN;
+	ael->ste->evs  = (struct epoll_event *) malloc( ael->ste->evsz * sizeof( struct epoll_event ) );
+	ael->ste->epfd = epoll_create1( EPOLL_CLOEXEC );
+	if (NULL == ael->ste->evs || -1 == ael->ste->epfd)
+	{
+		t_ael_free_impl( ael );
+		return -1;
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Epoll() specific cleanup of t_ael.
+ * \param   struct t_ael * pointer to userdata about to be collected
+ * --------------------------------------------------------------------------*/
+void
+t_ael_free_impl( struct t_ael *ael )
+{
+	if (NULL == ael->ste)
+		return;
+	if (-1 != ael->ste->epfd)
+		close( ael->ste->epfd );
+	free( ael->ste->evs );
+	free( ael->ste );
+	ael->ste = NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Add a File/Socket event handler to the T.Loop.
+ * \param   struct t_ael*.
+ * \param   int          fd.
+ * \param   enum t_ael_t t - direction of socket to be observed.
+ * \return  int          0 on success, -1 if epoll refuses fd.
+ * --------------------------------------------------------------------------*/
+int
+t_ael_addhandle_impl( struct t_ael *ael, int fd, enum t_ael_t t )
+{
+	enum t_ael_t o = ael->fd_set[ fd ]->t;
+	return ((o | t) != o) ? t_ael_epo_ctl( ael, fd, o, o | t ) : 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Remove a File/Socket event handler to the T.Loop.
+ * \param   struct t_ael*.
+ * \param   int          fd.
+ * \param   enum t_ael_t t - direction of socket to be observed.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_removehandle_impl( struct t_ael *ael, int fd, enum t_ael_t t )
+{
+	enum t_ael_t o = ael->fd_set[ fd ]->t;
+	if ((o & ~t) != o)
+		t_ael_epo_ctl( ael, fd, o, o & ~t );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Wait for events in the T.Loop using epoll_wait() and execute them.
+ * \param   L              Lua state.
+ * \param   struct t_ael   The loop struct.
+ * \return  int            0 on success, <0 if epoll_wait() failed.
+ * --------------------------------------------------------------------------*/
+int
+t_ael_poll_impl( lua_State *L, struct t_ael *ael )
+{
+	int              i,r,fd;
+	int              ms = -1;      ///< epoll_wait timeout; -1 means infinite
+	struct timeval  *tv;
+	struct timeval   rt;           ///< time left until next timer is due
+	enum t_ael_t     t;            ///< handle action per fd (read/write/either)
+	uint32_t         e;            ///< events reported for fd
+	struct epoll_event *evs;       ///< grown event array
+
+	if (NULL != (tv = t_ael_nexttimer( ael, &rt )))
+	{
+		// round up; timers further out than INT_MAX ms just wake the loop early
+		ms = (tv->tv_sec < INT_MAX / 1000 - 1)
+		   ? (int) (tv->tv_sec*1000 + (tv->tv_usec+999)/1000)
+		   : INT_MAX;
+	}
+
+	T_AEL_STS_SYS( ael, 1 );
+	r = epoll_wait( ael->ste->epfd, ael->ste->evs, ael->ste->evsz, ms );
+	//printf("RESULT: %d\n",r);
+	if (r<0)
+		return r;
+
+	// deal with sockets/file handles
+	for (i=0; i<r; i++)
+	{
+		fd = ael->ste->evs[ i ].data.fd;
+		e  = ael->ste->evs[ i ].events;
+		// previous handler in this batch may have removed it
+		if (NULL == ael->fd_set[ fd ])
+			continue;
+		t = T_AEL_NO;
+		if (ael->fd_set[ fd ]->t & T_AEL_RD  &&  e & (EPOLLIN  | EPOLLHUP | EPOLLERR))
+			t |= T_AEL_RD;
+		if (ael->fd_set[ fd ]->t & T_AEL_WR  &&  e & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+			t |= T_AEL_WR;
+		if (T_AEL_NO != t)
+			t_ael_executehandle( L, ael, fd, t );
+	}
+	// array was too small to report all ready handles at once -> grow
+	if (r == ael->ste->evsz && ael->ste->evsz < T_AEL_EPO_EVS_MAX)
+	{
+		evs = (struct epoll_event *) realloc( ael->ste->evs,
+		      2 * ael->ste->evsz * sizeof( struct epoll_event ) );
+		if (NULL != evs)
+		{
+			ael->ste->evs   = evs;
+			ael->ste->evsz *= 2;
+		}
+	}
+	// deal with all timers which are due by now
+	t_ael_executetimer( L, ael );
+	// run the tasks deferred to the end of this iteration
+	t_ael_executedefer( L, ael );
+
+	return 0;
+}
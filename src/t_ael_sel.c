@@ -16,21 +16,47 @@
 #include "t.h"
 #include "t_ael.h"
 
+#include <stdlib.h>           // malloc, free
 #include <string.h>           // memcpy
 
 
+/// select() specific state of the loop
+struct t_ael_ste {
+	fd_set             rfds;
+	fd_set             wfds;
+	fd_set             rfds_w;   ///< working copy of rfds handed to select()
+	fd_set             wfds_w;   ///< working copy of wfds handed to select()
+};
+
+
 /**--------------------------------------------------------------------------
  * Select() specific initialization of t_ael.
  * \param   struct t_ael * pointer to new userdata on Lua Stack
- * \return  void
+ * \return  int   0 on success, -1 on failure.
  * --------------------------------------------------------------------------*/
-void
+int
 t_ael_create_ud_impl( struct t_ael *ael )
 {
-	FD_ZERO( &ael->rfds );
-	FD_ZERO( &ael->wfds );
-	FD_ZERO( &ael->rfds_w );
-	FD_ZERO( &ael->wfds_w );
+	ael->ste = (struct t_ael_ste *) malloc( sizeof( struct t_ael_ste ) );
+	if (NULL == ael->ste)
+		return -1;
+	FD_ZERO( &ael->ste->rfds );
+	FD_ZERO( &ael->ste->wfds );
+	FD_ZERO( &ael->ste->rfds_w );
+	FD_ZERO( &ael->ste->wfds_w );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Select() specific cleanup of t_ael.
+ * \param   struct t_ael * pointer to userdata about to be collected
+ * --------------------------------------------------------------------------*/
+void
+t_ael_free_impl( struct t_ael *ael )
+{
+	free( ael->ste );
+	ael->ste = NULL;
 }
 
 
@@ -39,12 +65,16 @@ t_ael_create_ud_impl( struct t_ael *ael )
  * \param   struct t_ael*.
  * \param   int          fd.
  * \param   enum t_ael_t t - direction of socket to be observed.
+ * \return  int          0 on success, -1 if fd doesn't fit into an fd_set.
  * --------------------------------------------------------------------------*/
-void
+int
 t_ael_addhandle_impl( struct t_ael *ael, int fd, enum t_ael_t t )
 {
-	if (t & T_AEL_RD)    FD_SET( fd, &ael->rfds );
-	if (t & T_AEL_WR)    FD_SET( fd, &ael->wfds );
+	if (fd < 0 || fd >= FD_SETSIZE)
+		return -1;
+	if (t & T_AEL_RD)    FD_SET( fd, &ael->ste->rfds );
+	if (t & T_AEL_WR)    FD_SET( fd, &ael->ste->wfds );
+	return 0;
 }
 
 
@@ -57,8 +87,10 @@ t_ael_addhandle_impl( struct t_ael *ael, int fd, enum t_ael_t t )
 void
 t_ael_removehandle_impl( struct t_ael *ael, int fd, enum t_ael_t t )
 {
-	if (t & T_AEL_RD)    FD_CLR( fd, &ael->rfds );
-	if (t & T_AEL_WR)    FD_CLR( fd, &ael->wfds );
+	if (fd < 0 || fd >= FD_SETSIZE)
+		return;
+	if (t & T_AEL_RD)    FD_CLR( fd, &ael->ste->rfds );
+	if (t & T_AEL_WR)    FD_CLR( fd, &ael->ste->wfds );
 }
 
 
@@ -87,38 +119,40 @@ t_ael_poll_impl( lua_State *L, struct t_ael *ael )
 {
 	int              i,r;
 	struct timeval  *tv;
-	struct timeval   rt;           ///< timer to calculate runtime over this poll
+	struct timeval   rt;           ///< time left until next timer is due
 	enum t_ael_t     t;            ///< handle action per fd (read/write/either)
 
-	t_tim_now( &rt, 0 );
-	tv  = (NULL != ael->tm_head) ? ael->tm_head->tv : NULL;
+	tv  = t_ael_nexttimer( ael, &rt );
 
-	memcpy( &ael->rfds_w, &ael->rfds, sizeof( fd_set ) );
-	memcpy( &ael->wfds_w, &ael->wfds, sizeof( fd_set ) );
+	memcpy( &ael->ste->rfds_w, &ael->ste->rfds, sizeof( fd_set ) );
+	memcpy( &ael->ste->wfds_w, &ael->ste->wfds, sizeof( fd_set ) );
 
-	r = select( ael->max_fd+1, &ael->rfds_w, &ael->wfds_w, NULL, tv );
+	T_AEL_STS_SYS( ael, 1 );
+	r = select( ael->max_fd+1, &ael->ste->rfds_w, &ael->ste->wfds_w, NULL, tv );
 	//printf("RESULT: %d\n",r);
 	if (r<0)
 		return r;
 
-	if (0==r) // deal with timer
-		t_ael_executetimer( L, ael, &rt );
-	else      // deal with sockets/file handles
-		for (i=0; r>0 && i <= ael->max_fd; i++)
+	// deal with sockets/file handles
+	for (i=0; r>0 && i <= ael->max_fd; i++)
+	{
+		if (NULL == ael->fd_set[ i ])
+			continue;
+		t = T_AEL_NO;
+		if (ael->fd_set[ i ]->t & T_AEL_RD  &&  FD_ISSET( i, &ael->ste->rfds_w ))
+			t |= T_AEL_RD;
+		if (ael->fd_set[ i ]->t & T_AEL_WR  &&  FD_ISSET( i, &ael->ste->wfds_w ))
+			t |= T_AEL_WR;
+		if (T_AEL_NO != t)
 		{
-			if (NULL == ael->fd_set[ i ])
-				continue;
-			t = T_AEL_NO;
-			if (ael->fd_set[ i ]->t & T_AEL_RD  &&  FD_ISSET( i, &ael->rfds_w ))
-				t |= T_AEL_RD;
-			if (ael->fd_set[ i ]->t & T_AEL_WR  &&  FD_ISSET( i, &ael->wfds_w ))
-				t |= T_AEL_WR;
-			if (T_AEL_NO != t)
-			{
-				t_ael_executehandle( L, ael, i, t );
-				r--;
-			}
+			t_ael_executehandle( L, ael, i, t );
+			r--;
 		}
+	}
+	// deal with all timers which are due by now
+	t_ael_executetimer( L, ael );
+	// run the tasks deferred to the end of this iteration
+	t_ael_executedefer( L, ael );
 
 	return r;
 }
@@ -0,0 +1,247 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_ael_sts.c
+ * \brief     Opt-in runtime statistics for T.Loop.
+ *            Collects time spent waiting vs. time spent in handlers, a
+ *            histogram of handler durations, event counts and the slowest
+ *            handlers.  Nothing gets measured unless enabled via
+ *            loop:stats( true ).
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+#include <stdlib.h>           // malloc, free
+#include <string.h>           // memset
+
+#include "t.h"
+#include "t_ael.h"
+
+
+/**--------------------------------------------------------------------------
+ * Histogram bucket for a duration.
+ * \detail  Log-linear buckets: below 4us each value has its own bucket,
+ *          above that each power of two gets split into four buckets which
+ *          keeps the relative error below 25% over the entire range.
+ * \param   unsigned long long  us - duration in microseconds.
+ * \return  size_t              index into t_ael_sts.hst.
+ * --------------------------------------------------------------------------*/
+static inline size_t
+t_ael_sts_bucket( unsigned long long us )
+{
+	int    msb = 2;
+	size_t i;
+
+	if (us < 4)
+		return (size_t) us;
+	while (us >> (msb+1))
+		msb++;
+	i = 4*(msb-1) + ((us >> (msb-2)) & 3);
+	return (i < T_AEL_STS_BKT) ? i : T_AEL_STS_BKT-1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Smallest duration counted in a histogram bucket.
+ * \param   size_t              index into t_ael_sts.hst.
+ * \return  unsigned long long  lower bound in microseconds.
+ * --------------------------------------------------------------------------*/
+static inline unsigned long long
+t_ael_sts_lower( size_t i )
+{
+	return (i < 4) ? i : (unsigned long long) (4 + i%4) << (i/4 - 1);
+}
+
+
+/**--------------------------------------------------------------------------
+ * Account for a handler which ran from t0 until now.
+ * \param   struct t_ael_sts*.
+ * \param   int           ref - reference of func/arg table or native owner.
+ * \param   int           fd  - descriptor; -1 for timers.
+ * \param   enum t_ael_t  t   - event; T_AEL_NO for timers.
+ * \param   struct timeval*  t0 - start of the handler (t_tim_mono()).
+ * --------------------------------------------------------------------------*/
+void
+t_ael_sts_handler( struct t_ael_sts *sts, int ref, int fd, enum t_ael_t t,
+                   struct timeval *t0 )
+{
+	struct timeval      nw;
+	unsigned long long  us;
+	size_t              n = T_AEL_STS_TOP - 1;   ///< slot to be replaced
+	size_t              i;
+
+	t_tim_mono( &nw );
+	t_tim_sub( &nw, t0, &nw );
+	us = (unsigned long long) nw.tv_sec * 1000000 + nw.tv_usec;
+
+	sts->cus += us;
+	sts->hst[ t_ael_sts_bucket( us ) ]++;
+	if (T_AEL_NO == t)
+		sts->tmc++;
+	else
+		sts->fdc++;
+
+	// a handler occupies a single slot holding its longest execution; slots
+	// of released handlers never get merged with anything
+	for (i=0; LUA_NOREF != ref && i < T_AEL_STS_TOP; i++)
+		if (sts->top[ i ].ref == ref && sts->top[ i ].fd == fd && sts->top[ i ].t == t)
+		{
+			n = i;
+			break;
+		}
+	if (us <= sts->top[ n ].us)
+		return;
+	while (n > 0 && sts->top[ n-1 ].us < us)
+	{
+		sts->top[ n ] = sts->top[ n-1 ];
+		n--;
+	}
+	sts->top[ n ].ref = ref;
+	sts->top[ n ].fd  = fd;
+	sts->top[ n ].t   = t;
+	sts->top[ n ].us  = us;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Forget the reference of a handler which gets released.
+ * \detail  References get reused by LUA_REGISTRYINDEX.  The slots of the
+ *          released handler keep their time but don't get attributed to
+ *          whichever handler gets the reference next.
+ * \param   struct t_ael_sts*.
+ * \param   int           ref - reference of func/arg table or native owner.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_sts_release( struct t_ael_sts *sts, int ref )
+{
+	size_t i;
+
+	for (i=0; LUA_NOREF != ref && i < T_AEL_STS_TOP; i++)
+		if (sts->top[ i ].ref == ref)
+			sts->top[ i ].ref = LUA_NOREF;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Account for a loop iteration which started at t0.
+ * \detail  Whatever time of the iteration was not spent in handlers was
+ *          spent waiting for events.
+ * \param   struct t_ael_sts*.
+ * \param   struct timeval*     t0  - start of the iteration (t_tim_mono()).
+ * \param   unsigned long long  cus - value of sts->cus at t0.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_sts_iteration( struct t_ael_sts *sts, struct timeval *t0,
+                     unsigned long long cus )
+{
+	struct timeval      nw;
+	unsigned long long  us;
+
+	t_tim_mono( &nw );
+	t_tim_sub( &nw, t0, &nw );
+	us  = (unsigned long long) nw.tv_sec * 1000000 + nw.tv_usec;
+	cus = (sts->cus > cus) ? sts->cus - cus : 0;
+	sts->wus += (us > cus) ? us - cus : 0;
+	sts->itr++;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Switch statistics on/off or read them.
+ * \detail  loop:stats( true ) resets and starts collecting, loop:stats( false )
+ *          stops.  loop:stats( ) returns a table:
+ *            iterations  # of loop iterations
+ *            wait        microseconds spent waiting for events
+ *            busy        microseconds spent in handlers
+ *            handles     # of fired handle events
+ *            timers      # of fired timer events
+ *            syscalls    # of system calls issued by the loop and the native
+ *                        handlers of T.Http.Server (poll, epoll_ctl,
+ *                        accept, setsockopt, recv, writev, sendfile,
+ *                        close)
+ *            histogram   { [lower bound in microseconds] = # of handlers }
+ *            slowest     { { ref=, fd=, event='read'|'write'|'timer', time= } }
+ *          ref is the LUA_REGISTRYINDEX reference of the func/arg table (or
+ *          of the owner of a native handler); -2 (LUA_NOREF) once that
+ *          handler got removed from the loop.
+ * \param   L    Lua state.
+ * \lparam  ud   T.Loop userdata instance.                       // 1
+ * \lparam  bool enable/disable statistics (optional).           // 2
+ * \lreturn table statistics or nil if not enabled.
+ * \return  int  #stack items returned by function call.
+ * --------------------------------------------------------------------------*/
+int
+lt_ael_stats( lua_State *L )
+{
+	struct t_ael     *ael = t_ael_check_ud( L, 1, 1 );
+	struct t_ael_sts *sts = ael->sts;
+	size_t            i;
+	int               n;
+
+	if (lua_gettop( L ) > 1)
+	{
+		if (! lua_toboolean( L, 2 ))
+		{
+			free( ael->sts );
+			ael->sts = NULL;
+			return 0;
+		}
+		if (NULL == sts && NULL == (sts = (struct t_ael_sts *) malloc( sizeof( struct t_ael_sts ) )))
+			return t_push_error( L, "Failed to enable statistics for "T_AEL_TYPE );
+		memset( sts, 0, sizeof( struct t_ael_sts ) );
+		for (i=0; i < T_AEL_STS_TOP; i++)
+		{
+			sts->top[ i ].ref = LUA_NOREF;
+			sts->top[ i ].fd  = -1;
+		}
+		ael->sts = sts;
+		return 0;
+	}
+
+	if (NULL == sts)
+	{
+		lua_pushnil( L );
+		return 1;
+	}
+	lua_createtable( L, 0, 8 );
+	lua_pushinteger( L, sts->itr );
+	lua_setfield( L, -2, "iterations" );
+	lua_pushinteger( L, sts->wus );
+	lua_setfield( L, -2, "wait" );
+	lua_pushinteger( L, sts->cus );
+	lua_setfield( L, -2, "busy" );
+	lua_pushinteger( L, sts->fdc );
+	lua_setfield( L, -2, "handles" );
+	lua_pushinteger( L, sts->tmc );
+	lua_setfield( L, -2, "timers" );
+	lua_pushinteger( L, sts->sys );
+	lua_setfield( L, -2, "syscalls" );
+
+	lua_newtable( L );
+	for (i=0; i < T_AEL_STS_BKT; i++)
+	{
+		if (0 == sts->hst[ i ])
+			continue;
+		lua_pushinteger( L, sts->hst[ i ] );
+		lua_rawseti( L, -2, t_ael_sts_lower( i ) );
+	}
+	lua_setfield( L, -2, "histogram" );
+
+	lua_newtable( L );
+	for (i=0, n=0; i < T_AEL_STS_TOP && sts->top[ i ].us > 0; i++)
+	{
+		lua_createtable( L, 0, 4 );
+		lua_pushinteger( L, sts->top[ i ].ref );
+		lua_setfield( L, -2, "ref" );
+		lua_pushinteger( L, sts->top[ i ].fd );
+		lua_setfield( L, -2, "fd" );
+		lua_pushstring( L, (T_AEL_NO == sts->top[ i ].t) ? "timer" :
+		                   (T_AEL_RD == sts->top[ i ].t) ? "read"  : "write" );
+		lua_setfield( L, -2, "event" );
+		lua_pushinteger( L, sts->top[ i ].us );
+		lua_setfield( L, -2, "time" );
+		lua_rawseti( L, -2, ++n );
+	}
+	lua_setfield( L, -2, "slowest" );
+	return 1;
+}
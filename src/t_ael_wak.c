@@ -0,0 +1,179 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_ael_wak.c
+ * \brief     Cross-thread wakeup and job submission for T.Loop.
+ *            Other threads push jobs onto a lock-free queue and wake the loop
+ *            via an eventfd (a pipe where eventfd is not available).  The loop
+ *            thread runs the jobs as a regular native handle event.
+ *            Only t_ael_post() may be called from threads other than the one
+ *            running the loop.
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+#include <unistd.h>           // pipe, read, write, close
+#include <fcntl.h>            // fcntl
+#include <stdint.h>           // uint64_t
+#ifdef __linux__
+#include <sys/eventfd.h>      // eventfd
+#endif
+
+#include "t.h"
+#include "t_ael.h"
+
+
+/**--------------------------------------------------------------------------
+ * Handle the wakeup descriptor becoming readable.
+ * \detail  Resets the descriptor, grabs all posted jobs at once and runs them
+ *          in the order they got posted.  The descriptor gets reset before
+ *          the jobs are taken, so a job posted meanwhile wakes the loop again
+ *          instead of getting lost.
+ * \param   L    The lua state.
+ * \param   void*  ud  struct t_ael*.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+t_ael_wak_rcv( lua_State *L, void *ud )
+{
+	struct t_ael     *ael = (struct t_ael *) ud;
+	struct t_ael_job *jb;
+	struct t_ael_job *nx;
+	struct t_ael_job *fo  = NULL;    ///< jobs in posting order
+	uint64_t          v;
+	int               n   = lua_gettop( L );
+	ssize_t           r __attribute__ ((unused));
+
+#ifdef __linux__
+	r = read( ael->wk_rd, &v, sizeof( v ) );
+#else
+	while ((r = read( ael->wk_rd, &v, sizeof( v ) )) > 0) ;
+#endif
+	jb = __atomic_exchange_n( &ael->jb_head, NULL, __ATOMIC_ACQUIRE );
+	while (NULL != jb)
+	{
+		nx      = jb->nxt;
+		jb->nxt = fo;
+		fo      = jb;
+		jb      = nx;
+	}
+	while (NULL != fo)
+	{
+		// the job may get freed or re-posted by cf
+		jb = fo;
+		fo = fo->nxt;
+		jb->cf( L, jb->ud );
+		lua_settop( L, n );
+	}
+	return 0;
+}
+
+
+#ifndef __linux__
+/**--------------------------------------------------------------------------
+ * Make a descriptor of the wakeup pipe non-blocking and close-on-exec.
+ * \param   int  descriptor.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_ael_wak_setfl( int fd )
+{
+	fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+	fcntl( fd, F_SETFD, FD_CLOEXEC );
+}
+#endif
+
+
+/**--------------------------------------------------------------------------
+ * Make the loop accept jobs from other threads.
+ * \detail  Must be called on the loop thread before any job gets posted.  The
+ *          wakeup descriptor counts as a handle, so the loop keeps running
+ *          until t_ael_wak_close() gets called.
+ * \param   L    The lua state.
+ * \param   struct t_ael*.
+ * \return  int  0 on success, -1 if the descriptor could not be created.
+ * --------------------------------------------------------------------------*/
+int
+t_ael_wak_open( lua_State *L, struct t_ael *ael )
+{
+	int fds[ 2 ];
+
+	if (-1 != ael->wk_rd)
+		return 0;
+#ifdef __linux__
+	if (-1 == (fds[ 0 ] = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC )))
+		return -1;
+	fds[ 1 ] = fds[ 0 ];
+#else
+	if (-1 == pipe( fds ))
+		return -1;
+	t_ael_wak_setfl( fds[ 0 ] );
+	t_ael_wak_setfl( fds[ 1 ] );
+#endif
+	ael->wk_rd = fds[ 0 ];
+	lua_pushnil( L );              // jobs are owned by their posters
+	t_ael_addfd_cf( L, ael, ael->wk_rd, T_AEL_RD, t_ael_wak_rcv, ael );
+	// from here on t_ael_post() accepts jobs
+	__atomic_store_n( &ael->wk_wr, fds[ 1 ], __ATOMIC_RELEASE );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Stop accepting jobs from other threads.
+ * \detail  Must be called on the loop thread once no thread posts anymore.
+ *          Jobs still pending get dropped without being run.
+ * \param   L    The lua state.
+ * \param   struct t_ael*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_ael_wak_close( lua_State *L, struct t_ael *ael )
+{
+	int wr;
+
+	if (-1 == ael->wk_rd)
+		return;
+	wr = __atomic_exchange_n( &ael->wk_wr, -1, __ATOMIC_ACQ_REL );
+	t_ael_removefd( L, ael, ael->wk_rd );
+	if (wr != ael->wk_rd)
+		close( wr );
+	close( ael->wk_rd );
+	ael->wk_rd   = -1;
+	ael->jb_head = NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Post a job to the loop; safe to call from any thread.
+ * \detail  Lock-free push onto the job list.  Only the post which finds the
+ *          list empty needs to wake the loop, all others ride along.  jb must
+ *          stay valid until jb->cf ran on the loop thread.
+ * \param   struct t_ael*.
+ * \param   struct t_ael_job*  job with cf and ud set.
+ * \return  int  0 on success, -1 if the loop doesn't accept jobs.
+ * --------------------------------------------------------------------------*/
+int
+t_ael_post( struct t_ael *ael, struct t_ael_job *jb )
+{
+	struct t_ael_job *hd;
+	uint64_t          v  = 1;
+	int               wr = __atomic_load_n( &ael->wk_wr, __ATOMIC_ACQUIRE );
+	ssize_t           r __attribute__ ((unused));
+
+	if (-1 == wr)
+		return -1;
+	// once pushed jb belongs to the loop thread; only hd may be looked at
+	hd = __atomic_load_n( &ael->jb_head, __ATOMIC_RELAXED );
+	do
+		jb->nxt = hd;
+	while (! __atomic_compare_exchange_n( &ael->jb_head, &hd, jb, 1,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED ));
+	if (NULL == hd)
+#ifdef __linux__
+		r = write( wr, &v, sizeof( v ) );
+#else
+		r = write( wr, &v, 1 );     // a full pipe is still readable
+#endif
+	return 0;
+}
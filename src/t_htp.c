@@ -11,28 +11,17 @@
  */
 
 
-#include <string.h>               // memset
+#include <stdlib.h>               // malloc, realloc
+#include <string.h>               // memchr, memcmp
+#include <limits.h>               // LLONG_MAX
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>            // _mm*_cmpgt_epi8, _mm*_movemask_epi8, ...
+#endif
 
 #include "t.h"
 #include "t_htp.h"
 
 
-/// State of the HTTP reader; defines the current read situation apart from
-/// content
-enum t_htp_rs {
-	T_HTP_R_XX,         ///< End of read or end of buffer
-	T_HTP_R_CR,         ///< Carriage return, expect LF next
-	T_HTP_R_LF,         ///< Line Feed, guaranteed end of line
-	T_HTP_R_LB,         ///< Line Feed, guaranteed end of line
-	T_HTP_R_KS,         ///< Reading Key Start
-	T_HTP_R_KY,         ///< Read Key
-	T_HTP_R_VL,         ///< Read value
-	T_HTP_R_ES,         ///< Eat space
-	// exit state from here
-	T_HTP_R_BD,         ///< Empty line (\r\n\r\n) -> end of headers
-};
-
-
 // taken from Ryan Dahls HTTP parser
 static const char tokens[256] = {
 /*   0 nul    1 soh    2 stx    3 etx    4 eot    5 enq    6 ack    7 bel  */
@@ -68,333 +57,752 @@ static const char tokens[256] = {
 /* 120  x   121  y   122  z   123  {   124  |   125  }   126  ~   127 del */
        'x',     'y',     'z',      0,      '|',      0,      '~',       0 };
 
-/**
- * Eat Linear White Space
- */
-static inline const char
-*eat_lws( const char *s )
+/**--------------------------------------------------------------------------
+ * Find the first control character in a buffer.
+ * \detail  Checks 32 (AVX2) or 16 (SSE2) bytes per step; the remainder and
+ *          builds without either get checked byte by byte.  Bytes >= 0x80 are
+ *          not control characters (obs-text).
+ * \param  const char*  buffer.
+ * \param  size_t       index to start at.
+ * \param  size_t       end of the buffer.
+ * \param  char         lowest byte which is not a stop; 0x20 stops at the line
+ *                      end (and tabs), 0x21 also at spaces.
+ * \return size_t       index of the first byte below lo or DEL; n if none.
+ * --------------------------------------------------------------------------*/
+static inline size_t
+t_htp_ctl( const char *b, size_t i, size_t n, char lo )
 {
-	while( ' ' == *s ||  '\r' == *s ||   '\n' == *s)
-		s++;
-	return s;
+#if defined( __AVX2__ )
+	const __m256i l32 = _mm256_set1_epi8( lo );
+	const __m256i d32 = _mm256_set1_epi8( 0x7f );
+	const __m256i z32 = _mm256_set1_epi8( -1 );
+	__m256i       v32;
+	unsigned int  m32;
+
+	for (; i+32 <= n; i+=32)
+	{
+		v32 = _mm256_loadu_si256( (const __m256i *) (b+i) );
+		// 0 <= v < lo (signed, so >= 0x80 is no stop) or v == DEL
+		m32 = (unsigned int) _mm256_movemask_epi8( _mm256_or_si256(
+		         _mm256_and_si256( _mm256_cmpgt_epi8( l32, v32 ), _mm256_cmpgt_epi8( v32, z32 ) ),
+		         _mm256_cmpeq_epi8( v32, d32 ) ) );
+		if (m32)
+			return i + __builtin_ctz( m32 );
+	}
+#endif
+#if defined( __SSE2__ )
+	const __m128i l16 = _mm_set1_epi8( lo );
+	const __m128i d16 = _mm_set1_epi8( 0x7f );
+	const __m128i z16 = _mm_set1_epi8( -1 );
+	__m128i       v16;
+	unsigned int  m16;
+
+	for (; i+16 <= n; i+=16)
+	{
+		v16 = _mm_loadu_si128( (const __m128i *) (b+i) );
+		m16 = (unsigned int) _mm_movemask_epi8( _mm_or_si128(
+		         _mm_and_si128( _mm_cmpgt_epi8( l16, v16 ), _mm_cmpgt_epi8( v16, z16 ) ),
+		         _mm_cmpeq_epi8( v16, d16 ) ) );
+		if (m16)
+			return i + __builtin_ctz( m16 );
+	}
+#endif
+	for (; i < n; i++)
+		if ((unsigned char) b[ i ] < (unsigned char) lo || 0x7f == b[ i ])
+			return i;
+	return n;
+}
+
+
+/// Recognized HTTP Methods by name
+static const struct {
+	const char     *nm;
+	size_t          l;
+	enum t_htp_mth  mth;
+} t_htp_mths[ ] = {
+	{ "GET",          3, T_HTP_MTH_GET         },
+	{ "POST",         4, T_HTP_MTH_POST        },
+	{ "PUT",          3, T_HTP_MTH_PUT         },
+	{ "HEAD",         4, T_HTP_MTH_HEAD        },
+	{ "DELETE",       6, T_HTP_MTH_DELETE      },
+	{ "OPTIONS",      7, T_HTP_MTH_OPTIONS     },
+	{ "PATCH",        5, T_HTP_MTH_PATCH       },
+	{ "CONNECT",      7, T_HTP_MTH_CONNECT     },
+	{ "TRACE",        5, T_HTP_MTH_TRACE       },
+	{ "CHECKOUT",     8, T_HTP_MTH_CHECKOUT    },
+	{ "COPY",         4, T_HTP_MTH_COPY        },
+	{ "LOCK",         4, T_HTP_MTH_LOCK        },
+	{ "MKCOL",        5, T_HTP_MTH_MKCOL       },
+	{ "MKACTIVITY",  10, T_HTP_MTH_MKACTIVITY  },
+	{ "MKCALENDAR",  10, T_HTP_MTH_MKCALENDAR  },
+	{ "M-SEARCH",     8, T_HTP_MTH_MSEARCH     },
+	{ "MERGE",        5, T_HTP_MTH_MERGE       },
+	{ "MOVE",         4, T_HTP_MTH_MOVE        },
+	{ "NOTIFY",       6, T_HTP_MTH_NOTIFY      },
+	{ "PURGE",        5, T_HTP_MTH_PURGE       },
+	{ "PROPFIND",     8, T_HTP_MTH_PROPFIND    },
+	{ "PROPPATCH",    9, T_HTP_MTH_PROPPATCH   },
+	{ "REPORT",       6, T_HTP_MTH_REPORT      },
+	{ "SUBSCRIBE",    9, T_HTP_MTH_SUBSCRIBE   },
+	{ "SEARCH",       6, T_HTP_MTH_SEARCH      },
+	{ "UNLOCK",       6, T_HTP_MTH_UNLOCK      },
+	{ "UNSUBSCRIBE", 11, T_HTP_MTH_UNSUBSCRIBE },
+	{ NULL,           0, T_HTP_MTH_ILLEGAL     }
 };
 
 
 /**--------------------------------------------------------------------------
- * Parse the entire first line of the request.
- * \param  L                  the Lua State
- * \param  struct t_htp_str*  pointer to t_htp_str.
- * \param  const char*        pointer to buffer to process.
- * \param  size_t             How many bytes are safe to be processed?
- *
- * \return const char*        pointer to buffer after processing the first line.
+ * Identify the HTTP method.
+ * \param  const char*     method name; not terminated.
+ * \param  size_t          length of the name.
+ * \return enum t_htp_mth  T_HTP_MTH_ILLEGAL if unknown.
+ * --------------------------------------------------------------------------*/
+enum t_htp_mth
+t_htp_method( const char *m, size_t l )
+{
+	size_t i;
+
+	for (i=0; NULL != t_htp_mths[ i ].nm; i++)
+		if (l == t_htp_mths[ i ].l && *m == *t_htp_mths[ i ].nm &&
+		    0 == memcmp( m, t_htp_mths[ i ].nm, l ))
+			break;
+	return t_htp_mths[ i ].mth;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Name of an HTTP method.
+ * \param  enum t_htp_mth  method.
+ * \return const char*     name of the method; NULL for T_HTP_MTH_ILLEGAL.
  * --------------------------------------------------------------------------*/
 const char
-*t_htp_pReqFirstLine( lua_State *L, struct t_htp_str *s, size_t n )
+*t_htp_mthname( enum t_htp_mth mth )
+{
+	size_t i;
+
+	for (i=0; NULL != t_htp_mths[ i ].nm && mth != t_htp_mths[ i ].mth; i++) ;
+	return t_htp_mths[ i ].nm;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Compare header tokens case insensitive.
+ * \param  const char*  token as received.
+ * \param  const char*  token to compare with.
+ * \param  size_t       length of both tokens.
+ * \return int          1 if equal, else 0.
+ * --------------------------------------------------------------------------*/
+int
+t_htp_ieq( const char *a, const char *b, size_t l )
+{
+	while (l--)
+		if (tokens[ (unsigned char) a[ l ] ] != tokens[ (unsigned char) b[ l ] ])
+			return 0;
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if a comma separated header value contains a token.
+ * \param  const char*  header value.
+ * \param  size_t       length of the header value.
+ * \param  const char*  lower case token to look for.
+ * \param  size_t       length of the token.
+ * \return int          1 if the token is in the list, else 0.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_hasToken( const char *v, size_t vl, const char *tk, size_t tl )
 {
-	const char *r   = s->con->b;  ///< runner char
-	const char *me  = s->con->b;  ///< HTTP Method end
-	const char *u   = NULL;       ///< URL start
-	const char *ue  = NULL;       ///< URL end
-	const char *q   = NULL,
-	           *v   = NULL;       // query, value (query reused as key)
-	int         run = 1;
-
-	// Determine HTTP Verb
-	if (n<11)
-		return NULL;             // don't change anything
-	r = s->con->b;
-	switch (*r)
+	size_t i = 0;
+	size_t s;
+
+	while (i < vl)
 	{
-		case 'C':
-			if ('O'==*(r+1) && ' '==*(r+7 )) { s->mth=T_HTP_MTH_CONNECT;     me+=7;  }
-			if ('H'==*(r+1) && ' '==*(r+8 )) { s->mth=T_HTP_MTH_CHECKOUT;    me+=8;  }
-			if ('O'==*(r+1) && ' '==*(r+4 )) { s->mth=T_HTP_MTH_COPY;        me+=4;  }
-			break;
-		case 'D':
-			if ('E'==*(r+1) && ' '==*(r+6 )) { s->mth=T_HTP_MTH_DELETE;      me+=6;  }
-			break;
-		case 'G':
-			if ('E'==*(r+1) && ' '==*(r+3 )) { s->mth=T_HTP_MTH_GET;         me+=3;  }
-			break;
-		case 'H':
-			if ('E'==*(r+1) && ' '==*(r+4 )) { s->mth=T_HTP_MTH_HEAD;        me+=4;  }
-			break;
-		case 'L':
-			if ('O'==*(r+1) && ' '==*(r+4 )) { s->mth=T_HTP_MTH_LOCK;        me+=4;  }
-			break;
-		case 'M':
-			if ('K'==*(r+1) && ' '==*(r+5 )) { s->mth=T_HTP_MTH_MKCOL;       me+=5;  }
-			if ('K'==*(r+1) && ' '==*(r+10)) { s->mth=T_HTP_MTH_MKACTIVITY;  me+=10; }
-			if ('C'==*(r+2) && ' '==*(r+10)) { s->mth=T_HTP_MTH_MKCALENDAR;  me+=10; }
-			if ('-'==*(r+1) && ' '==*(r+8 )) { s->mth=T_HTP_MTH_MSEARCH;     me+=8;  }
-			if ('E'==*(r+1) && ' '==*(r+5 )) { s->mth=T_HTP_MTH_MERGE;       me+=5;  }
-			if ('O'==*(r+1) && ' '==*(r+4 )) { s->mth=T_HTP_MTH_MOVE;        me+=4;  }
-			break;
-		case 'N':
-			if ('O'==*(r+1) && ' '==*(r+6 )) { s->mth=T_HTP_MTH_NOTIFY;      me+=6;  }
-			break;
-		case 'O':
-			if ('P'==*(r+1) && ' '==*(r+7 )) { s->mth=T_HTP_MTH_OPTIONS;     me+=7;  }
-			break;
-		case 'P':
-			if ('O'==*(r+1) && ' '==*(r+4 )) { s->mth=T_HTP_MTH_POST;        me+=4;  }
-			if ('U'==*(r+1) && ' '==*(r+3 )) { s->mth=T_HTP_MTH_PUT;         me+=3;  }
-			if ('A'==*(r+1) && ' '==*(r+5 )) { s->mth=T_HTP_MTH_PATCH;       me+=5;  }
-			if ('U'==*(r+1) && ' '==*(r+5 )) { s->mth=T_HTP_MTH_PURGE;       me+=5;  }
-			if ('R'==*(r+1) && ' '==*(r+8 )) { s->mth=T_HTP_MTH_PROPFIND;    me+=8;  }
-			if ('R'==*(r+1) && ' '==*(r+9 )) { s->mth=T_HTP_MTH_PROPPATCH;   me+=9;  }
+		while (i < vl && (' ' == v[ i ] || '\t' == v[ i ] || ',' == v[ i ]))
+			i++;
+		s = i;
+		while (i < vl && ',' != v[ i ] && ' ' != v[ i ] && '\t' != v[ i ])
+			i++;
+		if (i-s == tl && t_htp_ieq( v+s, tk, tl ))
+			return 1;
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Evaluate a header which controls how the request gets processed.
+ * \param  struct t_htp_str*  pointer to t_htp_str.
+ * \param  const char*        start of the request head.
+ * \param  struct t_htp_hdr*  the header just scanned.
+ * \return int                0 on success, -1 if the value is malformed.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_pSpecial( struct t_htp_str *s, const char *b, struct t_htp_hdr *h )
+{
+	const char   *k = b + h->ko;
+	const char   *v = b + h->vo;
+	unsigned int  i;
+
+	switch (h->kl)
+	{
+		case 14:
+			if (! t_htp_ieq( k, "content-length", 14 ))
+				break;
+			// ambiguous framing gets rejected; request smuggling
+			if (0 == h->vl || 0 != s->rqFr)
+				return -1;
+			s->rqFr = 1;
+			s->rqCl = 0;
+			for (i=0; i < h->vl; i++)
+			{
+				if (v[ i ] < '0' || v[ i ] > '9' || s->rqCl > (LLONG_MAX - 9) / 10)
+					return -1;
+				s->rqCl = s->rqCl*10 + (v[ i ] - '0');
+			}
 			break;
-		case 'R':
-			if ('E'==*(r+1) && ' '==*(r+6 )) { s->mth=T_HTP_MTH_REPORT;      me+=6;  }
+		case 17:
+			if (! t_htp_ieq( k, "transfer-encoding", 17 ))
+				break;
+			// the body length is only known if chunked is the final coding
+			if (0 != s->rqFr || h->vl < 7 || ! t_htp_ieq( v + h->vl - 7, "chunked", 7 ) ||
+			    (h->vl > 7 && ',' != v[ h->vl-8 ] && ' ' != v[ h->vl-8 ] && '\t' != v[ h->vl-8 ]))
+				return -1;
+			s->rqFr = 2;
+			s->cs   = T_HTP_CK_SZ0;
+			s->ck   = 0;
 			break;
-		case 'S':
-			if ('U'==*(r+1) && ' '==*(r+9 )) { s->mth=T_HTP_MTH_SUBSCRIBE;   me+=9;  }
-			if ('E'==*(r+1) && ' '==*(r+6 )) { s->mth=T_HTP_MTH_SEARCH;      me+=6;  }
+		case 10:
+			if (! t_htp_ieq( k, "connection", 10 ))
+				break;
+			if (t_htp_hasToken( v, h->vl, "keep-alive", 10 )) s->kpAlv   = 200;
+			if (t_htp_hasToken( v, h->vl, "close",       5 )) s->kpAlv   = 0;
+			if (t_htp_hasToken( v, h->vl, "upgrade",     7 ) && NULL != s->con)
+				s->con->upgrade = 1;
 			break;
-		case 'T':
-			if ('R'==*(r+1) && ' '==*(r+5 )) { s->mth=T_HTP_MTH_TRACE;       me+=5;  }
+		case 7:
+			if (t_htp_ieq( k, "upgrade", 7 ) && NULL != s->con)
+				s->con->upgrade = 1;
 			break;
-		case 'U':
-			if ('N'==*(r+1) && ' '==*(r+6 )) { s->mth=T_HTP_MTH_UNLOCK;      me+=6;  }
-			if ('N'==*(r+2) && ' '==*(r+11)) { s->mth=T_HTP_MTH_UNSUBSCRIBE; me+=11; }
+		case 6:
+			if (t_htp_ieq( k, "expect", 6 ))
+				s->expect = 1;
 			break;
 		default:
-			luaL_error( L, "Illegal HTTP header: Unknown HTTP Method" );
-	}
-	// That means no verb was recognized and the switch fell entirely through
-	if (T_HTP_MTH_ILLEGAL == s->mth)
-	{
-		luaL_error( L, "Illegal HTTP header: Unknown HTTP Method" );
-		return NULL;
+			break;
 	}
-	r = eat_lws( me );
-
-	//  _   _ ____  _                            _
-	// | | | |  _ \| |      _ __   __ _ _ __ ___(_)_ __   __ _
-	// | | | | |_) | |     | '_ \ / _` | '__/ __| | '_ \ / _` |
-	// | |_| |  _ <| |___  | |_) | (_| | |  \__ \ | | | | (_| |
-	//  \___/|_| \_\_____| | .__/ \__,_|_|  |___/_|_| |_|\__, |
-	//                     |_|                           |___/
-	u = r;
-	// TODO: create query table only when all of url is received
-	while (1 == run)
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Scan the request head (request line and headers) of a stream.
+ * \detail  Resumable: s->ps and s->po keep the position between calls, so
+ *          each byte of the head gets looked at once no matter in how many
+ *          pieces it arrives.  No Lua values get created; the stream records
+ *          offsets of the method, url, version and each header relative to
+ *          the start of the head.  Headers which control the connection get
+ *          evaluated right away.
+ *          Starting at T_HTP_P_RVR a response head gets scanned instead; the
+ *          status code takes the place of the url.  Such streams have no
+ *          connection (s->con is NULL).
+ * \param  struct t_htp_str*  pointer to t_htp_str.
+ * \param  const char*        start of the request head.
+ * \param  size_t             bytes available from the start of the head.
+ *
+ * \return int                1 if the head is complete and s->po its length,
+ *                            0 if more data is needed, -1 if malformed.
+ * --------------------------------------------------------------------------*/
+int
+t_htp_pHead( struct t_htp_str *s, const char *b, size_t n )
+{
+	struct t_htp_hdr *h = &(s->hdr[ s->hdn ]);  ///< header being scanned
+	const char       *e;                         ///< end of line
+	size_t            i = s->po;
+
+	while (i < n)
 	{
-		switch (*r)
+		switch (s->ps)
 		{
-			case '/':
+			case T_HTP_P_MTH:
+				if (' ' != b[ i ])
+				{
+					if (i++ > 11)           // longer than any known method
+						return -1;
+					break;
+				}
+				if (T_HTP_MTH_ILLEGAL == (s->mth = t_htp_method( b, i )))
+					return -1;
+				s->ml = i++;
+				s->ps = T_HTP_P_US;
+				break;
+			case T_HTP_P_US:
+				if (' ' == b[ i ])
+				{
+					i++;
+					break;
+				}
+				s->uo = i;
+				s->ps = T_HTP_P_URL;
+				break;
+			case T_HTP_P_URL:
+				if (n == (i = t_htp_ctl( b, i, n, 0x21 )))
+					break;
+				if (' ' != b[ i ])         // control character in url
+					return -1;
+				s->ul = i - s->uo;
+				s->ps = T_HTP_P_VS;
+				break;
+			case T_HTP_P_VS:
+				if (' ' == b[ i ])
+				{
+					i++;
+					break;
+				}
+				s->vo = i;
+				s->ps = T_HTP_P_VER;
 				break;
-			case '?':
-				lua_pushstring( L, "query" );
-				lua_newtable( L );
-				q = r+1;
+			case T_HTP_P_VER:
+				if (NULL == (e = memchr( b+i, '\n', n-i )))
+				{
+					i = n;
+					break;
+				}
+				i     = e - b;
+				s->vl = i - s->vo;
+				if (s->vl > 0 && '\r' == b[ i-1 ])
+					s->vl--;
+				// only HTTP/1.0 and HTTP/1.1 are spoken
+				if (8 != s->vl || 0 != memcmp( b + s->vo, "HTTP/1.", 7 ))
+					return -1;
+				switch (b[ s->vo+7 ])
+				{
+					case '1': s->ver = T_HTP_VER_11; s->kpAlv = 200; break;
+					case '0': s->ver = T_HTP_VER_10; s->kpAlv = 0  ; break;
+					default: return -1;
+				}
+				if (NULL != s->con)
+					s->con->ver = s->ver;
+				s->ps = T_HTP_P_KS;
+				i++;
 				break;
-			case '=':
-				lua_pushlstring( L, q, r-q ); // push key
-				//TODO: if key exists, create table
-				v = r+1;
+			case T_HTP_P_KS:
+				if ('\r' == b[ i ])
+				{
+					s->ps = T_HTP_P_LF;
+					i++;
+					break;
+				}
+				if ('\n' == b[ i ])
+				{
+					s->po = i+1;
+					return 1;
+				}
+				if (T_HTP_STR_HDN == s->hdn)
+					return -1;
+				h->ko = i;
+				s->ps = T_HTP_P_KY;
 				break;
-			case '&':
-				lua_pushlstring( L, v, r-v ); // push value
-				lua_rawset( L, -3 );
-				q = r+1;
+			case T_HTP_P_KY:
+				if (':' != b[ i ])
+				{
+					// rejects folded lines and anything else not a token
+					if (! tokens[ (unsigned char) b[ i ] ])
+						return -1;
+					i++;
+					break;
+				}
+				if (0 == (h->kl = i - h->ko))
+					return -1;
+				s->ps = T_HTP_P_WS;
+				i++;
 				break;
-			case ' ':      // last value
-				if (NULL != q)
+			case T_HTP_P_WS:
+				if (' ' == b[ i ] || '\t' == b[ i ])
 				{
-					lua_pushlstring( L, v, r-v ); // push value
-					lua_rawset( L, -3 );
-					lua_rawset( L, -3 );          // set proxy.query
+					i++;
+					break;
 				}
-				ue = r;
-				run = 0;
+				h->vo = i;
+				s->ps = T_HTP_P_VL;
+				break;
+			case T_HTP_P_VL:
+				i = t_htp_ctl( b, i, n, 0x20 );
+				if (i < n && '\t' == b[ i ])
+				{
+					i++;
+					break;
+				}
+				// a CR gets looked at again once its LF arrived
+				if (i == n || ('\r' == b[ i ] && i+1 == n))
+				{
+					s->po = i;
+					return 0;
+				}
+				e = b + i + ('\r' == b[ i ]);    // the LF ending the line
+				if ('\n' != *e)                  // control character in value
+					return -1;
+				h->vl = i - h->vo;
+				while (h->vl > 0 && (' ' == b[ h->vo + h->vl-1 ] || '\t' == b[ h->vo + h->vl-1 ]))
+					h->vl--;
+				if (0 != t_htp_pSpecial( s, b, h ))
+					return -1;
+				s->hdn++;
+				h++;
+				s->ps = T_HTP_P_KS;
+				i     = e - b + 1;
+				break;
+			case T_HTP_P_LF:
+				if ('\n' != b[ i ])
+					return -1;
+				s->po = i+1;
+				return 1;
+			case T_HTP_P_RVR:
+				if (' ' != b[ i ])
+				{
+					if (i++ > 8)
+						return -1;
+					break;
+				}
+				if (8 != i || 0 != memcmp( b, "HTTP/1.", 7 ))
+					return -1;
+				switch (b[ 7 ])
+				{
+					case '1': s->ver = T_HTP_VER_11; s->kpAlv = 200; break;
+					case '0': s->ver = T_HTP_VER_10; s->kpAlv = 0  ; break;
+					default: return -1;
+				}
+				s->vo = 0;
+				s->vl = 8;
+				s->uo = ++i;
+				s->ps = T_HTP_P_RST;
+				break;
+			case T_HTP_P_RST:
+				if (NULL == (e = memchr( b+i, '\n', n-i )))
+				{
+					i = n;
+					break;
+				}
+				i     = e - b;
+				s->ul = 3;              // the status code; the reason gets ignored
+				if (i - s->uo < 3 ||
+				    b[ s->uo   ] < '1' || b[ s->uo   ] > '9' ||
+				    b[ s->uo+1 ] < '0' || b[ s->uo+1 ] > '9' ||
+				    b[ s->uo+2 ] < '0' || b[ s->uo+2 ] > '9' ||
+				    (i - s->uo > 3 && ' ' != b[ s->uo+3 ] && '\r' != b[ s->uo+3 ]))
+					return -1;
+				s->ps = T_HTP_P_KS;
+				i++;
 				break;
-			default:           break;
 		}
-		if ((size_t) (r - s->con->b) > n) // run out of text before parsing is done
-			return NULL;
-		else
-			r++;
-	}
-	r = eat_lws( r );
-
-
-	//  _   _ _____ _____ ____    __     __            _
-	// | | | |_   _|_   _|  _ \   \ \   / /__ _ __ ___(_) ___  _ __
-	// | |_| | | |   | | | |_) |___\ \ / / _ \ '__/ __| |/ _ \| '_ \
-	// |  _  | | |   | | |  __/_____\ V /  __/ |  \__ \ | (_) | | | |
-	// |_| |_| |_|   |_| |_|         \_/ \___|_|  |___/_|\___/|_| |_|
-
-	//TODO: set values based on version default behaviour (eg, KeepAlive for 1.1 etc)
-	//TODO: check for n being big enough
-	switch (*(r+7))
-	{
-		case '1': s->con->ver=T_HTP_VER_11; s->con->kpAlv=200; break;
-		case '0': s->con->ver=T_HTP_VER_10; s->con->kpAlv=0  ; break;
-		case '9': s->con->ver=T_HTP_VER_09; s->con->kpAlv=0  ; break;
-		default: luaL_error( L, "ILLEGAL HTTP version in message" ); break;
 	}
-
-	lua_pushstring( L, "method" );
-	lua_pushlstring( L, s->con->b, me - s->con->b );
-	lua_rawset( L, -3 );
-
-	lua_pushstring( L, "url" );
-	lua_pushlstring( L, u, ue-u );
-	lua_rawset( L, -3 );
-
-	lua_pushstring( L, "version" );
-	lua_pushlstring( L, r, 8 );
-	lua_rawset( L, -3 );
-
-	s->state = T_HTP_STR_FLINE;     // indicate first line is done
-	// prepare for the header to be parsed by creating the header table on stack
-	lua_pushstring( L, "header" );           //S:P,h,"header"
-	lua_newtable( L );                       //S:P,h
-	lua_rawset( L, -3 );                     //S:P,h
-	s->con->b = eat_lws( r+8 );
-	return s->con->b;
+	s->po = i;
+	return 0;
 }
 
 
 /**--------------------------------------------------------------------------
- * Process HTTP Headers for this request.
- * \param  L                  the Lua State
+ * Scan the framing of a chunked request body.
+ * \detail  Resumable like t_htp_pHead(); s->cs and s->ck keep the position
+ *          between calls.  Stops ahead of chunk data, so the data can be
+ *          handed on straight from the buffer.  Chunk extensions and trailers
+ *          get skipped.
  * \param  struct t_htp_str*  pointer to t_htp_str.
- * \param  const char*        pointer to buffer to process.
+ * \param  const char*        buffer.
+ * \param  size_t             bytes available in the buffer.
  *
- * \return const char*        pointer to buffer after processing the headers.
+ * \return long               # of bytes consumed, -1 if malformed.  Data
+ *                            follows if s->cs is T_HTP_CK_DATA, the body is
+ *                            complete if it is T_HTP_CK_DONE.
  * --------------------------------------------------------------------------*/
-const char
-*t_htp_pHeaderLine( lua_State *L, struct t_htp_str *s, const size_t n )
+long
+t_htp_pChunk( struct t_htp_str *s, const char *b, size_t n )
 {
-	enum t_htp_rs rs = T_HTP_R_KS;     // local parse state = keystart
-	const char *v    = s->con->b;      ///< marks start of value string
-	const char *k    = s->con->b;      ///< marks start of key string
-	const char *ke   = s->con->b;      ///< marks end of key string
-	const char *r    = s->con->b;      ///< runner char
-	//size_t      run  = 200;
-	lua_pushstring( L, "header" );           //S:P,"header"
-	lua_rawget( L, -2 );                     //S:P,h
-
-	//while (rs && rs < T_HTP_R_BD)
-	while ((size_t)(r - s->con->b) < n) // run out of text before parsing is done
+	size_t i;
+	int    d;
+
+	for (i=0; i < n && T_HTP_CK_DATA != s->cs && T_HTP_CK_DONE != s->cs; i++)
 	{
-		// TODO: check that r+1 exists
-		switch (*r)
+		switch (s->cs)
 		{
-			case '\0':
-				rs=T_HTP_R_XX;
-				break;
-			case '\r':
-				if (T_HTP_R_LB != rs) rs=T_HTP_R_CR;
-				break;
-			case '\n':
-				if (' ' == *(r+1))
-					;// Handle continous value
-				else
+			case T_HTP_CK_SZ0:
+			case T_HTP_CK_SZ:
+				d = (b[ i ] >= '0' && b[ i ] <= '9') ? b[ i ] - '0'
+				  : (b[ i ] >= 'a' && b[ i ] <= 'f') ? b[ i ] - 'a' + 10
+				  : (b[ i ] >= 'A' && b[ i ] <= 'F') ? b[ i ] - 'A' + 10
+				  : -1;
+				if (d >= 0)
 				{
-					lua_pushlstring( L, k, ke-k );                            // push key
-					lua_pushlstring( L, v, (rs==T_HTP_R_LB)? r-v : r-v-1 );   // push value
-					lua_rawset( L, -3 );
-					k  = r+1;
-					rs = T_HTP_R_KS;         // Set Start of key processing
-				}
-				if ('\r' == *(r+1) || '\n' == *(r+1))
-				{
-					rs        = T_HTP_R_BD;   // End of Header; leave while loop
-					s->state  = T_HTP_STR_HEADDONE;
-					s->con->b = eat_lws( r );
+					if (s->ck > (LLONG_MAX >> 4))
+						return -1;
+					s->ck = (s->ck << 4) | d;
+					s->cs = T_HTP_CK_SZ;
 				}
+				else if (T_HTP_CK_SZ0 == s->cs)
+					return -1;
+				else if (';' == b[ i ] || ' ' == b[ i ] || '\t' == b[ i ])
+					s->cs = T_HTP_CK_EXT;
+				else if ('\r' == b[ i ])
+					s->cs = T_HTP_CK_SLF;
+				else
+					return -1;
 				break;
-			case  ':':
-				if (T_HTP_R_KY == rs)
-				{
-					ke = r;
-					r  = eat_lws( ++r );
-					v  = r;
-					rs = T_HTP_R_VL;
-				}
+			case T_HTP_CK_EXT:
+				if ('\r' == b[ i ])
+					s->cs = T_HTP_CK_SLF;
+				break;
+			case T_HTP_CK_SLF:
+				if ('\n' != b[ i ])
+					return -1;
+				s->cs = (s->ck > 0) ? T_HTP_CK_DATA : T_HTP_CK_TRL;
+				break;
+			case T_HTP_CK_DCR:
+				if ('\r' != b[ i ])
+					return -1;
+				s->cs = T_HTP_CK_DLF;
+				break;
+			case T_HTP_CK_DLF:
+				if ('\n' != b[ i ])
+					return -1;
+				s->cs = T_HTP_CK_SZ0;
+				break;
+			case T_HTP_CK_TRL:
+				s->cs = ('\r' == b[ i ]) ? T_HTP_CK_END : T_HTP_CK_TRLL;
+				break;
+			case T_HTP_CK_TRLL:
+				if ('\n' == b[ i ])
+					s->cs = T_HTP_CK_TRL;
+				break;
+			case T_HTP_CK_END:
+				if ('\n' != b[ i ])
+					return -1;
+				s->cs = T_HTP_CK_DONE;
 				break;
 			default:
-				// look for special Headers
-				if (T_HTP_R_KS == rs)
-				{
-					rs = T_HTP_R_KY;
-					switch (tokens[ (size_t) *r ])
-					{
-						// Content-Length, Connection
-						case 'c':
-							// Content-Length
-							if (':' == *(r+14))
-							{
-								ke = r+14;
-								v  = eat_lws( r+15 );
-								r  = v;
-								while ('\n' != *r && '\r' != *r)
-								{
-									s->rqCl = s->rqCl*10 + (*r - '0');
-									r++;
-								}
-								r--;
-								rs = T_HTP_R_VL;
-								break;
-							}
-							// Connection: Keep-alive, Close, Upgrade
-							else if (':' == *(r+10))
-							{
-								ke = r+10;
-								v  = eat_lws( r+11 );
-								r  = v;
-								// Keep-Alive
-								if ('k' == tokens[ (size_t) *v ] && 'e' == tokens[ (size_t) *(v+9) ] ) s->con->kpAlv   = 200;
-								// Close
-								if ('c' == tokens[ (size_t) *v ] && 'e' == tokens[ (size_t) *(v+4) ] ) s->con->kpAlv   = 0;
-								// Upgrade
-								if ('u' == tokens[ (size_t) *v ] && 'e' == tokens[ (size_t) *(v+6) ] ) s->con->upgrade = 1;
-								rs = T_HTP_R_VL;
-								break;
-							}
-							break;
-						// Expect
-						case 'e':
-							if (':' == *(r+6))
-							{
-								ke = r+6;
-								v  = eat_lws( r+7 );
-								r  = v;
-								s->expect = 1;
-								rs = T_HTP_R_VL;
-								break;
-							}
-							break;
-							// Upgrade
-						case 'u':
-							if (':' == *(r+7))
-							{
-								ke = r+7;
-								v  = eat_lws( r+8 );
-								r  = v;
-								s->con->upgrade = 1;
-								rs = T_HTP_R_VL;
-								break;
-							}
-							break;
-						default:
-							rs = T_HTP_R_KY;
-							break;
-					}  // END SWITCH on First character
-				}  // End test for T_HTP_R_KS
 				break;
 		}
-		//if ((size_t)(r - s->con->b) > n) // run out of text before parsing is done
-		//	return NULL;
-		//else
-			r++;
 	}
+	return (long) i;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Write the decimal representation of an unsigned integer.
+ * \param   char*  buffer of at least 20 bytes; not terminated.
+ * \param   unsigned long long  value.
+ * \return  size_t  # of digits written.
+ * --------------------------------------------------------------------------*/
+size_t
+t_htp_itoa( char *b, unsigned long long v )
+{
+	char   d[ 20 ];
+	size_t n = sizeof( d );
+
+	do
+		d[ --n ] = '0' + (v % 10);
+	while (v /= 10);
+	memcpy( b, d + n, sizeof( d ) - n );
+	return sizeof( d ) - n;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Write the lower case hexadecimal representation of an unsigned integer.
+ * \param   char*  buffer of at least 16 bytes; not terminated.
+ * \param   unsigned long long  value.
+ * \return  size_t  # of digits written.
+ * --------------------------------------------------------------------------*/
+size_t
+t_htp_xtoa( char *b, unsigned long long v )
+{
+	char   d[ 16 ];
+	size_t n = sizeof( d );
+
+	do
+		d[ --n ] = "0123456789abcdef"[ v & 0xf ];
+	while (v >>= 4);
+	memcpy( b, d + n, sizeof( d ) - n );
+	return sizeof( d ) - n;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Format a table of headers into a header block and push it onto the stack.
+ * \detail  Each pair becomes "name: value\r\n".  Names must be tokens and
+ *          values must not contain control characters other than tab, so
+ *          Lua code can't inject headers or break the response head.
+ * \param   L    The lua state.
+ * \param   int  stack position of the table.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_pushheaders( lua_State *L, int t )
+{
+	const char *k;
+	const char *v  = NULL;
+	size_t      kl, i;
+	size_t      vl = 0;
+	int         n  = 0;
+
+	t = lua_absindex( L, t );
+	lua_pushnil( L );
+	while (lua_next( L, t ))
+	{
+		// lua_tolstring() would turn a number key into a string -> lua_next fails
+		if (LUA_TSTRING != lua_type( L, -2 ) || NULL == (v = lua_tolstring( L, -1, &vl )))
+			t_push_error( L, "Header names must be strings, values strings or numbers" );
+		k = lua_tolstring( L, -2, &kl );
+		for (i=0; i < kl && tokens[ (unsigned char) k[ i ] ]; i++) ;
+		if (0 == kl || i < kl)
+			t_push_error( L, "Illegal header name `%s`", k );
+		for (i=0; i < vl && ((unsigned char) v[ i ] >= 0x20 || '\t' == v[ i ]) &&
+		                    0x7f != v[ i ]; i++) ;
+		if (i < vl)
+			t_push_error( L, "Illegal value for header `%s`", k );
+		luaL_checkstack( L, 2, "too many headers" );
+		lua_pushfstring( L, "%s: %s\r\n", k, v );
+		lua_insert( L, -3 );         // keep the block below key and value
+		lua_pop( L, 1 );
+		n++;
+	}
+	lua_concat( L, n );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Take a recycled userdata out of a pool and push it onto the stack.
+ * \detail  Pools are arrays in LUA_REGISTRYINDEX keyed by the address p,
+ *          so each Lua state has its own.  They get filled by finalizers,
+ *          hence anything in a pool is unreachable from Lua.
+ * \param   L    The lua state.
+ * \param   void*  key of the pool.
+ * \return  void*  the userdata; NULL and nothing pushed if the pool is empty.
+ * --------------------------------------------------------------------------*/
+void
+*t_htp_pool_get( lua_State *L, const void *p )
+{
+	lua_Integer n;
+
+	if (LUA_TTABLE != lua_rawgetp( L, LUA_REGISTRYINDEX, p ) ||
+	    0 == (n = (lua_Integer) lua_rawlen( L, -1 )))
+	{
+		lua_pop( L, 1 );
+		return NULL;
+	}
+	lua_rawgeti( L, -1, n );
+	lua_pushnil( L );
+	lua_rawseti( L, -3, n );
+	lua_remove( L, -2 );
+	return lua_touserdata( L, -1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Put a userdata into a pool for recycling.
+ * \detail  Meant to be called from __gc which resurrects the userdata.
+ *          Setting the metatable again once it gets taken out of the pool
+ *          arms the finalizer again.
+ * \param   L    The lua state.
+ * \param   void*  key of the pool.
+ * \param   int    stack position of the userdata.
+ * \param   int    maximum number of userdata in the pool.
+ * \return  int    1 if pooled, 0 if the pool is full.
+ * --------------------------------------------------------------------------*/
+int
+t_htp_pool_put( lua_State *L, const void *p, int pos, int max )
+{
+	lua_Integer n;
+
+	pos = lua_absindex( L, pos );
+	if (LUA_TTABLE != lua_rawgetp( L, LUA_REGISTRYINDEX, p ))
+	{
+		lua_pop( L, 1 );
+		lua_createtable( L, max, 0 );
+		lua_pushvalue( L, -1 );
+		lua_rawsetp( L, LUA_REGISTRYINDEX, p );
+	}
+	if ((n = (lua_Integer) lua_rawlen( L, -1 )) >= max)
+	{
+		lua_pop( L, 1 );
+		return 0;
+	}
+	lua_pushvalue( L, pos );
+	lua_rawseti( L, -2, n+1 );
+	lua_pop( L, 1 );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Remove all entries from a table referenced in LUA_REGISTRYINDEX.
+ * \detail  Keeps the memory of the table, so it can be reused for another
+ *          connection or stream without growing again.
+ * \param   L    The lua state.
+ * \param   int  reference of the table.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_wipe( lua_State *L, int ref )
+{
+	lua_rawgeti( L, LUA_REGISTRYINDEX, ref );
+	lua_pushnil( L );
+	while (lua_next( L, -2 ))
+	{
+		lua_pop( L, 1 );             // value
+		lua_pushvalue( L, -1 );      // key
+		lua_pushnil( L );
+		lua_rawset( L, -4 );         // clearing fields is allowed in lua_next()
+	}
+	lua_pop( L, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Make sure a receive buffer has room for more data.
+ * \detail  Shared by server and client connections.  Without a buffer one
+ *          gets taken from the pool (if any) or allocated.  Once all data got
+ *          processed the buffer starts over at its beginning.  If unprocessed
+ *          data fills the buffer it doubles instead of moving the data, so
+ *          parse positions just get rebased.
+ * \param   char**        the buffer; NULL if there is none yet.
+ * \param   size_t*       size of the buffer.
+ * \param   size_t*       # of bytes in the buffer.
+ * \param   const char**  current start of data to process.
+ * \param   char**        pool of idle buffers of T_HTP_CON_BSZ; may be NULL.
+ * \param   int*          # of buffers in the pool.
+ * \return  int    0 on success, -1 if the buffer can't (or mustn't) grow.
+ * --------------------------------------------------------------------------*/
+int
+t_htp_getbuffer( char **buf, size_t *bsz, size_t *read, const char **b,
+                 char **pl, int *pn )
+{
+	char *nb;
 
-	lua_pop( L, 1 );   // pop the header table
-	return s->con->b;
+	if (NULL == *buf)
+	{
+		if (NULL != pl && *pn > 0)
+			*buf = pl[ --(*pn) ];
+		else if (NULL == (*buf = (char *) malloc( T_HTP_CON_BSZ )))
+			return -1;
+		*bsz  = T_HTP_CON_BSZ;
+		*read = 0;
+		*b    = *buf;
+	}
+	else if (*b == *buf + *read)
+	{
+		*read = 0;
+		*b    = *buf;
+	}
+	if (*read < *bsz)
+		return 0;
+	if (*bsz >= T_HTP_CON_BMX)
+		return -1;
+	if (NULL == (nb = (char *) realloc( *buf, *bsz*2 )))
+		return -1;
+	*b    = nb + (*b - *buf);
+	*buf  = nb;
+	*bsz *= 2;
+	return 0;
 }
 
 
@@ -419,6 +827,14 @@ luaopen_t_htp( lua_State *L )
 	luaL_newlib( L, t_htp_lib );
 	luaopen_t_htp_srv( L );
 	lua_setfield( L, -2, T_HTP_SRV_NAME );
+	luaopen_t_htp_cli( L );
+	lua_setfield( L, -2, T_HTP_CLI_NAME );
+	luaopen_t_htp_rte( L );
+	lua_setfield( L, -2, T_HTP_RTE_NAME );
+	luaopen_t_htp_fil( L );
+	lua_setfield( L, -2, T_HTP_FIL_NAME );
+	luaopen_t_htp_bch( L );
+	lua_setfield( L, -2, T_HTP_BCH_NAME );
 	luaopen_t_htp_con( L );
 	luaopen_t_htp_str( L );
 	return 1;
@@ -7,17 +7,65 @@
  * \copyright See Copyright notice at the end of t.h
  */
 
+#include <sys/types.h>         // ino_t, off_t
+#include <netinet/in.h>        // struct sockaddr_in
+#include <pthread.h>           // pthread_t, pthread_mutex_t
+
 #include "t_ael.h"
 
 #define T_HTP_CON_NAME     "Connection"
 #define T_HTP_SRV_NAME     "Server"
 #define T_HTP_STR_NAME     "Stream"
 #define T_HTP_STR_PRX_NAME "Proxy"
+#define T_HTP_HDR_NAME     "Header"
+#define T_HTP_CLI_NAME     "Client"
+#define T_HTP_RSP_NAME     "Response"
+#define T_HTP_RTE_NAME     "Router"
+#define T_HTP_FIL_NAME     "Files"
+#define T_HTP_FEN_NAME     "Entry"
+#define T_HTP_BCH_NAME     "Bench"
+#define T_HTP_CLU_NAME     "Cluster"
 
 #define T_HTP_CON_TYPE     T_HTP_TYPE"."T_HTP_CON_NAME
 #define T_HTP_SRV_TYPE     T_HTP_TYPE"."T_HTP_SRV_NAME
 #define T_HTP_STR_TYPE     T_HTP_TYPE"."T_HTP_STR_NAME
 #define T_HTP_STR_PRX_TYPE T_HTP_TYPE"."T_HTP_STR_PRX_NAME
+#define T_HTP_HDR_TYPE     T_HTP_TYPE"."T_HTP_HDR_NAME
+#define T_HTP_CLI_TYPE     T_HTP_TYPE"."T_HTP_CLI_NAME
+#define T_HTP_RSP_TYPE     T_HTP_TYPE"."T_HTP_RSP_NAME
+#define T_HTP_RTE_TYPE     T_HTP_TYPE"."T_HTP_RTE_NAME
+#define T_HTP_FIL_TYPE     T_HTP_TYPE"."T_HTP_FIL_NAME
+#define T_HTP_BCH_TYPE     T_HTP_TYPE"."T_HTP_BCH_NAME
+#define T_HTP_CCN_TYPE     T_HTP_CLI_TYPE"."T_HTP_CON_NAME
+#define T_HTP_FEN_TYPE     T_HTP_FIL_TYPE"."T_HTP_FEN_NAME
+#define T_HTP_CLU_TYPE     T_HTP_SRV_TYPE"."T_HTP_CLU_NAME
+
+#define T_HTP_CON_BSZ      BUFSIZ        ///< initial size of a connections receive buffer
+#define T_HTP_CON_BMX      (64*1024)     ///< largest receive buffer (request line + headers)
+#define T_HTP_CON_IOV      64            ///< most buffers handed to a single writev()
+#define T_HTP_CON_SFMX     (1<<30)       ///< most bytes handed to a single sendfile()
+#define T_HTP_SRV_BPL      64            ///< idle receive buffers pooled per server
+#define T_HTP_CON_PL       256           ///< recycled connections kept per Lua state
+#define T_HTP_STR_PL       256           ///< recycled streams kept per Lua state
+#define T_HTP_SRV_TMH      10            ///< default seconds to receive a request head
+#define T_HTP_SRV_TMI      15            ///< default seconds a keep-alive connection idles
+#define T_HTP_STR_HDN      64            ///< most headers accepted per request
+#define T_HTP_CLI_CMX      4             ///< default most connections per host of a client
+#define T_HTP_RTE_CPN      16            ///< most captures per route
+#define T_HTP_ZIP_MIN      1024          ///< default smallest body getting compressed
+#define T_HTP_ZIP_BLK      (64*1024)     ///< most body bytes compressed per loop iteration
+#define T_HTP_ZIP_CSZ      (4*1024*1024) ///< default most bytes kept in the compression cache
+#define T_HTP_ZIP_LVL      6             ///< default compression level
+#define T_HTP_FIL_CSZ      (64*1024*1024) ///< default most bytes of files kept open
+#define T_HTP_FIL_FMX      (4*1024*1024) ///< default largest file kept open
+#define T_HTP_FIL_TTL      1             ///< seconds a cached file is trusted before checking it
+#define T_HTP_FIL_IDX      "index.html"  ///< file served for paths ending in '/'
+#define T_HTP_BCH_CN       16            ///< default # of benchmark connections
+#define T_HTP_BCH_DUR      5000          ///< default benchmark duration in ms
+#define T_HTP_BCH_TCK      1             ///< ms between open loop sends and end checks
+#define T_HTP_BCH_BSZ      (64*1024)     ///< receive buffer of a benchmark connection
+#define T_HTP_BCH_HGE      36            ///< latencies are recorded up to 2^HGE us
+#define T_HTP_BCH_HGN      (1024 + (T_HTP_BCH_HGE-10)*512) ///< # of latency histogram buckets
 
 // _   _ _____ _____ ____
 //| | | |_   _|_   _|  _ \   _ __   __ _ _ __ ___  ___ _ __
@@ -73,6 +121,61 @@ enum t_htp_srm_s {
 };
 
 
+/// Position of the chunked request body decoder; kept in the stream between reads
+enum t_htp_ck {
+	T_HTP_CK_SZ0,         ///< first digit of the chunk size
+	T_HTP_CK_SZ,          ///< chunk size
+	T_HTP_CK_EXT,         ///< chunk extension
+	T_HTP_CK_SLF,         ///< LF after the chunk size line
+	T_HTP_CK_DATA,        ///< chunk data
+	T_HTP_CK_DCR,         ///< CR after chunk data
+	T_HTP_CK_DLF,         ///< LF after chunk data
+	T_HTP_CK_TRL,         ///< start of a trailer line (or the final CRLF)
+	T_HTP_CK_TRLL,        ///< rest of a trailer line
+	T_HTP_CK_END,         ///< LF of the final CRLF
+	T_HTP_CK_DONE,        ///< body complete
+};
+
+
+/// is the request body of stream s received completely?
+#define T_HTP_STR_BODYDONE( s ) ((2 == (s)->rqFr) \
+	? T_HTP_CK_DONE == (s)->cs                    \
+	: (s)->rqBl == (s)->rqCl)
+
+
+/// Content coding of a response
+enum t_htp_zip_e {
+	T_HTP_ZIP_NO,         ///< sent as is
+	T_HTP_ZIP_GZIP,       ///< gzip
+	T_HTP_ZIP_DEFLATE,    ///< deflate (zlib format)
+};
+
+
+/// Timeout list a connection is linked into; busy connections are in none
+enum t_htp_tmo {
+	T_HTP_TMO_NO,         ///< busy; receiving a body or responding
+	T_HTP_TMO_HEAD,       ///< waiting for (the rest of) a request head
+	T_HTP_TMO_IDLE,       ///< keep-alive; waiting for the next request
+};
+
+
+/// Position of the request head parser; kept in the stream between reads
+enum t_htp_ps {
+	T_HTP_P_MTH,          ///< Method
+	T_HTP_P_US,           ///< Spaces ahead of the URL
+	T_HTP_P_URL,          ///< URL
+	T_HTP_P_VS,           ///< Spaces ahead of the HTTP version
+	T_HTP_P_VER,          ///< HTTP version up to the end of the line
+	T_HTP_P_KS,           ///< Start of a header line or the empty line
+	T_HTP_P_KY,           ///< Header key
+	T_HTP_P_WS,           ///< Whitespace ahead of the header value
+	T_HTP_P_VL,           ///< Header value up to the end of the line
+	T_HTP_P_LF,           ///< CR of the empty line seen; expect LF
+	T_HTP_P_RVR,          ///< Response: HTTP version
+	T_HTP_P_RST,          ///< Response: status code and reason up to the end of the line
+};
+
+
 // Available HTTP versions
 enum t_htp_ver {
 	T_HTP_VER_09,
@@ -93,9 +196,56 @@ struct t_htp_srv {
 	int               sR;     ///< Lua registry reference for t.Net.TCP instance
 	int               aR;     ///< Lua registry reference for t.Net.IP4 instance (struct sockaddr_in)
 	int               lR;     ///< Lua registry reference for t.Loop instance
-	int               rR;     ///< Lua registry reference to request handler function
+	int               rR;     ///< Lua registry reference to request handler function or router
+	struct t_htp_rte *rte;    ///< router referenced by rR; NULL for a handler function
 	time_t            nw;     ///< Current time on the server
 	char              fnw[30];///< Formatted Date time in HTTP format
+	int               hR;     ///< Lua registry reference to the header block sent with each response
+	const char       *hb;     ///< header block; NULL if none
+	size_t            hl;     ///< length of the header block
+	int               bpn;    ///< # of buffers in bpl; -1 once the server got collected
+	char             *bpl[ T_HTP_SRV_BPL ]; ///< idle receive buffers of T_HTP_CON_BSZ
+
+	// connections waiting for a request, oldest first; indexed by t_htp_tmo
+	int               tmo[ 3 ]; ///< timeout in seconds per list; 0 disables
+	struct t_htp_con *tmh[ 3 ]; ///< oldest connection per list
+	struct t_htp_con *tmt[ 3 ]; ///< youngest connection per list
+	struct timeval    tiv;    ///< interval of the timeout sweep
+
+	// response compression (T.Http.Server:compress()); bodies sent in one
+	// piece get compressed once and cached by their content
+	int               zlv;    ///< compression level; 0 disables compression
+	size_t            zmn;    ///< smallest body getting compressed
+	size_t            zcm;    ///< most bytes kept in the caches
+	size_t            zcs;    ///< bytes kept in the caches
+	int               zcR[ 2 ]; ///< Lua registry references to the gzip/deflate caches
+};
+
+
+/// one thread of a T.Http.Server.Cluster
+struct t_htp_wrk {
+	pthread_t         tid;
+	struct t_htp_clu *clu;    ///< cluster the worker belongs to
+	struct t_ael     *ael;    ///< loop of the worker while it runs; guarded by clu->mtx
+	struct t_ael_job  stp;    ///< job stopping the loop; posted by Cluster:stop()
+	char              err[ 256 ]; ///< error message if the worker failed
+};
+
+
+/// The userdata struct for T.Http.Server.Cluster; owns copies of all strings
+/// handed to the workers
+struct t_htp_clu {
+	pthread_mutex_t   mtx;    ///< guards sp and the loops of the workers
+	char             *mod;    ///< name of the request handler module
+	char             *path;   ///< package.path of the spawning state
+	char             *cpath;  ///< package.cpath of the spawning state
+	char             *host;   ///< address to bind to; NULL for INADDR_ANY
+	int               port;   ///< port to listen on
+	int               bl;     ///< listen backlog
+	int               sp;     ///< stop requested?
+	int               n;      ///< # of workers started and not joined yet
+	int               wn;     ///< # of workers allocated in w
+	struct t_htp_wrk *w;      ///< workers
 };
 
 
@@ -105,6 +255,7 @@ struct t_htp_con {
 	int               pR;     ///< Lua registry reference for proxy table
 	int               sR;     ///< Lua registry reference to the stream table
 	int               cnt;    ///< count requests (streams) handled in this con
+	int               rsp;    ///< id of the stream whose response goes out next
 
 	// onBody() handler; anytime a read-event is fired AFTER the header was
 	// received this gets executed; Can be LUA_NOREF which discards incoming data
@@ -112,12 +263,22 @@ struct t_htp_con {
 	struct t_net     *sck;    ///< pointer to the actual socket
 	struct t_htp_srv *srv;    ///< pointer to the HTTP-Server
 
-	int               kpAlv;  ///< keepalive value in seconds -> 0==no Keepalive
 	int               upgrade;///< shall the connection be upgraded?
+	int               psd;    ///< reading paused by the body handler?
 	enum t_htp_ver    ver;    ///< HTTP version
 
-	size_t            read;   ///< How many byte processed
-	char              buf[ BUFSIZ ];   ///< reading buffer
+	// timeouts; linked into one of the servers lists while waiting for a request
+	int               rcv;    ///< receiving: 0 between requests, 1 head, 2 body
+	enum t_htp_tmo    tmo;    ///< list the connection is linked into
+	time_t            tms;    ///< start of the wait on the monotonic clock
+	struct t_htp_con *tnx;    ///< next (younger) connection in the list
+	struct t_htp_con *tpv;    ///< previous (older) connection in the list
+
+	// receive buffer; only held while there is unprocessed data, else it goes
+	// back to the servers pool.  Grows if a request head doesn't fit
+	char             *buf;    ///< reading buffer; NULL while idle
+	size_t            bsz;    ///< size of buf
+	size_t            read;   ///< How many bytes are in buf
 	const char       *b;      ///< Current start of buffer to process
 
 	// output buffer handling with linked list (FiFo), this has significant
@@ -128,16 +289,30 @@ struct t_htp_con {
 };
 
 
+/// location of a header within the request head
+struct t_htp_hdr {
+	unsigned int      ko;     ///< key offset
+	unsigned int      kl;     ///< key length
+	unsigned int      vo;     ///< value offset
+	unsigned int      vl;     ///< value length
+};
+
+
 /// userdata for a single request-response (HTTP stream)
 struct t_htp_str {
 	// Proxy contains lua readable items such as headers, length, status code etc
 	int               pR;     ///< Lua registry reference for proxy table
-	int               rqCl;   ///< request  content length
-	int               rsCl;   ///< response content length
-	int               rsBl;   ///< response buffer length (headers + rsCl)
-	int               rsSl;   ///< response buffer sent length (if rsBl==rsSl; stream is done)
+	long long         rqCl;   ///< request  content length
+	long long         rqBl;   ///< request  body bytes received so far
+	int               rqFr;   ///< request body framing: 0 none, 1 Content-Length, 2 chunked
+	enum t_htp_ck     cs;     ///< position of the chunk decoder
+	long long         ck;     ///< bytes left in the current chunk
+	long long         rsCl;   ///< response content length; -1 if chunked
+	long long         rsBl;   ///< response buffer length (headers + rsCl)
+	long long         rsSl;   ///< response buffer sent length (if rsBl==rsSl; stream is done)
 	int               bR;     ///< Lua registry reference to body handler function
 	int               expect; ///< shall the connection return an expected thingy?
+	int               kpAlv;  ///< keep the connection open after this response?
 	enum t_htp_srm_s  state;  ///< HTTP Message state
 	enum t_htp_mth    mth;    ///< HTTP Method for this request
 	enum t_htp_ver    ver;    ///< HTTP version
@@ -145,31 +320,239 @@ struct t_htp_str {
 	// in HTTP1.1 the connections counter will provide the id, in HTTP2.0
 	// the ID gets provided in the protocol by the client
 	int               cntId;  ///< id inherited from count in connection
+	enum t_htp_zip_e  ze;     ///< content coding of the response
+	struct t_htp_zip *zp;     ///< deflate state of a compressed chunked response; NULL if none
+
+	// request head; scanned in C and kept as a single string, Lua values for
+	// method, url, headers etc. get created when they are accessed
+	enum t_htp_ps     ps;     ///< position of the head parser
+	size_t            po;     ///< bytes of the head scanned so far
+	int               hR;     ///< Lua registry reference to the request head string
+	const char       *hd;     ///< request head (string in hR); NULL while incomplete
+	unsigned int      ml;     ///< method length (starts at offset 0)
+	unsigned int      uo;     ///< url offset
+	unsigned int      ul;     ///< url length
+	unsigned int      vo;     ///< version offset
+	unsigned int      vl;     ///< version length
+	int               hdn;    ///< # of headers in hdr
+	struct t_htp_hdr  hdr[ T_HTP_STR_HDN ];   ///< headers in order received
 };
 
 
-/// userdata for HTTP connection output buffer chunk
+/// The userdata struct for T.Http.Client
+struct t_htp_cli {
+	struct t_ael     *ael;    ///< t_ael event loop
+	int               lR;     ///< Lua registry reference for t.Loop instance
+	int               mx;     ///< most connections per host
+};
+
+
+/// Connections of a T.Http.Client to one host:port; kept in the uservalue
+/// table of the client
+struct t_htp_hst {
+	struct t_htp_cli *cli;    ///< client the host belongs to
+	struct t_htp_ccn *ch;     ///< open connections; most recent first
+	int               n;      ///< # of open connections
+	struct t_htp_rsp *wh;     ///< oldest request waiting for an idle connection
+	struct t_htp_rsp *wt;     ///< youngest request waiting for an idle connection
+	struct sockaddr_in adr;   ///< address of the host
+};
+
+
+/// Connection of a T.Http.Client; requests are queued in the order sent and
+/// the response at the head of the queue is the one being received
+struct t_htp_ccn {
+	struct t_htp_hst *hst;    ///< host the connection belongs to
+	struct t_net     *sck;    ///< socket; NULL once closed
+	int               cnn;    ///< is connect() still in progress?
+	int               psd;    ///< reading paused by the body handler?
+	int               use;    ///< # of responses received completely
+	int               qn;     ///< # of requests queued
+	struct t_htp_rsp *qh;     ///< oldest request; receives the next response
+	struct t_htp_rsp *qt;     ///< youngest request
+	struct t_htp_rsp *qs;     ///< first request not sent completely; NULL if none
+	struct t_htp_ccn *hnx;    ///< next connection to the same host
+	struct t_htp_ccn *hpv;    ///< previous connection to the same host
+
+	// receive buffer; grows if a response head doesn't fit
+	char             *buf;    ///< reading buffer; NULL until data arrives
+	size_t            bsz;    ///< size of buf
+	size_t            read;   ///< How many bytes are in buf
+	const char       *b;      ///< Current start of buffer to process
+};
+
+
+/// userdata for a request sent by T.Http.Client and its response (T.Http.Response)
+struct t_htp_rsp {
+	struct t_htp_str  s;      ///< response head and body parser state; s.con is NULL
+	int               rR;     ///< self reference while queued on a connection
+	int               fR;     ///< Lua registry reference to the response handler
+	int               qR;     ///< Lua registry reference to the request (head and body)
+	size_t            ql;     ///< length of the request
+	size_t            qo;     ///< bytes of the request sent
+	int               sts;    ///< status code; 0 until the head arrived
+	int               nb;     ///< response can't have a body (HEAD request)?
+	int               idm;    ///< idempotent method; may be pipelined?
+	int               rty;    ///< may be sent again if a reused connection fails?
+	struct t_htp_ccn *cc;     ///< connection; NULL while not queued
+	struct t_htp_rsp *nxt;    ///< next request queued on the connection
+};
+
+
+/// Node of the route table of a T.Http.Router.  A static node matches one or
+/// more whole path segments, a capturing node one segment (:name) or the rest
+/// of the path (*name).  Static children are sorted by their first segment.
+struct t_htp_rtn {
+	char             *lb;     ///< static segments joined by '/'; NULL for capturing nodes
+	size_t            ll;     ///< length of lb
+	size_t            fl;     ///< length of the first segment in lb
+	struct t_htp_rtn **ch;    ///< static children
+	size_t            chn;    ///< # of static children
+	struct t_htp_rtn *pc;     ///< child capturing one segment; NULL if none
+	struct t_htp_rtn *wc;     ///< child capturing the rest of the path; NULL if none
+	int               hn;     ///< # of handlers; 0 unless a route ends here
+	int               aR;     ///< Lua registry reference to the handler for any method
+	int               mR[ T_HTP_MTH_UNSUBSCRIBE+1 ]; ///< handler per method; LUA_NOREF if none
+};
+
+
+/// The userdata struct for T.Http.Router
+struct t_htp_rte {
+	struct t_htp_rtn *rt;     ///< root; matches the empty path ahead of the first '/'
+	int               fR;     ///< Lua registry reference to the fallback handler
+	int               n;      ///< # of routes
+};
+
+
+/// A file of a T.Http.Files cache, kept open.  Entries are userdata so chunks
+/// being sent keep the descriptor open after the entry got evicted
+struct t_htp_fen {
+	struct t_htp_fil *fil;    ///< cache the entry is linked into; NULL if not cached
+	int               fd;     ///< open file; -1 once closed
+	size_t            sz;     ///< size of the file
+	time_t            mt;     ///< modification time of the file
+	ino_t             ino;    ///< inode of the file
+	time_t            ck;     ///< last time the file got checked for changes
+	int               kR;     ///< Lua registry reference to the key in the cache table
+	int               hR;     ///< Lua registry reference to the formatted header lines
+	char              et[ 40 ];  ///< ETag (quoted)
+	char              lm[ 30 ];  ///< Last-Modified
+	struct t_htp_fen *nxt;    ///< next entry; used less recently
+	struct t_htp_fen *prv;    ///< previous entry; used more recently
+};
+
+
+/// The userdata struct for T.Http.Files; entries are kept in its uservalue
+/// table keyed by their path and in a list ordered by their last use
+struct t_htp_fil {
+	char             *rt;     ///< document root; without trailing '/'
+	size_t            rl;     ///< length of rt
+	size_t            csz;    ///< most bytes cached
+	size_t            fmx;    ///< largest file cached
+	size_t            use;    ///< bytes cached
+	int               n;      ///< # of entries cached
+	struct t_htp_fen *hd;     ///< most recently used entry
+	struct t_htp_fen *tl;     ///< least recently used entry
+};
+
+
+/// userdata for HTTP connection output buffer chunk; file chunks (fd != -1)
+/// get sent straight from the file and bR references the Lua file handle or
+/// T.Http.Files entry they came from, if any.  Memory chunks get sent from bp
+/// which is kept valid by the value bR references
 struct t_htp_buf {
+	const char        *bp;    ///< data of a memory chunk; NULL for file chunks
 	int                bR;    ///< string reference within luaState
 	int                sR;    ///< string reference within luaState
 	size_t             bl;    ///< Outgoing Buffer Length (content+header)
 	size_t             sl;    ///< Outgoing Sent
 	char               last;  ///< Boolean to signify the last buffer for a stream
+	int                fd;    ///< file to send from; -1 for string chunks
+	int                fc;    ///< close fd once the chunk is done?
+	off_t              fo;    ///< offset in fd of the next byte to send
 	struct t_htp_str  *str;   ///< stream this buffer is made for
 	struct t_htp_buf  *prv;   ///< previous pointer for linked list
 	struct t_htp_buf  *nxt;   ///< next pointer for linked list
 };
 
 
+/// Connection of a T.Http.Bench; requests are queued until sent and their
+/// intended send times are kept in a ring until the response arrived
+struct t_htp_bcn {
+	struct t_htp_bch *bch;    ///< benchmark the connection belongs to
+	struct t_net     *sck;    ///< socket; NULL while closed
+	int               cnn;    ///< is connect() still in progress?
+	int               qn;     ///< # of requests not sent completely
+	size_t            qo;     ///< bytes sent of the first request not sent completely
+	int               fl;     ///< # of requests in flight (queued or sent)
+	int               sn;     ///< # of requests issued on this connection
+	int               rn;     ///< # of responses received on this connection
+	int               ih;     ///< ring position of the oldest request in flight
+	struct timeval   *it;     ///< intended send times of requests in flight
+	struct timeval    due;    ///< open loop: when the next request is due
+	struct t_htp_str  s;      ///< response head and body parser state
+	int               hd;     ///< response head received?
+	int               sts;    ///< status code of the response being received
+	char             *buf;    ///< receive buffer
+	size_t            read;   ///< How many bytes are in buf
+	const char       *b;      ///< Current start of buffer to process
+};
+
+
+/// The userdata struct for T.Http.Bench
+struct t_htp_bch {
+	struct t_ael     *ael;    ///< t_ael event loop
+	int               lR;     ///< Lua registry reference for t.Loop instance
+	int               qR;     ///< Lua registry reference to the request string
+	int               fR;     ///< Lua registry reference to the done handler
+	int               bR;     ///< self reference while running
+	const char       *rq;     ///< request (string in qR)
+	size_t            rql;    ///< length of the request
+	struct sockaddr_in adr;   ///< address of the server
+	struct t_htp_bcn *cs;     ///< connections
+	int               cn;     ///< # of connections
+	int               pl;     ///< most requests in flight per connection
+	int               rpc;    ///< requests per connection before reconnecting; 0 never
+	double            rate;   ///< requests per second; 0 runs a closed loop
+	long              dur;    ///< duration in ms
+	int               run;    ///< is the benchmark running?
+	struct timeval    t0;     ///< start of the run
+	struct timeval    t1;     ///< end of the run
+	struct timeval    tk;     ///< tick of the timer
+	struct timeval    iv;     ///< open loop: time between requests on a connection
+
+	// results
+	long long         n;      ///< # of responses received
+	long long         nok;    ///< # of responses with a status >= 400
+	long long         err;    ///< # of connection errors
+	long long         cnc;    ///< # of connects
+	long long         byt;    ///< bytes received
+	unsigned long long lsm;   ///< sum of latencies in us
+	unsigned long long lmx;   ///< largest latency in us
+	unsigned long long *hg;   ///< latency histogram; log-linear buckets of us
+};
+
+
 //  __  __      _   _               _
 // |  \/  | ___| |_| |__   ___   __| |___
 // | |\/| |/ _ \ __| '_ \ / _ \ / _` / __|
 // | |  | |  __/ |_| | | | (_) | (_| \__ \
 // |_|  |_|\___|\__|_| |_|\___/ \__,_|___/
 // t_htp.c
-const char       *t_htp_pReqFirstLine( lua_State *L, struct t_htp_str *s, size_t n );
-const char       *t_htp_pHeaderLine  ( lua_State *L, struct t_htp_str *s, size_t n );
+int               t_htp_pHead        ( struct t_htp_str *s, const char *b, size_t n );
+long              t_htp_pChunk       ( struct t_htp_str *s, const char *b, size_t n );
+int               t_htp_ieq          ( const char *a, const char *b, size_t l );
 const char       *t_htp_status       ( int status );
+enum t_htp_mth    t_htp_method       ( const char *m, size_t l );
+const char       *t_htp_mthname      ( enum t_htp_mth mth );
+size_t            t_htp_itoa         ( char *b, unsigned long long v );
+size_t            t_htp_xtoa         ( char *b, unsigned long long v );
+void              t_htp_pushheaders  ( lua_State *L, int t );
+void             *t_htp_pool_get     ( lua_State *L, const void *p );
+int               t_htp_pool_put     ( lua_State *L, const void *p, int pos, int max );
+void              t_htp_wipe         ( lua_State *L, int ref );
+int               t_htp_getbuffer    ( char **buf, size_t *bsz, size_t *read,
+                                       const char **b, char **pl, int *pn );
 
 
 // t_htp_srv.c
@@ -178,29 +561,72 @@ struct t_htp_srv *t_htp_srv_check_ud ( lua_State *L, int pos, int check );
 struct t_htp_srv *t_htp_srv_create_ud( lua_State *L );
 void              t_htp_srv_setnow( struct t_htp_srv *s, int force );
 
+// t_htp_zip.c   response compression; a no-op unless built with T_HTP_ZIP
+enum t_htp_zip_e  t_htp_zip_choose   ( struct t_htp_str *s, int code, long long len,
+                                       const char *h, size_t hl );
+void              t_htp_zip_init     ( lua_State *L, struct t_htp_str *s );
+void              t_htp_zip_body     ( lua_State *L, struct t_htp_str *s, int pos );
+void              t_htp_zip_feed     ( lua_State *L, struct t_htp_str *s, int pos, int fin );
+void              t_htp_zip_free     ( lua_State *L, struct t_htp_str *s );
+int               lt_htp_srv_compress( lua_State *L );
+
 
 // HTTP Connection specific methods
 // Constructors
 struct t_htp_con *t_htp_con_check_ud ( lua_State *L, int pos, int check );
 struct t_htp_con *t_htp_con_create_ud( lua_State *L, struct t_htp_srv *srv );
 // methods
-int               t_htp_con_rcv    ( lua_State *L );
-int               t_htp_con_rsp    ( lua_State *L );
-void              t_htp_con_adjustbuffer( struct t_htp_con *c, size_t read, const char* rpos );
+int               t_htp_con_rcv    ( lua_State *L, void *ud );
+int               t_htp_con_rsp    ( lua_State *L, void *ud );
+int               t_htp_con_flush  ( lua_State *L, void *ud );
+int               t_htp_con_sweep  ( lua_State *L, void *ud );
+void              t_htp_con_pause  ( struct t_htp_con *c );
+void              t_htp_con_resume ( lua_State *L, struct t_htp_con *c );
 
 // HTTP Stream specific methods
 // Constructors
 struct t_htp_str *t_htp_str_check_ud ( lua_State *L, int pos, int check );
 struct t_htp_str *t_htp_str_create_ud( lua_State *L, struct t_htp_con *con );
 // methods
-int               t_htp_str_rcv    ( lua_State *L, struct t_htp_str *s, size_t rcvd );
-int               lt_htp_str__gc( lua_State *L );
+int               t_htp_str_rcv    ( lua_State *L, struct t_htp_str *s );
+int               t_htp_str_addbuffer( lua_State *L, struct t_htp_str *s, size_t l, int last );
+void              t_htp_str_addmem ( lua_State *L, struct t_htp_str *s, const char *d,
+                                     size_t l, int last );
+void              t_htp_str_addfile( lua_State *L, struct t_htp_str *s, int fd, int fc,
+                                     off_t off, size_t l, int last );
+size_t            t_htp_str_formHeader( lua_State *L, luaL_Buffer *lB, struct t_htp_str *s,
+                                     int code, const char *msg, long long len, int t, int zip );
+const char       *t_htp_str_getheader( struct t_htp_str *s, const char *k, size_t kl, size_t *vl );
+void              t_htp_str_release( lua_State *L, struct t_htp_str *s );
+void              t_htp_hdr_create_ud( lua_State *L, struct t_htp_str *s, int pos );
+
+// HTTP Client
+struct t_htp_cli *t_htp_cli_check_ud ( lua_State *L, int pos, int check );
+struct t_htp_cli *t_htp_cli_create_ud( lua_State *L );
+
+// HTTP Router
+struct t_htp_rte *t_htp_rte_check_ud ( lua_State *L, int pos, int check );
+struct t_htp_rte *t_htp_rte_create_ud( lua_State *L );
+void              t_htp_rte_dispatch ( lua_State *L, struct t_htp_rte *r,
+                                       struct t_htp_str *s, int si );
+
+// HTTP Files
+struct t_htp_fil *t_htp_fil_check_ud ( lua_State *L, int pos, int check );
+struct t_htp_fil *t_htp_fil_create_ud( lua_State *L, const char *rt, size_t rl );
+
+// HTTP Bench
+struct t_htp_bch *t_htp_bch_check_ud ( lua_State *L, int pos, int check );
+struct t_htp_bch *t_htp_bch_create_ud( lua_State *L );
 
 
 // library exporters
 LUAMOD_API int luaopen_t_htp_str( lua_State *L );
 LUAMOD_API int luaopen_t_htp_con( lua_State *L );
 LUAMOD_API int luaopen_t_htp_srv( lua_State *L );
+LUAMOD_API int luaopen_t_htp_cli( lua_State *L );
+LUAMOD_API int luaopen_t_htp_rte( lua_State *L );
+LUAMOD_API int luaopen_t_htp_fil( lua_State *L );
+LUAMOD_API int luaopen_t_htp_bch( lua_State *L );
 
 
 // __        __   _    ____             _        _
@@ -0,0 +1,933 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_htp_bch.c
+ * \brief     HTTP/1.1 load generator (T.Http.Bench)
+ * \detail    Keeps a number of connections to a server busy with the same
+ *            request and records the latency of each response in a
+ *            log-linear histogram.  Runs either a closed loop (each
+ *            connection keeps `pipeline` requests in flight) or an open loop
+ *            (requests get issued at a fixed rate no matter how fast the
+ *            server answers).  In the open loop the latency counts from when
+ *            a request was due, not from when it could be sent, so a stalled
+ *            server can't hide behind the requests it held back.  Everything
+ *            runs natively on the T.Loop, so the generator costs a fraction
+ *            of what the server spends on a request.
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+
+#include <stdlib.h>               // malloc, calloc, free
+#include <string.h>               // memset, memmove, strerror
+#include <limits.h>               // INT_MAX
+#include <errno.h>                // errno, EINPROGRESS, EAGAIN
+#include <fcntl.h>                // fcntl
+#include <arpa/inet.h>            // inet_pton, htons
+#include <netinet/tcp.h>          // TCP_NODELAY
+#include <sys/socket.h>           // connect, recv
+#include <sys/uio.h>              // struct iovec
+
+#include "t.h"
+#include "t_htp.h"
+#include "t_tim.h"
+
+
+/**--------------------------------------------------------------------------
+ * Get an integer option from the options table.
+ * \param   L    The lua state.
+ * \param   int  stack position of the options table.
+ * \param   const char*  name of the option.
+ * \param   lua_Integer  default value.
+ * \param   lua_Integer  smallest value accepted.
+ * \return  lua_Integer.
+ * --------------------------------------------------------------------------*/
+static lua_Integer
+t_htp_bch_optint( lua_State *L, int t, const char *k, lua_Integer d, lua_Integer mn )
+{
+	lua_Integer v;
+
+	lua_getfield( L, t, k );
+	v = luaL_opt( L, luaL_checkinteger, -1, d );
+	lua_pop( L, 1 );
+	if (v < mn || v > INT_MAX)
+		luaL_argerror( L, t, lua_pushfstring( L, "`%s` is out of range", k ) );
+	return v;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Construct a T.Http.Bench.
+ * \detail  Options are host (IPv4 address, default '127.0.0.1'), port (8000),
+ *          path ('/'), connections, pipeline (most requests in flight per
+ *          connection, 1), requests (per connection before it reconnects; 0
+ *          keeps connections open), rate (requests per second over all
+ *          connections; 0 runs a closed loop) and duration (ms).
+ * \param   L      Lua state.
+ * \lparam  CLASS  table Http.Bench.
+ * \lparam  ud     T.Loop userdata instance for the Bench.
+ * \lparam  table  options (optional).
+ * \lreturn ud     T.Http.Bench userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_bch__Call( lua_State *L )
+{
+	struct t_ael     *l    = t_ael_check_ud( L, 2, 1 );
+	const char       *host = "127.0.0.1";
+	const char       *path = "/";
+	lua_Integer       port = 8000;
+	struct t_htp_bch *b;
+	int               i;
+
+	if (lua_isnoneornil( L, 3 ))
+		lua_newtable( L );
+	luaL_checktype( L, 3, LUA_TTABLE );
+	lua_settop( L, 3 );
+	b = t_htp_bch_create_ud( L );               //S: CLASS,ael,opt,bch
+	b->ael = l;
+	lua_pushvalue( L, 2 );
+	b->lR  = luaL_ref( L, LUA_REGISTRYINDEX );
+
+	if (LUA_TNIL != lua_getfield( L, 3, "host" ))
+		host = luaL_checkstring( L, -1 );
+	if (LUA_TNIL != lua_getfield( L, 3, "path" ))
+		path = luaL_checkstring( L, -1 );      // both stay on the stack
+	port   = t_htp_bch_optint( L, 3, "port", port, 1 );
+	b->cn  = (int) t_htp_bch_optint( L, 3, "connections", T_HTP_BCH_CN, 1 );
+	b->pl  = (int) t_htp_bch_optint( L, 3, "pipeline", 1, 1 );
+	b->rpc = (int) t_htp_bch_optint( L, 3, "requests", 0, 0 );
+	b->dur = (long) t_htp_bch_optint( L, 3, "duration", T_HTP_BCH_DUR, 1 );
+	lua_getfield( L, 3, "rate" );
+	b->rate = luaL_optnumber( L, -1, 0 );
+	lua_pop( L, 1 );
+	luaL_argcheck( L, port <= 65535, 3, "`port` is out of range" );
+	luaL_argcheck( L, b->rate >= 0, 3, "`rate` must not be negative" );
+	if (b->rpc > 0 && b->pl > b->rpc)
+		b->pl = b->rpc;
+
+	b->adr.sin_family = AF_INET;
+	b->adr.sin_port   = htons( (int) port );
+	if (1 != inet_pton( AF_INET, host, &(b->adr.sin_addr) ))
+		return t_push_error( L, "Illegal IPv4 address `%s`", host );
+	lua_pushfstring( L, "GET %s HTTP/1.1\r\nHost: %s:%d\r\n\r\n", path, host, (int) port );
+	b->rq  = lua_tolstring( L, -1, &(b->rql) );
+	b->qR  = luaL_ref( L, LUA_REGISTRYINDEX );
+
+	b->hg  = (unsigned long long *) calloc( T_HTP_BCH_HGN, sizeof( unsigned long long ) );
+	b->cs  = (struct t_htp_bcn *) calloc( b->cn, sizeof( struct t_htp_bcn ) );
+	if (NULL == b->hg || NULL == b->cs)
+		return t_push_error( L, "Failed to allocate "T_HTP_BCH_TYPE );
+	for (i=0; i < b->cn; i++)
+	{
+		b->cs[ i ].bch = b;
+		b->cs[ i ].it  = (struct timeval *) malloc( b->pl * sizeof( struct timeval ) );
+		b->cs[ i ].buf = (char *) malloc( T_HTP_BCH_BSZ );
+		if (NULL == b->cs[ i ].it || NULL == b->cs[ i ].buf)
+			return t_push_error( L, "Failed to allocate "T_HTP_BCH_TYPE );
+	}
+	lua_settop( L, 4 );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Create a t_htp_bch and push to LuaStack.
+ * \param   L  The lua state.
+ *
+ * \return  struct t_htp_bch*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_bch
+*t_htp_bch_create_ud( lua_State *L )
+{
+	struct t_htp_bch *b;
+
+	b = (struct t_htp_bch *) lua_newuserdata( L, sizeof( struct t_htp_bch ) );
+	memset( b, 0, sizeof( struct t_htp_bch ) );
+	b->lR = LUA_NOREF;
+	b->qR = LUA_NOREF;
+	b->fR = LUA_NOREF;
+	b->bR = LUA_NOREF;
+	b->tk.tv_sec  = 0;
+	b->tk.tv_usec = T_HTP_BCH_TCK * 1000;
+
+	luaL_getmetatable( L, T_HTP_BCH_TYPE );
+	lua_setmetatable( L, -2 );
+	return b;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if the item on stack position pos is an t_htp_bch struct and return it
+ * \param  L    the Lua State
+ * \param  pos      position on the stack
+ *
+ * \return  struct t_htp_bch*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_bch
+*t_htp_bch_check_ud( lua_State *L, int pos, int check )
+{
+	void *ud = luaL_testudata( L, pos, T_HTP_BCH_TYPE );
+	luaL_argcheck( L, (ud != NULL || !check), pos, "`"T_HTP_BCH_TYPE"` expected" );
+	return (NULL==ud) ? NULL : (struct t_htp_bch *) ud;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Histogram bucket of a latency.
+ * \detail  Below 1024us each microsecond has its own bucket; above each
+ *          power of two is split into 512 buckets, which keeps the error
+ *          below 0.2% at any magnitude.
+ * \param   unsigned long long  latency in us.
+ * \return  size_t  index of the bucket.
+ * --------------------------------------------------------------------------*/
+static size_t
+t_htp_bch_bucket( unsigned long long v )
+{
+	int e;
+
+	if (v < 1024)
+		return (size_t) v;
+	if (v >= (1ULL << T_HTP_BCH_HGE))
+		v = (1ULL << T_HTP_BCH_HGE) - 1;
+	for (e = 10; v >> (e+1); e++)
+		;
+	return 1024 + (e-10)*512 + ((v >> (e-9)) & 511);
+}
+
+
+/**--------------------------------------------------------------------------
+ * Latency a histogram bucket stands for.
+ * \param   size_t  index of the bucket.
+ * \return  unsigned long long  middle of the bucket in us.
+ * --------------------------------------------------------------------------*/
+static unsigned long long
+t_htp_bch_value( size_t i )
+{
+	int e;
+
+	if (i < 1024)
+		return i;
+	e = (int) (i-1024) / 512 + 10;
+	return ((512ULL + (i-1024) % 512) << (e-9)) + ((1ULL << (e-9)) >> 1);
+}
+
+
+/**--------------------------------------------------------------------------
+ * Latency below which a share of the responses arrived.
+ * \param   struct t_htp_bch*.
+ * \param   double  share of the responses; 0 < q <= 1.
+ * \return  unsigned long long  latency in us.
+ * --------------------------------------------------------------------------*/
+static unsigned long long
+t_htp_bch_quantile( struct t_htp_bch *b, double q )
+{
+	unsigned long long w = (unsigned long long) (q * b->n);
+	unsigned long long c = 0;
+	unsigned long long v;
+	size_t             i;
+
+	if ((double) w < q * b->n)
+		w++;
+	if (0 == w)
+		w = 1;
+	for (i=0; i < T_HTP_BCH_HGN; i++)
+		if ((c += b->hg[ i ]) >= w)
+		{
+			v = t_htp_bch_value( i );
+			return (v > b->lmx) ? b->lmx : v;
+		}
+	return b->lmx;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Record the response to the oldest request in flight on a connection.
+ * \param   struct t_htp_bcn*.
+ * \param   struct timeval*  time the response arrived.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_bch_record( struct t_htp_bcn *c, struct timeval *nw )
+{
+	struct t_htp_bch   *b  = c->bch;
+	struct timeval     *it = &(c->it[ c->ih ]);
+	long long           d;
+	unsigned long long  v;
+
+	d = (long long) (nw->tv_sec - it->tv_sec) * 1000000 + (nw->tv_usec - it->tv_usec);
+	v = (d < 0) ? 0 : (unsigned long long) d;
+	b->hg[ t_htp_bch_bucket( v ) ]++;
+	b->lsm += v;
+	if (v > b->lmx)
+		b->lmx = v;
+	b->n++;
+	if (400 <= c->sts)
+		b->nok++;
+	c->ih = (c->ih + 1) % b->pl;
+	c->fl--;
+	c->rn++;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Prepare a connection for (another) response head.
+ * \param   struct t_htp_bcn*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_bch_reset( struct t_htp_bcn *c )
+{
+	c->s.ps    = T_HTP_P_RVR;
+	c->s.po    = 0;
+	c->s.hdn   = 0;
+	c->s.rqFr  = 0;
+	c->s.rqCl  = 0;
+	c->s.rqBl  = 0;
+	c->s.cs    = T_HTP_CK_SZ0;
+	c->s.ck    = 0;
+	c->s.kpAlv = 0;
+	c->sts     = 0;
+	c->hd      = 0;
+}
+
+
+static void t_htp_bch_close( lua_State *L, struct t_htp_bcn *c, int err );
+
+
+/**--------------------------------------------------------------------------
+ * Stop or start observing a benchmark connection for an event.
+ * \detail  If the loop can't observe the connection it gets closed.
+ * \param   L    The lua state.
+ * \param   struct t_htp_bcn*.
+ * \param   enum t_ael_t  T_AEL_RD or T_AEL_WR.
+ * \param   int   boolean; observe?
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_bch_watch( lua_State *L, struct t_htp_bcn *c, enum t_ael_t t, int on )
+{
+	if (NULL != c->sck &&
+	    0 != t_ael_watch( c->bch->ael, c->sck->fd, t, on ))
+		t_htp_bch_close( L, c, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Close a benchmark connection and take it off the loop.
+ * \detail  Requests in flight are lost.  Safe to be called more than once.
+ * \param   L    The lua state.
+ * \param   struct t_htp_bcn*.
+ * \param   int  boolean; count as an error?
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_bch_close( lua_State *L, struct t_htp_bcn *c, int err )
+{
+	if (NULL == c->sck)
+		return;
+	// t_net_close() takes the socket out of the loop as well
+	t_net_close( L, c->sck );
+	c->sck  = NULL;
+	c->cnn  = 0;
+	c->qn   = 0;
+	c->qo   = 0;
+	c->fl   = 0;
+	c->sn   = 0;
+	c->rn   = 0;
+	c->ih   = 0;
+	c->read = 0;
+	c->b    = c->buf;
+	t_htp_bch_reset( c );
+	if (err && c->bch->run)
+		c->bch->err++;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Queue requests on a connection as the load model allows.
+ * \detail  In a closed loop the connection gets filled up to the pipeline
+ *          depth.  In an open loop each request due gets queued, up to the
+ *          pipeline depth; the rest stays due and its latency keeps growing.
+ * \param   struct t_htp_bcn*.
+ * \param   struct timeval*  current time.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_bch_fill( struct t_htp_bcn *c, struct timeval *nw )
+{
+	struct t_htp_bch *b = c->bch;
+
+	while (NULL != c->sck && c->fl < b->pl && (0 == b->rpc || c->sn < b->rpc))
+	{
+		if (b->rate > 0)
+		{
+			if (t_tim_cmp( &(c->due), nw, > ))
+				break;
+			c->it[ (c->ih + c->fl) % b->pl ] = c->due;
+			t_tim_add( &(c->due), &(b->iv), &(c->due) );
+		}
+		else
+			c->it[ (c->ih + c->fl) % b->pl ] = *nw;
+		c->fl++;
+		c->qn++;
+		c->sn++;
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Send the queued requests of a connection.
+ * \detail  Gathers up to T_HTP_CON_IOV copies of the request into a single
+ *          call; whatever doesn't go out waits for the socket to become
+ *          writable.
+ * \param   L    The lua state.
+ * \param   struct t_htp_bcn*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_bch_flush( lua_State *L, struct t_htp_bcn *c )
+{
+	struct t_htp_bch *b = c->bch;
+	struct iovec      iov[ T_HTP_CON_IOV ];
+	int               n = 0;
+	int               snt;
+
+	if (NULL == c->sck || c->cnn)
+		return;
+	while (n < c->qn && n < T_HTP_CON_IOV)
+	{
+		iov[ n ].iov_base = (char *) b->rq + ((0 == n) ? c->qo : 0);
+		iov[ n ].iov_len  = b->rql - ((0 == n) ? c->qo : 0);
+		n++;
+	}
+	if (0 == n)
+	{
+		t_htp_bch_watch( L, c, T_AEL_WR, 0 );
+		return;
+	}
+	if (-1 == (snt = t_net_tcp_sendv( L, c->sck, iov, n )))
+	{
+		t_htp_bch_close( L, c, 1 );
+		return;
+	}
+	while (c->qn > 0 && (size_t) snt >= b->rql - c->qo)
+	{
+		snt  -= b->rql - c->qo;
+		c->qo = 0;
+		c->qn--;
+	}
+	if (c->qn > 0)
+		c->qo += snt;
+	t_htp_bch_watch( L, c, T_AEL_WR, c->qn > 0 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Process the data in the receive buffer of a benchmark connection.
+ * \detail  Response bodies get skipped without being copied.  A response
+ *          without a length is counted as malformed, since it would end the
+ *          connection anyways.
+ * \param   struct t_htp_bcn*.
+ * \param   struct timeval*  time the data arrived.
+ * \return  int  0 to carry on, 1 if the server ends the connection, -1 if a
+ *               response was malformed.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_bch_process( struct t_htp_bcn *c, struct timeval *nw )
+{
+	size_t            k;          ///< bytes left to process
+	long              ck;         ///< bytes of chunk framing
+	long long         l;          ///< body bytes left in chunk or response
+	const char       *st;
+
+	while (c->fl > 0)
+	{
+		k = c->buf + c->read - c->b;
+		if (! c->hd)
+		{
+			switch (t_htp_pHead( &(c->s), c->b, k ))
+			{
+				case  0:
+					return 0;
+				case -1:
+					return -1;
+				default:
+					st     = c->b + c->s.uo;
+					c->sts = (st[ 0 ]-'0')*100 + (st[ 1 ]-'0')*10 + (st[ 2 ]-'0');
+					c->b  += c->s.po;
+					if (c->sts < 200)         // interim response
+					{
+						t_htp_bch_reset( c );
+						continue;
+					}
+					if (204 == c->sts || 304 == c->sts)
+					{
+						c->s.rqFr = 0;
+						c->s.rqCl = 0;
+					}
+					else if (0 == c->s.rqFr)
+						return -1;
+					c->hd = 1;
+					k     = c->buf + c->read - c->b;
+			}
+		}
+		while (k > 0 && ! T_HTP_STR_BODYDONE( &(c->s) ))
+		{
+			if (2 == c->s.rqFr && T_HTP_CK_DATA != c->s.cs)
+			{
+				if ((ck = t_htp_pChunk( &(c->s), c->b, k )) < 0)
+					return -1;
+				c->b += ck;
+				k    -= ck;
+				continue;
+			}
+			l = (2 == c->s.rqFr) ? c->s.ck : c->s.rqCl - c->s.rqBl;
+			if ((long long) k > l)
+				k = (size_t) l;
+			c->b      += k;
+			c->s.rqBl += k;
+			if (2 == c->s.rqFr && 0 == (c->s.ck -= k))
+				c->s.cs = T_HTP_CK_DCR;
+			k = c->buf + c->read - c->b;
+		}
+		if (! T_HTP_STR_BODYDONE( &(c->s) ))
+			return 0;
+		t_htp_bch_record( c, nw );
+		if (! c->s.kpAlv)
+			return 1;
+		t_htp_bch_reset( c );
+	}
+	return 0;
+}
+
+
+static int t_htp_bch_connect( lua_State *L, struct t_htp_bcn *c, struct timeval *nw );
+
+
+/**--------------------------------------------------------------------------
+ * Handle incoming data on a benchmark connection.
+ * Native T.Loop handler; the benchmark is on top of the stack.  All responses
+ * in one read share a single clock reading.
+ * \param   L     lua Virtual Machine.
+ * \param   void* struct t_htp_bcn.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_bch_rcv( lua_State *L, void *ud )
+{
+	struct t_htp_bcn *c = (struct t_htp_bcn *) ud;
+	struct t_htp_bch *b = c->bch;
+	struct timeval    nw;
+	ssize_t           rcvd;
+	size_t            k;
+	int               r;
+
+	if (NULL == c->sck)
+		return 0;
+	if (c->read == T_HTP_BCH_BSZ)
+	{
+		t_htp_bch_close( L, c, 1 );         // response head too large
+		return 0;
+	}
+	rcvd = recv( c->sck->fd, c->buf + c->read, T_HTP_BCH_BSZ - c->read, 0 );
+	if (-1 == rcvd)
+	{
+		if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+			t_htp_bch_close( L, c, 1 );
+		return 0;
+	}
+	if (0 == rcvd)
+	{
+		t_htp_bch_close( L, c, c->fl > 0 );
+		return 0;
+	}
+	t_tim_mono( &nw );
+	c->read += rcvd;
+	if (b->run)
+		b->byt += rcvd;
+	r = t_htp_bch_process( c, &nw );
+	if (0 != r || (b->rpc > 0 && c->rn >= b->rpc))
+	{
+		t_htp_bch_close( L, c, -1 == r );
+		if (b->run && -1 != r)
+			t_htp_bch_connect( L, c, &nw );   // churn; errors get retried by the tick
+		return 0;
+	}
+	// keep what is left of an incomplete response at the start of the buffer
+	k = c->buf + c->read - c->b;
+	if (k > 0 && c->b != c->buf)
+		memmove( c->buf, c->b, k );
+	c->read = k;
+	c->b    = c->buf;
+	if (b->run)
+	{
+		t_htp_bch_fill( c, &nw );
+		t_htp_bch_flush( L, c );
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Send queued requests over a benchmark connection.
+ * Native T.Loop handler; the benchmark is on top of the stack.  The first
+ * write event also completes the non-blocking connect().
+ * \param   L     lua Virtual Machine.
+ * \param   void* struct t_htp_bcn.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_bch_snd( lua_State *L, void *ud )
+{
+	struct t_htp_bcn *c  = (struct t_htp_bcn *) ud;
+	int               e  = 0;
+	socklen_t         el = sizeof( e );
+
+	if (NULL == c->sck)
+		return 0;
+	if (c->cnn)
+	{
+		if (-1 == getsockopt( c->sck->fd, SOL_SOCKET, SO_ERROR, &e, &el ))
+			e = errno;
+		if (0 != e)
+		{
+			t_htp_bch_close( L, c, 1 );
+			return 0;
+		}
+		c->cnn = 0;
+	}
+	t_htp_bch_flush( L, c );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Open a connection to the server and queue its first requests.
+ * \detail  The connection is owned by the benchmark, which stays referenced
+ *          by the loop while it is running.  Failures get counted and the
+ *          connection stays closed until the next tick.
+ * \param   L    The lua state.
+ * \param   struct t_htp_bcn*  closed connection.
+ * \param   struct timeval*  current time.
+ * \return  int  0 on success, -1 on failure.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_bch_connect( lua_State *L, struct t_htp_bcn *c, struct timeval *nw )
+{
+	struct t_htp_bch *b   = c->bch;
+	struct t_ael     *ael = b->ael;
+	struct t_net     *s;
+	int               one = 1;
+
+	b->cnc++;
+	if (NULL == (s = t_net_create_ud( L, T_NET_TCP, 1 )))
+	{
+		lua_pop( L, 1 );
+		b->err++;
+		return -1;
+	}
+	fcntl( s->fd, F_SETFL, fcntl( s->fd, F_GETFL, 0 ) | O_NONBLOCK );
+	setsockopt( s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+	if (-1 == connect( s->fd, (struct sockaddr *) &(b->adr), sizeof( b->adr ) ) &&
+	    EINPROGRESS != errno)
+	{
+		t_net_close( L, s );
+		lua_pop( L, 1 );
+		b->err++;
+		return -1;
+	}
+
+	lua_rawgeti( L, LUA_REGISTRYINDEX, b->bR );  //S: ...,sck,bch
+	t_ael_addhandle_cf( L, ael, -2, T_AEL_RD, t_htp_bch_rcv, c );
+	lua_rawgeti( L, LUA_REGISTRYINDEX, b->bR );
+	t_ael_sethandler_cf( L, ael, s->fd, T_AEL_WR, t_htp_bch_snd, c );
+	lua_pop( L, 1 );                            // the socket is referenced by the loop
+	c->sck = s;
+	c->cnn = 1;
+	t_htp_bch_watch( L, c, T_AEL_WR, 1 );
+	t_htp_bch_fill( c, nw );
+	return (NULL == c->sck) ? -1 : 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Push the results of the benchmark as a table onto the stack.
+ * \detail  Latencies are in milliseconds.
+ * \param   L    The lua state.
+ * \param   struct t_htp_bch*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_bch_pushstats( lua_State *L, struct t_htp_bch *b )
+{
+	struct timeval nw;
+	double         s;
+
+	if (b->run)
+		t_tim_mono( &nw );
+	else
+		nw = b->t1;
+	s = (double) (nw.tv_sec - b->t0.tv_sec) + (nw.tv_usec - b->t0.tv_usec) / 1000000.0;
+
+	lua_createtable( L, 0, 14 );
+	lua_pushinteger( L, b->n );
+	lua_setfield( L, -2, "requests" );
+	lua_pushinteger( L, b->nok );
+	lua_setfield( L, -2, "failed" );
+	lua_pushinteger( L, b->err );
+	lua_setfield( L, -2, "errors" );
+	lua_pushinteger( L, b->cnc );
+	lua_setfield( L, -2, "connects" );
+	lua_pushinteger( L, b->byt );
+	lua_setfield( L, -2, "bytes" );
+	lua_pushnumber( L, s );
+	lua_setfield( L, -2, "seconds" );
+	lua_pushnumber( L, (s > 0) ? b->n / s : 0 );
+	lua_setfield( L, -2, "rps" );
+	lua_pushnumber( L, (b->n > 0) ? b->lsm / (double) b->n / 1000.0 : 0 );
+	lua_setfield( L, -2, "mean" );
+	lua_pushnumber( L, (b->n > 0) ? t_htp_bch_quantile( b, 0.5 ) / 1000.0 : 0 );
+	lua_setfield( L, -2, "p50" );
+	lua_pushnumber( L, (b->n > 0) ? t_htp_bch_quantile( b, 0.9 ) / 1000.0 : 0 );
+	lua_setfield( L, -2, "p90" );
+	lua_pushnumber( L, (b->n > 0) ? t_htp_bch_quantile( b, 0.99 ) / 1000.0 : 0 );
+	lua_setfield( L, -2, "p99" );
+	lua_pushnumber( L, (b->n > 0) ? t_htp_bch_quantile( b, 0.999 ) / 1000.0 : 0 );
+	lua_setfield( L, -2, "p999" );
+	lua_pushnumber( L, b->lmx / 1000.0 );
+	lua_setfield( L, -2, "max" );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Drive the benchmark.
+ * Native T.Loop timer; the benchmark is on top of the stack.  Issues the
+ * requests which came due in an open loop, reopens connections which failed
+ * and ends the run once its time is up.  Then all connections get closed
+ * and the done handler gets called with the benchmark and its results.
+ * \param   L     lua Virtual Machine.
+ * \param   void* struct t_htp_bch.
+ * \return  int   1 to keep the timer running, else 0.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_bch_tick( lua_State *L, void *ud )
+{
+	struct t_htp_bch *b = (struct t_htp_bch *) ud;
+	struct t_htp_bcn *c;
+	struct timeval    nw;
+	int               i;
+
+	t_tim_mono( &nw );
+	if (t_tim_cmp( &nw, &(b->t1), < ))
+	{
+		for (i=0; i < b->cn; i++)
+		{
+			c = &(b->cs[ i ]);
+			if (NULL == c->sck)
+				t_htp_bch_connect( L, c, &nw );
+			else if (b->rate > 0)
+				t_htp_bch_fill( c, &nw );
+			t_htp_bch_flush( L, c );
+		}
+		return 1;
+	}
+	b->run = 0;
+	b->t1  = nw;
+	for (i=0; i < b->cn; i++)
+		t_htp_bch_close( L, &(b->cs[ i ]), 0 );
+	lua_rawgeti( L, LUA_REGISTRYINDEX, b->fR );
+	lua_rawgeti( L, LUA_REGISTRYINDEX, b->bR );
+	luaL_unref( L, LUA_REGISTRYINDEX, b->fR );
+	luaL_unref( L, LUA_REGISTRYINDEX, b->bR );
+	b->fR = LUA_NOREF;
+	b->bR = LUA_NOREF;
+	t_htp_bch_pushstats( L, b );
+	lua_call( L, 2, 0 );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Start the benchmark.
+ * \detail  Opens all connections right away; in an open loop the first
+ *          requests of the connections are spread over one interval.  Once
+ *          the duration has passed the done handler gets called with the
+ *          benchmark and the results (see Bench:stats()).
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Bench userdata instance.
+ * \lparam  func   done handler.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_bch_run( lua_State *L )
+{
+	struct t_htp_bch *b = t_htp_bch_check_ud( L, 1, 1 );
+	long long         us;
+	int               i;
+
+	luaL_checktype( L, 2, LUA_TFUNCTION );
+	luaL_argcheck( L, ! b->run, 1, "benchmark is running already" );
+	lua_settop( L, 2 );
+	b->fR  = luaL_ref( L, LUA_REGISTRYINDEX );
+	lua_pushvalue( L, 1 );
+	b->bR  = luaL_ref( L, LUA_REGISTRYINDEX );
+	b->n   = 0;
+	b->nok = 0;
+	b->err = 0;
+	b->cnc = 0;
+	b->byt = 0;
+	b->lsm = 0;
+	b->lmx = 0;
+	memset( b->hg, 0, T_HTP_BCH_HGN * sizeof( unsigned long long ) );
+
+	// each connection gets 1/cn of the rate
+	us = (b->rate > 0) ? (long long) (1000000.0 * b->cn / b->rate) : 0;
+	b->iv.tv_sec  = us / 1000000;
+	b->iv.tv_usec = us % 1000000;
+	b->run = 1;
+	t_tim_mono( &(b->t0) );
+	b->t1.tv_sec  = b->t0.tv_sec  + b->dur / 1000;
+	b->t1.tv_usec = b->t0.tv_usec + (b->dur % 1000) * 1000;
+	if (b->t1.tv_usec >= 1000000)
+	{
+		b->t1.tv_sec++;
+		b->t1.tv_usec -= 1000000;
+	}
+	for (i=0; i < b->cn; i++)
+	{
+		us = (long long) b->t0.tv_usec + (b->iv.tv_sec * 1000000LL + b->iv.tv_usec) * i / b->cn;
+		b->cs[ i ].due.tv_sec  = b->t0.tv_sec + us / 1000000;
+		b->cs[ i ].due.tv_usec = us % 1000000;
+		t_htp_bch_reset( &(b->cs[ i ]) );
+		b->cs[ i ].read = 0;
+		b->cs[ i ].b    = b->cs[ i ].buf;
+		t_htp_bch_connect( L, &(b->cs[ i ]), &(b->t0) );
+	}
+	lua_pushvalue( L, 1 );
+	t_ael_addtimer_cf( L, b->ael, &(b->tk), t_htp_bch_tick, b );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Get the results of the current or the last run.
+ * \detail  requests, failed (status >= 400), errors (connection errors and
+ *          malformed responses), connects, bytes, seconds, rps and the
+ *          latencies mean, p50, p90, p99, p999 and max in milliseconds.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Bench userdata instance.
+ * \lreturn table  results.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_bch_stats( lua_State *L )
+{
+	t_htp_bch_pushstats( L, t_htp_bch_check_ud( L, 1, 1 ) );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __tostring (print) representation of a T.Http.Bench instance.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Bench userdata instance.
+ * \lreturn string formatted string representing T.Http.Bench.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_bch__tostring( lua_State *L )
+{
+	struct t_htp_bch *b = t_htp_bch_check_ud( L, 1, 1 );
+	lua_pushfstring( L, T_HTP_BCH_TYPE"{%d*%d}: %p", b->cn, b->pl, b );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Bench instance.
+ * \detail  A running benchmark is referenced by the loop, so there are no
+ *          open connections left by now.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Bench userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_bch__gc( lua_State *L )
+{
+	struct t_htp_bch *b = t_htp_bch_check_ud( L, 1, 1 );
+	int               i;
+
+	if (NULL != b->cs)
+	{
+		for (i=0; i < b->cn; i++)
+		{
+			free( b->cs[ i ].it );
+			free( b->cs[ i ].buf );
+		}
+		free( b->cs );
+		b->cs = NULL;
+	}
+	free( b->hg );
+	b->hg = NULL;
+	luaL_unref( L, LUA_REGISTRYINDEX, b->lR );
+	luaL_unref( L, LUA_REGISTRYINDEX, b->qR );
+	luaL_unref( L, LUA_REGISTRYINDEX, b->fR );
+	b->lR = LUA_NOREF;
+	b->qR = LUA_NOREF;
+	b->fR = LUA_NOREF;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Class metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_bch_fm [] = {
+	  { "__call",      lt_htp_bch__Call }
+	, { NULL,          NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * Class functions library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_bch_cf [] = {
+	  { NULL,  NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * Objects metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_bch_m [] = {
+	  { "__tostring",  lt_htp_bch__tostring }
+	, { "__gc",        lt_htp_bch__gc }
+	, { "run",         lt_htp_bch_run }
+	, { "stats",       lt_htp_bch_stats }
+	, { NULL,    NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * Pushes this library onto the stack
+ *          - creates Metatable with functions
+ *          - creates metatable with methods
+ * \param   L      The lua state.
+ * \lreturn table  the library
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+LUAMOD_API int
+luaopen_t_htp_bch( lua_State *L )
+{
+	// T.Http.Bench instance metatable
+	luaL_newmetatable( L, T_HTP_BCH_TYPE );
+	luaL_setfuncs( L, t_htp_bch_m, 0 );
+	lua_setfield( L, -1, "__index" );
+
+	// T.Http.Bench class
+	luaL_newlib( L, t_htp_bch_cf );
+	luaL_newlib( L, t_htp_bch_fm );
+	lua_setmetatable( L, -2 );
+	return 1;
+}
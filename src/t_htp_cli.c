@@ -0,0 +1,1264 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_htp_cli.c
+ * \brief     OOP wrapper for an asynchronous HTTP/1.1 Client (T.Http.Client)
+ * \detail    Requests go to a host:port over a pool of keep-alive
+ *            connections.  A request takes an idle connection of the host,
+ *            else a new one until the client limit is reached.  Beyond that
+ *            idempotent requests get pipelined behind the requests on the
+ *            least busy connection, others wait for a connection to become
+ *            idle.
+ *            Responses get parsed with the same resumable parser the server
+ *            uses and their bodies get streamed to the body handler.
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+
+#include <stdlib.h>               // malloc, free
+#include <string.h>               // strcmp, strerror
+#include <limits.h>               // LLONG_MAX
+#include <errno.h>                // errno, EINPROGRESS, EAGAIN
+#include <fcntl.h>                // fcntl
+#include <arpa/inet.h>            // inet_pton, htons
+#include <netinet/tcp.h>          // TCP_NODELAY
+#include <sys/socket.h>           // connect, recv
+#include <sys/uio.h>              // struct iovec
+
+#include "t.h"
+#include "t_htp.h"
+
+
+static void t_htp_cli_close   ( lua_State *L, struct t_htp_ccn *cc, const char *msg );
+static void t_htp_cli_dispatch( lua_State *L, struct t_htp_rsp *r );
+static void t_htp_cli_drain   ( lua_State *L, struct t_htp_hst *h );
+
+
+/**--------------------------------------------------------------------------
+ * Construct a T.Http.Client.
+ * \param   L      Lua state.
+ * \lparam  CLASS  table Http.Client.
+ * \lparam  ud     T.Loop userdata instance for the Client.
+ * \lparam  int    most connections per host (optional).
+ * \lreturn ud     T.Http.Client userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_cli__Call( lua_State *L )
+{
+	struct t_ael     *l  = t_ael_check_ud( L, 2, 1 );
+	lua_Integer       mx = luaL_optinteger( L, 3, T_HTP_CLI_CMX );
+	struct t_htp_cli *c;
+
+	luaL_argcheck( L, mx > 0 && mx <= INT_MAX, 3, "connections per host must be positive" );
+	c      = t_htp_cli_create_ud( L );
+	c->ael = l;
+	c->mx  = (int) mx;
+	lua_pushvalue( L, 2 );
+	c->lR  = luaL_ref( L, LUA_REGISTRYINDEX );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Create a t_htp_cli and push to LuaStack.
+ * \detail  The hosts the client talks to are kept in its uservalue table.
+ * \param   L  The lua state.
+ *
+ * \return  struct t_htp_cli*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_cli
+*t_htp_cli_create_ud( lua_State *L )
+{
+	struct t_htp_cli *c;
+
+	c = (struct t_htp_cli *) lua_newuserdata( L, sizeof( struct t_htp_cli ) );
+	c->ael = NULL;
+	c->lR  = LUA_NOREF;
+	c->mx  = T_HTP_CLI_CMX;
+	lua_newtable( L );
+	lua_setuservalue( L, -2 );
+
+	luaL_getmetatable( L, T_HTP_CLI_TYPE );
+	lua_setmetatable( L, -2 );
+	return c;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if the item on stack position pos is an t_htp_cli struct and return it
+ * \param  L    the Lua State
+ * \param  pos      position on the stack
+ *
+ * \return  struct t_htp_cli*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_cli
+*t_htp_cli_check_ud( lua_State *L, int pos, int check )
+{
+	void *ud = luaL_testudata( L, pos, T_HTP_CLI_TYPE );
+	luaL_argcheck( L, (ud != NULL || !check), pos, "`"T_HTP_CLI_TYPE"` expected" );
+	return (NULL==ud) ? NULL : (struct t_htp_cli *) ud;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if the item on stack position pos is an t_htp_rsp struct and return it
+ * \param  L    the Lua State
+ * \param  pos      position on the stack
+ *
+ * \return  struct t_htp_rsp*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_rsp
+*t_htp_rsp_check_ud( lua_State *L, int pos, int check )
+{
+	void *ud = luaL_testudata( L, pos, T_HTP_RSP_TYPE );
+	luaL_argcheck( L, (ud != NULL || !check), pos, "`"T_HTP_RSP_TYPE"` expected" );
+	return (NULL==ud) ? NULL : (struct t_htp_rsp *) ud;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Get the host entry of a client and push it onto the stack.
+ * \detail  Created on first use; the entry keeps the client alive as its
+ *          uservalue, so a client stays around as long as it has connections.
+ * \param   L    The lua state.
+ * \param   int  stack position of the client.
+ * \param   const char*  IPv4 address.
+ * \param   int  port.
+ * \return  struct t_htp_hst*.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_hst
+*t_htp_cli_host( lua_State *L, int ci, const char *ip, int port )
+{
+	struct t_htp_hst *h;
+
+	lua_getuservalue( L, ci );
+	lua_pushfstring( L, "%s:%d", ip, port );
+	lua_pushvalue( L, -1 );
+	if (LUA_TNIL != lua_rawget( L, -3 ))
+	{
+		h = (struct t_htp_hst *) lua_touserdata( L, -1 );
+		lua_replace( L, -3 );
+		lua_pop( L, 1 );
+		return h;
+	}
+	lua_pop( L, 1 );
+	h = (struct t_htp_hst *) lua_newuserdata( L, sizeof( struct t_htp_hst ) );
+	memset( h, 0, sizeof( struct t_htp_hst ) );
+	h->cli = t_htp_cli_check_ud( L, ci, 1 );
+	h->adr.sin_family = AF_INET;
+	h->adr.sin_port   = htons( port );
+	if (1 != inet_pton( AF_INET, ip, &(h->adr.sin_addr) ))
+		t_push_error( L, "Illegal IPv4 address `%s`", ip );
+	lua_pushvalue( L, ci );
+	lua_setuservalue( L, -2 );
+	lua_pushvalue( L, -1 );
+	lua_insert( L, -4 );             //S: h,tbl,key,h
+	lua_rawset( L, -3 );
+	lua_pop( L, 1 );
+	return h;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Stop or start observing a client connection for an event.
+ * \detail  If the loop can't observe the connection it gets closed.
+ * \param   L    The lua state.
+ * \param   struct t_htp_ccn*.
+ * \param   enum t_ael_t  T_AEL_RD or T_AEL_WR.
+ * \param   int   boolean; observe?
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_watch( lua_State *L, struct t_htp_ccn *cc, enum t_ael_t t, int on )
+{
+	if (NULL != cc->sck &&
+	    0 != t_ael_watch( cc->hst->cli->ael, cc->sck->fd, t, on ))
+		t_htp_cli_close( L, cc, "Failed to observe connection" );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Prepare a response for (another) response head.
+ * \param   struct t_htp_rsp*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_reset( struct t_htp_rsp *r )
+{
+	r->s.ps    = T_HTP_P_RVR;
+	r->s.po    = 0;
+	r->s.hdn   = 0;
+	r->s.rqFr  = 0;
+	r->s.rqCl  = 0;
+	r->s.rqBl  = 0;
+	r->s.cs    = T_HTP_CK_SZ0;
+	r->s.ck    = 0;
+	r->s.kpAlv = 0;
+	r->sts     = 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Report a failed request to Lua and drop it.
+ * \detail  Without a response head the response handler gets called with nil
+ *          and the message, else the body handler with the response, nil and
+ *          the message.
+ * \param   L    The lua state.
+ * \param   struct t_htp_rsp*  request taken off its connection.
+ * \param   const char*  reason.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_fail( lua_State *L, struct t_htp_rsp *r, const char *msg )
+{
+	lua_rawgeti( L, LUA_REGISTRYINDEX, r->rR );   // anchors r during the call
+	luaL_unref( L, LUA_REGISTRYINDEX, r->rR );
+	r->rR = LUA_NOREF;
+	if (NULL == r->s.hd)
+	{
+		lua_rawgeti( L, LUA_REGISTRYINDEX, r->fR );
+		lua_pushnil( L );
+		lua_pushstring( L, msg );
+		lua_call( L, 2, 0 );
+	}
+	else if (LUA_NOREF != r->s.bR)
+	{
+		lua_rawgeti( L, LUA_REGISTRYINDEX, r->s.bR );
+		lua_pushvalue( L, -2 );
+		lua_pushnil( L );
+		lua_pushstring( L, msg );
+		lua_call( L, 3, 0 );
+	}
+	lua_pop( L, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Close a client connection and take it off the loop.
+ * \detail  Requests still queued fail.  On a connection which delivered
+ *          responses before the server may have closed it while idle, so
+ *          idempotent requests which got no response yet get sent once more
+ *          on another connection.  Safe to be called more than once.
+ * \param   L    The lua state.
+ * \param   struct t_htp_ccn*.
+ * \param   const char*  reason reported to the queued requests.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_close( lua_State *L, struct t_htp_ccn *cc, const char *msg )
+{
+	struct t_htp_hst *h   = cc->hst;
+	struct t_htp_rsp *r;
+	struct t_htp_rsp *q;
+	int               n   = lua_gettop( L );
+
+	if (NULL == cc->sck)
+		return;
+	// the connection stays alive
+	t_ael_pushhandler( L, h->cli->ael, cc->sck->fd, T_AEL_RD );
+	lua_getuservalue( L, -1 );                    // its host; S: ...,cc,h
+
+	if (NULL == cc->hpv)
+		h->ch = cc->hnx;
+	else
+		cc->hpv->hnx = cc->hnx;
+	if (NULL != cc->hnx)
+		cc->hnx->hpv = cc->hpv;
+	cc->hnx = NULL;
+	cc->hpv = NULL;
+	h->n--;
+
+	// t_net_close() takes the socket out of the loop as well
+	t_net_close( L, cc->sck );
+	cc->sck = NULL;
+	free( cc->buf );
+	cc->buf  = NULL;
+	cc->bsz  = 0;
+	cc->read = 0;
+	cc->b    = NULL;
+
+	q      = cc->qh;
+	cc->qh = NULL;
+	cc->qt = NULL;
+	cc->qs = NULL;
+	cc->qn = 0;
+	while (NULL != (r = q))
+	{
+		q      = r->nxt;
+		r->nxt = NULL;
+		r->cc  = NULL;
+		if (cc->use > 0 && r->rty && NULL == r->s.hd)
+		{
+			r->rty = 0;
+			t_htp_cli_reset( r );
+			lua_pushvalue( L, n+2 );
+			t_htp_cli_dispatch( L, r );
+		}
+		else
+			t_htp_cli_fail( L, r, msg );
+	}
+	// a slot for another connection got free
+	lua_pushvalue( L, n+2 );
+	t_htp_cli_drain( L, h );
+	lua_settop( L, n );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Hand a piece of the response body to the body handler.
+ * \detail  The handler gets called with the response and the data; at the
+ *          end of the body with the response only.  If it returns false
+ *          reading from the connection pauses until Response:resume().
+ * \param  L            lua Virtual Machine.
+ * \param  struct t_htp_rsp*.
+ * \param  int          stack position of the response.
+ * \param  const char*  data; NULL at the end of the body.
+ * \param  size_t       length of data.
+ * \return void.
+ *  -------------------------------------------------------------------------*/
+static void
+t_htp_cli_body( lua_State *L, struct t_htp_rsp *r, int ri, const char *b, size_t n )
+{
+	if (LUA_NOREF == r->s.bR)
+		return;
+	lua_rawgeti( L, LUA_REGISTRYINDEX, r->s.bR );
+	lua_pushvalue( L, ri );
+	if (NULL == b)
+		lua_call( L, 1, 1 );
+	else
+	{
+		lua_pushlstring( L, b, n );
+		lua_call( L, 2, 1 );
+	}
+	if (lua_isboolean( L, -1 ) && ! lua_toboolean( L, -1 ) && NULL != r->cc)
+	{
+		r->cc->psd = 1;
+		t_htp_cli_watch( L, r->cc, T_AEL_RD, 0 );
+	}
+	lua_pop( L, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Take a completely received response off its connection.
+ * \param   L    The lua state.
+ * \param   struct t_htp_ccn*.
+ * \param   struct t_htp_rsp*  head of the connections queue.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_done( lua_State *L, struct t_htp_ccn *cc, struct t_htp_rsp *r )
+{
+	// the server may answer before it got the whole request
+	int kp = r->s.kpAlv && cc->qs != r;
+
+	cc->qh = r->nxt;
+	if (NULL == cc->qh)
+		cc->qt = NULL;
+	if (cc->qs == r)
+		cc->qs = r->nxt;
+	cc->qn--;
+	cc->use++;
+	r->nxt = NULL;
+	r->cc  = NULL;
+	luaL_unref( L, LUA_REGISTRYINDEX, r->qR );
+	luaL_unref( L, LUA_REGISTRYINDEX, r->rR );
+	r->qR  = LUA_NOREF;
+	r->rR  = LUA_NOREF;
+	if (! kp)
+		t_htp_cli_close( L, cc, "Connection closed by server" );
+	else
+	{
+		if (cc->psd)
+		{
+			// only the response could resume; the next one starts unpaused
+			cc->psd = 0;
+			t_htp_cli_watch( L, cc, T_AEL_RD, 1 );
+		}
+		if (NULL != cc->sck && 0 == cc->qn && NULL != cc->hst->wh)
+		{
+			t_ael_pushhandler( L, cc->hst->cli->ael, cc->sck->fd, T_AEL_RD );
+			lua_getuservalue( L, -1 );
+			lua_remove( L, -2 );
+			t_htp_cli_drain( L, cc->hst );
+		}
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Evaluate a complete response head.
+ * \detail  Interim (1xx) responses get dropped.  Responses to HEAD requests
+ *          and 204/304 have no body; without Content-Length or chunked
+ *          encoding the body ends when the server closes the connection.
+ * \param   L    The lua state.
+ * \param   struct t_htp_ccn*.
+ * \param   struct t_htp_rsp*.
+ * \return  int  1 if it was an interim response, else 0.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_cli_head( lua_State *L, struct t_htp_ccn *cc, struct t_htp_rsp *r )
+{
+	const char *c = cc->b + r->s.uo;
+
+	r->sts = (c[ 0 ]-'0')*100 + (c[ 1 ]-'0')*10 + (c[ 2 ]-'0');
+	if (r->sts < 200 && 101 != r->sts)
+	{
+		cc->b += r->s.po;
+		t_htp_cli_reset( r );
+		return 1;
+	}
+	lua_pushlstring( L, cc->b, r->s.po );
+	r->s.hd  = lua_tostring( L, -1 );
+	r->s.hR  = luaL_ref( L, LUA_REGISTRYINDEX );
+	cc->b   += r->s.po;
+	if (r->nb || 101 == r->sts || 204 == r->sts || 304 == r->sts)
+	{
+		r->s.rqFr = 0;
+		r->s.rqCl = 0;
+	}
+	else if (0 == r->s.rqFr)
+	{
+		r->s.rqCl  = LLONG_MAX;
+		r->s.kpAlv = 0;
+	}
+	if (101 == r->sts)              // the connection isn't HTTP anymore
+		r->s.kpAlv = 0;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Process the data in the receive buffer of a client connection.
+ * \detail  Hands the data to the requests in the order they were sent;
+ *          pipelined responses get processed as long as there is data.
+ *          Stops early if the body handler paused reading.
+ * \param   L    The lua state.
+ * \param   struct t_htp_ccn*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_process( lua_State *L, struct t_htp_ccn *cc )
+{
+	struct t_htp_rsp *r;
+	int               n = lua_gettop( L );
+	size_t            k;          ///< bytes left to process
+	long              ck;         ///< bytes of chunk framing
+	long long         l;          ///< body bytes left in chunk or response
+
+	while (NULL != cc->sck && ! cc->psd && NULL != (r = cc->qh))
+	{
+		lua_settop( L, n );
+		lua_rawgeti( L, LUA_REGISTRYINDEX, r->rR );   // S: ...,rsp
+		k = cc->buf + cc->read - cc->b;
+		if (NULL == r->s.hd)
+		{
+			switch (t_htp_pHead( &(r->s), cc->b, k ))
+			{
+				case  0:
+					lua_settop( L, n );     // wait for the rest of the head
+					return;
+				case -1:
+					t_htp_cli_close( L, cc, "Malformed response" );
+					lua_settop( L, n );
+					return;
+				default:
+					if (! t_htp_cli_head( L, cc, r ))
+					{
+						lua_rawgeti( L, LUA_REGISTRYINDEX, r->fR );
+						lua_pushvalue( L, n+1 );
+						lua_call( L, 1, 0 );
+					}
+					continue;
+			}
+		}
+		while (k > 0 && ! cc->psd && ! T_HTP_STR_BODYDONE( &(r->s) ))
+		{
+			if (2 == r->s.rqFr && T_HTP_CK_DATA != r->s.cs)
+			{
+				if ((ck = t_htp_pChunk( &(r->s), cc->b, k )) < 0)
+				{
+					t_htp_cli_close( L, cc, "Malformed response" );
+					lua_settop( L, n );
+					return;
+				}
+				cc->b += ck;
+				k     -= ck;
+				continue;
+			}
+			l = (2 == r->s.rqFr) ? r->s.ck : r->s.rqCl - r->s.rqBl;
+			if ((long long) k > l)
+				k = (size_t) l;
+			t_htp_cli_body( L, r, n+1, cc->b, k );
+			if (NULL == cc->sck)
+				break;
+			cc->b     += k;
+			r->s.rqBl += k;
+			if (2 == r->s.rqFr && 0 == (r->s.ck -= k))
+				r->s.cs = T_HTP_CK_DCR;
+			k = cc->buf + cc->read - cc->b;
+		}
+		if (NULL == cc->sck || ! T_HTP_STR_BODYDONE( &(r->s) ))
+			break;
+		t_htp_cli_body( L, r, n+1, NULL, 0 );
+		t_htp_cli_done( L, cc, r );
+	}
+	lua_settop( L, n );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Handle incoming data on a client connection.
+ * Native T.Loop handler; the connection is on top of the stack.
+ * \param   L     lua Virtual Machine.
+ * \param   void* struct t_htp_ccn.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_cli_rcv( lua_State *L, void *ud )
+{
+	struct t_htp_ccn *cc = (struct t_htp_ccn *) ud;
+	struct t_htp_rsp *r;
+	ssize_t           rcvd;
+
+	if (NULL == cc->sck)
+		return 0;
+	// paused while the event was pending already
+	if (cc->psd)
+	{
+		t_htp_cli_watch( L, cc, T_AEL_RD, 0 );
+		return 0;
+	}
+	if (0 != t_htp_getbuffer( &cc->buf, &cc->bsz, &cc->read, &cc->b, NULL, NULL ))
+	{
+		t_htp_cli_close( L, cc, "Response head too large" );
+		return 0;
+	}
+	rcvd = recv( cc->sck->fd, cc->buf + cc->read, cc->bsz - cc->read, 0 );
+	if (-1 == rcvd)
+	{
+		if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+			t_htp_cli_close( L, cc, strerror( errno ) );
+		return 0;
+	}
+	if (0 == rcvd)
+	{
+		// a body without length ends here
+		if (NULL != (r = cc->qh) && NULL != r->s.hd && LLONG_MAX == r->s.rqCl)
+		{
+			lua_rawgeti( L, LUA_REGISTRYINDEX, r->rR );
+			t_htp_cli_body( L, r, lua_gettop( L ), NULL, 0 );
+			t_htp_cli_done( L, cc, r );
+		}
+		t_htp_cli_close( L, cc, "Connection closed by server" );
+		return 0;
+	}
+	cc->read += rcvd;
+	t_htp_cli_process( L, cc );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Send queued requests over a client connection.
+ * Native T.Loop handler; the connection is on top of the stack.  The first
+ * write event also completes the non-blocking connect().  Gathers the queued
+ * requests and sends them with a single call.
+ * \param   L     lua Virtual Machine.
+ * \param   void* struct t_htp_ccn.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_cli_snd( lua_State *L, void *ud )
+{
+	struct t_htp_ccn *cc = (struct t_htp_ccn *) ud;
+	struct iovec      iov[ T_HTP_CON_IOV ];
+	struct t_htp_rsp *r;
+	int               n  = 0;
+	int               e  = 0;
+	socklen_t         el = sizeof( e );
+	int               snt;
+
+	if (NULL == cc->sck)
+		return 0;
+	if (cc->cnn)
+	{
+		if (-1 == getsockopt( cc->sck->fd, SOL_SOCKET, SO_ERROR, &e, &el ))
+			e = errno;
+		if (0 != e)
+		{
+			t_htp_cli_close( L, cc, strerror( e ) );
+			return 0;
+		}
+		cc->cnn = 0;
+	}
+	for (r = cc->qs; NULL != r && n < T_HTP_CON_IOV; r = r->nxt)
+	{
+		// the string stays anchored by r->qR
+		lua_rawgeti( L, LUA_REGISTRYINDEX, r->qR );
+		iov[ n ].iov_base = (char *) lua_tostring( L, -1 ) + r->qo;
+		iov[ n ].iov_len  = r->ql - r->qo;
+		lua_pop( L, 1 );
+		n++;
+	}
+	if (0 == n)
+	{
+		t_htp_cli_watch( L, cc, T_AEL_WR, 0 );
+		return 0;
+	}
+	if (-1 == (snt = t_net_tcp_sendv( L, cc->sck, iov, n )))
+	{
+		t_htp_cli_close( L, cc, strerror( errno ) );
+		return 0;
+	}
+	while (NULL != (r = cc->qs) && (size_t) snt >= r->ql - r->qo)
+	{
+		snt   -= r->ql - r->qo;
+		r->qo  = r->ql;
+		cc->qs = r->nxt;
+	}
+	if (NULL != r)
+		r->qo += snt;
+	else
+		t_htp_cli_watch( L, cc, T_AEL_WR, 0 );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Open a new connection to a host and push it onto the stack.
+ * \detail  Expects the host entry on top of the stack.  The connection is
+ *          owned by the loop until it gets closed.
+ * \param   L    The lua state.
+ * \param   struct t_htp_hst*.
+ * \return  struct t_htp_ccn*; NULL and nothing pushed if the connection
+ *          failed right away (errno).
+ * --------------------------------------------------------------------------*/
+static struct t_htp_ccn
+*t_htp_cli_connect( lua_State *L, struct t_htp_hst *h )
+{
+	struct t_ael     *ael = h->cli->ael;
+	struct t_htp_ccn *cc;
+	struct t_net     *s;
+	int               one = 1;
+	int               e;
+
+	cc = (struct t_htp_ccn *) lua_newuserdata( L, sizeof( struct t_htp_ccn ) );
+	memset( cc, 0, sizeof( struct t_htp_ccn ) );
+	cc->hst = h;
+	luaL_getmetatable( L, T_HTP_CCN_TYPE );
+	lua_setmetatable( L, -2 );
+	lua_pushvalue( L, -2 );
+	lua_setuservalue( L, -2 );                  //S: h,cc
+
+	if (NULL == (s = t_net_create_ud( L, T_NET_TCP, 1 )))
+	{
+		lua_pop( L, 2 );
+		return NULL;
+	}
+	fcntl( s->fd, F_SETFL, fcntl( s->fd, F_GETFL, 0 ) | O_NONBLOCK );
+	setsockopt( s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+	if (-1 == connect( s->fd, (struct sockaddr *) &(h->adr), sizeof( h->adr ) ) &&
+	    EINPROGRESS != errno)
+	{
+		e = errno;
+		t_net_close( L, s );
+		lua_pop( L, 2 );
+		errno = e;
+		return NULL;
+	}
+
+	lua_pushvalue( L, -2 );                     //S: h,cc,sck,cc
+	t_ael_addhandle_cf( L, ael, -2, T_AEL_RD, t_htp_cli_rcv, cc );
+	lua_pushvalue( L, -2 );
+	t_ael_sethandler_cf( L, ael, s->fd, T_AEL_WR, t_htp_cli_snd, cc );
+	lua_pop( L, 1 );                            // the socket is referenced by the loop
+	cc->sck = s;
+	cc->cnn = 1;
+
+	cc->hnx = h->ch;
+	if (NULL != h->ch)
+		h->ch->hpv = cc;
+	h->ch = cc;
+	h->n++;
+	return cc;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Find the connection a request can be queued on.
+ * \detail  Prefers an idle connection.  Else, if the client allows no more
+ *          connections, idempotent requests get pipelined on the least busy
+ *          connection which has no non-idempotent request queued.
+ * \param   struct t_htp_hst*.
+ * \param   struct t_htp_rsp*.
+ * \param   int*  set to 1 if another connection may be opened, else 0.
+ * \return  struct t_htp_ccn*; NULL if there is none to use right now.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_ccn
+*t_htp_cli_pick( struct t_htp_hst *h, struct t_htp_rsp *r, int *cn )
+{
+	struct t_htp_ccn *cc;
+	struct t_htp_ccn *lb = NULL;      ///< least busy connection
+
+	for (cc = h->ch; NULL != cc; cc = cc->hnx)
+	{
+		if (0 == cc->qn)
+		{
+			*cn = 0;
+			return cc;
+		}
+		if (r->idm && cc->qt->idm && (NULL == lb || cc->qn < lb->qn))
+			lb = cc;
+	}
+	*cn = h->n < h->cli->mx;
+	return (*cn) ? NULL : lb;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Report a request whose connection failed right away.
+ * \detail  Deferred by t_htp_cli_dispatch(), so the response handler doesn't
+ *          get called from within Client:request().  The reason is on top of
+ *          the stack.
+ * \param   L     lua Virtual Machine.
+ * \param   void* struct t_htp_rsp.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_cli_refused( lua_State *L, void *ud )
+{
+	t_htp_cli_fail( L, (struct t_htp_rsp *) ud, lua_tostring( L, -1 ) );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Queue a request on a connection to its host.
+ * \detail  Expects the host entry on top of the stack and pops it.  Prefers
+ *          an idle connection, then opens a new one if the client allows
+ *          more, else pipelines idempotent requests on the least busy
+ *          connection.  Other requests wait for a connection to become idle.
+ *          If the connection can't be opened the request fails.
+ * \param   L    The lua state.
+ * \param   struct t_htp_rsp*  request which is on no connection.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_dispatch( lua_State *L, struct t_htp_rsp *r )
+{
+	struct t_htp_hst *h  = (struct t_htp_hst *) lua_touserdata( L, -1 );
+	struct t_htp_ccn *cc;
+	int               cn;
+
+	cc     = t_htp_cli_pick( h, r, &cn );
+	r->nxt = NULL;
+	if (NULL == cc && ! cn)
+	{
+		if (NULL == h->wt)
+			h->wh = r;
+		else
+			h->wt->nxt = r;
+		h->wt = r;
+		lua_pop( L, 1 );
+		return;
+	}
+	if (NULL == cc)
+	{
+		if (NULL == (cc = t_htp_cli_connect( L, h )))
+		{
+			lua_pushfstring( L, "Failed to connect to %s:%d (%s)",
+			   inet_ntoa( h->adr.sin_addr ), ntohs( h->adr.sin_port ), strerror( errno ) );
+			t_ael_defer_cf( L, h->cli->ael, t_htp_cli_refused, r );
+			lua_pop( L, 1 );
+			return;
+		}
+		lua_pop( L, 1 );
+	}
+	lua_pop( L, 1 );
+
+	r->qo  = 0;
+	r->cc  = cc;
+	if (NULL == cc->qt)
+		cc->qh = r;
+	else
+		cc->qt->nxt = r;
+	cc->qt = r;
+	if (NULL == cc->qs)
+		cc->qs = r;
+	cc->qn++;
+	t_htp_cli_watch( L, cc, T_AEL_WR, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Dispatch requests waiting for a connection of a host.
+ * \detail  Expects the host entry on top of the stack and pops it.  Stops
+ *          at the first request which would have to wait again, so they
+ *          stay in order.
+ * \param   L    The lua state.
+ * \param   struct t_htp_hst*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_cli_drain( lua_State *L, struct t_htp_hst *h )
+{
+	struct t_htp_rsp *r;
+	int               cn;
+
+	while (NULL != (r = h->wh) && (NULL != t_htp_cli_pick( h, r, &cn ) || cn))
+	{
+		if (NULL == (h->wh = r->nxt))
+			h->wt = NULL;
+		r->nxt = NULL;
+		lua_pushvalue( L, -1 );
+		t_htp_cli_dispatch( L, r );
+	}
+	lua_pop( L, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if a header table has an entry of a given name, case insensitive.
+ * \param   L    The lua state.
+ * \param   int  stack position of the table.
+ * \param   const char*  lower case name.
+ * \param   size_t       length of the name.
+ * \return  int  1 if the name is in the table, else 0.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_cli_hasheader( lua_State *L, int t, const char *k, size_t kl )
+{
+	lua_pushnil( L );
+	while (lua_next( L, t ))
+	{
+		lua_pop( L, 1 );
+		if (LUA_TSTRING == lua_type( L, -1 ) &&
+		    kl == lua_rawlen( L, -1 ) && t_htp_ieq( lua_tostring( L, -1 ), k, kl ))
+		{
+			lua_pop( L, 1 );
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Send a request.
+ * \detail  The request gets described by a table:
+ *            host     IPv4 address of the server.
+ *            port     port of the server; default 80.
+ *            method   default GET.
+ *            path     default /.
+ *            headers  table of additional request headers.
+ *            body     string sent as request body.
+ *          Host and Content-Length get added unless the headers have them.
+ *          The handler gets called as func( response ) once the response
+ *          head arrived, or as func( nil, errmsg ) if the request failed.
+ *          The body gets streamed to the response:onBody() handler.
+ * \param   L     Lua state.
+ * \lparam  ud    T.Http.Client userdata instance.
+ * \lparam  table description of the request.
+ * \lparam  func  response handler.
+ * \lreturn ud    T.Http.Response userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+lt_htp_cli_request( lua_State *L )
+{
+	struct t_htp_rsp *r;
+	const char       *host;
+	const char       *mth;
+	const char       *pth;
+	size_t            ml, pl, bl = 0, i;
+	lua_Integer       port;
+	int               hs, n = 0;
+
+	t_htp_cli_check_ud( L, 1, 1 );
+	luaL_checktype( L, 2, LUA_TTABLE );
+	luaL_checktype( L, 3, LUA_TFUNCTION );
+	lua_settop( L, 3 );
+	lua_getfield( L, 2, "host" );               //S: cli,tbl,fnc,host  4
+	lua_getfield( L, 2, "port" );               //S: ...,port          5
+	lua_getfield( L, 2, "method" );             //S: ...,method        6
+	lua_getfield( L, 2, "path" );               //S: ...,path          7
+	lua_getfield( L, 2, "headers" );            //S: ...,headers       8
+	lua_getfield( L, 2, "body" );               //S: ...,body          9
+	host = luaL_checkstring( L, 4 );
+	port = luaL_optinteger( L, 5, 80 );
+	mth  = luaL_optlstring( L, 6, "GET", &ml );
+	pth  = luaL_optlstring( L, 7, "/", &pl );
+	luaL_argcheck( L, port > 0 && port < 65536, 2, "port number out of range" );
+	for (i=0; i<ml && ((mth[ i ] >= 'A' && mth[ i ] <= 'Z') || '-' == mth[ i ]); i++) ;
+	luaL_argcheck( L, ml > 0 && i == ml, 2, "illegal method" );
+	for (i=0; i<pl && (unsigned char) pth[ i ] > 0x20 && 0x7f != pth[ i ]; i++) ;
+	luaL_argcheck( L, pl > 0 && i == pl, 2, "illegal path" );
+	if (! lua_isnil( L, 9 ))
+		luaL_checklstring( L, 9, &bl );
+	// raises on an illegal address before anything got referenced
+	t_htp_cli_host( L, 1, host, (int) port );   //S: ...,host         10
+
+	// assemble head and body into a single string
+	lua_pushfstring( L, "%s %s HTTP/1.1\r\n", mth, pth );
+	n++;
+	hs = lua_istable( L, 8 );
+	if (! hs || ! t_htp_cli_hasheader( L, 8, "host", 4 ))
+	{
+		if (80 == port)
+			lua_pushfstring( L, "Host: %s\r\n", host );
+		else
+			lua_pushfstring( L, "Host: %s:%d\r\n", host, (int) port );
+		n++;
+	}
+	if (hs)
+	{
+		t_htp_pushheaders( L, 8 );
+		n++;
+	}
+	if (bl > 0 && ! (hs && t_htp_cli_hasheader( L, 8, "content-length", 14 )))
+	{
+		lua_pushfstring( L, "Content-Length: %I\r\n", (lua_Integer) bl );
+		n++;
+	}
+	lua_pushliteral( L, "\r\n" );
+	n++;
+	if (bl > 0)
+	{
+		lua_pushvalue( L, 9 );
+		n++;
+	}
+	lua_concat( L, n );                         //S: ...,host,request 11
+
+	r = (struct t_htp_rsp *) lua_newuserdata( L, sizeof( struct t_htp_rsp ) );
+	memset( r, 0, sizeof( struct t_htp_rsp ) );
+	r->s.pR  = LUA_NOREF;
+	r->s.bR  = LUA_NOREF;
+	r->s.hR  = LUA_NOREF;
+	r->s.con = NULL;
+	t_htp_cli_reset( r );
+	r->nb    = (4 == ml && 0 == memcmp( mth, "HEAD", 4 ));
+	r->idm   = r->nb || 0 == strcmp( mth, "GET" ) || 0 == strcmp( mth, "PUT" ) ||
+	           0 == strcmp( mth, "DELETE" ) || 0 == strcmp( mth, "OPTIONS" );
+	r->rty   = r->idm;
+	luaL_getmetatable( L, T_HTP_RSP_TYPE );
+	lua_setmetatable( L, -2 );                  //S: ...,request,rsp  12
+	lua_pushvalue( L, 3 );
+	r->fR    = luaL_ref( L, LUA_REGISTRYINDEX );
+	lua_pushvalue( L, 11 );
+	r->qR    = luaL_ref( L, LUA_REGISTRYINDEX );
+	r->ql    = lua_rawlen( L, 11 );
+	lua_pushvalue( L, 12 );
+	r->rR    = luaL_ref( L, LUA_REGISTRYINDEX );
+
+	// a failing connection gets reported through the response handler
+	lua_pushvalue( L, 10 );
+	t_htp_cli_dispatch( L, r );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __tostring (print) representation of a T.Http.Client instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_cli  The Client instance user_data.
+ * \lreturn string     formatted string representing T.Http.Client.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_cli__tostring( lua_State *L )
+{
+	struct t_htp_cli *c = t_htp_cli_check_ud( L, 1, 1 );
+
+	lua_pushfstring( L, T_HTP_CLI_TYPE": %p", c );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Client instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_cli  The Client instance user_data.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_cli__gc( lua_State *L )
+{
+	struct t_htp_cli *c = t_htp_cli_check_ud( L, 1, 1 );
+
+	luaL_unref( L, LUA_REGISTRYINDEX, c->lR );
+	c->lR = LUA_NOREF;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Client connection.
+ * \detail  Connections are owned by the loop while open, so only the
+ *          receive buffer can be left.
+ * \param   L      The lua state.
+ * \lparam  t_htp_ccn  The connection user_data.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_ccn__gc( lua_State *L )
+{
+	struct t_htp_ccn *cc = (struct t_htp_ccn *) luaL_checkudata( L, 1, T_HTP_CCN_TYPE );
+
+	free( cc->buf );
+	cc->buf = NULL;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Sets the body handler of a T.Http.Response.
+ * \detail  The function gets called as func( response, data ) for each piece
+ *          of the response body as it arrives, chunked bodies already
+ *          decoded.  Once the body is complete it gets called as
+ *          func( response ), if the connection fails before as
+ *          func( response, nil, errmsg ).  Returning false pauses reading
+ *          from the connection until response:resume() gets called.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Response instance.
+ * \lparam  function to be executed when body data arrives (or nil).
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rsp_onbody( lua_State *L )
+{
+	struct t_htp_rsp *r = t_htp_rsp_check_ud( L, 1, 1 );
+
+	if (! lua_isnoneornil( L, 2 ))
+		luaL_checktype( L, 2, LUA_TFUNCTION );
+	lua_settop( L, 2 );
+	luaL_unref( L, LUA_REGISTRYINDEX, r->s.bR );
+	r->s.bR = (lua_isnil( L, 2 )) ? LUA_NOREF : luaL_ref( L, LUA_REGISTRYINDEX );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Stop reading from the connection of a T.Http.Response.
+ * \detail  Pipelined responses behind it wait as well.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Response instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rsp_pause( lua_State *L )
+{
+	struct t_htp_rsp *r = t_htp_rsp_check_ud( L, 1, 1 );
+
+	if (NULL != r->cc && NULL != r->cc->sck)
+	{
+		r->cc->psd = 1;
+		t_htp_cli_watch( L, r->cc, T_AEL_RD, 0 );
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Process what got buffered while paused and continue reading.
+ * \detail  Deferred by Response:resume(); the connection is on top of the
+ *          stack.
+ * \param   L    The lua state.
+ * \param   void*  ud  struct t_htp_ccn*.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_cli_continue( lua_State *L, void *ud )
+{
+	struct t_htp_ccn *cc = (struct t_htp_ccn *) ud;
+
+	if (NULL == cc->sck || cc->psd)
+		return 0;
+	if (NULL != cc->buf && cc->b < cc->buf + cc->read)
+		t_htp_cli_process( L, cc );
+	if (NULL != cc->sck && ! cc->psd)
+		t_htp_cli_watch( L, cc, T_AEL_RD, 1 );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Continue reading from the connection of a T.Http.Response.
+ * \detail  Buffered data gets processed at the end of the loop iteration, so
+ *          the body handler won't be called from within resume().
+ * \param   L    The lua state.
+ * \lparam  T.Http.Response instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rsp_resume( lua_State *L )
+{
+	struct t_htp_rsp *r = t_htp_rsp_check_ud( L, 1, 1 );
+	struct t_htp_ccn *cc = r->cc;
+	struct t_ael     *ael;
+
+	if (NULL == cc || NULL == cc->sck || ! cc->psd)
+		return 0;
+	cc->psd = 0;
+	ael     = cc->hst->cli->ael;
+	t_ael_pushhandler( L, ael, cc->sck->fd, T_AEL_RD );
+	t_ael_defer_cf( L, ael, t_htp_cli_continue, cc );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Access values of a T.Http.Response.
+ * \detail  status, version and header are available once the head arrived.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Response instance.
+ * \lparam  key   string
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rsp__index( lua_State *L )
+{
+	struct t_htp_rsp *r = t_htp_rsp_check_ud( L, 1, 1 );
+	const char       *k;
+
+	lua_pushvalue( L, 2 );
+	if (LUA_TNIL != lua_rawget( L, lua_upvalueindex( 1 ) ) ||
+	    LUA_TSTRING != lua_type( L, 2 ) || NULL == r->s.hd)
+		return 1;
+	k = lua_tostring( L, 2 );
+	if (0 == strcmp( k, "status" ))
+		lua_pushinteger( L, r->sts );
+	else if (0 == strcmp( k, "version" ))
+		lua_pushlstring( L, r->s.hd + r->s.vo, r->s.vl );
+	else if (0 == strcmp( k, "header" ))
+		t_htp_hdr_create_ud( L, &(r->s), 1 );
+	else
+		lua_pushnil( L );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __tostring (print) representation of a T.Http.Response instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_rsp  The Response instance user_data.
+ * \lreturn string     formatted string representing T.Http.Response.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rsp__tostring( lua_State *L )
+{
+	struct t_htp_rsp *r = t_htp_rsp_check_ud( L, 1, 1 );
+
+	lua_pushfstring( L, T_HTP_RSP_TYPE"{%d}: %p", r->sts, r );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Response instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_rsp  The Response instance user_data.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rsp__gc( lua_State *L )
+{
+	struct t_htp_rsp *r = t_htp_rsp_check_ud( L, 1, 1 );
+
+	luaL_unref( L, LUA_REGISTRYINDEX, r->s.hR );
+	luaL_unref( L, LUA_REGISTRYINDEX, r->s.bR );
+	luaL_unref( L, LUA_REGISTRYINDEX, r->fR );
+	luaL_unref( L, LUA_REGISTRYINDEX, r->qR );
+	r->s.hR = LUA_NOREF;
+	r->s.bR = LUA_NOREF;
+	r->fR   = LUA_NOREF;
+	r->qR   = LUA_NOREF;
+	r->s.hd = NULL;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Class metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_cli_fm [] = {
+	  { "__call",        lt_htp_cli__Call }
+	, { NULL,            NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * Class functions library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_cli_cf [] = {
+	  { NULL,   NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * Objects metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_cli_m [] = {
+	  { "__gc",          lt_htp_cli__gc }
+	, { "__tostring",    lt_htp_cli__tostring }
+	, { "request",       lt_htp_cli_request }
+	, { NULL,    NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * T.Http.Response metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_rsp_m [] = {
+	  { "__gc",          lt_htp_rsp__gc }
+	, { "__tostring",    lt_htp_rsp__tostring }
+	, { NULL,    NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * T.Http.Response methods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_rsp_prx_m [] = {
+	  { "onBody",        lt_htp_rsp_onbody }
+	, { "pause",         lt_htp_rsp_pause }
+	, { "resume",        lt_htp_rsp_resume }
+	, { NULL,    NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * \brief   pushes this library onto the stack
+ *          - creates Metatable with functions
+ *          - creates metatable with methods
+ * \param   L      The lua state.
+ * \lreturn table  the library
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+LUAMOD_API int
+luaopen_t_htp_cli( lua_State *L )
+{
+	// T.Http.Client instance metatable
+	luaL_newmetatable( L, T_HTP_CLI_TYPE );
+	luaL_setfuncs( L, t_htp_cli_m, 0 );
+	lua_setfield( L, -1, "__index" );
+
+	// T.Http.Client.Connection metatable; only used internally
+	luaL_newmetatable( L, T_HTP_CCN_TYPE );
+	lua_pushcfunction( L, lt_htp_ccn__gc );
+	lua_setfield( L, -2, "__gc" );
+	lua_pop( L, 1 );
+
+	// T.Http.Response instance metatable
+	luaL_newmetatable( L, T_HTP_RSP_TYPE );
+	luaL_setfuncs( L, t_htp_rsp_m, 0 );
+	luaL_newlib( L, t_htp_rsp_prx_m );
+	lua_pushcclosure( L, lt_htp_rsp__index, 1 );
+	lua_setfield( L, -2, "__index" );
+	lua_pop( L, 1 );
+
+	// T.Http.Client class
+	luaL_newlib( L, t_htp_cli_cf );
+	luaL_newlib( L, t_htp_cli_fm );
+	lua_setmetatable( L, -2 );
+	return 1;
+}
@@ -10,16 +10,24 @@
 
 #include <stdlib.h>               // malloc, free
 #include <string.h>               // strchr, ...
+#include <unistd.h>               // close
+#include <sys/uio.h>              // struct iovec
 
 #include "t.h"
 #include "t_htp.h"
 
 
-static int lt_htp_con__gc( lua_State *L );
+static void t_htp_con_close( lua_State *L, struct t_htp_con *c );
+static void t_htp_con_settimeout( struct t_htp_con *c );
+
+
+static const char t_htp_con_pool = 0;    ///< key of the connection pool
 
 
 /**--------------------------------------------------------------------------
  * create a t_htp_con and push to LuaStack.
+ * \detail  Recycles a collected connection including its proxy and stream
+ *          tables if available.
  * \param   L  The lua state.
  *
  * \return  struct t_htp_con*  pointer to the struct.
@@ -28,14 +36,33 @@ struct t_htp_con
 *t_htp_con_create_ud( lua_State *L, struct t_htp_srv *srv )
 {
 	struct t_htp_con *c;
-	c = (struct t_htp_con *) lua_newuserdata( L, sizeof( struct t_htp_con ) );
+
+	if (NULL == (c = (struct t_htp_con *) t_htp_pool_get( L, &t_htp_con_pool )))
+	{
+		c = (struct t_htp_con *) lua_newuserdata( L, sizeof( struct t_htp_con ) );
+		lua_newtable( L ); // proxy table holding socket and address
+		c->pR     = luaL_ref( L, LUA_REGISTRYINDEX );
+		lua_newtable( L ); // empty table to hold streams inside
+		c->sR     = luaL_ref( L, LUA_REGISTRYINDEX );
+	}
+	c->sck       = NULL;
+	c->bR        = LUA_NOREF;
 	c->buf_head  = NULL;   // reference to current output buffer head
 	c->buf_tail  = NULL;   // reference to current output buffer head
 	c->srv       = srv;
 	c->cnt       = 1;
-	lua_newtable( L ); // empty table to hold streams inside
-
-	c->sR        = luaL_ref( L, LUA_REGISTRYINDEX );
+	c->rsp       = 1;
+	c->upgrade   = 0;
+	c->psd       = 0;
+	c->buf       = NULL;
+	c->bsz       = 0;
+	c->read      = 0;
+	c->b         = NULL;
+	c->rcv       = 1;      // the header timeout applies from accept on
+	c->tmo       = T_HTP_TMO_NO;
+	c->tnx       = NULL;
+	c->tpv       = NULL;
+	t_htp_con_settimeout( c );
 
 	luaL_getmetatable( L, T_HTP_CON_TYPE );
 	lua_setmetatable( L, -2 );
@@ -59,150 +86,496 @@ struct t_htp_con
 }
 
 
-// TODO: use this to adjust large incoming chnks for headers upto BUFSIZ per
-// line
-void t_htp_con_adjustbuffer( struct t_htp_con *c, size_t read, const char* rpos )
+/**--------------------------------------------------------------------------
+ * Make sure the connection has room in its receive buffer.
+ * \detail  Idle connections hold no buffer; one gets taken from the servers
+ *          pool when data arrives.
+ * \param   struct t_htp_con*.
+ * \return  int    0 on success, -1 if the buffer can't (or mustn't) grow.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_con_getbuffer( struct t_htp_con *c )
+{
+	return t_htp_getbuffer( &c->buf, &c->bsz, &c->read, &c->b,
+	                        c->srv->bpl, &c->srv->bpn );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Hand the receive buffer of a connection back to the servers pool.
+ * \detail  Grown buffers and buffers beyond the pools capacity get freed.
+ * \param   struct t_htp_con*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_con_putbuffer( struct t_htp_con *c )
+{
+	struct t_htp_srv *s = c->srv;
+
+	if (NULL == c->buf)
+		return;
+	if (T_HTP_CON_BSZ == c->bsz && s->bpn >= 0 && s->bpn < T_HTP_SRV_BPL)
+		s->bpl[ s->bpn++ ] = c->buf;
+	else
+		free( c->buf );
+	c->buf  = NULL;
+	c->bsz  = 0;
+	c->read = 0;
+	c->b    = NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Take a connection out of the servers timeout list it is linked into.
+ * \param   struct t_htp_con*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_con_unlink( struct t_htp_con *c )
 {
-	memcpy( &(c->buf), rpos, (const char*) &(c->buf) + read - rpos );
+	struct t_htp_srv *s = c->srv;
+
+	if (T_HTP_TMO_NO == c->tmo)
+		return;
+	if (NULL == c->tpv)
+		s->tmh[ c->tmo ] = c->tnx;
+	else
+		c->tpv->tnx = c->tnx;
+	if (NULL == c->tnx)
+		s->tmt[ c->tmo ] = c->tpv;
+	else
+		c->tnx->tpv = c->tpv;
+	c->tnx = NULL;
+	c->tpv = NULL;
+	c->tmo = T_HTP_TMO_NO;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Put a connection into the timeout list matching what it is waiting for.
+ * \detail  Connections which have unanswered requests or receive a body are
+ *          busy and in no list.  Connections waiting for (the rest of) a
+ *          request head go into the header list; the header timeout counts
+ *          from the start of the head, so trickling bytes don't extend it.
+ *          Anything else idles between requests and counts from now.  Each
+ *          list is ordered by the start of the wait, so appending and
+ *          unlinking are O(1) and the sweep only looks at expired heads.
+ * \param   struct t_htp_con*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_con_settimeout( struct t_htp_con *c )
+{
+	struct t_htp_srv *s = c->srv;
+	struct timeval    nw;
+	enum t_htp_tmo    t = (c->rsp < c->cnt || 2 == c->rcv) ? T_HTP_TMO_NO
+	                    : (1 == c->rcv)                    ? T_HTP_TMO_HEAD
+	                                                       : T_HTP_TMO_IDLE;
+
+	if (T_HTP_TMO_HEAD == t && T_HTP_TMO_HEAD == c->tmo)
+		return;
+	t_htp_con_unlink( c );
+	if (T_HTP_TMO_NO == t)
+		return;
+	t_tim_mono( &nw );
+	c->tms = nw.tv_sec;
+	c->tmo = t;
+	c->tpv = s->tmt[ t ];
+	if (NULL == c->tpv)
+		s->tmh[ t ] = c;
+	else
+		c->tpv->tnx = c;
+	s->tmt[ t ] = c;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Close connections of a server which waited too long for a request.
+ * \detail  Native T.Loop timer, fires every s->tiv; the server is on top of
+ *          the stack.  Only the heads of the lists need to be checked since
+ *          they are ordered by the start of the wait.
+ * \param   L    The lua state.
+ * \param   void*  ud  struct t_htp_srv*.
+ * \return  int    1; the timer keeps running.
+ * --------------------------------------------------------------------------*/
+int
+t_htp_con_sweep( lua_State *L, void *ud )
+{
+	struct t_htp_srv *s = (struct t_htp_srv *) ud;
+	struct t_htp_con *c;
+	struct timeval    nw;
+	int               n = lua_gettop( L );
+	int               t;
+
+	t_tim_mono( &nw );
+	for (t = T_HTP_TMO_HEAD; t <= T_HTP_TMO_IDLE; t++)
+		while (s->tmo[ t ] > 0 && NULL != (c = s->tmh[ t ]) &&
+		       nw.tv_sec - c->tms >= s->tmo[ t ])
+		{
+			t_htp_con_close( L, c );     // unlinks c
+			lua_settop( L, n );
+		}
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Drop a stream from the connections stream table.
+ * \detail  Done once the request was received completely and the response
+ *          went out; from then on only Lua code may still reference it.
+ * \param   L     lua Virtual Machine.
+ * \param   struct t_htp_con*.
+ * \param   int   id of the stream (t_htp_str.cntId).
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_con_unstream( lua_State *L, struct t_htp_con *c, int id )
+{
+	lua_rawgeti( L, LUA_REGISTRYINDEX, c->sR );
+	lua_pushnil( L );
+	lua_rawseti( L, -2, id );
+	lua_pop( L, 1 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Stop or start observing the connections socket for reading.
+ * \param   struct t_htp_con*.
+ * \param   int   boolean; observe?
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_con_rdwatch( struct t_htp_con *c, int rd )
+{
+	t_ael_watch( c->srv->ael, c->sck->fd, T_AEL_RD, rd );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Process the data in the receive buffer of a T.Http.Connection.
+ * \detail  Hands the data to the stream receiving now; pipelined requests
+ *          get processed as long as requests got completed and there is more
+ *          data buffered.  Stops early if the body handler paused reading.
+ *          The connection must be on top of the stack.
+ * \param   L     lua Virtual Machine.
+ * \param   struct t_htp_con*.
+ * \return  void.
+ *  -------------------------------------------------------------------------*/
+static void
+t_htp_con_process( lua_State *L, struct t_htp_con *c )
+{
+	int               ci   = lua_gettop( L );   ///< stack position of c
+	struct t_htp_str *s;
+	int               cnt;     ///< id of the stream receiving
+
+	do
+	{
+		// negotiate which stream object is responsible
+		// if HTTP1.0 or HTTP1.1 this is the last, HTTP2.0 has a stream identifier
+		cnt = c->cnt;
+		lua_rawgeti( L, LUA_REGISTRYINDEX, c->sR );
+		lua_rawgeti( L, -1, cnt );            // S:c,sR,s
+		if (lua_isnoneornil( L, -1 ))
+		{          // create new stream and put into stream table
+			lua_pop( L, 1 );                   // pop nil( failed stream )
+			s = t_htp_str_create_ud( L, c );   // S:c,sR,str
+			lua_rawgeti( L, LUA_REGISTRYINDEX, s->pR );
+			lua_pushstring( L, "connection" );
+			lua_pushvalue( L, ci );            // S:c,sR.str,pR,'connection',c
+			lua_rawset( L, -3 );
+			lua_pop( L, 1 );                   // remove s->pR
+			lua_pushvalue( L, ci );            // s->con stays valid while s lives
+			lua_setuservalue( L, -2 );
+			lua_pushvalue( L, -1 );
+			lua_rawseti( L, -3, cnt );         // S:c,sR,str
+		}
+		else
+		{
+			s = t_htp_str_check_ud( L, -1, 0 );
+		}
+		lua_remove( L, -2 );       // pop the stream table
+
+		if (0 != t_htp_str_rcv( L, s ))
+		{
+			t_htp_con_close( L, c );   // malformed request
+			return;
+		}
+		lua_settop( L, ci );
+		if (NULL == c->sck)           // closed by the handler
+			return;
+		// fully received and already responded to -> done with the stream
+		if (cnt != c->cnt && cnt < c->rsp)
+			t_htp_con_unstream( L, c, cnt );
+	}
+	while (cnt != c->cnt && s->kpAlv && ! c->upgrade && ! c->psd &&
+	       c->b < c->buf + c->read);
+	c->rcv = (cnt != c->cnt) ? 0 : (T_HTP_STR_ZERO == s->state) ? 1 : 2;
+	t_htp_con_settimeout( c );
+	if (c->psd)
+		t_htp_con_rdwatch( c, 0 );
+
+	// everything processed -> don't hold on to the buffer while idle
+	if (NULL != c->buf && c->b == c->buf + c->read)
+		t_htp_con_putbuffer( c );
 }
 
 
 /**--------------------------------------------------------------------------
  * Handle incoming chunks from T.Http.Connection socket.
  * Called anytime the client socket returns from the poll for read event.
+ * Native T.Loop handler; the connection is on top of the stack.
  * \param   L     lua Virtual Machine.
- * \lparam  userdata  struct t_htp_con.
+ * \param   void* struct t_htp_con.
  * \return  int    # of values pushed onto the stack.
  *  -------------------------------------------------------------------------*/
 int
-t_htp_con_rcv( lua_State *L )
+t_htp_con_rcv( lua_State *L, void *ud )
 {
-	struct t_htp_con *c    = t_htp_con_check_ud( L, 1, 1 );
-	struct t_htp_str *s;
+	struct t_htp_con *c    = (struct t_htp_con *) ud;
 	int               rcvd;
-	int               res;   // return result
 
+	// paused while the event was pending already
+	if (c->psd)
+	{
+		t_htp_con_rdwatch( c, 0 );
+		return 0;
+	}
+	// request head exceeds T_HTP_CON_BMX or out of memory
+	if (0 != t_htp_con_getbuffer( c ))
+	{
+		t_htp_con_close( L, c );
+		return 0;
+	}
 	// read
-	rcvd = t_net_tcp_recv( L, c->sck, &(c->buf[ c->read ]), BUFSIZ - c->read );
+	T_AEL_STS_SYS( c->srv->ael, 1 );
+	rcvd = t_net_tcp_recv( L, c->sck, &(c->buf[ c->read ]), c->bsz - c->read );
+#if PRINT_DEBUGS == 1
 	printf( "RCVD: %d bytes\n", rcvd );
+#endif
 
 	if (! rcvd)    // peer has closed
-		return lt_htp_con__gc( L );
-	// negotiate which stream object is responsible
-	// if HTTP1.0 or HTTP1.1 this is the last, HTTP2.0 has a stream identifier
-	lua_rawgeti( L, LUA_REGISTRYINDEX, c->sR );
-	lua_rawgeti( L, -1, c->cnt );         // S:c,sR,s
-	if (lua_isnoneornil( L, -1 ))
-	{          // create new stream and put into stream table
-		lua_pop( L, 1 );                   // pop nil( failed stream )
-		s = t_htp_str_create_ud( L, c );   // S:c,sR,str
-		lua_rawgeti( L, LUA_REGISTRYINDEX, s->pR );
-		lua_pushstring( L, "connection" );
-		lua_pushvalue( L, -1 );            // S:c,sR.str,pR,'connection',c
-		lua_rawset( L, -3 );
-		lua_pop( L, 1 );                   // remove s->pR
-		lua_rawseti( L, -2, c->cnt );      // S:c,sR
-		lua_rawgeti( L, -1, c->cnt );      // S:c,sR,str
-	}
-	else
 	{
-		s = t_htp_str_check_ud( L, -1, 0 );
+		t_htp_con_close( L, c );
+		return 0;
 	}
-	lua_remove( L, -2 );       // pop the stream table
+	c->read += rcvd;
+	t_htp_con_process( L, c );
+	return 0;
+}
 
-	//printf( "Received %d  \n'%s'\n", rcvd, &(m->buf[ m->read ]) );
-	// TODO: set or reset c-read
 
-	c->b = &( c->buf[ 0 ] );
+/**--------------------------------------------------------------------------
+ * Process what got buffered while paused and continue reading.
+ * \detail  Deferred by t_htp_con_resume(); the connection is on top of the
+ *          stack.
+ * \param   L    The lua state.
+ * \param   void*  ud  struct t_htp_con*.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_con_continue( lua_State *L, void *ud )
+{
+	struct t_htp_con *c = (struct t_htp_con *) ud;
+
+	if (NULL == c->sck || c->psd)
+		return 0;
+	if (NULL != c->buf && c->b < c->buf + c->read)
+		t_htp_con_process( L, c );
+	if (NULL != c->sck && ! c->psd)
+		t_htp_con_rdwatch( c, 1 );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Pause reading from a T.Http.Connection.
+ * \param   struct t_htp_con*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_con_pause( struct t_htp_con *c )
+{
+	c->psd = 1;
+	if (NULL != c->sck)
+		t_htp_con_rdwatch( c, 0 );
+}
+
 
-	res = t_htp_str_rcv( L, s, c->read + rcvd );
-	switch (res)
+/**--------------------------------------------------------------------------
+ * Resume reading from a paused T.Http.Connection.
+ * \detail  Expects the connection on top of the stack and pops it.  Buffered
+ *          data gets processed at the end of the loop iteration.
+ * \param   L    The lua state.
+ * \param   struct t_htp_con*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_con_resume( lua_State *L, struct t_htp_con *c )
+{
+	if (! c->psd || NULL == c->sck)
 	{
-		case 0:
-			c->read = 0;
-		default:
-			break;
+		lua_pop( L, 1 );
+		return;
 	}
+	c->psd = 0;
+	t_ael_defer_cf( L, c->srv->ael, t_htp_con_continue, c );
+}
 
-	return 0;
+
+/**--------------------------------------------------------------------------
+ * Stop waiting for the connections socket to become writable.
+ * \param   struct t_htp_con*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_con_unwatch( struct t_htp_con *c )
+{
+	t_ael_watch( c->srv->ael, c->sck->fd, T_AEL_WR, 0 );
 }
 
 
 /**--------------------------------------------------------------------------
  * Handle outgoing T.Http.Connection into it's socket.
+ * Native T.Loop handler; the connection is on top of the stack.  Gathers the
+ * pending buffers and sends them with a single writev().  Only buffers of the
+ * stream responding now (c->rsp) get sent; once its last buffer is included
+ * the buffers of the next pipelined stream may follow.  File chunks go out on
+ * their own via sendfile().
  * \param   L     lua Virtual Machine.
- * \lparam  userdata  struct t_htp_con.
- * \param   pointer to the buffer to read from(already positioned).
- * \lreturn value from the buffer a packers position according to packer format.
+ * \param   void* struct t_htp_con.
  * \return  int    # of values pushed onto the stack.
  *  -------------------------------------------------------------------------*/
 int
-t_htp_con_rsp( lua_State *L )
+t_htp_con_rsp( lua_State *L, void *ud )
 {
-	struct t_htp_con *c    = t_htp_con_check_ud( L, 1, 1 );
-	size_t            snt;
-	const char       *b;
-	struct t_htp_buf *buf  = c->buf_head;
+	struct t_htp_con *c    = (struct t_htp_con *) ud;
+	struct iovec      iov[ T_HTP_CON_IOV ];
+	struct t_htp_buf *buf;
 	struct t_htp_str *str;
+	int               rsp  = c->rsp;   ///< stream the next buffer must belong to
+	int               n    = 0;        ///< # of buffers gathered
+	int               r    = 0;        ///< result of the send call
+	size_t            snt;
+	size_t            k;
 
-	// TODO: test for NULL
-	// get tail buffer turn into char * array
-	lua_rawgeti( L, LUA_REGISTRYINDEX, buf->bR );
-	b = lua_tostring( L, -1 );
-	// fetch the currently active stream for this buffer
-	lua_rawgeti( L, LUA_REGISTRYINDEX, buf->sR );
-	str = t_htp_str_check_ud( L, -1, 1 );
-	//printf( "Send ResponseChunk: %s\n", b );
-
-	snt = t_net_tcp_send( L,
-			c->sck,
-			&(b[ buf->sl ]),
-			buf->bl - buf->sl );
-	buf->sl   += snt;  // How much of current buffer is sent -> adjustment
-	str->rsSl += snt;  // How much of current stream is sent -> adjustment
-
-	//printf( "%zu   %zu  -- %u    %u\n", buf->sl, buf->bl,
-	//   buf->sl==buf->bl, buf->sl!=buf->bl );
-
-	if (buf->bl == buf->sl)      // current buffer is sent completly
+	buf = c->buf_head;
+	if (NULL == buf || buf->str->cntId != rsp)
+	{
+		t_htp_con_unwatch( c );
+		return 0;
+	}
+	if (-1 != buf->fd)
 	{
-		if ( buf->last )
+		k = buf->bl - buf->sl;
+		if (k > T_HTP_CON_SFMX)
+			k = T_HTP_CON_SFMX;
+		r = t_net_tcp_sendfile( L, c->sck, buf->fd, &(buf->fo), k );
+		n = 1;
+	}
+	else
+	{
+		for (; NULL != buf && -1 == buf->fd && n < T_HTP_CON_IOV && buf->str->cntId == rsp;
+		     buf = buf->nxt)
 		{
-			//printf( "EndOfStream\n" );
-			lua_pushcfunction( L, lt_htp_str__gc );
-			lua_rawgeti( L, LUA_REGISTRYINDEX, buf->sR );
-			luaL_unref( L, LUA_REGISTRYINDEX, buf->sR ); // unref stream for gc
-			lua_call( L, 1, 0 );
+			// the memory stays anchored by buf->bR
+			iov[ n ].iov_base = (char *) buf->bp + buf->sl;
+			iov[ n ].iov_len  = buf->bl - buf->sl;
+			n++;
+			if (buf->last)
+				rsp++;
 		}
-		// free current buffer and go backwards in linked list
-		luaL_unref( L, LUA_REGISTRYINDEX, buf->bR ); // unref string for gc
+		r = t_net_tcp_sendv( L, c->sck, iov, n );
+	}
+	T_AEL_STS_SYS( c->srv->ael, 1 );
+	// peer is gone or the file got truncated meanwhile
+	if (-1 == r)
+	{
+		t_htp_con_close( L, c );
+		return 0;
+	}
+	snt = (size_t) r;     // 0 if the socket is full; the write event retries
+
+	// account for what got sent, release buffers sent completely
+	while (n-- > 0)
+	{
+		buf = c->buf_head;
+		str = buf->str;      // anchored by buf->sR
+		k   = buf->bl - buf->sl;
+		if (k > snt)
+			k = snt;
+		buf->sl   += k;  // How much of current buffer is sent -> adjustment
+		str->rsSl += k;  // How much of current stream is sent -> adjustment
+		snt       -= k;
+		if (buf->sl < buf->bl)     // rest goes out on the next write event
+			break;
+
 		c->buf_head = buf->nxt;
-		free( buf );
+		if (NULL == c->buf_head)
+			c->buf_tail = NULL;
+		else
+			c->buf_head->prv = NULL;
+		luaL_unref( L, LUA_REGISTRYINDEX, buf->bR ); // unref string for gc
+		if (buf->fc)
+			close( buf->fd );
 
-		// TODO:  If there is no kpAlv discard connection
-		//        If kpAlv and the buffers are empty, set up a timer to discard 
-		//        on kpAlv timeout
-		if (NULL == c->buf_head)       // current connection has no buffers left
+		if (buf->last)
 		{
-			printf( "remove "T_HTP_CON_TYPE" from Loop\n" );
-			// remove this connections socket from evLoop
-			t_ael_removehandle_impl( c->srv->ael, c->sck->fd, T_AEL_WR );
-			c->srv->ael->fd_set[ c->sck->fd ]->t = T_AEL_RD;
-			// done with current the stream has overall
-			if ( T_HTP_STR_FINISH == str->state || str->rsSl == str->rsBl)
+			// the next pipelined stream may respond now
+			c->rsp++;
+			t_htp_str_release( L, str );
+			// received completely as well -> done with the stream
+			if (str->cntId < c->cnt)
+				t_htp_con_unstream( L, c, str->cntId );
+			if (! str->kpAlv)
 			{
-				if (! c->kpAlv)
-				{
-					lua_pushcfunction( L, lt_htp_con__gc );
-					lua_pushvalue( L, 1 );
-					lua_call( L, 1, 0 );
-					return 1;
-				}
+				luaL_unref( L, LUA_REGISTRYINDEX, buf->sR );
+				free( buf );
+				t_htp_con_close( L, c );
+				return 0;
 			}
 		}
+		luaL_unref( L, LUA_REGISTRYINDEX, buf->sR ); // unref stream for gc
+		free( buf );
+	}
+
+	// all answered -> the idle timeout applies again
+	t_htp_con_settimeout( c );
+	if (NULL == c->buf_head || c->buf_head->str->cntId != c->rsp)
+		t_htp_con_unwatch( c );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Send pending buffers at the end of a loop iteration.
+ * \detail  Deferred by t_htp_str_addbuffer() once the responding stream has a
+ *          buffer at the head of the list, so all chunks written during an
+ *          iteration go out at once instead of waiting for a write event.
+ *          Whatever can't be sent now is left to t_htp_con_rsp() on the write
+ *          event.
+ * \param   L    The lua state.
+ * \param   void*  ud  struct t_htp_con*.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+int
+t_htp_con_flush( lua_State *L, void *ud )
+{
+	struct t_htp_con *c = (struct t_htp_con *) ud;
+	struct t_htp_buf *b;
+	int               n = lua_gettop( L );
 
+	// t_htp_con_rsp() only moves on if the head buffer was sent completely;
+	// once a send came up short the socket is full -> wait until writable
+	while (NULL != c->sck && NULL != (b = c->buf_head) && b->str->cntId == c->rsp)
+	{
+		t_htp_con_rsp( L, c );
+		lua_settop( L, n );
+		if (b == c->buf_head || (NULL != c->buf_head && c->buf_head->sl > 0))
+			break;
 	}
-	return 1;
+	if (NULL != c->sck && NULL != c->buf_head && c->buf_head->str->cntId == c->rsp)
+		t_ael_watch( c->srv->ael, c->sck->fd, T_AEL_WR, 1 );
+	return 0;
 }
 
 
@@ -279,48 +652,73 @@ lt_htp_con__len( lua_State *L )
 
 
 /**--------------------------------------------------------------------------
- * __gc of a T.Http.Connection instance.
+ * Close a T.Http.Connection and take it off the loop.
+ * \detail  Releases proxy, pending buffers and the socket.  Safe to be called
+ *          more than once.
  * \param   L      The lua state.
- * \lparam  t_htp_con  The Connection instance user_data.
- * \return  int    # of values pushed onto the stack.
+ * \param   struct t_htp_con.
+ * \return  void.
  * --------------------------------------------------------------------------*/
-static int
-lt_htp_con__gc( lua_State *L )
+static void
+t_htp_con_close( lua_State *L, struct t_htp_con *c )
 {
-	struct t_htp_con *c = t_htp_con_check_ud( L, 1, 1 );
 	struct t_htp_buf *b;
 
+	t_htp_con_unlink( c );
 	if (LUA_NOREF != c->pR)
-	{
-		luaL_unref( L, LUA_REGISTRYINDEX, c->pR );
-		c->pR = LUA_NOREF;
-	}
+		t_htp_wipe( L, c->pR );
+	t_htp_con_putbuffer( c );
 	// in normal operarion no buffer should still exist, this is only for 
 	while (NULL != c->buf_head)
 	{
 		b = c->buf_head;
-		luaL_unref( L, LUA_REGISTRYINDEX, b->sR ); // unref string for gc
+		luaL_unref( L, LUA_REGISTRYINDEX, b->bR ); // unref string for gc
+		luaL_unref( L, LUA_REGISTRYINDEX, b->sR ); // unref stream for gc
+		if (b->fc)
+			close( b->fd );
 		c->buf_head = c->buf_head->nxt;
 		free( b );
 	}
+	c->buf_tail = NULL;
 	if (NULL != c->sck)
 	{
-		printf( "REMOVE Socket %d FROM LOOP ...", c->sck->fd );
-		t_ael_removehandle_impl( c->srv->ael, c->sck->fd, T_AEL_RD );
-		t_ael_removehandle_impl( c->srv->ael, c->sck->fd, T_AEL_WR );
-		c->srv->ael->fd_set[ c->sck->fd ]->t = T_AEL_NO;
-		luaL_unref( L, LUA_REGISTRYINDEX, c->srv->ael->fd_set[ c->sck->fd ]->rR );
-		luaL_unref( L, LUA_REGISTRYINDEX, c->srv->ael->fd_set[ c->sck->fd ]->wR );
-		luaL_unref( L, LUA_REGISTRYINDEX, c->srv->ael->fd_set[ c->sck->fd ]->hR );
-		free( c->srv->ael->fd_set[ c->sck->fd ] );
-		c->srv->ael->fd_set[ c->sck->fd ] = NULL;
-
+#if PRINT_DEBUGS == 1
+		printf( "REMOVE Socket %d FROM LOOP\n", c->sck->fd );
+#endif
+		// t_net_close() takes the socket out of the loop as well
+		T_AEL_STS_SYS( c->srv->ael, 1 );
 		t_net_close( L, c->sck );
 		c->sck = NULL;
-		printf( "  DONE\n" );
 	}
 
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Connection instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_con  The Connection instance user_data.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_con__gc( lua_State *L )
+{
+	struct t_htp_con *c = t_htp_con_check_ud( L, 1, 1 );
+
+	t_htp_con_close( L, c );
+	// unreachable -> recycle it including the proxy and stream tables
+	if (LUA_NOREF != c->sR)
+		t_htp_wipe( L, c->sR );
+	if (LUA_NOREF != c->pR && ! t_htp_pool_put( L, &t_htp_con_pool, 1, T_HTP_CON_PL ))
+	{
+		luaL_unref( L, LUA_REGISTRYINDEX, c->pR );
+		luaL_unref( L, LUA_REGISTRYINDEX, c->sR );
+		c->pR = LUA_NOREF;
+		c->sR = LUA_NOREF;
+	}
+#if PRINT_DEBUGS == 1
 	printf( "GC'ed "T_HTP_CON_TYPE" connection: %p\n", c );
+#endif
 
 	return 0;
 }
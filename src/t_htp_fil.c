@@ -0,0 +1,771 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_htp_fil.c
+ * \brief     Static files for T.Http.Server (T.Http.Files)
+ * \detail    The most recently used files are kept open along with their
+ *            formatted header lines (Content-Type, ETag, Last-Modified), up
+ *            to a total size.  Serving a cached file assembles the response
+ *            head from those lines and sends the body with sendfile(), so it
+ *            neither gets copied nor faulted in on the loop thread.
+ *            Conditional requests
+ *            (If-None-Match, If-Modified-Since) get answered with 304 from
+ *            the cache as well.  Cached files are trusted for T_HTP_FIL_TTL
+ *            seconds before they get checked for changes; files should be
+ *            replaced (rename()) rather than rewritten in place.
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+
+#include <stdlib.h>               // malloc, free
+#include <string.h>               // memcpy, memcmp, strlen
+#include <stdio.h>                // snprintf
+#include <limits.h>               // PATH_MAX
+#include <time.h>                 // gmtime_r, timegm
+#include <fcntl.h>                // open
+#include <unistd.h>               // close
+#include <sys/stat.h>             // stat, fstat
+
+#include "t.h"
+#include "t_htp.h"
+
+
+/// Content-Type by file extension
+static const struct {
+	const char *x;
+	const char *t;
+} t_htp_fil_types [] = {
+	  { "html",  "text/html; charset=utf-8" }
+	, { "htm",   "text/html; charset=utf-8" }
+	, { "css",   "text/css; charset=utf-8" }
+	, { "js",    "text/javascript; charset=utf-8" }
+	, { "mjs",   "text/javascript; charset=utf-8" }
+	, { "json",  "application/json" }
+	, { "txt",   "text/plain; charset=utf-8" }
+	, { "xml",   "application/xml" }
+	, { "svg",   "image/svg+xml" }
+	, { "png",   "image/png" }
+	, { "jpg",   "image/jpeg" }
+	, { "jpeg",  "image/jpeg" }
+	, { "gif",   "image/gif" }
+	, { "webp",  "image/webp" }
+	, { "ico",   "image/x-icon" }
+	, { "wasm",  "application/wasm" }
+	, { "woff",  "font/woff" }
+	, { "woff2", "font/woff2" }
+	, { "pdf",   "application/pdf" }
+	, { "mp4",   "video/mp4" }
+	, { NULL,    NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * Find the Content-Type of a file by its extension.
+ * \param   const char*  path of the file.
+ * \param   size_t       length of the path.
+ * \return  const char*  the Content-Type.
+ * --------------------------------------------------------------------------*/
+static const char
+*t_htp_fil_type( const char *k, size_t kl )
+{
+	size_t i = kl;
+	size_t xl;
+	int    n;
+
+	while (i > 0 && '.' != k[ i-1 ] && '/' != k[ i-1 ])
+		i--;
+	if (i > 0 && '.' == k[ i-1 ])
+		for (xl = kl - i, n=0; NULL != t_htp_fil_types[ n ].x; n++)
+			if (xl == strlen( t_htp_fil_types[ n ].x ) && t_htp_ieq( k+i, t_htp_fil_types[ n ].x, xl ))
+				return t_htp_fil_types[ n ].t;
+	return "application/octet-stream";
+}
+
+
+/**--------------------------------------------------------------------------
+ * Value of a hex digit.
+ * \param   char   digit.
+ * \return  int    value; -1 if c is not a hex digit.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_fil_hex( char c )
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Turn the path of an url into the path of a file below the document root.
+ * \detail  Percent encoding gets decoded, empty and '.' segments get dropped.
+ *          Paths containing '..' segments or NUL bytes are refused.  Paths
+ *          ending in '/' get T_HTP_FIL_IDX appended.
+ * \param   const char*  path.
+ * \param   size_t       length of the path.
+ * \param   char*        buffer for the file path; relative, no leading '/'.
+ * \param   size_t       size of the buffer.
+ * \return  size_t       length of the file path; 0 if refused.
+ * --------------------------------------------------------------------------*/
+static size_t
+t_htp_fil_path( const char *u, size_t ul, char *k, size_t mx )
+{
+	size_t i;
+	size_t n  = 0;            ///< bytes in k
+	size_t sg = 0;            ///< start of the current segment in k
+	int    c, h, l;
+
+	for (i=0; i <= ul; i++)
+	{
+		c = (i < ul) ? (unsigned char) u[ i ] : '/';
+		if ('%' == c)
+		{
+			if (i+2 >= ul || (h = t_htp_fil_hex( u[ i+1 ] )) < 0 || (l = t_htp_fil_hex( u[ i+2 ] )) < 0
+			 || 0 == (c = h*16 + l))
+				return 0;
+			i += 2;
+		}
+		if ('/' != c)
+		{
+			if (n+1 >= mx)
+				return 0;
+			k[ n++ ] = (char) c;
+			continue;
+		}
+		// end of a segment
+		if (n == sg)
+			continue;
+		if (1 == n-sg && '.' == k[ sg ])
+		{
+			n = sg;
+			continue;
+		}
+		if (2 == n-sg && '.' == k[ sg ] && '.' == k[ sg+1 ])
+			return 0;
+		if (i == ul)            // the last segment names a file
+			return n;
+		if (n+1 >= mx)
+			return 0;
+		k[ n++ ] = '/';
+		sg = n;
+	}
+	if (n + sizeof( T_HTP_FIL_IDX ) > mx)
+		return 0;
+	memcpy( k+n, T_HTP_FIL_IDX, sizeof( T_HTP_FIL_IDX ) - 1 );
+	return n + sizeof( T_HTP_FIL_IDX ) - 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Parse digits of fixed length.
+ * \param   const char*  digits.
+ * \param   int          # of digits.
+ * \return  int          value; -1 if not all are digits.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_fil_num( const char *v, int n )
+{
+	int r = 0;
+
+	for (; n > 0; n--, v++)
+	{
+		if (*v < '0' || *v > '9')
+			return -1;
+		r = r*10 + (*v - '0');
+	}
+	return r;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Parse a HTTP date as sent in Date headers; Sun, 06 Nov 1994 08:49:37 GMT.
+ * \detail  The obsolete formats of RFC 850 and asctime() are not understood;
+ *          conditions using them get ignored.
+ * \param   const char*  date.
+ * \param   size_t       length of the date.
+ * \return  time_t       the time; -1 if it can't be parsed.
+ * --------------------------------------------------------------------------*/
+static time_t
+t_htp_fil_date( const char *v, size_t vl )
+{
+	static const char mn[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	struct tm         tm;
+	int               i;
+
+	if (29 != vl || ',' != v[ 3 ] || 0 != memcmp( v+25, " GMT", 4 ))
+		return -1;
+	for (i=0; i < 12 && 0 != memcmp( mn + 3*i, v+8, 3 ); i++) ;
+	memset( &tm, 0, sizeof( tm ) );
+	tm.tm_mon  = i;
+	tm.tm_mday = t_htp_fil_num( v+5,  2 );
+	tm.tm_year = t_htp_fil_num( v+12, 4 ) - 1900;
+	tm.tm_hour = t_htp_fil_num( v+17, 2 );
+	tm.tm_min  = t_htp_fil_num( v+20, 2 );
+	tm.tm_sec  = t_htp_fil_num( v+23, 2 );
+	if (12 == i || tm.tm_mday < 0 || tm.tm_year < 0 ||
+	    tm.tm_hour < 0 || tm.tm_min < 0 || tm.tm_sec < 0)
+		return -1;
+	return timegm( &tm );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if the client has the current version of a file already.
+ * \detail  If-None-Match takes precedence over If-Modified-Since.  ETags get
+ *          compared weakly as required for GET and HEAD.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \param   struct t_htp_fen*  file.
+ * \return  int    1 if a 304 can be sent, else 0.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_fil_fresh( struct t_htp_str *s, struct t_htp_fen *e )
+{
+	size_t      vl = 0;
+	size_t      el = strlen( e->et );
+	const char *v  = t_htp_str_getheader( s, "if-none-match", 13, &vl );
+	const char *x  = v + vl;
+	const char *r;
+	const char *t;            ///< end of the trimmed tag
+	time_t      ims;
+
+	if (NULL != v)
+	{
+		for (; v < x; v = r+1)
+		{
+			for (; v < x && (' ' == *v || '\t' == *v); v++) ;
+			for (r = v; r < x && ',' != *r; r++) ;
+			for (t = r; t > v && (' ' == t[ -1 ] || '\t' == t[ -1 ]); t--) ;
+			if (t - v >= 2 && 'W' == v[ 0 ] && '/' == v[ 1 ])
+				v += 2;
+			if ((1 == t - v && '*' == *v) ||
+			    ((size_t) (t - v) == el && 0 == memcmp( v, e->et, el )))
+				return 1;
+		}
+		return 0;
+	}
+	if (NULL != (v = t_htp_str_getheader( s, "if-modified-since", 17, &vl )))
+		return -1 != (ims = t_htp_fil_date( v, vl )) && e->mt <= ims;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Open a file and push it as T.Http.Files.Entry.
+ * \param   L      Lua state.
+ * \param   const char*  path of the file.
+ * \param   const char*  path relative to the document root.
+ * \param   size_t       length of the relative path.
+ * \return  struct t_htp_fen*  the entry; NULL and nothing pushed if the file
+ *                             isn't a readable regular file.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_fen
+*t_htp_fil_load( lua_State *L, const char *fp, const char *k, size_t kl )
+{
+	struct t_htp_fen *e  = (struct t_htp_fen *) lua_newuserdata( L, sizeof( struct t_htp_fen ) );
+	struct stat       st;
+	struct tm         tm;
+	int               fd;
+
+	memset( e, 0, sizeof( struct t_htp_fen ) );
+	e->fd = -1;
+	e->kR = LUA_NOREF;
+	e->hR = LUA_NOREF;
+	luaL_getmetatable( L, T_HTP_FEN_TYPE );
+	lua_setmetatable( L, -2 );
+
+	if (-1 == (fd = open( fp, O_RDONLY | O_CLOEXEC )))
+	{
+		lua_pop( L, 1 );
+		return NULL;
+	}
+	if (-1 == fstat( fd, &st ) || ! S_ISREG( st.st_mode ))
+	{
+		close( fd );
+		lua_pop( L, 1 );
+		return NULL;
+	}
+	e->fd  = fd;
+	e->sz  = (size_t) st.st_size;
+	e->mt  = st.st_mtime;
+	e->ino = st.st_ino;
+
+	gmtime_r( &e->mt, &tm );
+	strftime( e->lm, sizeof( e->lm ), "%a, %d %b %Y %H:%M:%S GMT", &tm );
+	snprintf( e->et, sizeof( e->et ), "\"%llx-%llx\"",
+		(unsigned long long) st.st_mtime, (unsigned long long) st.st_size );
+	lua_pushfstring( L, "Content-Type: %s\r\nETag: %s\r\nLast-Modified: %s\r\n",
+		t_htp_fil_type( k, kl ), e->et, e->lm );
+	e->hR = luaL_ref( L, LUA_REGISTRYINDEX );
+	return e;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Take an entry out of the cache.
+ * \detail  The file stays open until no chunk being sent references it.
+ * \param   L      Lua state.
+ * \param   struct t_htp_fil*.
+ * \param   struct t_htp_fen*  entry.
+ * \param   int    stack position of the cache table.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_fil_evict( lua_State *L, struct t_htp_fil *f, struct t_htp_fen *e, int ti )
+{
+	lua_rawgeti( L, LUA_REGISTRYINDEX, e->kR );
+	lua_pushnil( L );
+	lua_rawset( L, ti );
+	luaL_unref( L, LUA_REGISTRYINDEX, e->kR );
+	e->kR = LUA_NOREF;
+
+	if (NULL == e->prv)
+		f->hd = e->nxt;
+	else
+		e->prv->nxt = e->nxt;
+	if (NULL == e->nxt)
+		f->tl = e->prv;
+	else
+		e->nxt->prv = e->prv;
+	e->nxt  = NULL;
+	e->prv  = NULL;
+	e->fil  = NULL;
+	f->use -= e->sz;
+	f->n--;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Add the entry on top of the stack to the cache as most recently used.
+ * \detail  Evicts the least recently used entries until the cache fits.
+ * \param   L      Lua state.
+ * \param   struct t_htp_fil*.
+ * \param   struct t_htp_fen*  entry; on top of the stack.
+ * \param   const char*  key; path relative to the document root.
+ * \param   size_t       length of the key.
+ * \param   int    stack position of the cache table.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_fil_insert( lua_State *L, struct t_htp_fil *f, struct t_htp_fen *e,
+	const char *k, size_t kl, int ti )
+{
+	lua_pushlstring( L, k, kl );
+	lua_pushvalue( L, -1 );
+	e->kR = luaL_ref( L, LUA_REGISTRYINDEX );
+	lua_pushvalue( L, -2 );
+	lua_rawset( L, ti );
+
+	e->fil = f;
+	e->prv = NULL;
+	e->nxt = f->hd;
+	if (NULL == f->hd)
+		f->tl = e;
+	else
+		f->hd->prv = e;
+	f->hd   = e;
+	f->use += e->sz;
+	f->n++;
+	while (f->use > f->csz && f->tl != e)
+		t_htp_fil_evict( L, f, f->tl, ti );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Mark an entry as most recently used.
+ * \param   struct t_htp_fil*.
+ * \param   struct t_htp_fen*  cached entry.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_fil_touch( struct t_htp_fil *f, struct t_htp_fen *e )
+{
+	if (f->hd == e)
+		return;
+	e->prv->nxt = e->nxt;
+	if (NULL == e->nxt)
+		f->tl = e->prv;
+	else
+		e->nxt->prv = e->prv;
+	e->prv      = NULL;
+	e->nxt      = f->hd;
+	f->hd->prv  = e;
+	f->hd       = e;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Respond with a file; 304 if the client has it already.
+ * \detail  The head gets assembled from the formatted header lines of the
+ *          entry, the body gets sent from the open file by sendfile().  A
+ *          file truncated meanwhile closes the connection.  Expects the
+ *          stream on stack position 1.
+ * \param   L      Lua state.
+ * \param   struct t_htp_str*.
+ * \param   struct t_htp_fen*  entry.
+ * \param   int    stack position of the entry.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_fil_respond( lua_State *L, struct t_htp_str *s, struct t_htp_fen *e, int ei )
+{
+	int          code = (t_htp_fil_fresh( s, e )) ? 304 : 200;
+	int          body = (200 == code && T_HTP_MTH_HEAD != s->mth && e->sz > 0);
+	int          hi;
+	luaL_Buffer  lB;
+
+	lua_rawgeti( L, LUA_REGISTRYINDEX, e->hR );
+	hi = lua_gettop( L );
+	luaL_buffinit( L, &lB );
+	t_htp_str_formHeader( L, &lB, s, code, NULL, (long long) e->sz, hi, 0 );
+	luaL_pushresult( &lB );
+	s->state = T_HTP_STR_FINISH;
+	t_htp_str_addbuffer( L, s, lB.n, ! body );
+	lua_pop( L, 1 );          // the header lines
+	if (body)
+	{
+		lua_pushvalue( L, ei );  // keeps the file open
+		t_htp_str_addfile( L, s, e->fd, 0, 0, e->sz, 1 );
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Respond with an error status.  Expects the stream on stack position 1.
+ * \param   L      Lua state.
+ * \param   struct t_htp_str*.
+ * \param   int    status code; 404 or 405.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_fil_reject( lua_State *L, struct t_htp_str *s, int code )
+{
+	const char  *m = t_htp_status( code );
+	int          hi;
+	luaL_Buffer  lB;
+
+	lua_pushstring( L, (405 == code) ? "Allow: GET, HEAD\r\n" : "" );
+	hi = lua_gettop( L );
+	luaL_buffinit( L, &lB );
+	t_htp_str_formHeader( L, &lB, s, code, m, (long long) strlen( m ), hi, 0 );
+	if (T_HTP_MTH_HEAD != s->mth)
+		luaL_addstring( &lB, m );
+	luaL_pushresult( &lB );
+	s->state = T_HTP_STR_FINISH;
+	t_htp_str_addbuffer( L, s, lB.n, 1 );
+	lua_pop( L, 1 );          // the header lines
+}
+
+
+/**--------------------------------------------------------------------------
+ * Respond to a request with a file below the document root.
+ * \detail  Only GET and HEAD get served, anything else gets a 405.  Missing
+ *          files get a 404.  The stream gets finished either way.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Files userdata instance.
+ * \lparam  ud     T.Http.Stream userdata instance.
+ * \lparam  string path (optional; default the path of the url).
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_fil__call( lua_State *L )
+{
+	struct t_htp_fil *f  = t_htp_fil_check_ud( L, 1, 1 );
+	struct t_htp_str *s  = t_htp_str_check_ud( L, 2, 1 );
+	struct t_htp_srv *srv;
+	struct t_htp_fen *e;
+	const char       *u;
+	size_t            ul;
+	size_t            kl;
+	char              fp[ PATH_MAX ];
+	struct stat       st;
+
+	luaL_argcheck( L, NULL != s->hd, 2, "request head not received yet" );
+	luaL_argcheck( L, T_HTP_STR_SEND != s->state && T_HTP_STR_FINISH != s->state,
+		2, "response already started" );
+	if (lua_isnoneornil( L, 3 ))
+	{
+		u = s->hd + s->uo;
+		for (ul = 0; ul < s->ul && '?' != u[ ul ] && '#' != u[ ul ]; ul++) ;
+	}
+	else
+		u = luaL_checklstring( L, 3, &ul );
+	// t_htp_str_addbuffer() expects the stream on position 1
+	lua_settop( L, 3 );
+	lua_rotate( L, 1, -1 );                        //S: str,path,fil
+	srv = s->con->srv;
+
+	if (T_HTP_MTH_GET != s->mth && T_HTP_MTH_HEAD != s->mth)
+	{
+		t_htp_fil_reject( L, s, 405 );
+		return 0;
+	}
+	if (f->rl + 1 >= sizeof( fp ) ||
+	    0 == (kl = t_htp_fil_path( u, ul, fp + f->rl + 1, sizeof( fp ) - f->rl - 1 )))
+	{
+		t_htp_fil_reject( L, s, 404 );
+		return 0;
+	}
+	memcpy( fp, f->rt, f->rl );
+	fp[ f->rl ]          = '/';
+	fp[ f->rl + 1 + kl ] = '\0';
+
+	lua_getuservalue( L, 3 );
+	lua_pushlstring( L, fp + f->rl + 1, kl );
+	lua_rawget( L, 4 );                            //S: str,path,fil,cache,entry
+	e = (struct t_htp_fen *) lua_touserdata( L, 5 );
+	t_htp_srv_setnow( srv, 0 );
+	if (NULL != e && srv->nw - e->ck >= T_HTP_FIL_TTL)
+	{
+		if (0 == stat( fp, &st ) && S_ISREG( st.st_mode ) && st.st_mtime == e->mt &&
+		    (size_t) st.st_size == e->sz && st.st_ino == e->ino)
+			e->ck = srv->nw;
+		else
+		{
+			t_htp_fil_evict( L, f, e, 4 );
+			e = NULL;
+		}
+	}
+	if (NULL == e)
+	{
+		lua_pop( L, 1 );
+		if (NULL == (e = t_htp_fil_load( L, fp, fp + f->rl + 1, kl )))
+		{
+			t_htp_fil_reject( L, s, 404 );
+			return 0;
+		}
+		e->ck = srv->nw;
+		// too large ones get sent and dropped
+		if (e->sz <= f->fmx && e->sz <= f->csz)
+			t_htp_fil_insert( L, f, e, fp + f->rl + 1, kl, 4 );
+	}
+	else
+		t_htp_fil_touch( f, e );
+	t_htp_fil_respond( L, s, e, 5 );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Construct a T.Http.Files.
+ * \param   L      Lua state.
+ * \lparam  CLASS  table Http.Files.
+ * \lparam  string document root; a directory.
+ * \lparam  int    most bytes of files kept open (optional).
+ * \lparam  int    largest file kept open (optional).
+ * \lreturn ud     T.Http.Files userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_fil__Call( lua_State *L )
+{
+	size_t            rl;
+	const char       *rt  = luaL_checklstring( L, 2, &rl );
+	lua_Integer       csz = luaL_optinteger( L, 3, T_HTP_FIL_CSZ );
+	lua_Integer       fmx = luaL_optinteger( L, 4, T_HTP_FIL_FMX );
+	struct t_htp_fil *f;
+	struct stat       st;
+
+	luaL_argcheck( L, csz >= 0, 3, "size must not be negative" );
+	luaL_argcheck( L, fmx >= 0, 4, "size must not be negative" );
+	if (-1 == stat( rt, &st ) || ! S_ISDIR( st.st_mode ))
+		return t_push_error( L, "Can't serve files from `%s`; not a directory", rt );
+	f = t_htp_fil_create_ud( L, rt, rl );
+	f->csz = (size_t) csz;
+	f->fmx = (size_t) fmx;
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Create a t_htp_fil and push to LuaStack.
+ * \param   L  The lua state.
+ * \param   const char*  document root.
+ * \param   size_t       length of the document root.
+ *
+ * \return  struct t_htp_fil*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_fil
+*t_htp_fil_create_ud( lua_State *L, const char *rt, size_t rl )
+{
+	struct t_htp_fil *f;
+
+	f = (struct t_htp_fil *) lua_newuserdata( L, sizeof( struct t_htp_fil ) );
+	f->rt  = NULL;
+	f->rl  = 0;
+	f->csz = T_HTP_FIL_CSZ;
+	f->fmx = T_HTP_FIL_FMX;
+	f->use = 0;
+	f->n   = 0;
+	f->hd  = NULL;
+	f->tl  = NULL;
+	luaL_getmetatable( L, T_HTP_FIL_TYPE );
+	lua_setmetatable( L, -2 );
+	lua_newtable( L );
+	lua_setuservalue( L, -2 );
+
+	while (rl > 0 && '/' == rt[ rl-1 ])
+		rl--;
+	if (NULL == (f->rt = (char *) malloc( rl+1 )))
+		t_push_error( L, "Failed to allocate "T_HTP_FIL_TYPE );
+	memcpy( f->rt, rt, rl );
+	f->rt[ rl ] = '\0';
+	f->rl       = rl;
+	return f;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if the item on stack position pos is an t_htp_fil struct and return it
+ * \param  L    the Lua State
+ * \param  pos      position on the stack
+ *
+ * \return  struct t_htp_fil*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_fil
+*t_htp_fil_check_ud( lua_State *L, int pos, int check )
+{
+	void *ud = luaL_testudata( L, pos, T_HTP_FIL_TYPE );
+	luaL_argcheck( L, (ud != NULL || !check), pos, "`"T_HTP_FIL_TYPE"` expected" );
+	return (NULL==ud) ? NULL : (struct t_htp_fil *) ud;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __tostring (print) representation of a T.Http.Files instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_fil  The Files instance user_data.
+ * \lreturn string     formatted string representing T.Http.Files.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_fil__tostring( lua_State *L )
+{
+	struct t_htp_fil *f = t_htp_fil_check_ud( L, 1, 1 );
+
+	lua_pushfstring( L, T_HTP_FIL_TYPE"{%s:%d}: %p", f->rt, f->n, f );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __len (#) of a T.Http.Files instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_fil  The Files instance user_data.
+ * \lreturn int        # of files cached.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_fil__len( lua_State *L )
+{
+	struct t_htp_fil *f = t_htp_fil_check_ud( L, 1, 1 );
+
+	lua_pushinteger( L, f->n );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Files instance.
+ * \detail  The entries go with the cache table; each closes its file once no
+ *          chunk being sent references it any more.
+ * \param   L      The lua state.
+ * \lparam  t_htp_fil  The Files instance user_data.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_fil__gc( lua_State *L )
+{
+	struct t_htp_fil *f = t_htp_fil_check_ud( L, 1, 1 );
+
+	free( f->rt );
+	f->rt = NULL;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Files.Entry; closes the file.
+ * \param   L      The lua state.
+ * \lparam  t_htp_fen  The Entry instance user_data.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_fen__gc( lua_State *L )
+{
+	struct t_htp_fen *e = (struct t_htp_fen *) luaL_checkudata( L, 1, T_HTP_FEN_TYPE );
+
+	if (-1 != e->fd)
+		close( e->fd );
+	e->fd = -1;
+	luaL_unref( L, LUA_REGISTRYINDEX, e->hR );
+	luaL_unref( L, LUA_REGISTRYINDEX, e->kR );
+	e->hR = LUA_NOREF;
+	e->kR = LUA_NOREF;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Class metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_fil_fm [] = {
+	  { "__call",        lt_htp_fil__Call }
+	, { NULL,            NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * Class functions library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_fil_cf [] = {
+	  { NULL,   NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * Objects metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_fil_m [] = {
+	  { "__call",        lt_htp_fil__call }
+	, { "__len",         lt_htp_fil__len }
+	, { "__gc",          lt_htp_fil__gc }
+	, { "__tostring",    lt_htp_fil__tostring }
+	, { NULL,    NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * Entry metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_fen_m [] = {
+	  { "__gc",          lt_htp_fen__gc }
+	, { NULL,    NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * \brief   pushes this library onto the stack
+ *          - creates Metatable with functions
+ *          - creates metatable with methods
+ * \param   L      The lua state.
+ * \lreturn table  the library
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+LUAMOD_API int
+luaopen_t_htp_fil( lua_State *L )
+{
+	// T.Http.Files.Entry instance metatable
+	luaL_newmetatable( L, T_HTP_FEN_TYPE );
+	luaL_setfuncs( L, t_htp_fen_m, 0 );
+	lua_pop( L, 1 );
+
+	// T.Http.Files instance metatable
+	luaL_newmetatable( L, T_HTP_FIL_TYPE );
+	luaL_setfuncs( L, t_htp_fil_m, 0 );
+	lua_setfield( L, -1, "__index" );
+
+	// T.Http.Files class
+	luaL_newlib( L, t_htp_fil_cf );
+	luaL_newlib( L, t_htp_fil_fm );
+	lua_setmetatable( L, -2 );
+	return 1;
+}
@@ -0,0 +1,661 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_htp_rte.c
+ * \brief     Route table for T.Http.Server (T.Http.Router)
+ * \detail    Routes get compiled into a radix tree over path segments.  A
+ *            pattern consists of static segments, segments capturing one
+ *            segment (:name) and a last segment capturing the rest of the
+ *            path (*name).  Requests get resolved straight from the url
+ *            offsets of the parsed head; only captured segments become Lua
+ *            strings and get handed to the handler as extra arguments in
+ *            pattern order.  Static segments take precedence over :name,
+ *            which takes precedence over *name.  Captures are not decoded.
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+
+#include <stdlib.h>               // malloc, realloc, free
+#include <string.h>               // memchr, memcmp, memcpy, memmove
+
+#include "t.h"
+#include "t_htp.h"
+
+
+/**--------------------------------------------------------------------------
+ * Create a node of the route table.
+ * \param   L      Lua state.
+ * \param   const char*  static segments; NULL for a capturing node.
+ * \param   size_t       length of the static segments.
+ * \return  struct t_htp_rtn*  the node; not linked to the table yet.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_rtn
+*t_htp_rte_node( lua_State *L, const char *lb, size_t ll )
+{
+	struct t_htp_rtn *n = (struct t_htp_rtn *) malloc( sizeof( struct t_htp_rtn ) );
+	char             *b = (NULL == lb) ? NULL : (char *) malloc( ll+1 );
+	const char       *e;
+	size_t            i;
+
+	if (NULL == n || (NULL != lb && NULL == b))
+	{
+		free( n );
+		free( b );
+		t_push_error( L, "Failed to allocate "T_HTP_RTE_TYPE" node" );
+		return NULL;
+	}
+	n->lb = b;
+	n->fl = 0;
+	if (NULL != lb)
+	{
+		memcpy( n->lb, lb, ll );
+		n->lb[ ll ] = '\0';
+		n->fl = (NULL == (e = memchr( lb, '/', ll ))) ? ll : (size_t) (e - lb);
+	}
+	n->ll  = ll;
+	n->ch  = NULL;
+	n->chn = 0;
+	n->pc  = NULL;
+	n->wc  = NULL;
+	n->hn  = 0;
+	n->aR  = LUA_NOREF;
+	for (i=0; i <= T_HTP_MTH_UNSUBSCRIBE; i++)
+		n->mR[ i ] = LUA_NOREF;
+	return n;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Free a node of the route table and everything below it.
+ * \param   L      Lua state.
+ * \param   struct t_htp_rtn*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_rte_free( lua_State *L, struct t_htp_rtn *n )
+{
+	size_t i;
+
+	if (NULL == n)
+		return;
+	for (i=0; i < n->chn; i++)
+		t_htp_rte_free( L, n->ch[ i ] );
+	t_htp_rte_free( L, n->pc );
+	t_htp_rte_free( L, n->wc );
+	luaL_unref( L, LUA_REGISTRYINDEX, n->aR );
+	for (i=0; i <= T_HTP_MTH_UNSUBSCRIBE; i++)
+		luaL_unref( L, LUA_REGISTRYINDEX, n->mR[ i ] );
+	free( n->ch );
+	free( n->lb );
+	free( n );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Find the static child of a node by the first path segment.
+ * \param   struct t_htp_rtn*  node.
+ * \param   const char*  segment.
+ * \param   size_t       length of segment.
+ * \param   size_t*      index of the child or where it would get inserted.
+ * \return  struct t_htp_rtn*  the child; NULL if none.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_rtn
+*t_htp_rte_child( struct t_htp_rtn *n, const char *sg, size_t sl, size_t *idx )
+{
+	size_t            lo = 0;
+	size_t            hi = n->chn;
+	size_t            m;
+	struct t_htp_rtn *c;
+	int               r;
+
+	while (lo < hi)
+	{
+		m = (lo + hi) / 2;
+		c = n->ch[ m ];
+		if (0 == (r = memcmp( sg, c->lb, (sl < c->fl) ? sl : c->fl )))
+			r = (sl < c->fl) ? -1 : (sl > c->fl);
+		if (0 == r)
+		{
+			*idx = m;
+			return c;
+		}
+		if (r < 0)
+			hi = m;
+		else
+			lo = m + 1;
+	}
+	*idx = lo;
+	return NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Add the nodes for a pattern below a node.
+ * \detail  p points to the '/' ahead of the next segment or to e.  A static
+ *          child sharing the leading segments with the pattern gets split at
+ *          the last common segment.
+ * \param   L      Lua state.
+ * \param   struct t_htp_rtn*  node.
+ * \param   const char*  rest of the pattern.
+ * \param   const char*  end of the pattern.
+ * \param   int*         counts the captures of the pattern.
+ * \return  struct t_htp_rtn*  the node the pattern ends at.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_rtn
+*t_htp_rte_insert( lua_State *L, struct t_htp_rtn *n, const char *p, const char *e, int *cn )
+{
+	const char       *sg;        ///< start of the segment
+	const char       *q;         ///< end of the segment
+	const char       *r;         ///< end of the static run
+	struct t_htp_rtn *c;
+	struct t_htp_rtn *m;
+	struct t_htp_rtn **ch;
+	size_t            i;
+	size_t            b;
+
+	if (p == e)
+		return n;
+	sg = p + 1;
+	q  = (NULL == (q = memchr( sg, '/', e - sg ))) ? e : q;
+	if (q > sg && (':' == *sg || '*' == *sg))
+	{
+		if (++(*cn) > T_HTP_RTE_CPN)
+			t_push_error( L, "A route can't have more than %d captures", T_HTP_RTE_CPN );
+		if ('*' == *sg && q != e)
+			t_push_error( L, "*name must be the last segment of a route" );
+		if ('*' == *sg)
+			return (NULL != n->wc) ? n->wc : (n->wc = t_htp_rte_node( L, NULL, 0 ));
+		if (NULL == n->pc)
+			n->pc = t_htp_rte_node( L, NULL, 0 );
+		return t_htp_rte_insert( L, n->pc, q, e, cn );
+	}
+	// the run of static segments which may become a single label
+	for (r = q; r < e && ! (r+1 < e && (':' == r[1] || '*' == r[1])); )
+		r = (NULL == (q = memchr( r+1, '/', e-r-1 ))) ? e : q;
+	q = (NULL == (q = memchr( sg, '/', e - sg ))) ? e : q;
+
+	if (NULL == (c = t_htp_rte_child( n, sg, q - sg, &i )))
+	{
+		c  = t_htp_rte_node( L, sg, r - sg );
+		ch = (struct t_htp_rtn **) realloc( n->ch, (n->chn+1) * sizeof( struct t_htp_rtn * ) );
+		if (NULL == ch)
+		{
+			t_htp_rte_free( L, c );
+			t_push_error( L, "Failed to allocate "T_HTP_RTE_TYPE" node" );
+		}
+		memmove( ch+i+1, ch+i, (n->chn - i) * sizeof( struct t_htp_rtn * ) );
+		ch[ i ] = c;
+		n->ch   = ch;
+		n->chn++;
+		return t_htp_rte_insert( L, c, r, e, cn );
+	}
+	for (b=0; b < c->ll && b < (size_t) (r - sg) && c->lb[ b ] == sg[ b ]; b++) ;
+	if (b == c->ll && (b == (size_t) (r - sg) || '/' == sg[ b ]))
+		return t_htp_rte_insert( L, c, sg + b, e, cn );
+	// back off to the last segment boundary both share; at worst the first
+	while (! ('/' == c->lb[ b ] && (b == (size_t) (r - sg) || '/' == sg[ b ])))
+		b--;
+	m = t_htp_rte_node( L, c->lb, b );
+	if (NULL == (m->ch = (struct t_htp_rtn **) malloc( sizeof( struct t_htp_rtn * ) )))
+	{
+		t_htp_rte_free( L, m );
+		t_push_error( L, "Failed to allocate "T_HTP_RTE_TYPE" node" );
+	}
+	memmove( c->lb, c->lb + b + 1, c->ll - b );   // includes the '\0'
+	c->ll     -= b + 1;
+	c->fl      = (NULL == (q = memchr( c->lb, '/', c->ll ))) ? c->ll : (size_t) (q - c->lb);
+	m->ch[ 0 ] = c;
+	m->chn     = 1;
+	n->ch[ i ] = m;
+	return t_htp_rte_insert( L, m, sg + b, e, cn );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Find the node a path ends at.
+ * \detail  p points to the '/' ahead of the next segment or to e.  Tries the
+ *          static child first, then the one capturing a segment, then the
+ *          one capturing the rest, and backs off if a branch doesn't end at
+ *          a route.  Captures are stored as start/end pairs in cp.
+ * \param   struct t_htp_rtn*  node.
+ * \param   const char*  rest of the path.
+ * \param   const char*  end of the path.
+ * \param   const char** captures.
+ * \param   int          # of captures so far.
+ * \param   int*         # of captures of the route found.
+ * \return  struct t_htp_rtn*  node with handlers; NULL if none matches.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_rtn
+*t_htp_rte_find( struct t_htp_rtn *n, const char *p, const char *e,
+                 const char **cp, int c, int *cn )
+{
+	const char       *sg;        ///< start of the segment
+	const char       *q;         ///< end of the segment
+	struct t_htp_rtn *x;
+	struct t_htp_rtn *f;
+	size_t            i;
+
+	if (p == e)
+	{
+		*cn = c;
+		return (n->hn > 0) ? n : NULL;
+	}
+	sg = p + 1;
+	q  = (NULL == (q = memchr( sg, '/', e - sg ))) ? e : q;
+	if (NULL != (x = t_htp_rte_child( n, sg, q - sg, &i ))
+	 && x->ll <= (size_t) (e - sg) && 0 == memcmp( sg, x->lb, x->ll )
+	 && (sg + x->ll == e || '/' == sg[ x->ll ])
+	 && NULL != (f = t_htp_rte_find( x, sg + x->ll, e, cp, c, cn )))
+		return f;
+	if (NULL != n->pc && q > sg)
+	{
+		cp[ 2*c ]   = sg;
+		cp[ 2*c+1 ] = q;
+		if (NULL != (f = t_htp_rte_find( n->pc, q, e, cp, c+1, cn )))
+			return f;
+	}
+	if (NULL != n->wc && n->wc->hn > 0)
+	{
+		cp[ 2*c ]   = sg;
+		cp[ 2*c+1 ] = e;
+		*cn         = c+1;
+		return n->wc;
+	}
+	return NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Pick the handler of a route for a method.
+ * \detail  HEAD requests fall back to the GET handler.
+ * \param   struct t_htp_rtn*  node with handlers.
+ * \param   enum t_htp_mth     method.
+ * \return  int  Lua registry reference; LUA_NOREF if the method isn't allowed.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_rte_handler( struct t_htp_rtn *n, enum t_htp_mth mth )
+{
+	if (LUA_NOREF != n->mR[ mth ])
+		return n->mR[ mth ];
+	if (T_HTP_MTH_HEAD == mth && LUA_NOREF != n->mR[ T_HTP_MTH_GET ])
+		return n->mR[ T_HTP_MTH_GET ];
+	return n->aR;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Find the route for a url.
+ * \detail  Query and fragment are not part of the path.
+ * \param   struct t_htp_rte*  router.
+ * \param   const char*  url.
+ * \param   size_t       length of url.
+ * \param   const char** captures; 2*T_HTP_RTE_CPN slots.
+ * \param   int*         # of captures.
+ * \return  struct t_htp_rtn*  node with handlers; NULL if none matches.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_rtn
+*t_htp_rte_match( struct t_htp_rte *r, const char *u, size_t ul, const char **cp, int *cn )
+{
+	size_t l;
+
+	for (l=0; l < ul && '?' != u[ l ] && '#' != u[ l ]; l++) ;
+	*cn = 0;
+	return (l > 0 && '/' == *u) ? t_htp_rte_find( r->rt, u, u + l, cp, 0, cn ) : NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Answer a request no route handles with 404 or 405.
+ * \detail  HEAD requests get the same head, Content-Length included, but no
+ *          body.
+ * \param   L      Lua state.
+ * \param   struct t_htp_rtn*  node the path ended at; NULL if none.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \param   int    stack position of the stream.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_rte_reject( lua_State *L, struct t_htp_rtn *n, struct t_htp_str *s, int si )
+{
+	int          sc = (NULL == n) ? 404 : 405;
+	const char  *m  = t_htp_status( sc );
+	luaL_Buffer  lB;
+	int          i;
+
+	lua_getfield( L, si, "writeHead" );
+	lua_pushvalue( L, si );
+	lua_pushinteger( L, sc );
+	lua_pushinteger( L, (lua_Integer) strlen( m ) );
+	if (NULL != n)
+	{
+		lua_createtable( L, 0, 1 );
+		luaL_buffinit( L, &lB );
+		for (i=0; i <= T_HTP_MTH_UNSUBSCRIBE; i++)
+			if (LUA_NOREF != n->mR[ i ])
+			{
+				if (lB.n > 0)
+					luaL_addlstring( &lB, ", ", 2 );
+				luaL_addstring( &lB, t_htp_mthname( (enum t_htp_mth) i ) );
+			}
+		luaL_pushresult( &lB );
+		lua_setfield( L, -2, "Allow" );
+	}
+	lua_call( L, (NULL == n) ? 3 : 4, 0 );
+	lua_getfield( L, si, "finish" );
+	lua_pushvalue( L, si );
+	if (T_HTP_MTH_HEAD == s->mth)
+		lua_call( L, 1, 0 );
+	else
+	{
+		lua_pushstring( L, m );
+		lua_call( L, 2, 0 );
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Hand a request to the handler of its route.
+ * \detail  Called once the request head is parsed.  The handler gets the
+ *          stream and the captures of the route.  Requests without a route
+ *          go to the fallback handler, or get answered with 404 or 405.
+ * \param   L      Lua state.
+ * \param   struct t_htp_rte*  router.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \param   int    stack position of the stream.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_rte_dispatch( lua_State *L, struct t_htp_rte *r, struct t_htp_str *s, int si )
+{
+	const char       *cp[ 2*T_HTP_RTE_CPN ];
+	int               cn;
+	int               i;
+	int               ref = LUA_NOREF;
+	struct t_htp_rtn *n   = t_htp_rte_match( r, s->hd + s->uo, s->ul, cp, &cn );
+
+	if (NULL != n && LUA_NOREF != (ref = t_htp_rte_handler( n, s->mth )))
+	{
+		lua_rawgeti( L, LUA_REGISTRYINDEX, ref );
+		lua_pushvalue( L, si );
+		luaL_checkstack( L, cn, "too many captures" );
+		for (i=0; i<cn; i++)
+			lua_pushlstring( L, cp[ 2*i ], cp[ 2*i+1 ] - cp[ 2*i ] );
+		lua_call( L, 1+cn, 0 );
+	}
+	else if (LUA_NOREF != r->fR)
+	{
+		lua_rawgeti( L, LUA_REGISTRYINDEX, r->fR );
+		lua_pushvalue( L, si );
+		lua_call( L, 1, 0 );
+	}
+	else
+		t_htp_rte_reject( L, n, s, si );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Construct a T.Http.Router.
+ * \param   L      Lua state.
+ * \lparam  CLASS  table Http.Router.
+ * \lparam  func   handler for requests without a route (optional).
+ * \lreturn ud     T.Http.Router userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rte__Call( lua_State *L )
+{
+	struct t_htp_rte *r;
+
+	if (! lua_isnoneornil( L, 2 ))
+		luaL_checktype( L, 2, LUA_TFUNCTION );
+	r = t_htp_rte_create_ud( L );
+	if (! lua_isnoneornil( L, 2 ))
+	{
+		lua_pushvalue( L, 2 );
+		r->fR = luaL_ref( L, LUA_REGISTRYINDEX );
+	}
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Create a t_htp_rte and push to LuaStack.
+ * \param   L  The lua state.
+ *
+ * \return  struct t_htp_rte*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_rte
+*t_htp_rte_create_ud( lua_State *L )
+{
+	struct t_htp_rte *r;
+
+	r = (struct t_htp_rte *) lua_newuserdata( L, sizeof( struct t_htp_rte ) );
+	r->rt = NULL;
+	r->fR = LUA_NOREF;
+	r->n  = 0;
+	luaL_getmetatable( L, T_HTP_RTE_TYPE );
+	lua_setmetatable( L, -2 );
+	r->rt = t_htp_rte_node( L, "", 0 );
+	return r;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check if the item on stack position pos is an t_htp_rte struct and return it
+ * \param  L    the Lua State
+ * \param  pos      position on the stack
+ *
+ * \return  struct t_htp_rte*  pointer to the struct.
+ * --------------------------------------------------------------------------*/
+struct t_htp_rte
+*t_htp_rte_check_ud( lua_State *L, int pos, int check )
+{
+	void *ud = luaL_testudata( L, pos, T_HTP_RTE_TYPE );
+	luaL_argcheck( L, (ud != NULL || !check), pos, "`"T_HTP_RTE_TYPE"` expected" );
+	return (NULL==ud) ? NULL : (struct t_htp_rte *) ud;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Add a route.
+ * \detail  A route added again for the same method replaces the handler.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Router userdata instance.
+ * \lparam  string method; '*' for any method without a handler of its own.
+ * \lparam  string pattern; :name captures a segment, a last *name the rest.
+ * \lparam  func   handler; gets the stream and the captures.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rte_add( lua_State *L )
+{
+	struct t_htp_rte *r   = t_htp_rte_check_ud( L, 1, 1 );
+	size_t            ml;
+	size_t            pl;
+	const char       *m   = luaL_checklstring( L, 2, &ml );
+	const char       *p   = luaL_checklstring( L, 3, &pl );
+	enum t_htp_mth    mth = T_HTP_MTH_ILLEGAL;
+	struct t_htp_rtn *n;
+	int              *ref;
+	int               cn  = 0;
+
+	luaL_checktype( L, 4, LUA_TFUNCTION );
+	luaL_argcheck( L, (1 == ml && '*' == *m) || T_HTP_MTH_ILLEGAL != (mth = t_htp_method( m, ml )),
+		2, "unknown HTTP method" );
+	luaL_argcheck( L, pl > 0 && '/' == *p, 3, "pattern must start with '/'" );
+	luaL_argcheck( L, NULL == memchr( p, '?', pl ) && NULL == memchr( p, '#', pl ),
+		3, "pattern must be a path" );
+
+	n   = t_htp_rte_insert( L, r->rt, p, p + pl, &cn );
+	ref = (T_HTP_MTH_ILLEGAL == mth) ? &n->aR : &n->mR[ mth ];
+	if (LUA_NOREF == *ref)
+	{
+		n->hn++;
+		r->n++;
+	}
+	luaL_unref( L, LUA_REGISTRYINDEX, *ref );
+	lua_pushvalue( L, 4 );
+	*ref = luaL_ref( L, LUA_REGISTRYINDEX );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Find the route for a request.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Router userdata instance.
+ * \lparam  string method.
+ * \lparam  string url.
+ * \lreturn func   handler; nil if no route matches.
+ * \lreturn ...    captures.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rte_match( lua_State *L )
+{
+	struct t_htp_rte *r   = t_htp_rte_check_ud( L, 1, 1 );
+	size_t            ml;
+	size_t            ul;
+	const char       *m   = luaL_checklstring( L, 2, &ml );
+	const char       *u   = luaL_checklstring( L, 3, &ul );
+	const char       *cp[ 2*T_HTP_RTE_CPN ];
+	struct t_htp_rtn *n;
+	int               cn;
+	int               i;
+	int               ref;
+
+	if (NULL == (n = t_htp_rte_match( r, u, ul, cp, &cn ))
+	 || LUA_NOREF == (ref = t_htp_rte_handler( n, t_htp_method( m, ml ) )))
+		return 0;
+	lua_rawgeti( L, LUA_REGISTRYINDEX, ref );
+	luaL_checkstack( L, cn, "too many captures" );
+	for (i=0; i<cn; i++)
+		lua_pushlstring( L, cp[ 2*i ], cp[ 2*i+1 ] - cp[ 2*i ] );
+	return 1+cn;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Dispatch a stream; lets a router be used inside a Lua request handler.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Router userdata instance.
+ * \lparam  ud     T.Http.Stream userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rte__call( lua_State *L )
+{
+	struct t_htp_rte *r = t_htp_rte_check_ud( L, 1, 1 );
+	struct t_htp_str *s = t_htp_str_check_ud( L, 2, 1 );
+
+	luaL_argcheck( L, NULL != s->hd, 2, "request head not received yet" );
+	t_htp_rte_dispatch( L, r, s, 2 );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __tostring (print) representation of a T.Http.Router instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_rte  The Router instance user_data.
+ * \lreturn string     formatted string representing T.Http.Router.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rte__tostring( lua_State *L )
+{
+	struct t_htp_rte *r = t_htp_rte_check_ud( L, 1, 1 );
+
+	lua_pushfstring( L, T_HTP_RTE_TYPE"{%d}: %p", r->n, r );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __len (#) of a T.Http.Router instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_rte  The Router instance user_data.
+ * \lreturn int        # of routes.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rte__len( lua_State *L )
+{
+	struct t_htp_rte *r = t_htp_rte_check_ud( L, 1, 1 );
+
+	lua_pushinteger( L, r->n );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Router instance.
+ * \param   L      The lua state.
+ * \lparam  t_htp_rte  The Router instance user_data.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_rte__gc( lua_State *L )
+{
+	struct t_htp_rte *r = t_htp_rte_check_ud( L, 1, 1 );
+
+	t_htp_rte_free( L, r->rt );
+	r->rt = NULL;
+	luaL_unref( L, LUA_REGISTRYINDEX, r->fR );
+	r->fR = LUA_NOREF;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Class metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_rte_fm [] = {
+	  { "__call",        lt_htp_rte__Call }
+	, { NULL,            NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * Class functions library definition
+ * --------------------------------------------------------------------------*/
+static const struct luaL_Reg t_htp_rte_cf [] = {
+	  { NULL,   NULL }
+};
+
+/**--------------------------------------------------------------------------
+ * Objects metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_rte_m [] = {
+	  { "__call",        lt_htp_rte__call }
+	, { "__len",         lt_htp_rte__len }
+	, { "__gc",          lt_htp_rte__gc }
+	, { "__tostring",    lt_htp_rte__tostring }
+	, { "add",           lt_htp_rte_add }
+	, { "match",         lt_htp_rte_match }
+	, { NULL,    NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * \brief   pushes this library onto the stack
+ *          - creates Metatable with functions
+ *          - creates metatable with methods
+ * \param   L      The lua state.
+ * \lreturn table  the library
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+LUAMOD_API int
+luaopen_t_htp_rte( lua_State *L )
+{
+	// T.Http.Router instance metatable
+	luaL_newmetatable( L, T_HTP_RTE_TYPE );
+	luaL_setfuncs( L, t_htp_rte_m, 0 );
+	lua_setfield( L, -1, "__index" );
+
+	// T.Http.Router class
+	luaL_newlib( L, t_htp_rte_cf );
+	luaL_newlib( L, t_htp_rte_fm );
+	lua_setmetatable( L, -2 );
+	return 1;
+}
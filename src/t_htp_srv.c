@@ -8,8 +8,14 @@
  */
 
 
+#include <stdlib.h>               // free
 #include <string.h>               // memset
-#include <time.h>                 // gmtime
+#include <limits.h>               // INT_MAX
+#include <stdio.h>                // snprintf
+#include <time.h>                 // gmtime_r
+#include <unistd.h>               // sysconf
+#include <pthread.h>              // pthread_create, pthread_join
+#include <sys/socket.h>           // bind, setsockopt, SOMAXCONN
 
 #include "t.h"
 #include "t_htp.h"
@@ -20,7 +26,7 @@
  * \param   L      Lua state.
  * \lparam  CLASS  table Http.Server
  * \lparam  ud     T.Loop userdata instance for the Server.
- * \lparam  func   WSAPI style request handler.
+ * \lparam  func   WSAPI style request handler or T.Http.Router.
  * \return  int    # of values pushed onto the stack.
  * \lreturn ud     T.Http.Server userdata instances.
  * \return  int    # of values pushed onto the stack.
@@ -31,17 +37,19 @@ static int lt_htp_srv__Call( lua_State *L )
 	struct t_ael     *l;
 
 	lua_remove( L, 1 );
-	if (lua_isfunction( L, -1 ) && (l = t_ael_check_ud( L, -2, 1 )))
+	if ((lua_isfunction( L, -1 ) || t_htp_rte_check_ud( L, -1, 0 ))
+	 && (l = t_ael_check_ud( L, -2, 1 )))
 	{
 		s     = t_htp_srv_create_ud( L );
 		lua_insert( L, -3 );
-		s->rR = luaL_ref( L, LUA_REGISTRYINDEX );
+		s->rte = t_htp_rte_check_ud( L, -1, 0 );
+		s->rR  = luaL_ref( L, LUA_REGISTRYINDEX );
 
 		s->ael = l;
 		s->lR  = luaL_ref( L, LUA_REGISTRYINDEX );
 	}
 	else
-		return t_push_error( L, T_HTP_SRV_TYPE"( func ) requires a function as parameter" );
+		return t_push_error( L, T_HTP_SRV_TYPE"( loop, func ) requires a function or "T_HTP_RTE_TYPE" as parameter" );
 	return 1;
 }
 
@@ -57,6 +65,28 @@ struct t_htp_srv
 {
 	struct t_htp_srv *s;
 	s = (struct t_htp_srv *) lua_newuserdata( L, sizeof( struct t_htp_srv ));
+	s->sR = LUA_NOREF;
+	s->aR = LUA_NOREF;
+	s->lR = LUA_NOREF;
+	s->rR = LUA_NOREF;
+	s->rte = NULL;
+	s->hR = LUA_NOREF;
+	s->hb = NULL;
+	s->hl = 0;
+	s->bpn = 0;
+	s->tmo[ T_HTP_TMO_NO ]   = 0;
+	s->tmo[ T_HTP_TMO_HEAD ] = T_HTP_SRV_TMH;
+	s->tmo[ T_HTP_TMO_IDLE ] = T_HTP_SRV_TMI;
+	memset( s->tmh, 0, sizeof( s->tmh ) );
+	memset( s->tmt, 0, sizeof( s->tmt ) );
+	s->tiv.tv_sec  = 1;
+	s->tiv.tv_usec = 0;
+	s->zlv = 0;
+	s->zmn = T_HTP_ZIP_MIN;
+	s->zcm = T_HTP_ZIP_CSZ;
+	s->zcs = 0;
+	s->zcR[ 0 ] = LUA_NOREF;
+	s->zcR[ 1 ] = LUA_NOREF;
 	s->nw = time( NULL );
 	t_htp_srv_setnow( s, 1 );
 
@@ -93,14 +123,14 @@ void
 t_htp_srv_setnow( struct t_htp_srv *s, int force )
 {
 	time_t     nw = time( NULL );
-	struct tm *tm_struct;
+	struct tm  tm_struct;    // servers may run in several threads -> gmtime_r
 
 	if ((nw - s->nw) > 0 || force )
 	{
 		s->nw = nw;
-		tm_struct = gmtime( &(s->nw) );
+		gmtime_r( &(s->nw), &tm_struct );
 		/* Sun, 06 Nov 1994 08:49:37 GMT */
-		strftime( s->fnw, 30, "%a, %d %b %Y %H:%M:%S %Z", tm_struct );
+		strftime( s->fnw, 30, "%a, %d %b %Y %H:%M:%S %Z", &tm_struct );
 	}
 }
 
@@ -108,62 +138,47 @@ t_htp_srv_setnow( struct t_htp_srv *s, int force )
 /**--------------------------------------------------------------------------
  * Accept a connection from a Http.Server listener.
  * Called anytime a new connection gets established.
+ * Native T.Loop handler; the server is on top of the stack.
  * \param   L     lua Virtual Machine.
- * \lparam  userdata  struct t_htp_srv.
- * \param   pointer to the buffer to read from(already positioned).
- * \lreturn value from the buffer a packers position according to packer format.
+ * \param   void* struct t_htp_srv.
  * \return  int    # of values pushed onto the stack.
  *  -------------------------------------------------------------------------*/
 static int
-lt_htp_srv_accept( lua_State *L )
+t_htp_srv_accept( lua_State *L, void *ud )
 {
-	struct t_htp_srv   *s     = (struct t_htp_srv *) lua_touserdata( L, 1 );
-	struct sockaddr_in *si_cli;
+	struct t_htp_srv   *s     = (struct t_htp_srv *) ud;
 	struct t_net       *c_sck;
-	struct t_net       *s_sck;
 	struct t_ael       *ael;    // AELoop
 	struct t_htp_con   *c;      // new message userdata
+	int                 cp;     // stack position of client socket
 
 	lua_rawgeti( L, LUA_REGISTRYINDEX, s->sR );
-	s_sck = t_net_check_ud( L, -1, 1 );
-
-	t_net_tcp_accept( L, 2 );   //S: srv,ssck,csck,cip
-	c_sck  = t_net_tcp_check_ud( L, -2, 1 );
-	si_cli = t_net_ip4_check_ud( L, -1, 1 );
+	t_net_tcp_accept( L, lua_gettop( L ) );   //S: srv,ssck,csck,cip
+	cp     = lua_gettop( L ) - 1;
+	c_sck  = t_net_tcp_check_ud( L, cp, 1 );
 	t_net_reuseaddr( L, c_sck );
 
-	// prepare the ael_fd->wR table on stack
-	lua_newtable( L );
-	lua_pushcfunction( L, t_htp_con_rsp ); //S: s,ss,cs,ip,rt,rsp
-	lua_rawseti( L, -2, 1 );
-
-	lua_pushcfunction( L, lt_ael_addhandle );
 	lua_rawgeti( L, LUA_REGISTRYINDEX, s->lR );
-	ael = t_ael_check_ud( L, -1, 1 );      //S: s,ss,cs,ip,rt,add(),ael
-	lua_pushvalue( L, -5 );                // push client socket
-	lua_pushboolean( L, 1 );               // yepp, that's for reading
-	lua_pushcfunction( L, t_htp_con_rcv ); //S: s,ss,cs,ip,rt,add(),ael,cs,true,rcv
-	c = t_htp_con_create_ud( L, s );
-	lua_pushvalue( L, -1 );                // preserve to put onto rsp function
-	lua_rawseti( L, -8, 2 );
-	lua_newtable( L );                     // create connection proxy table
+	ael = t_ael_check_ud( L, -1, 1 );      //S: s,ss,cs,ip,ael
+	T_AEL_STS_SYS( ael, 2 );               // accept() and setsockopt()
+	c = t_htp_con_create_ud( L, s );       //S: s,ss,cs,ip,ael,msg
+	lua_rawgeti( L, LUA_REGISTRYINDEX, c->pR );   // fill connection proxy table
 	lua_pushstring( L, "socket" );
-	lua_pushvalue( L, -11 );  //S: s,ss,cs,ip,rt,add(),ael,cs,true,rcv,msg,proxy,"socket",cs
+	lua_pushvalue( L, cp );   //S: s,ss,cs,ip,ael,msg,proxy,"socket",cs
 	lua_rawset( L, -3 );
 	lua_pushstring( L, "ip" );
-	lua_pushvalue( L, -10 );  //S: s,ss,cs,ip,rt,add(),ael,cs,true,rcv,msg,proxy,"ip",ip
+	lua_pushvalue( L, cp+1 ); //S: s,ss,cs,ip,ael,msg,proxy,"ip",ip
 	lua_rawset( L, -3 );
-	c->pR  = luaL_ref( L, LUA_REGISTRYINDEX );
+	lua_pop( L, 1 );
 	c->sck = c_sck;
 
-	// actually put it onto the loop  //S: s,ss,cs,ip,rt,add(),ael,cs,true,rcv,msg
-	lua_call( L, 5, 0 );          // execute ael:addhandle(cli,tread,rcv,msg)
+	// actually put it onto the loop; the loop calls the C handlers directly
+	lua_pushvalue( L, -1 );       //S: s,ss,cs,ip,ael,msg,msg
+	t_ael_addhandle_cf( L, ael, cp, T_AEL_RD, t_htp_con_rcv, c );
 	// Here the t_ael_fd is all allocated and set up for reading.  This will put
-	// the response writer method on the ->wR reference for faster processing
+	// the response writer on as native write handler for faster processing
 	// since an HTTP msg will bounce back and forth between reading and writing.
-	//S: s,ss,cs,ip,rt,(true/false)
-	//lua_pop( L, 1 );                           // TODO: pop true or false
-	ael->fd_set[ c->sck->fd ]->wR = luaL_ref( L, LUA_REGISTRYINDEX );
+	t_ael_sethandler_cf( L, ael, c->sck->fd, T_AEL_WR, t_htp_con_rsp, c );
 	return 0;
 }
 
@@ -181,6 +196,7 @@ lt_htp_srv_listen( lua_State *L )
 	struct t_htp_srv   *s   = t_htp_srv_check_ud( L, 1, 1 );
 	struct t_net       *sc  = NULL;
 	struct sockaddr_in *ip  = NULL;
+	struct t_ael       *ael;
 
 	// reuse socket:listen( )
 	t_net_listen( L, 2, T_NET_TCP );
@@ -191,25 +207,444 @@ lt_htp_srv_listen( lua_State *L )
 	s->sck = sc;
 	s->sR  = luaL_ref( L, LUA_REGISTRYINDEX );
 
-	// TODO: cheaper to reimplement functionality -> less overhead?
-	lua_pushcfunction( L, lt_ael_addhandle );   //S: srv addhandle
 	lua_rawgeti( L, LUA_REGISTRYINDEX, s->lR );
-	t_ael_check_ud( L, -1, 1 );
+	ael    = t_ael_check_ud( L, -1, 1 );
 	lua_rawgeti( L, LUA_REGISTRYINDEX, s->sR );
-	lua_pushboolean( L, 1 );                    //S: srv addhandle ael sck true
-	lua_pushcfunction( L, lt_htp_srv_accept );  //S: srv addhandle ael sck true accept
-
-	lua_pushvalue( L, 1 );                      //S: srv addhandle ael sck true accept srv
-
-	//TODO: Check if that returns tru or false; if false resize loop
-	lua_call( L, 5, 0 );
+	lua_pushvalue( L, 1 );                      //S: srv ael sck srv
+	// the loop grows its handle table as needed; errors out if it can't
+	t_ael_addhandle_cf( L, ael, -2, T_AEL_RD, t_htp_srv_accept, s );
+	lua_pushvalue( L, 1 );                      //S: srv ael sck srv
+	t_ael_addtimer_cf( L, ael, &s->tiv, t_htp_con_sweep, s );
+	lua_pop( L, 2 );
 	lua_rawgeti( L, LUA_REGISTRYINDEX, s->sR );
 	lua_rawgeti( L, LUA_REGISTRYINDEX, s->aR );
+#if PRINT_DEBUGS == 1
 	t_stackDump( L );
+#endif
 	return  2;
 }
 
 
+/**--------------------------------------------------------------------------
+ * Get and set the timeouts for connections waiting for a request.
+ * \detail  The header timeout limits how long a client may take to send a
+ *          request head, counted from accepting the connection or the first
+ *          byte of a pipelined/keep-alive request.  The idle timeout limits
+ *          how long a keep-alive connection may sit between requests.  Expired
+ *          connections get closed by a sweep once per second.  0 disables a
+ *          timeout; nil keeps the current value.
+ * \param   L     Lua state.
+ * \lparam  ud    T.Http.Server userdata instance.
+ * \lparam  int   idle timeout in seconds (optional).
+ * \lparam  int   header timeout in seconds (optional).
+ * \lreturn int   idle timeout in seconds.
+ * \lreturn int   header timeout in seconds.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+lt_htp_srv_timeout( lua_State *L )
+{
+	struct t_htp_srv *s   = t_htp_srv_check_ud( L, 1, 1 );
+	lua_Integer       idl = luaL_optinteger( L, 2, s->tmo[ T_HTP_TMO_IDLE ] );
+	lua_Integer       hdr = luaL_optinteger( L, 3, s->tmo[ T_HTP_TMO_HEAD ] );
+
+	luaL_argcheck( L, idl >= 0 && idl <= INT_MAX, 2, "timeout must be 0 or positive" );
+	luaL_argcheck( L, hdr >= 0 && hdr <= INT_MAX, 3, "timeout must be 0 or positive" );
+	s->tmo[ T_HTP_TMO_IDLE ] = (int) idl;
+	s->tmo[ T_HTP_TMO_HEAD ] = (int) hdr;
+	lua_pushinteger( L, s->tmo[ T_HTP_TMO_IDLE ] );
+	lua_pushinteger( L, s->tmo[ T_HTP_TMO_HEAD ] );
+	return 2;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Set the headers sent with each response of the server.
+ * \detail  The table gets formatted once into a header block which each
+ *          response head copies as is.  Headers passed to writeHead() get added
+ *          after the block, so they shouldn't repeat its names.  Without a
+ *          table the block gets removed.
+ * \param   L     Lua state.
+ * \lparam  ud    T.Http.Server userdata instance.
+ * \lparam  table key:value pairs of HTTP headers (optional).
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+lt_htp_srv_headers( lua_State *L )
+{
+	struct t_htp_srv *s = t_htp_srv_check_ud( L, 1, 1 );
+
+	if (! lua_isnoneornil( L, 2 ))
+	{
+		luaL_checktype( L, 2, LUA_TTABLE );
+		t_htp_pushheaders( L, 2 );
+	}
+	luaL_unref( L, LUA_REGISTRYINDEX, s->hR );
+	s->hR = LUA_NOREF;
+	s->hb = NULL;
+	s->hl = 0;
+	if (! lua_isnoneornil( L, 2 ))
+	{
+		s->hb = lua_tolstring( L, -1, &s->hl );
+		s->hR = luaL_ref( L, LUA_REGISTRYINDEX );
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Stop the loop of a cluster worker.
+ * \detail  Posted to the worker by Cluster:stop(); runs on the worker thread.
+ * \param   L     Lua state of the worker.
+ * \param   void* struct t_ael of the worker.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_srv_halt( lua_State *L, void *ud )
+{
+	(void) L;
+	((struct t_ael *) ud)->run = 0;
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Set up and run the server of a cluster worker in its own Lua state.
+ * \detail  Loads the t library and the request handler module, creates a
+ *          T.Loop and a T.Http.Server listening on a SO_REUSEPORT socket, so
+ *          the kernel balances incoming connections across all workers.
+ *          The loop accepts jobs from other threads, so Cluster:stop() can
+ *          end it.  Returns once the loop stops.
+ * \param   L     Lua state of the worker.
+ * \lparam  lightuserdata  struct t_htp_wrk.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+t_htp_srv_boot( lua_State *L )
+{
+	struct t_htp_wrk   *w   = (struct t_htp_wrk *) lua_touserdata( L, 1 );
+	struct t_htp_clu   *cl  = w->clu;
+	struct t_htp_srv   *s;
+	struct t_ael       *ael;
+	struct t_net       *sc;
+	struct sockaddr_in *ip;
+	int                 one = 1;
+	int                 sp;
+
+	luaL_openlibs( L );
+	// register this very library, so require't' in the module gets it
+	luaL_requiref( L, "t", luaopen_t, 0 );
+	lua_getglobal( L, "package" );
+	lua_pushstring( L, cl->path );
+	lua_setfield( L, -2, "path" );
+	lua_pushstring( L, cl->cpath );
+	lua_setfield( L, -2, "cpath" );
+	lua_getglobal( L, "require" );
+	lua_pushstring( L, cl->mod );
+	lua_call( L, 1, 1 );                        //S: w,t,package,func
+	if (! lua_isfunction( L, 4 ) && NULL == t_htp_rte_check_ud( L, 4, 0 ))
+		return t_push_error( L, "Module `%s` must return a request handler or router", cl->mod );
+
+	ael   = t_ael_create_ud( L, T_AEL_FD_SZ );  //S: w,t,package,func,ael
+	s     = t_htp_srv_create_ud( L );           //S: w,t,package,func,ael,srv
+	s->ael = ael;
+	s->rte = t_htp_rte_check_ud( L, 4, 0 );
+	lua_pushvalue( L, 4 );
+	s->rR = luaL_ref( L, LUA_REGISTRYINDEX );
+	lua_pushvalue( L, 5 );
+	s->lR = luaL_ref( L, LUA_REGISTRYINDEX );
+
+	lua_pushcfunction( L, lt_htp_srv_listen );
+	lua_pushvalue( L, 6 );                      //S: ...,srv,listen,srv
+	if (NULL == (sc = t_net_create_ud( L, T_NET_TCP, 1 )))
+		return t_push_error( L, "Failed to create socket" );
+#ifdef SO_REUSEPORT
+	if (-1 == setsockopt( sc->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof( one ) ))
+		return t_push_error( L, "Failed to set SO_REUSEPORT" );
+#else
+	(void) one;
+	return t_push_error( L, T_HTP_SRV_TYPE".cluster() requires SO_REUSEPORT" );
+#endif
+	ip    = t_net_ip4_create_ud( L );           //S: ...,srv,listen,srv,sck,ip
+	if (NULL != cl->host)
+		lua_pushstring( L, cl->host );
+	lua_pushinteger( L, cl->port );
+	t_net_ip4_set( L, lua_gettop( L ) - ((NULL != cl->host) ? 1 : 0), ip ); // pops host and port
+	if (-1 == bind( sc->fd, (struct sockaddr *) ip, sizeof( struct sockaddr ) ))
+		return t_push_error( L, "ERROR binding socket to port %d", cl->port );
+	lua_pushinteger( L, cl->bl );               //S: ...,srv,listen,srv,sck,ip,bl
+	lua_call( L, 4, 0 );
+
+	if (0 != t_ael_wak_open( L, ael ))
+		return t_push_error( L, "Failed to accept jobs on "T_AEL_TYPE );
+	pthread_mutex_lock( &cl->mtx );
+	w->stp.cf = t_htp_srv_halt;
+	w->stp.ud = ael;
+	w->ael    = ael;
+	sp        = cl->sp;
+	pthread_mutex_unlock( &cl->mtx );
+	if (sp)
+		return 0;
+	lua_getfield( L, 5, "run" );
+	lua_pushvalue( L, 5 );
+	lua_call( L, 1, 0 );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Thread function of a cluster worker.
+ * \param   void*  struct t_htp_wrk.
+ * \return  void*  NULL; errors get reported via w->err.
+ *  -------------------------------------------------------------------------*/
+static void
+*t_htp_srv_worker( void *arg )
+{
+	struct t_htp_wrk *w = (struct t_htp_wrk *) arg;
+	lua_State        *L = luaL_newstate( );
+
+	if (NULL == L)
+	{
+		snprintf( w->err, sizeof( w->err ), "Failed to create Lua state" );
+		return NULL;
+	}
+	lua_pushcfunction( L, t_htp_srv_boot );
+	lua_pushlightuserdata( L, w );
+	if (LUA_OK != lua_pcall( L, 1, 0, 0 ))
+		snprintf( w->err, sizeof( w->err ), "%s", lua_tostring( L, -1 ) );
+	// the loop is gone with the Lua state; nothing may be posted to it anymore
+	pthread_mutex_lock( &w->clu->mtx );
+	w->ael = NULL;
+	pthread_mutex_unlock( &w->clu->mtx );
+	lua_close( L );
+	return NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Check a value on the stack for being a struct t_htp_clu.
+ * \param   L    The lua state.
+ * \param   int      position on the stack.
+ * \param   int      check(boolean): if true error out on fail.
+ * \return  struct t_htp_clu*  pointer to userdata on stack.
+ * --------------------------------------------------------------------------*/
+static struct t_htp_clu
+*t_htp_clu_check_ud( lua_State *L, int pos, int check )
+{
+	void *ud = luaL_testudata( L, pos, T_HTP_CLU_TYPE );
+	luaL_argcheck( L, (ud != NULL || !check), pos, "`"T_HTP_CLU_TYPE"` expected" );
+	return (NULL==ud) ? NULL : (struct t_htp_clu *) ud;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Ask all workers of a cluster to stop.
+ * \detail  Workers which haven't started their loop yet won't start it.
+ *          Doesn't wait for the workers; safe to be called more than once.
+ * \param   struct t_htp_clu*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_clu_stop( struct t_htp_clu *cl )
+{
+	int i;
+
+	pthread_mutex_lock( &cl->mtx );
+	if (! cl->sp)
+	{
+		cl->sp = 1;
+		for (i=0; i < cl->n; i++)
+			if (NULL != cl->w[ i ].ael)
+				t_ael_post( cl->w[ i ].ael, &cl->w[ i ].stp );
+	}
+	pthread_mutex_unlock( &cl->mtx );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Wait for all workers of a cluster to finish.
+ * \param   struct t_htp_clu*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_clu_join( struct t_htp_clu *cl )
+{
+	while (cl->n > 0)
+		pthread_join( cl->w[ --cl->n ].tid, NULL );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Raise the error of the first failed worker of a joined cluster.
+ * \param   L      Lua state.
+ * \param   struct t_htp_clu*.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_clu_error( lua_State *L, struct t_htp_clu *cl )
+{
+	int i;
+
+	for (i=0; i < cl->wn; i++)
+		if ('\0' != cl->w[ i ].err[0])
+			return t_push_error( L, T_HTP_SRV_TYPE" worker %d failed: %s", i+1, cl->w[ i ].err );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Run an HTTP server on multiple cores.
+ * \detail  Starts n threads, each with its own lua_State, T.Loop and
+ *          T.Http.Server.  Each worker loads the module via require(); it must
+ *          return the request handler function or a T.Http.Router.  All
+ *          workers listen on the same port with SO_REUSEPORT.  Returns
+ *          right away; Cluster:join() waits for the workers and
+ *          Cluster:stop() ends them.
+ *          Since the workers share no Lua state, anything shared between
+ *          requests must live outside of Lua (or in each worker).
+ * \param   L      Lua state.
+ * \lparam  int    number of workers; < 1 for one per online CPU.
+ * \lparam  string name of the request handler module.
+ * \lparam  string IP address to bind to (optional).
+ * \lparam  int    port.
+ * \lparam  int    backlog (optional).
+ * \lreturn ud     T.Http.Server.Cluster userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+lt_htp_srv_cluster( lua_State *L )
+{
+	lua_Integer       n    = luaL_checkinteger( L, 1 );
+	const char       *mod  = luaL_checkstring( L, 2 );
+	int               hs   = (LUA_TSTRING == lua_type( L, 3 )) ? 1 : 0;
+	const char       *host = (hs) ? lua_tostring( L, 3 ) : NULL;
+	int               port = luaL_checkinteger( L, 3+hs );
+	int               bl   = luaL_optinteger( L, 4+hs, SOMAXCONN );
+	const char       *path;
+	const char       *cpath;
+	struct t_htp_clu *cl;
+	int               i;
+
+	if (n < 1 && (n = sysconf( _SC_NPROCESSORS_ONLN )) < 1)
+		n = 1;
+	if (n > INT_MAX / (lua_Integer) sizeof( struct t_htp_wrk ))
+		return t_push_error( L, "Too many "T_HTP_SRV_TYPE" workers" );
+	lua_getglobal( L, "package" );
+	lua_getfield( L, -1, "path" );
+	lua_getfield( L, -2, "cpath" );
+	path  = lua_tostring( L, -2 );
+	cpath = lua_tostring( L, -1 );
+
+	cl = (struct t_htp_clu *) lua_newuserdata( L, sizeof( struct t_htp_clu ) );
+	memset( cl, 0, sizeof( struct t_htp_clu ) );
+	pthread_mutex_init( &cl->mtx, NULL );
+	luaL_getmetatable( L, T_HTP_CLU_TYPE );
+	lua_setmetatable( L, -2 );
+	cl->port  = port;
+	cl->bl    = bl;
+	cl->mod   = strdup( mod );
+	cl->path  = strdup( (NULL != path)  ? path  : "" );
+	cl->cpath = strdup( (NULL != cpath) ? cpath : "" );
+	cl->host  = (NULL != host) ? strdup( host ) : NULL;
+	cl->w     = (struct t_htp_wrk *) calloc( n, sizeof( struct t_htp_wrk ) );
+	if (NULL == cl->mod || NULL == cl->path || NULL == cl->cpath ||
+	    (NULL != host && NULL == cl->host) || NULL == cl->w)
+		return t_push_error( L, "Failed to create "T_HTP_CLU_TYPE );
+	cl->wn = (int) n;
+
+	for (i=0; i < cl->wn; i++, cl->n++)
+	{
+		cl->w[ i ].clu = cl;
+		if (0 != pthread_create( &cl->w[ i ].tid, NULL, t_htp_srv_worker, &cl->w[ i ] ))
+		{
+			t_htp_clu_stop( cl );
+			t_htp_clu_join( cl );
+			return t_push_error( L, "Failed to start "T_HTP_SRV_TYPE" worker %d", i+1 );
+		}
+	}
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Wait for all workers of a T.Http.Server.Cluster to finish.
+ * \detail  Errors out with the message of the first failed worker.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Server.Cluster userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+lt_htp_clu_join( lua_State *L )
+{
+	struct t_htp_clu *cl = t_htp_clu_check_ud( L, 1, 1 );
+
+	t_htp_clu_join( cl );
+	return t_htp_clu_error( L, cl );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Stop all workers of a T.Http.Server.Cluster and wait for them.
+ * \detail  Each worker stops its loop and closes its Lua state; connections
+ *          still open get closed.
+ * \param   L      Lua state.
+ * \lparam  ud     T.Http.Server.Cluster userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+static int
+lt_htp_clu_stop( lua_State *L )
+{
+	struct t_htp_clu *cl = t_htp_clu_check_ud( L, 1, 1 );
+
+	t_htp_clu_stop( cl );
+	t_htp_clu_join( cl );
+	return t_htp_clu_error( L, cl );
+}
+
+
+/**--------------------------------------------------------------------------
+ * __tostring (print) representation of a T.Http.Server.Cluster instance.
+ * \param   L      The lua state.
+ * \lparam  ud     T.Http.Server.Cluster userdata instance.
+ * \lreturn string formatted string representing the cluster.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_clu__tostring( lua_State *L )
+{
+	struct t_htp_clu *cl = t_htp_clu_check_ud( L, 1, 1 );
+
+	lua_pushfstring( L, T_HTP_CLU_TYPE"[%d]: %p", cl->wn, cl );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __gc of a T.Http.Server.Cluster instance.
+ * \detail  Workers still running get stopped and joined.
+ * \param   L      The lua state.
+ * \lparam  ud     T.Http.Server.Cluster userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_clu__gc( lua_State *L )
+{
+	struct t_htp_clu *cl = t_htp_clu_check_ud( L, 1, 1 );
+
+	t_htp_clu_stop( cl );
+	t_htp_clu_join( cl );
+	pthread_mutex_destroy( &cl->mtx );
+	free( cl->w );
+	free( cl->mod );
+	free( cl->path );
+	free( cl->cpath );
+	free( cl->host );
+	cl->w  = NULL;
+	cl->wn = 0;
+	return 0;
+}
+
+
 /**--------------------------------------------------------------------------
  * __tostring (print) representation of an T.Http.Server  instance.
  * \param   L      The lua state.
@@ -252,13 +687,22 @@ lt_htp_srv__gc( lua_State *L )
 {
 	struct t_htp_srv *s = t_htp_srv_check_ud( L, 1, 1 );
 
+	// connections collected later free their buffers instead of pooling them
+	while (s->bpn > 0)
+		free( s->bpl[ --s->bpn ] );
+	s->bpn = -1;
 	// t_net_close( L, s->sck );     // segfaults???
 	luaL_unref( L, LUA_REGISTRYINDEX, s->sR );
 	luaL_unref( L, LUA_REGISTRYINDEX, s->aR );
 	luaL_unref( L, LUA_REGISTRYINDEX, s->lR );
 	luaL_unref( L, LUA_REGISTRYINDEX, s->rR );
+	luaL_unref( L, LUA_REGISTRYINDEX, s->hR );
+	luaL_unref( L, LUA_REGISTRYINDEX, s->zcR[ 0 ] );
+	luaL_unref( L, LUA_REGISTRYINDEX, s->zcR[ 1 ] );
 
+#if PRINT_DEBUGS == 1
 	printf("GC'ed "T_HTP_SRV_TYPE" ...\n");
+#endif
 
 	return 0;
 }
@@ -276,7 +720,8 @@ static const struct luaL_Reg t_htp_srv_fm [] = {
  * Class functions library definition
  * --------------------------------------------------------------------------*/
 static const struct luaL_Reg t_htp_srv_cf [] = {
-	{ NULL,   NULL }
+	  { "cluster",       lt_htp_srv_cluster }
+	, { NULL,   NULL }
 };
 
 
@@ -288,6 +733,21 @@ static const luaL_Reg t_htp_srv_m [] = {
 	, { "__gc",          lt_htp_srv__gc }
 	, { "__tostring",    lt_htp_srv__tostring }
 	, { "listen",        lt_htp_srv_listen }
+	, { "timeout",       lt_htp_srv_timeout }
+	, { "headers",       lt_htp_srv_headers }
+	, { "compress",      lt_htp_srv_compress }
+	, { NULL,    NULL }
+};
+
+
+/**--------------------------------------------------------------------------
+ * Cluster metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_clu_m [] = {
+	  { "__gc",          lt_htp_clu__gc }
+	, { "__tostring",    lt_htp_clu__tostring }
+	, { "join",          lt_htp_clu_join }
+	, { "stop",          lt_htp_clu_stop }
 	, { NULL,    NULL }
 };
 
@@ -308,6 +768,11 @@ luaopen_t_htp_srv( lua_State *L )
 	luaL_setfuncs( L, t_htp_srv_m, 0 );
 	lua_setfield( L, -1, "__index" );
 
+	// T.Http.Server.Cluster instance metatable
+	luaL_newmetatable( L, T_HTP_CLU_TYPE );
+	luaL_setfuncs( L, t_htp_clu_m, 0 );
+	lua_setfield( L, -1, "__index" );
+
 	// T.Http.Server class
 	luaL_newlib( L, t_htp_srv_cf );
 	luaL_newlib( L, t_htp_srv_fm );
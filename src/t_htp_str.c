@@ -10,12 +10,21 @@
 
 #include <stdlib.h>               // malloc, free
 #include <string.h>               // strchr, ...
+#include <stdio.h>                // snprintf, fileno
+#include <limits.h>               // LLONG_MAX
+#include <fcntl.h>                // open
+#include <unistd.h>               // close
+#include <sys/stat.h>             // fstat
 
 #include "t.h"
 #include "t_htp.h"
 
+static const char t_htp_str_pool = 0;    ///< key of the stream pool
+
+
 /**--------------------------------------------------------------------------
  * create a t_htp_str and push to LuaStack.
+ * \detail  Recycles a collected stream and its proxy table if available.
  * \param   L  The lua state.
  *
  * \return  struct t_htp_str*  pointer to the struct.
@@ -24,20 +33,39 @@ struct t_htp_str
 *t_htp_str_create_ud( lua_State *L, struct t_htp_con *con )
 {
 	struct t_htp_str *s;
-	s = (struct t_htp_str *) lua_newuserdata( L, sizeof( struct t_htp_str ));
-	// Proxy contains lua readable items such as headers, length, status code etc
-	lua_newtable( L );
-	luaL_getmetatable( L, T_HTP_STR_PRX_TYPE );
-	lua_setmetatable( L, -2 );
-	s->pR      = luaL_ref( L, LUA_REGISTRYINDEX );
+
+	if (NULL == (s = (struct t_htp_str *) t_htp_pool_get( L, &t_htp_str_pool )))
+	{
+		s = (struct t_htp_str *) lua_newuserdata( L, sizeof( struct t_htp_str ));
+		// Proxy contains lua readable items such as headers, length, status code etc
+		lua_newtable( L );
+		luaL_getmetatable( L, T_HTP_STR_PRX_TYPE );
+		lua_setmetatable( L, -2 );
+		s->pR   = luaL_ref( L, LUA_REGISTRYINDEX );
+	}
 	s->rqCl    = 0;                 ///< request  content length
+	s->rqBl    = 0;                 ///< request  body bytes received so far
+	s->rqFr    = 0;                 ///< request body framing
+	s->cs      = T_HTP_CK_SZ0;      ///< position of the chunk decoder
+	s->ck      = 0;                 ///< bytes left in the current chunk
+	s->expect  = 0;                 ///< Expect: header received
 	s->rsCl    = 0;                 ///< response content length
 	s->rsBl    = 0;                 ///< response buffer length (headers + rsCl)
-	s->bR      = 0;                 ///< Lua registry reference to body handler function
+	s->rsSl    = 0;                 ///< response buffer sent length
+	s->bR      = LUA_NOREF;         ///< Lua registry reference to body handler function
 	s->state   = T_HTP_STR_ZERO;    ///< shall the connection return an expected thingy?
 	s->mth     = T_HTP_MTH_ILLEGAL; ///< HTTP Message state
 	s->ver     = T_HTP_VER_09;      ///< HTTP Method for this request
 	s->con     = con;               ///< connection
+	s->cntId   = con->cnt;          ///< position in the connections request order
+	s->kpAlv   = 0;                 ///< keepalive; set by the request head
+	s->ps      = T_HTP_P_MTH;       ///< position of the head parser
+	s->po      = 0;                 ///< bytes of the head scanned so far
+	s->hR      = LUA_NOREF;         ///< request head string
+	s->hd      = NULL;              ///< request head; NULL while incomplete
+	s->hdn     = 0;                 ///< # of headers
+	s->ze      = T_HTP_ZIP_NO;      ///< content coding of the response
+	s->zp      = NULL;              ///< deflate state
 
 	luaL_getmetatable( L, T_HTP_STR_TYPE );
 	lua_setmetatable( L, -2 );
@@ -61,191 +89,363 @@ struct t_htp_str
 }
 
 
+/**--------------------------------------------------------------------------
+ * Hand a piece of the request body to the onBody handler of the stream.
+ * \detail  The handler gets called with the stream and the data; at the end of
+ *          the body with the stream only.  If it returns false reading from
+ *          the connection pauses until Stream:resume() gets called.
+ * \param  L            lua Virtual Machine.
+ * \param  struct t_htp_str struct t_htp_str.
+ * \param  int          stack position of the stream.
+ * \param  const char*  data; NULL at the end of the body.
+ * \param  size_t       length of data.
+ * \return void.
+ *  -------------------------------------------------------------------------*/
+static void
+t_htp_str_body( lua_State *L, struct t_htp_str *s, int si, const char *b, size_t n )
+{
+	if (LUA_NOREF == s->bR)
+		return;
+	lua_rawgeti( L, LUA_REGISTRYINDEX, s->bR );
+	lua_pushvalue( L, si );
+	if (NULL == b)
+		lua_call( L, 1, 1 );
+	else
+	{
+		lua_pushlstring( L, b, n );
+		lua_call( L, 2, 1 );
+	}
+	if (lua_isboolean( L, -1 ) && ! lua_toboolean( L, -1 ))
+		t_htp_con_pause( s->con );
+	lua_pop( L, 1 );
+}
+
+
 /**--------------------------------------------------------------------------
  * Handle incoming chunks from T.Http.Connection socket.
- * Called anytime the client socket returns from the poll for read.
+ * Called anytime the client socket returns from the poll for read.  Processes
+ * the connections buffer starting at con->b.  While the head is incomplete
+ * con->b stays at its start and the parser picks up where it stopped; once
+ * complete the head gets copied into a single Lua string and con->b moves
+ * past it.  Expects the stream on top of the stack.
  * \param  L            lua Virtual Machine.
  * \param  struct t_htp_str struct t_htp_str.
- * \param  const char *     pointer to the buffer (already positioned).
- * \return  integer         success indicator.
+ * \return  integer         0 on success, -1 if the request is malformed.
  *  -------------------------------------------------------------------------*/
 int
-t_htp_str_rcv( lua_State *L, struct t_htp_str *s, size_t rcvd )
+t_htp_str_rcv( lua_State *L, struct t_htp_str *s )
 {
-	const char *b = &(s->con->buf[ s->con->read ]);
+	struct t_htp_con *c  = s->con;
+	int               si = lua_gettop( L );    ///< stack position of the stream
+	int               go = 1;
+	size_t            n;                       ///< bytes left to process
+	long              k;                       ///< bytes of chunk framing
+	long long         l;                       ///< body bytes left in chunk or request
 
-	while (NULL != b)
+	while (go)
 	{
+		n = c->buf + c->read - c->b;
 		switch (s->state)
 		{
 			case T_HTP_STR_ZERO:
-				lua_rawgeti( L, LUA_REGISTRYINDEX, s->pR );
-				b = t_htp_pReqFirstLine( L, s, rcvd );
-				break;
-			case T_HTP_STR_FLINE:
-				//lua_rawgeti( L, LUA_REGISTRYINDEX, s->pR );
-				b = t_htp_pHeaderLine( L, s, rcvd );
+				// tolerate empty lines ahead of the request line
+				while (0 == s->po && n > 0 && ('\r' == *c->b || '\n' == *c->b))
+				{
+					c->b++;
+					n--;
+				}
+				switch (t_htp_pHead( s, c->b, n ))
+				{
+					case  0:
+						go = 0;                 // wait for the rest of the head
+						break;
+					case -1:
+						return -1;
+					default:
+						lua_pushlstring( L, c->b, s->po );
+						s->hd    = lua_tostring( L, -1 );
+						s->hR    = luaL_ref( L, LUA_REGISTRYINDEX );
+						c->b    += s->po;
+						s->state = T_HTP_STR_HEADDONE;
+						break;
+				}
 				break;
 			case T_HTP_STR_HEADDONE:
-				s->con->cnt++;
-				lua_pop( L, 1 );      // pop s->pR
-				// execute function from server
-				lua_rawgeti( L, LUA_REGISTRYINDEX, s->con->srv->rR );
-				lua_pushvalue( L, 2 );
-				lua_call( L, 1, 0 );
-				// if request has content length keep reading body, else stop reading
-				if (s->rqCl > 0 )
+				// the handler may move the state on to SEND/FINISH
+				s->state = (T_HTP_STR_BODYDONE( s )) ? T_HTP_STR_RECEIVED : T_HTP_STR_BODY;
+				// execute function (or route) from server
+				if (NULL != c->srv->rte)
+					t_htp_rte_dispatch( L, c->srv->rte, s, si );
+				else
 				{
-					s->state = T_HTP_STR_BODY;
-					t_htp_con_adjustbuffer( s->con, rcvd, b );
-					// read body
+					lua_rawgeti( L, LUA_REGISTRYINDEX, c->srv->rR );
+					lua_pushvalue( L, si );   // the stream
+					lua_call( L, 1, 0 );
 				}
-				else
-					b = NULL;     // signal while loop to be done
-				break;
-		/*
-			case T_htp_str_S_BODY:
-				// execute req.onData
-				nxt = NULL;
-				break;
-			case T_htp_str_S_FINISH:
-				// ignore
-				nxt = NULL;
 				break;
-		*/
 			default:
-				luaL_error( L, "Illegal state for "T_HTP_STR_TYPE" %d", (int) s->state );
+				// the head is done; whatever belongs to the request is body
+				// and goes to the handler piece by piece as it arrives
+				while (n > 0 && ! c->psd && ! T_HTP_STR_BODYDONE( s ))
+				{
+					if (2 == s->rqFr && T_HTP_CK_DATA != s->cs)
+					{
+						if ((k = t_htp_pChunk( s, c->b, n )) < 0)
+							return -1;
+						c->b += k;
+						n    -= k;
+						continue;
+					}
+					l = (2 == s->rqFr) ? s->ck : s->rqCl - s->rqBl;
+					if ((long long) n > l)
+						n = (size_t) l;
+					t_htp_str_body( L, s, si, c->b, n );
+					c->b    += n;
+					s->rqBl += n;
+					if (2 == s->rqFr && 0 == (s->ck -= n))
+						s->cs = T_HTP_CK_DCR;
+					n = c->buf + c->read - c->b;
+				}
+				// request complete; more data belongs to the next stream
+				if (T_HTP_STR_BODYDONE( s ))
+				{
+					if (0 != s->rqFr)
+						t_htp_str_body( L, s, si, NULL, 0 );
+					c->cnt++;
+				}
+				go = 0;
+				break;
 		}
-		//if (NULL == b)
-		//{
-		//}
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Queue a buffer chunk in the Linked List buffer in t_htp_con.
+ * Expects the t_htp_str element on stack position 1.  Responses must go out
+ * in the order the requests came in, so the list is kept ordered by stream.
+ * If the chunk becomes the head of the list and belongs to the stream
+ * responding now, a flush of the connection gets deferred to the end of the
+ * current loop iteration.
+ * \param   L        The lua state.
+ * \param   struct t_htp_str*.
+ * \param   struct t_htp_buf*  chunk; everything but the list pointers set.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_str_queue( lua_State *L, struct t_htp_str *s, struct t_htp_buf *b )
+{
+	struct t_htp_con *c = s->con;
+	struct t_htp_buf *p;            ///< buffer to insert after
 
+	lua_pushvalue( L, 1 );
+	b->sR   = luaL_ref( L, LUA_REGISTRYINDEX );
+	b->str  = s;
+
+	// a pipelined stream may respond before the ones ahead of it
+	for (p = c->buf_tail; NULL != p && p->str->cntId > s->cntId; p = p->prv) ;
+	b->prv = p;
+	b->nxt = (NULL == p) ? c->buf_head : p->nxt;
+	if (NULL == p)
+		c->buf_head = b;
+	else
+		p->nxt = b;
+	if (NULL == b->nxt)
+		c->buf_tail = b;
+	else
+		b->nxt->prv = b;
+
+	if (c->buf_head == b && s->cntId == c->rsp)
+	{
+		// can also happen if current buffer is flushed but response is
+		// incomplete.  Everything added during this loop iteration goes out in
+		// a single flush at its end; the write handler references (and
+		// anchors) the connection
+		t_ael_pushhandler( L, c->srv->ael, c->sck->fd, T_AEL_WR );
+		t_ael_defer_cf( L, c->srv->ael, t_htp_con_flush, c );
 	}
-	return 1;  /// TODO: make sense of this
 }
 
 
 /**--------------------------------------------------------------------------
  * Add a new buffer chunk to the Linked List buffer in t_htp_con.
- * General handling of buffers within the connection.  It does expect a Lua
- * string on top of the stack which will be wrapped into a linked list element.
- * It also expects the t_htp_str element on stack position 1. If the current
- * buffer head is null, the connections socket must also be added to the
- * EventLoop for outgoing connections.
+ * It does expect a Lua string on top of the stack which will be wrapped into
+ * a linked list element.  It also expects the t_htp_str element on stack
+ * position 1.
  * \param   L        The lua state.
  * \param   integer      The string length of the chunk on stack.
  * \return  int    # of values pushed onto the stack.
  * --------------------------------------------------------------------------*/
-static int
+int
 t_htp_str_addbuffer( lua_State *L, struct t_htp_str *s, size_t l, int last )
 {
-	struct t_htp_con *c = s->con;
+#if PRINT_DEBUGS == 1
+	printf( "Add Buffer: %zu bytes\n", l );
+#endif
+	t_htp_str_addmem( L, s, lua_tostring( L, -1 ), l, last );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Add a chunk of memory to the Linked List buffer in t_htp_con.
+ * \detail  The memory gets sent as it is; it must stay valid as long as the
+ *          value on top of the stack lives, which the chunk keeps referenced.
+ *          Expects the t_htp_str element on stack position 1.
+ * \param   L        The lua state.
+ * \param   struct t_htp_str*.
+ * \param   const char*  data to send.
+ * \param   size_t   length of the data.
+ * \param   int      is this the last chunk of the response?
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_str_addmem( lua_State *L, struct t_htp_str *s, const char *d, size_t l, int last )
+{
 	struct t_htp_buf *b = malloc( sizeof( struct t_htp_buf ) );
 
-	printf( "Add Buffer: %zu bytes\n", l );
+	b->bp   = d;
 	b->bl   = l;
 	b->sl   = 0;
 	b->bR   = luaL_ref( L, LUA_REGISTRYINDEX );
-	b->nxt  = NULL;
-	b->prv  = NULL;
-	lua_pushvalue( L, 1 );
-	b->sR   = luaL_ref( L, LUA_REGISTRYINDEX );
 	b->last = last;
+	b->fd   = -1;
+	b->fc   = 0;
+	b->fo   = 0;
+	t_htp_str_queue( L, s, b );
+}
 
-	if (NULL == c->buf_head)
-	{
-		c->buf_head = b;
-		c->buf_tail = b;
-		// wrote the first line to the buffer, can also happen if
-		// current buffer is flushed but response is incomplete
-		t_ael_addhandle_impl( c->srv->ael, c->sck->fd, T_AEL_WR );
-		c->srv->ael->fd_set[ c->sck->fd ]->t = T_AEL_RW;
-	}
-	else
-	{
-		c->buf_tail->nxt = b;
-		b->prv           = c->buf_tail;
-		c->buf_tail      = b;
-	}
-	return 1;
+
+/**--------------------------------------------------------------------------
+ * Add a file chunk to the Linked List buffer in t_htp_con.
+ * Expects the value fd belongs to (a Lua file handle or a T.Http.Files
+ * entry; nil if fc is set) on top of the stack and the t_htp_str element on
+ * stack position 1.
+ * \param   L        The lua state.
+ * \param   struct t_htp_str*.
+ * \param   int      file descriptor.
+ * \param   int      close fd once the chunk is done?
+ * \param   off_t    offset of the chunk in the file.
+ * \param   size_t   length of the chunk.
+ * \param   int      is this the last chunk of the response?
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_str_addfile( lua_State *L, struct t_htp_str *s, int fd, int fc,
+	off_t off, size_t l, int last )
+{
+	struct t_htp_buf *b = malloc( sizeof( struct t_htp_buf ) );
+
+	b->bp   = NULL;
+	b->bl   = l;
+	b->sl   = 0;
+	b->bR   = (lua_isnil( L, -1 )) ? (lua_pop( L, 1 ), LUA_NOREF)
+	                               : luaL_ref( L, LUA_REGISTRYINDEX );
+	b->last = last;
+	b->fd   = fd;
+	b->fc   = fc;
+	b->fo   = off;
+	t_htp_str_queue( L, s, b );
+}
+
+
+/**-----------------------------------------------------------------------------
+ * Add the size line of a chunk to a buffer.
+ * \param  luaL_Buffer  Lua Buffer pointer.
+ * \param  size_t       size of the chunk.
+ * \return void.
+ * ---------------------------------------------------------------------------*/
+static void
+t_htp_str_addchunk( luaL_Buffer *lB, size_t sz )
+{
+	char nb[ 16 ];
+
+	luaL_addlstring( lB, nb, t_htp_xtoa( nb, sz ) );
+	luaL_addlstring( lB, "\r\n", 2 );
 }
 
 
 /**-----------------------------------------------------------------------------
  * Form HTTP response Header.
+ * \detail  Assembled from constant pieces, the servers header block (see
+ *          T.Http.Server:headers()) and the optional header table, so nothing
+ *          gets parsed from a format string.  The header table gets formatted
+ *          before the buffer is used and replaced by the formatted block.
  * \param  L        The lua state.
  * \param  luaL_Buffer  Lua Buffer pointer.
  * \param  struct t_htp_str struct pointer.
  * \param  int          the HTTP Status Code to be returned.
  * \param  char*        the HTTP Status Message to be returned.
- * \param  size_t*      length of the HTTP Payload aka. Content-length.
- * \param  int          position of table on stack where headers are present.
+ * \param  long long    length of the HTTP Payload aka. Content-length;
+ *                      -1 for chunked encoding.
+ * \param  int          position of table on stack where headers are present;
+ *                      a string there is taken as formatted header lines.
  *                      0 means no additional headers.
+ * \param  int          may the body get compressed as it is written?  If so
+ *                      and t_htp_zip_choose() agrees the response becomes
+ *                      chunked.  Else s->ze tells whether the body got
+ *                      compressed by the caller.
  * \return  int         size of string added to the buffer.
  * ---------------------------------------------------------------------------*/
-static size_t
+size_t
 t_htp_str_formHeader( lua_State *L, luaL_Buffer *lB, struct t_htp_str *s,
-	int code, const char *msg, int len, int t )
+	int code, const char *msg, long long len, int t, int zip )
 {
-	size_t   c;       ///< count all chars added in this method
-	size_t   bs;      ///< chars added currently to buffers
-	char    *b = luaL_prepbuffer( lB );
+	struct t_htp_srv *srv = s->con->srv;
+	size_t            c   = lB->n;  ///< buffer length before the head
+	const char       *h   = NULL;                ///< formatted header table
+	size_t            hl  = 0;
+	char              nb[ 20 ];
 
-	if (len)
+	if (t)
 	{
-		bs = sprintf( b,
-			"HTTP/1.1 %d %s\r\n"
-			"Connection: %s\r\n"
-			"Date: %s\r\n"
-			"Content-Length: %d\r\n"
-			"%s",
-			(int) code,                               // HTTP Status code
-			(NULL == msg) ? t_htp_status( code ) : msg, // HTTP Status Message
-			(s->con->kpAlv) ? "Keep-Alive" : "Close", // Keep-Alive or close
-			s->con->srv->fnw,                         // Formatted Date
-			len,                                      // Content-Length
-			(t) ? "" : "\r\n"
-			);
-		s->rsCl = len;
+		if (LUA_TSTRING != lua_type( L, t ))
+		{
+			t_htp_pushheaders( L, t );
+			lua_replace( L, t );
+		}
+		h = lua_tolstring( L, t, &hl );
 	}
-	else
+	if (NULL == msg && NULL == (msg = t_htp_status( code )))
+		msg = "";
+	if (zip && T_HTP_ZIP_NO != (s->ze = t_htp_zip_choose( s, code, len, h, hl )))
 	{
-		bs = sprintf( b,
-			"HTTP/1.1 %d %s\r\n"
-			"Connection: %s\r\n"
-			"Date: %s\r\n"
-			"Transfer-Encoding: chunked\r\n"
-			"%s",
-			(int) code,                               // HTTP Status code
-			(NULL == msg) ? t_htp_status( code ) : msg, // HTTP Status Message
-			(s->con->kpAlv) ? "Keep-Alive" : "Close", // Keep-Alive or close
-			s->con->srv->fnw,                         // Formatted Date
-			(t) ? "" : "\r\n"
-			);
-		s->rsCl = len;
+		t_htp_zip_init( L, s );
+		len = -1;
 	}
-	luaL_addsize( lB, bs );
-	// TODO: Find a way to deal more efficiently with that buffer
-	b  = luaL_prepbuffer( lB );
-	c  = bs;
-	bs = 0;
-	if (t)
+	t_htp_srv_setnow( srv, 0 );
+
+	luaL_addlstring( lB, "HTTP/1.1 ", 9 );
+	luaL_addlstring( lB, nb, t_htp_itoa( nb, (code < 0) ? 0 : code ) );
+	luaL_addchar( lB, ' ' );
+	luaL_addstring( lB, msg );
+	if (s->kpAlv)
+		luaL_addlstring( lB, "\r\nConnection: Keep-Alive\r\nDate: ", 32 );
+	else
+		luaL_addlstring( lB, "\r\nConnection: Close\r\nDate: ", 27 );
+	luaL_addstring( lB, srv->fnw );
+	if (len >= 0)
 	{
-		lua_pushnil( L );
-		while (lua_next( L, t ))
-		{
-			bs += sprintf( b,
-				"%s: %s\r\n",
-				lua_tostring( L, -2 ),
-				lua_tostring( L, -1 )
-				);
-			lua_pop( L, 1 );      //FIXME:  this can't pop, it must remove
-		}
-		bs += sprintf( b, "\r\n" );   // finish off the HTTP Headers part
-		luaL_addsize( lB, bs );
+		luaL_addlstring( lB, "\r\nContent-Length: ", 18 );
+		luaL_addlstring( lB, nb, t_htp_itoa( nb, len ) );
+		luaL_addlstring( lB, "\r\n", 2 );
 	}
-	c += bs;
-	s->rsBl = (len) ? c + len : 0;
+	else
+		luaL_addlstring( lB, "\r\nTransfer-Encoding: chunked\r\n", 30 );
+	if (T_HTP_ZIP_GZIP == s->ze)
+		luaL_addlstring( lB, "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n", 47 );
+	else if (T_HTP_ZIP_DEFLATE == s->ze)
+		luaL_addlstring( lB, "Content-Encoding: deflate\r\nVary: Accept-Encoding\r\n", 50 );
+	if (srv->hl)
+		luaL_addlstring( lB, srv->hb, srv->hl );
+	if (hl)
+		luaL_addlstring( lB, h, hl );
+	luaL_addlstring( lB, "\r\n", 2 );   // finish off the HTTP Headers part
+
+	s->rsCl = len;
+	c       = lB->n - c;
+	s->rsBl = (len >= 0) ? (long long) c + len : 0;
 	return c;
 }
 
@@ -274,33 +474,34 @@ lt_htp_str_writeHead( lua_State *L )
 	struct t_htp_str *s = t_htp_str_check_ud( L, 1, 1 );
 	int               i = lua_gettop( L );
 	int               t = (LUA_TTABLE == lua_type( L, i )); // processing headers
-	size_t            c = 0;
 	luaL_Buffer       lB;
 
 	luaL_buffinit( L, &lB );
 	// indicate the Content-Length was provided
 	if (LUA_TNUMBER == lua_type( L, 3 ) || LUA_TNUMBER == lua_type( L, 4 ))
 	{
-		c = t_htp_str_formHeader( L, &lB, s,
+		t_htp_str_formHeader( L, &lB, s,
 			(int) luaL_checkinteger( L, 2 ),   // HTTP Status code
 			(LUA_TSTRING == lua_type( L, 3))   // HTTP Status message
 				? lua_tostring( L, 3 )
 				: t_htp_status( luaL_checkinteger( L, 2 ) ),
 			(LUA_TNUMBER == lua_type( L, 3))   // Content-Length
-				?  (int) luaL_checkinteger( L, 3 )
-				:  (int) luaL_checkinteger( L, 4 ),
-			(t) ? i : 0                            // position of optional header table on stack
+				?  (long long) luaL_checkinteger( L, 3 )
+				:  (long long) luaL_checkinteger( L, 4 ),
+			(t) ? i : 0,                           // position of optional header table on stack
+			1                                      // may get compressed
 			);
 	}
 	else     // Prepare headers for chunked encoding
 	{
-		c = t_htp_str_formHeader( L, &lB, s,
+		t_htp_str_formHeader( L, &lB, s,
 			(int) luaL_checkinteger( L, 2 ),   // HTTP Status code
 			(LUA_TSTRING == lua_type( L, 3))   // HTTP Status message
 				? lua_tostring( L, 3 )
 				: t_htp_status( luaL_checkinteger( L, 2 ) ),
-			0,                                     // Content-Length 0 -> chunked
-			(t) ? i : 0                            // position of optional header table on stack
+			-1,                                    // no Content-Length -> chunked
+			(t) ? i : 0,                           // position of optional header table on stack
+			1                                      // may get compressed
 			);
 	}
 	luaL_pushresult( &lB );
@@ -323,10 +524,7 @@ lt_htp_str_write( lua_State *L )
 {
 	struct t_htp_str *s   = t_htp_str_check_ud( L, 1, 1 );
 	size_t            sz;
-	char             *b;
-	size_t            c   = 0;
 	luaL_Buffer       lB;
-	luaL_buffinit( L, &lB );
 
 	luaL_checklstring( L, 2, &sz );
 
@@ -334,35 +532,47 @@ lt_htp_str_write( lua_State *L )
 	if (T_HTP_STR_SEND != s->state)
 	{
 		luaL_buffinit( L, &lB );
-		c = t_htp_str_formHeader( L, &lB, s, 200, NULL, 0, 0 );
-		b = luaL_prepbuffer( &lB );
-		c = sprintf( b, "%zx\r\n", sz );
-		luaL_addsize( &lB, c );
+		t_htp_str_formHeader( L, &lB, s, 200, NULL, -1, 0, 1 );
+		if (NULL != s->zp)
+		{
+			luaL_pushresult( &lB );
+			s->state = T_HTP_STR_SEND;
+			t_htp_str_addbuffer( L, s, lB.n, 0 );
+			t_htp_zip_feed( L, s, 2, 0 );
+			return 0;
+		}
+		t_htp_str_addchunk( &lB, sz );
 		lua_pushvalue( L, 2 );
 		luaL_addvalue( &lB );
 		luaL_addlstring( &lB, "\r\n", 2 );
 		luaL_pushresult( &lB );
 		s->state = T_HTP_STR_SEND;
 	}
+	else if (NULL != s->zp)
+	{
+		t_htp_zip_feed( L, s, 2, 0 );
+		return 0;
+	}
 	else
 	{
 		// if the response Content-length is not known when we are sending
 		// the encoding must be chunked
-		if (! s->rsCl)
+		if (s->rsCl < 0)
 		{
 			luaL_buffinit( L, &lB );
-			b = luaL_prepbuffer( &lB );
-			c = sprintf( b, "%zx\r\n", sz );
-			luaL_addsize( &lB, c );
+			t_htp_str_addchunk( &lB, sz );
 			lua_pushvalue( L, 2 );
 			luaL_addvalue( &lB );
 			luaL_addlstring( &lB, "\r\n", 2 );
 			luaL_pushresult( &lB );
 		}
 		else
+		{
 			lua_pushvalue( L, 2 );
+			t_htp_str_addbuffer( L, s, sz, 0 );
+			return 0;
+		}
 	}
-	// TODO: 
 	t_htp_str_addbuffer( L, s, lB.n, 0 );
 
 	return 0;
@@ -381,32 +591,49 @@ lt_htp_str_finish( lua_State *L )
 {
 	struct t_htp_str *s = t_htp_str_check_ud( L, 1, 1 );
 	size_t            sz;  /// length of optional string handed in
-	char             *b;
-	size_t            c   = 0;
 	luaL_Buffer       lB;
 
 	// the first action ever called on the stream, prep header first
 	if (T_HTP_STR_SEND != s->state)
 	{
 		luaL_checklstring( L, 2, &sz );
+		// bodies of one loop iterations worth get compressed (or taken from
+		// the cache) right away, larger ones get streamed
+		if (sz <= T_HTP_ZIP_BLK &&
+		    T_HTP_ZIP_NO != (s->ze = t_htp_zip_choose( s, 200, (long long) sz, NULL, 0 )))
+		{
+			t_htp_zip_body( L, s, 2 );
+			lua_replace( L, 2 );
+			lua_tolstring( L, 2, &sz );
+		}
 		luaL_buffinit( L, &lB );
-		c = t_htp_str_formHeader( L, &lB, s, 200, NULL, (int) sz, 0 );
-		lua_pushvalue( L, 2 );
-		luaL_addvalue( &lB );
-		luaL_pushresult( &lB );
-		t_htp_str_addbuffer( L, s, lB.n, 1 );
+		t_htp_str_formHeader( L, &lB, s, 200, NULL, (long long) sz, 0, sz > T_HTP_ZIP_BLK );
+		if (NULL != s->zp)
+		{
+			luaL_pushresult( &lB );
+			s->state = T_HTP_STR_SEND;
+			t_htp_str_addbuffer( L, s, lB.n, 0 );
+			t_htp_zip_feed( L, s, 2, 1 );
+		}
+		else
+		{
+			lua_pushvalue( L, 2 );
+			luaL_addvalue( &lB );
+			luaL_pushresult( &lB );
+			t_htp_str_addbuffer( L, s, lB.n, 1 );
+		}
 	}
+	else if (NULL != s->zp)
+		t_htp_zip_feed( L, s, (LUA_TSTRING == lua_type( L, 2 )) ? 2 : 0, 1 );
 	else
 	{
 		if (LUA_TSTRING == lua_type( L, 2 ))
 		{
 			luaL_checklstring( L, 2, &sz );
-			if (! s->rsCl)   // chunked
+			if (s->rsCl < 0)   // chunked
 			{
 				luaL_buffinit( L, &lB );
-				b = luaL_prepbuffer( &lB );
-				c = sprintf( b, "%zx\r\n", sz );
-				luaL_addsize( &lB, c );
+				t_htp_str_addchunk( &lB, sz );
 				lua_pushvalue( L, 2 );
 				luaL_addvalue( &lB );
 				luaL_addlstring( &lB, "\r\n0\r\n\r\n", 7 );
@@ -421,11 +648,16 @@ lt_htp_str_finish( lua_State *L )
 		}
 		else
 		{
-			if (! s->rsCl)   // chunked
+			if (s->rsCl < 0)   // chunked
 			{
 				lua_pushstring( L, "0\r\n\r\n" );
 				t_htp_str_addbuffer( L, s, 5, 1 );
 			}
+			else              // mark the end of the response
+			{
+				lua_pushliteral( L, "" );
+				t_htp_str_addbuffer( L, s, 0, 1 );
+			}
 		}
 	}
 	/*if ( 0 == s->obc )
@@ -447,8 +679,188 @@ lt_htp_str_finish( lua_State *L )
 }
 
 
+/**--------------------------------------------------------------------------
+ * Evaluate the Range header of the request for an entity of sz bytes.
+ * \detail  Only a single range of bytes is supported; other units, multiple
+ *          ranges or malformed values get ignored and the entire entity gets
+ *          served as RFC 7233 permits.
+ * \param   struct t_htp_str*.
+ * \param   long long   size of the entity.
+ * \param   long long*  set to the offset of the range.
+ * \param   long long*  set to the length of the range.
+ * \return  int  1 for a range, 0 to serve the entity, -1 if unsatisfiable.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_str_range( struct t_htp_str *s, long long sz, long long *ro, long long *rl )
+{
+	size_t      vl;
+	const char *v = t_htp_str_getheader( s, "range", 5, &vl );
+	const char *e;
+	long long   a = -1;       ///< first byte
+	long long   z = -1;       ///< last byte
+
+	if (NULL == v || vl < 7 || 0 != memcmp( v, "bytes=", 6 ) || NULL != memchr( v, ',', vl ))
+		return 0;
+	for (e = v+vl, v += 6; v < e && *v >= '0' && *v <= '9' && a < LLONG_MAX/10 - 9; v++)
+		a = ((a < 0) ? 0 : a*10) + (*v - '0');
+	if (v == e || '-' != *v++)
+		return 0;
+	for (; v < e && *v >= '0' && *v <= '9' && z < LLONG_MAX/10 - 9; v++)
+		z = ((z < 0) ? 0 : z*10) + (*v - '0');
+	if (v != e || (a < 0 && z < 0) || (a >= 0 && z >= 0 && a > z))
+		return 0;
+	if (a < 0)                 // suffix; the last z bytes
+	{
+		if (0 == z)
+			return -1;
+		a = (z > sz) ? 0 : sz - z;
+		z = sz - 1;
+	}
+	else if (z < 0 || z >= sz)
+		z = sz - 1;
+	if (a >= sz)
+		return -1;
+	*ro = a;
+	*rl = z - a + 1;
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Send a file (or a part of it) as response of the T.Http.Stream.
+ * \detail  The data goes out straight from the file; it doesn't get copied
+ *          into Lua.  If nothing was written yet this sends the entire
+ *          response, honouring a Range request (206/416) and HEAD requests,
+ *          and finishes the stream.  Otherwise the file gets appended to the
+ *          body; the stream must still be finished.
+ * \param   L    The lua state.
+ * \lparam  Http.Stream instance.
+ * \lparam  string|file  path or Lua file handle.
+ * \lparam  int  offset into the file (optional; default 0).
+ * \lparam  int  length (optional; default up to the end of the file).
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_str_sendfile( lua_State *L )
+{
+	struct t_htp_str *s    = t_htp_str_check_ud( L, 1, 1 );
+	long long         o    = luaL_optinteger( L, 3, 0 );
+	long long         l    = luaL_optinteger( L, 4, -1 );
+	luaL_Stream      *p    = NULL;
+	long long         ro   = 0;
+	long long         rl;
+	int               code = 200;
+	int               fd;
+	int               t;
+	struct stat       st;
+	char              cr[ 72 ];    ///< "bytes a-b/l" of three 20 digit numbers
+	luaL_Buffer       lB;
+
+	luaL_argcheck( L, o >= 0, 3, "offset must not be negative" );
+	if (LUA_TSTRING == lua_type( L, 2 ))
+	{
+		if (-1 == (fd = open( lua_tostring( L, 2 ), O_RDONLY | O_CLOEXEC )))
+			return t_push_error( L, "Can't open file `%s`", lua_tostring( L, 2 ) );
+	}
+	else
+	{
+		p = (luaL_Stream *) luaL_checkudata( L, 2, LUA_FILEHANDLE );
+		luaL_argcheck( L, NULL != p->closef, 2, "attempt to use a closed file" );
+		fd = fileno( p->f );
+	}
+	if (NULL != s->zp)
+	{
+		if (NULL == p)
+			close( fd );
+		return t_push_error( L, "Can't send a file as part of a compressed response" );
+	}
+	if (-1 == fstat( fd, &st ) || ! S_ISREG( st.st_mode ) ||
+	    o > st.st_size || (l >= 0 && o + l > st.st_size))
+	{
+		if (NULL == p)
+			close( fd );
+		return t_push_error( L, "Can only send existing ranges of regular files" );
+	}
+	if (l < 0)
+		l = st.st_size - o;
+	rl = l;
+
+	if (T_HTP_STR_SEND != s->state)
+	{
+		lua_createtable( L, 0, 2 );
+		t = lua_gettop( L );
+		lua_pushliteral( L, "bytes" );
+		lua_setfield( L, t, "Accept-Ranges" );
+		switch (t_htp_str_range( s, l, &ro, &rl ))
+		{
+			case 1:
+				code = 206;
+				snprintf( cr, sizeof( cr ), "bytes %lld-%lld/%lld", ro, ro+rl-1, l );
+				lua_pushstring( L, cr );
+				lua_setfield( L, t, "Content-Range" );
+				break;
+			case -1:
+				code = 416;
+				rl   = 0;
+				snprintf( cr, sizeof( cr ), "bytes */%lld", l );
+				lua_pushstring( L, cr );
+				lua_setfield( L, t, "Content-Range" );
+				break;
+			default:
+				break;
+		}
+		luaL_buffinit( L, &lB );
+		t_htp_str_formHeader( L, &lB, s, code, NULL, rl, t, 0 );
+		luaL_pushresult( &lB );
+		// no body for HEAD requests
+		if (T_HTP_MTH_HEAD == s->mth)
+			rl = 0;
+		t_htp_str_addbuffer( L, s, lB.n, (0 == rl) );
+		lua_pop( L, 1 );        // the header table
+		s->state = T_HTP_STR_FINISH;
+		if (0 == rl)
+		{
+			if (NULL == p)
+				close( fd );
+			return 0;
+		}
+	}
+	else if (0 == rl)
+	{
+		if (NULL == p)
+			close( fd );
+		return 0;
+	}
+	else if (s->rsCl < 0)     // chunked; wrap the file into a chunk
+	{
+		snprintf( cr, sizeof( cr ), "%llx\r\n", rl );
+		lua_pushstring( L, cr );
+		t_htp_str_addbuffer( L, s, strlen( cr ), 0 );
+	}
+
+	if (NULL == p)
+		lua_pushnil( L );
+	else
+		lua_pushvalue( L, 2 );   // keep the file handle alive
+	t_htp_str_addfile( L, s, fd, (NULL == p), o + ro, (size_t) rl,
+	                   T_HTP_STR_FINISH == s->state );
+	if (T_HTP_STR_SEND == s->state && s->rsCl < 0)
+	{
+		lua_pushliteral( L, "\r\n" );
+		t_htp_str_addbuffer( L, s, 2, 0 );
+	}
+	return 0;
+}
+
+
 /**--------------------------------------------------------------------------
  * Sets the onData method in T.Http.Message.
+ * \detail  The function gets called as func( stream, data ) for each piece
+ *          of the request body as it arrives; Content-Length and chunked
+ *          bodies alike, chunked ones already decoded.  Once the body is
+ *          complete it gets called as func( stream ).  Returning false pauses
+ *          reading from the connection until stream:resume() gets called,
+ *          so bodies can be streamed to slow sinks without buffering them.
  * \param   L    The lua state.
  * \lparam  Http.Message instance.
  * \lparam  function to be executed when body data arrives on connection.
@@ -458,14 +870,17 @@ static int
 lt_htp_str_onbody( lua_State *L )
 {
 	struct t_htp_str *m = t_htp_str_check_ud( L, 1, 1 );
-	
+
 	if (lua_isfunction( L, 2 ))
 	{
+		lua_settop( L, 2 );
+		luaL_unref( L, LUA_REGISTRYINDEX, m->bR );
 		m->bR = luaL_ref( L, LUA_REGISTRYINDEX );
 		return 0;
 	}
 	if (lua_isnoneornil( L, 2 ))
 	{
+		luaL_unref( L, LUA_REGISTRYINDEX, m->bR );
 		m->bR = LUA_NOREF;
 		return 0;
 	}
@@ -474,6 +889,255 @@ lt_htp_str_onbody( lua_State *L )
 }
 
 
+/**--------------------------------------------------------------------------
+ * Stop reading from the connection of the stream.
+ * \detail  Unprocessed data stays in the connections buffer and the kernel
+ *          stops accepting data once its buffers are full, so the client
+ *          gets slowed down to the pace of the handler.
+ * \param   L    The lua state.
+ * \lparam  Http.Message instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_str_pause( lua_State *L )
+{
+	struct t_htp_str *s = t_htp_str_check_ud( L, 1, 1 );
+
+	t_htp_con_pause( s->con );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Continue reading from the connection of the stream.
+ * \detail  Buffered data gets processed at the end of the loop iteration, so
+ *          the handler won't be called from within resume().
+ * \param   L    The lua state.
+ * \lparam  Http.Message instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_str_resume( lua_State *L )
+{
+	struct t_htp_str *s = t_htp_str_check_ud( L, 1, 1 );
+
+	lua_getuservalue( L, 1 );       // the connection
+	t_htp_con_resume( L, s->con );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Find a request header by name, case insensitive.
+ * \param   struct t_htp_str*  stream.
+ * \param   const char*  name of the header.
+ * \param   size_t       length of the name.
+ * \param   size_t*      set to the length of the value.
+ * \return  const char*  value of the first header of that name; NULL if
+ *                       there is none or the head isn't complete yet.
+ * --------------------------------------------------------------------------*/
+const char
+*t_htp_str_getheader( struct t_htp_str *s, const char *k, size_t kl, size_t *vl )
+{
+	int i;
+
+	if (NULL == s->hd)
+		return NULL;
+	for (i=0; i < s->hdn; i++)
+		if (kl == s->hdr[ i ].kl && t_htp_ieq( s->hd + s->hdr[ i ].ko, k, kl ))
+		{
+			*vl = s->hdr[ i ].vl;
+			return s->hd + s->hdr[ i ].vo;
+		}
+	return NULL;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Create a T.Http.Header for the stream and push it to the LuaStack.
+ * \detail  The header object reads straight from the head of the stream
+ *          which it keeps alive as its uservalue.  The value at pos may also
+ *          be a T.Http.Response which embeds the stream.
+ * \param   L    The lua state.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \param   int  stack position of the stream.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_hdr_create_ud( lua_State *L, struct t_htp_str *s, int pos )
+{
+	struct t_htp_str **h;
+
+	h  = (struct t_htp_str **) lua_newuserdata( L, sizeof( struct t_htp_str * ) );
+	*h = s;
+	luaL_getmetatable( L, T_HTP_HDR_TYPE );
+	lua_setmetatable( L, -2 );
+	lua_pushvalue( L, pos );
+	lua_setuservalue( L, -2 );
+}
+
+
+/**--------------------------------------------------------------------------
+ * Look up a request header by name, case insensitive.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Header instance.
+ * \lparam  string  name of the header.
+ * \lreturn string  value of the first header of that name or nil.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_hdr__index( lua_State *L )
+{
+	struct t_htp_str *s = *(struct t_htp_str **) luaL_checkudata( L, 1, T_HTP_HDR_TYPE );
+	size_t            l;
+	const char       *k = lua_tolstring( L, 2, &l );
+	const char       *v;
+
+	if (NULL != k && NULL != (v = t_htp_str_getheader( s, k, l, &l )))
+		lua_pushlstring( L, v, l );
+	else
+		lua_pushnil( L );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Iterator over the request headers in the order received.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Header instance.
+ * \lreturn string  name and value of the next header; nothing when done.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_hdr_next( lua_State *L )
+{
+	struct t_htp_str *s = *(struct t_htp_str **) luaL_checkudata( L, 1, T_HTP_HDR_TYPE );
+	int               i = (int) lua_tointeger( L, lua_upvalueindex( 1 ) );
+
+	if (NULL == s->hd || i >= s->hdn)
+		return 0;
+	lua_pushinteger( L, i+1 );
+	lua_replace( L, lua_upvalueindex( 1 ) );
+	lua_pushlstring( L, s->hd + s->hdr[ i ].ko, s->hdr[ i ].kl );
+	lua_pushlstring( L, s->hd + s->hdr[ i ].vo, s->hdr[ i ].vl );
+	return 2;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __pairs of a T.Http.Header instance.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Header instance.
+ * \lreturn function, T.Http.Header, nil.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_hdr__pairs( lua_State *L )
+{
+	luaL_checkudata( L, 1, T_HTP_HDR_TYPE );
+	lua_pushinteger( L, 0 );
+	lua_pushcclosure( L, lt_htp_hdr_next, 1 );
+	lua_pushvalue( L, 1 );
+	lua_pushnil( L );
+	return 3;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __len (#) of a T.Http.Header instance.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Header instance.
+ * \lreturn int   number of headers received.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_hdr__len( lua_State *L )
+{
+	struct t_htp_str *s = *(struct t_htp_str **) luaL_checkudata( L, 1, T_HTP_HDR_TYPE );
+
+	lua_pushinteger( L, s->hdn );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * __tostring (print) representation of a T.Http.Header instance.
+ * \param   L    The lua state.
+ * \lparam  T.Http.Header instance.
+ * \lreturn string     formatted string representing T.Http.Header.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+lt_htp_hdr__tostring( lua_State *L )
+{
+	struct t_htp_str *s = *(struct t_htp_str **) luaL_checkudata( L, 1, T_HTP_HDR_TYPE );
+
+	lua_pushfstring( L, T_HTP_HDR_TYPE": %p", s );
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Push the query of the request url as table.
+ * \param   L    The lua state.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \return  int  1 if the url has a query, else 0 and nothing pushed.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_str_pushquery( lua_State *L, struct t_htp_str *s )
+{
+	const char *u = s->hd + s->uo;
+	const char *e = u + s->ul;        ///< end of url
+	const char *k;                    ///< start of key
+	const char *v;                    ///< end of key/start of value
+	const char *r;                    ///< end of key/value pair
+
+	if (NULL == (k = memchr( u, '?', s->ul )))
+		return 0;
+	lua_newtable( L );
+	for (k++; k < e; k = r+1)
+	{
+		if (NULL == (r = memchr( k, '&', e-k )))
+			r = e;
+		if (r == k)
+			continue;
+		if (NULL == (v = memchr( k, '=', r-k )))
+			v = r;
+		lua_pushlstring( L, k, v-k );
+		lua_pushlstring( L, (v < r) ? v+1 : r, (v < r) ? r-v-1 : 0 );
+		lua_rawset( L, -3 );
+	}
+	return 1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Push a value derived from the request head.
+ * \param   L    The lua state.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \param   int          stack position of the stream.
+ * \param   const char*  name of the value.
+ * \return  int  1 if k names a value of the head, else 0 and nothing pushed.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_str_pushrequest( lua_State *L, struct t_htp_str *s, int pos, const char *k )
+{
+	if (0 == strcmp( k, "header" ))
+		t_htp_hdr_create_ud( L, s, pos );
+	else if (0 == strcmp( k, "method" ))
+		lua_pushlstring( L, s->hd, s->ml );
+	else if (0 == strcmp( k, "url" ))
+		lua_pushlstring( L, s->hd + s->uo, s->ul );
+	else if (0 == strcmp( k, "version" ))
+		lua_pushlstring( L, s->hd + s->vo, s->vl );
+	else if (0 == strcmp( k, "query" ))
+		return t_htp_str_pushquery( L, s );
+	else
+		return 0;
+	return 1;
+}
+
+
 /**--------------------------------------------------------------------------
  * Access Field Values in T.Http.Message by accessing proxy table.
  * \param   L    The lua state.
@@ -485,11 +1149,19 @@ lt_htp_str_onbody( lua_State *L )
 static int
 lt_htp_str__index( lua_State *L )
 {
-	struct t_htp_str *s = t_htp_str_check_ud( L, -2, 1 );
+	struct t_htp_str *s = t_htp_str_check_ud( L, 1, 1 );
 
 	lua_rawgeti( L, LUA_REGISTRYINDEX, s->pR );  // fetch the proxy table
-	lua_pushvalue( L, -2 );                      // repush the key
-	lua_gettable( L, -2 );
+	lua_pushvalue( L, 2 );                       // repush the key
+	lua_gettable( L, 3 );
+	// values from the request head get created on first access and cached
+	if (lua_isnil( L, -1 ) && NULL != s->hd && LUA_TSTRING == lua_type( L, 2 )
+	 && t_htp_str_pushrequest( L, s, 1, lua_tostring( L, 2 ) ))
+	{
+		lua_pushvalue( L, 2 );
+		lua_pushvalue( L, -2 );
+		lua_rawset( L, 3 );
+	}
 	return 1;
 }
 
@@ -544,24 +1216,57 @@ lt_htp_str__len( lua_State *L )
 }
 
 
+/**--------------------------------------------------------------------------
+ * Release what a stream holds once its response went out.
+ * \detail  Drops the request head and the deflate state of the response and
+ *          empties the proxy table.  Lua code may still hold the stream, so
+ *          it stays usable as a dead object.
+ * \param   L    The lua state.
+ * \param   struct t_htp_str*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_str_release( lua_State *L, struct t_htp_str *s )
+{
+	t_htp_zip_free( L, s );
+	if (LUA_NOREF != s->pR)
+		t_htp_wipe( L, s->pR );
+	if (LUA_NOREF != s->hR)
+	{
+		luaL_unref( L, LUA_REGISTRYINDEX, s->hR );
+		s->hR  = LUA_NOREF;
+		s->hd  = NULL;
+		s->hdn = 0;
+	}
+}
+
+
 /**--------------------------------------------------------------------------
  * __gc of a T.Http.Message instance.
  * \param   L      The lua state.
  * \lparam  t_htp_str  The Message instance user_data.
  * \return  int    # of values pushed onto the stack.
  * --------------------------------------------------------------------------*/
-int
+static int
 lt_htp_str__gc( lua_State *L )
 {
 	struct t_htp_str *s = t_htp_str_check_ud( L, 1, 1 );
 
-	if (LUA_NOREF != s->pR)
+	t_htp_str_release( L, s );
+	luaL_unref( L, LUA_REGISTRYINDEX, s->bR );
+	s->bR = LUA_NOREF;
+	// unreachable -> recycle it including the proxy table
+	lua_pushnil( L );
+	lua_setuservalue( L, 1 );
+	if (LUA_NOREF != s->pR && ! t_htp_pool_put( L, &t_htp_str_pool, 1, T_HTP_STR_PL ))
 	{
 		luaL_unref( L, LUA_REGISTRYINDEX, s->pR );
 		s->pR = LUA_NOREF;
 	}
 
+#if PRINT_DEBUGS == 1
 	printf( "GC'ed "T_HTP_STR_TYPE": %p\n", s );
+#endif
 
 	return 0;
 }
@@ -578,6 +1283,17 @@ static const luaL_Reg t_htp_str_m [] = {
 	, { NULL,    NULL }
 };
 
+/**--------------------------------------------------------------------------
+ * T.Http.Header metamethods library definition
+ * --------------------------------------------------------------------------*/
+static const luaL_Reg t_htp_hdr_m [] = {
+	  { "__index",      lt_htp_hdr__index }
+	, { "__pairs",      lt_htp_hdr__pairs }
+	, { "__len",        lt_htp_hdr__len }
+	, { "__tostring",   lt_htp_hdr__tostring }
+	, { NULL,    NULL }
+};
+
 /**--------------------------------------------------------------------------
  * Proxytable methods library definition
  * --------------------------------------------------------------------------*/
@@ -586,6 +1302,9 @@ static const luaL_Reg t_htp_str_prx_s [] = {
 	, { "finish",       lt_htp_str_finish }
 	, { "writeHead",    lt_htp_str_writeHead }
 	, { "onBody",       lt_htp_str_onbody }
+	, { "pause",        lt_htp_str_pause }
+	, { "resume",       lt_htp_str_resume }
+	, { "sendFile",     lt_htp_str_sendfile }
 	, { NULL,    NULL }
 };
 
@@ -607,7 +1326,12 @@ luaopen_t_htp_str( lua_State *L )
 	luaL_setfuncs( L, t_htp_str_m, 0 );
 	lua_pop( L, 1 );        // remove metatable T.Http.Stream from stack
 
-	luaL_newmetatable( L, T_HTP_STR_PRX_NAME );
+	// T.Http.Header instance metatable
+	luaL_newmetatable( L, T_HTP_HDR_TYPE );
+	luaL_setfuncs( L, t_htp_hdr_m, 0 );
+	lua_pop( L, 1 );        // remove metatable T.Http.Header from stack
+
+	luaL_newmetatable( L, T_HTP_STR_PRX_TYPE );
 	luaL_setfuncs( L, t_htp_str_prx_s, 0 );
 	lua_setfield( L, -1, "__index" );
 	return 0;
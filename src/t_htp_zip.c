@@ -0,0 +1,551 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      t_htp_zip.c
+ * \brief     gzip/deflate compression of T.Http.Stream responses
+ * \detail    The coding gets negotiated from Accept-Encoding.  Bodies handed
+ *            to finish() in one piece get compressed at once, sent with a
+ *            Content-Length and cached by their content, so repeated bodies
+ *            get compressed once only.  Everything else is sent chunked and
+ *            compressed as it is written.  At most T_HTP_ZIP_BLK bytes get
+ *            compressed per loop iteration; the rest of a large body waits in
+ *            a queue, so compression can't stall the loop.
+ *            Without T_HTP_ZIP (zlib) responses are never compressed.
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+
+#include <stdlib.h>               // malloc, realloc, free
+#include <string.h>               // memchr
+#ifdef T_HTP_ZIP
+#include <zlib.h>
+#endif
+
+#include "t.h"
+#include "t_htp.h"
+
+
+#ifdef T_HTP_ZIP
+/// deflate state of a compressed chunked response
+struct t_htp_zip {
+	z_stream          z;
+	int               qR;     ///< Lua registry reference to the queue of pending body pieces
+	int               qh;     ///< index of the oldest pending piece
+	int               qt;     ///< index of the next piece queued
+	size_t            qo;     ///< bytes of the oldest piece compressed already
+	int               fin;    ///< finish the body once the queue is empty?
+	int               end;    ///< body finished?
+	int               dfr;    ///< compression of the queue deferred?
+	char             *ob;     ///< compressed output of the current step
+	size_t            obsz;   ///< size of ob
+	size_t            on;     ///< bytes in ob
+};
+
+
+static int t_htp_zip_continue( lua_State *L, void *ud );
+
+
+/**--------------------------------------------------------------------------
+ * Check if a content coding is in a header block.
+ * \param   const char*  formatted headers; "Key: value\r\n" each.
+ * \param   size_t       length of the headers.
+ * \return  int          1 if the block has a Content-Encoding, else 0.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_zip_encoded( const char *h, size_t hl )
+{
+	const char *e = h + hl;
+
+	while (NULL != h && e - h > 16)
+	{
+		if (':' == h[ 16 ] && t_htp_ieq( h, "content-encoding", 16 ))
+			return 1;
+		if (NULL != (h = memchr( h, '\n', e - h )))
+			h++;
+	}
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Pick a content coding the client accepts.
+ * \detail  gzip is preferred over deflate.  Codings with q=0 are refused.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \return  enum t_htp_zip_e   T_HTP_ZIP_NO if the client accepts neither.
+ * --------------------------------------------------------------------------*/
+static enum t_htp_zip_e
+t_htp_zip_accept( struct t_htp_str *s )
+{
+	size_t      vl = 0;
+	const char *v  = t_htp_str_getheader( s, "accept-encoding", 15, &vl );
+	const char *e  = v + vl;
+	const char *t;                 ///< start of the coding
+	const char *r;                 ///< end of the element
+	const char *q;
+	size_t      tl;
+	int         ok;
+	int         gz = 0;            ///< 1 accepted; -1 refused; 0 not mentioned
+	int         df = 0;
+	int         an = 0;            ///< "*"
+
+	for (; NULL != v && v < e; v = r+1)
+	{
+		if (NULL == (r = memchr( v, ',', e - v )))
+			r = e;
+		for (t = v; t < r && (' ' == *t || '\t' == *t); t++) ;
+		for (tl = 0; t+tl < r && ';' != t[ tl ] && ' ' != t[ tl ] && '\t' != t[ tl ]; tl++) ;
+		// q=0, q=0.0 ... refuse the coding
+		ok = 1;
+		if (NULL != (q = memchr( t+tl, '=', r - t - tl )))
+		{
+			for (q++; q < r && '0' == *q; q++) ;
+			if (q < r && '.' == *q)
+				for (q++; q < r && '0' == *q; q++) ;
+			ok = (q < r && '1' <= *q && '9' >= *q);
+		}
+		ok = (ok) ? 1 : -1;
+		if ((4 == tl && t_htp_ieq( t, "gzip", 4 )) || (6 == tl && t_htp_ieq( t, "x-gzip", 6 )))
+			gz = ok;
+		else if (7 == tl && t_htp_ieq( t, "deflate", 7 ))
+			df = ok;
+		else if (1 == tl && '*' == *t)
+			an = ok;
+	}
+	if (1 == gz || (0 == gz && 1 == an))
+		return T_HTP_ZIP_GZIP;
+	if (1 == df || (0 == df && 1 == an))
+		return T_HTP_ZIP_DEFLATE;
+	return T_HTP_ZIP_NO;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Set up a z_stream for a content coding.
+ * \detail  Doesn't raise, so callers can release their state first.
+ * \param   z_stream*.
+ * \param   int    compression level.
+ * \param   enum t_htp_zip_e  content coding.
+ * \return  int    0 on success, -1 on failure.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_zip_deflateinit( z_stream *z, int lvl, enum t_htp_zip_e ze )
+{
+	z->zalloc = Z_NULL;
+	z->zfree  = Z_NULL;
+	z->opaque = Z_NULL;
+	return (Z_OK == deflateInit2( z, lvl, Z_DEFLATED, (T_HTP_ZIP_GZIP == ze) ? 15+16 : 15,
+	                              8, Z_DEFAULT_STRATEGY )) ? 0 : -1;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Compress a piece of the body into the output of the current step.
+ * \param   L      The lua state.
+ * \param   struct t_htp_zip*.
+ * \param   const char*  data.
+ * \param   size_t       length of data.
+ * \param   int          zlib flush mode.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_zip_deflate( lua_State *L, struct t_htp_zip *zp, const char *d, size_t n, int flush )
+{
+	char   *ob;
+	int     r;
+
+	zp->z.next_in  = (Bytef *) d;
+	zp->z.avail_in = (uInt) n;
+	do
+	{
+		if (zp->obsz - zp->on < 1024)
+		{
+			if (NULL == (ob = (char *) realloc( zp->ob, zp->obsz * 2 )))
+				t_push_error( L, "Failed to allocate compression buffer" );
+			zp->ob    = ob;
+			zp->obsz *= 2;
+		}
+		zp->z.next_out  = (Bytef *) zp->ob + zp->on;
+		zp->z.avail_out = (uInt) (zp->obsz - zp->on);
+		if (Z_STREAM_ERROR == (r = deflate( &zp->z, flush )))
+			t_push_error( L, "Failed to compress response" );
+		zp->on = zp->obsz - zp->z.avail_out;
+	}
+	while (0 == zp->z.avail_out || (Z_FINISH == flush && Z_STREAM_END != r));
+}
+
+
+/**--------------------------------------------------------------------------
+ * Compress up to T_HTP_ZIP_BLK bytes of the queued body pieces.
+ * \detail  The output goes out as a single chunk.  The end of each piece gets
+ *          flushed so whatever got written reaches the client.  If pieces are
+ *          left the next step gets deferred to the end of the loop iteration.
+ *          Expects the stream on stack position 1.
+ * \param   L      The lua state.
+ * \param   struct t_htp_str*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+static void
+t_htp_zip_step( lua_State *L, struct t_htp_str *s )
+{
+	struct t_htp_zip *zp  = s->zp;
+	size_t            bgt = T_HTP_ZIP_BLK;   ///< bytes left to compress in this step
+	size_t            l;
+	size_t            n;
+	const char       *d;
+	char              nb[ 16 ];
+	luaL_Buffer       lB;
+
+	zp->on = 0;
+	lua_rawgeti( L, LUA_REGISTRYINDEX, zp->qR );
+	while (bgt > 0 && zp->qh < zp->qt)
+	{
+		lua_rawgeti( L, -1, zp->qh );
+		d = lua_tolstring( L, -1, &l );
+		n = (l - zp->qo < bgt) ? l - zp->qo : bgt;
+		if (zp->qo + n < l)
+			t_htp_zip_deflate( L, zp, d + zp->qo, n, Z_NO_FLUSH );
+		else if (zp->fin && zp->qh+1 == zp->qt)
+		{
+			t_htp_zip_deflate( L, zp, d + zp->qo, n, Z_FINISH );
+			zp->end = 1;
+		}
+		else
+			t_htp_zip_deflate( L, zp, d + zp->qo, n, Z_SYNC_FLUSH );
+		lua_pop( L, 1 );
+		bgt    -= n;
+		zp->qo += n;
+		if (zp->qo == l)
+		{
+			lua_pushnil( L );
+			lua_rawseti( L, -2, zp->qh++ );
+			zp->qo = 0;
+		}
+	}
+	lua_pop( L, 1 );
+	if (zp->fin && ! zp->end && zp->qh == zp->qt)
+	{
+		t_htp_zip_deflate( L, zp, NULL, 0, Z_FINISH );
+		zp->end = 1;
+	}
+
+	if (zp->on > 0 || zp->end)
+	{
+		luaL_buffinit( L, &lB );
+		if (zp->on > 0)
+		{
+			luaL_addlstring( &lB, nb, t_htp_xtoa( nb, zp->on ) );
+			luaL_addlstring( &lB, "\r\n", 2 );
+			luaL_addlstring( &lB, zp->ob, zp->on );
+			luaL_addlstring( &lB, "\r\n", 2 );
+		}
+		if (zp->end)
+			luaL_addlstring( &lB, "0\r\n\r\n", 5 );
+		luaL_pushresult( &lB );
+		t_htp_str_addbuffer( L, s, lB.n, zp->end );
+	}
+	if (zp->qh < zp->qt)
+	{
+		zp->dfr = 1;
+		lua_pushvalue( L, 1 );
+		t_ael_defer_cf( L, s->con->srv->ael, t_htp_zip_continue, s );
+	}
+}
+
+
+/**--------------------------------------------------------------------------
+ * Run the next compression step; called via lua_call() so the stream ends
+ * up on stack position 1.
+ * \param   L      The lua state.
+ * \lparam  ud     T.Http.Stream userdata instance.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_zip_run( lua_State *L )
+{
+	struct t_htp_str *s = (struct t_htp_str *) lua_touserdata( L, 1 );
+
+	// the connection may have been closed meanwhile
+	if (NULL == s->zp)
+		return 0;
+	s->zp->dfr = 0;
+	if (NULL == s->con->sck)
+		t_htp_zip_free( L, s );
+	else
+		t_htp_zip_step( L, s );
+	return 0;
+}
+
+
+/**--------------------------------------------------------------------------
+ * Continue compressing the queued body pieces of a stream.
+ * Native T.Loop task; the stream is on top of the stack.
+ * \param   L      The lua state.
+ * \param   void*  struct t_htp_str.
+ * \return  int    # of values pushed onto the stack.
+ * --------------------------------------------------------------------------*/
+static int
+t_htp_zip_continue( lua_State *L, void *ud )
+{
+	(void) ud;
+	lua_pushcfunction( L, t_htp_zip_run );
+	lua_insert( L, -2 );
+	lua_call( L, 1, 0 );
+	return 0;
+}
+#endif
+
+
+/**--------------------------------------------------------------------------
+ * Decide whether and how a response gets compressed.
+ * \detail  Requires compression to be enabled on the server, a client
+ *          accepting gzip or deflate, a status code with a body and a body
+ *          of at least the servers minimum size (unless the size is unknown).
+ *          Responses carrying a Content-Encoding already are left alone.
+ * \param   struct t_htp_str*  stream with a complete request head.
+ * \param   int          status code of the response.
+ * \param   long long    length of the body; -1 if unknown.
+ * \param   const char*  formatted response headers; may be NULL.
+ * \param   size_t       length of the headers.
+ * \return  enum t_htp_zip_e  T_HTP_ZIP_NO if not to be compressed.
+ * --------------------------------------------------------------------------*/
+enum t_htp_zip_e
+t_htp_zip_choose( struct t_htp_str *s, int code, long long len, const char *h, size_t hl )
+{
+#ifdef T_HTP_ZIP
+	struct t_htp_srv *srv = s->con->srv;
+
+	if (0 == srv->zlv || NULL == s->hd || T_HTP_MTH_HEAD == s->mth
+	 || code < 200 || 204 == code || 206 == code || 304 == code
+	 || (len >= 0 && len < (long long) srv->zmn)
+	 || t_htp_zip_encoded( srv->hb, srv->hl ) || t_htp_zip_encoded( h, hl ))
+		return T_HTP_ZIP_NO;
+	return t_htp_zip_accept( s );
+#else
+	(void) s; (void) code; (void) len; (void) h; (void) hl;
+	return T_HTP_ZIP_NO;
+#endif
+}
+
+
+/**--------------------------------------------------------------------------
+ * Start compressing the chunked response of a stream with coding s->ze.
+ * \detail  Allocates the deflate state only; pushes nothing, so it can be
+ *          called while the response head gets assembled.
+ * \param   L      The lua state.
+ * \param   struct t_htp_str*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_zip_init( lua_State *L, struct t_htp_str *s )
+{
+#ifdef T_HTP_ZIP
+	struct t_htp_zip *zp = (struct t_htp_zip *) malloc( sizeof( struct t_htp_zip ) );
+
+	if (NULL == zp || NULL == (zp->ob = (char *) malloc( BUFSIZ )))
+	{
+		free( zp );
+		t_push_error( L, "Failed to allocate compression state" );
+	}
+	if (0 != t_htp_zip_deflateinit( &zp->z, s->con->srv->zlv, s->ze ))
+	{
+		free( zp->ob );
+		free( zp );
+		t_push_error( L, "Failed to initialize compression" );
+	}
+	zp->qR   = LUA_NOREF;
+	zp->qh   = 1;
+	zp->qt   = 1;
+	zp->qo   = 0;
+	zp->fin  = 0;
+	zp->end  = 0;
+	zp->dfr  = 0;
+	zp->obsz = BUFSIZ;
+	zp->on   = 0;
+	s->zp    = zp;
+#else
+	(void) L; (void) s;
+#endif
+}
+
+
+/**--------------------------------------------------------------------------
+ * Push the body at pos compressed with coding s->ze.
+ * \detail  Looks the body up in the servers cache first.  Compressed bodies
+ *          get added to the cache; once it holds more than the servers limit
+ *          it gets emptied.
+ * \param   L      The lua state.
+ * \param   struct t_htp_str*.
+ * \param   int    stack position of the body string.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_zip_body( lua_State *L, struct t_htp_str *s, int pos )
+{
+#ifdef T_HTP_ZIP
+	struct t_htp_srv *srv = s->con->srv;
+	int              *cR  = &srv->zcR[ (T_HTP_ZIP_GZIP == s->ze) ? 0 : 1 ];
+	size_t            l;
+	const char       *d   = lua_tolstring( L, pos, &l );
+	size_t            bl;
+	z_stream          z;
+	luaL_Buffer       lB;
+
+	pos = lua_absindex( L, pos );
+	if (LUA_NOREF == *cR)
+	{
+		lua_newtable( L );
+		*cR = luaL_ref( L, LUA_REGISTRYINDEX );
+	}
+	lua_rawgeti( L, LUA_REGISTRYINDEX, *cR );
+	lua_pushvalue( L, pos );
+	if (LUA_TSTRING == lua_rawget( L, -2 ))
+	{
+		lua_remove( L, -2 );
+		return;
+	}
+	lua_pop( L, 1 );
+
+	if (0 != t_htp_zip_deflateinit( &z, srv->zlv, s->ze ))
+		t_push_error( L, "Failed to initialize compression" );
+	bl = deflateBound( &z, l );
+	luaL_buffinit( L, &lB );
+	z.next_in   = (Bytef *) d;
+	z.avail_in  = (uInt) l;
+	z.next_out  = (Bytef *) luaL_prepbuffsize( &lB, bl );
+	z.avail_out = (uInt) bl;
+	if (Z_STREAM_END != deflate( &z, Z_FINISH ))
+	{
+		deflateEnd( &z );
+		t_push_error( L, "Failed to compress response" );
+	}
+	luaL_addsize( &lB, bl - z.avail_out );
+	deflateEnd( &z );
+	luaL_pushresult( &lB );                //S: ...,cache,zipped
+
+	srv->zcs += l + lB.n;
+	if (srv->zcs > srv->zcm)
+	{
+		// start over instead of tracking what got used last
+		luaL_unref( L, LUA_REGISTRYINDEX, srv->zcR[ 0 ] );
+		luaL_unref( L, LUA_REGISTRYINDEX, srv->zcR[ 1 ] );
+		srv->zcR[ 0 ] = LUA_NOREF;
+		srv->zcR[ 1 ] = LUA_NOREF;
+		srv->zcs      = 0;
+	}
+	if (l + lB.n <= srv->zcm)
+	{
+		if (LUA_NOREF == *cR)
+		{
+			lua_newtable( L );
+			lua_replace( L, -3 );
+			lua_pushvalue( L, -2 );
+			*cR = luaL_ref( L, LUA_REGISTRYINDEX );
+			srv->zcs = l + lB.n;
+		}
+		lua_pushvalue( L, pos );
+		lua_pushvalue( L, -2 );
+		lua_rawset( L, -4 );
+	}
+	lua_remove( L, -2 );
+#else
+	(void) s;
+	lua_pushvalue( L, pos );
+#endif
+}
+
+
+/**--------------------------------------------------------------------------
+ * Hand a piece of the body to the compressor of a chunked response.
+ * \detail  Pieces get compressed in the order they arrive; if earlier pieces
+ *          are still waiting for the next loop iteration this one queues up
+ *          behind them.  Expects the stream on stack position 1.
+ * \param   L      The lua state.
+ * \param   struct t_htp_str*  stream with s->zp set.
+ * \param   int    stack position of the body string; 0 for none.
+ * \param   int    is this the end of the body?
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_zip_feed( lua_State *L, struct t_htp_str *s, int pos, int fin )
+{
+#ifdef T_HTP_ZIP
+	struct t_htp_zip *zp = s->zp;
+
+	if (pos && lua_rawlen( L, pos ) > 0)
+	{
+		if (LUA_NOREF == zp->qR)
+		{
+			lua_newtable( L );
+			zp->qR = luaL_ref( L, LUA_REGISTRYINDEX );
+		}
+		lua_rawgeti( L, LUA_REGISTRYINDEX, zp->qR );
+		lua_pushvalue( L, pos );
+		lua_rawseti( L, -2, zp->qt++ );
+		lua_pop( L, 1 );
+	}
+	zp->fin |= fin;
+	if (! zp->dfr)
+		t_htp_zip_step( L, s );
+#else
+	(void) L; (void) s; (void) pos; (void) fin;
+#endif
+}
+
+
+/**--------------------------------------------------------------------------
+ * Drop the deflate state of a stream.
+ * \param   L      The lua state.
+ * \param   struct t_htp_str*.
+ * \return  void.
+ * --------------------------------------------------------------------------*/
+void
+t_htp_zip_free( lua_State *L, struct t_htp_str *s )
+{
+#ifdef T_HTP_ZIP
+	if (NULL == s->zp)
+		return;
+	deflateEnd( &s->zp->z );
+	luaL_unref( L, LUA_REGISTRYINDEX, s->zp->qR );
+	free( s->zp->ob );
+	free( s->zp );
+	s->zp = NULL;
+#else
+	(void) L; (void) s;
+#endif
+}
+
+
+/**--------------------------------------------------------------------------
+ * Configure the compression of responses.
+ * \detail  level 0 disables compression.  Bodies smaller than min bytes are
+ *          sent as they are.  Up to cache bytes of bodies and their
+ *          compressed variants are kept to answer repeated bodies without
+ *          compressing them again.
+ * \param   L     Lua state.
+ * \lparam  ud    T.Http.Server userdata instance.
+ * \lparam  int   compression level 0-9 (optional; default 6).
+ * \lparam  int   smallest body to compress in bytes (optional).
+ * \lparam  int   size of the cache in bytes (optional).
+ * \return  int    # of values pushed onto the stack.
+ *  -------------------------------------------------------------------------*/
+int
+lt_htp_srv_compress( lua_State *L )
+{
+	struct t_htp_srv *s   = t_htp_srv_check_ud( L, 1, 1 );
+	lua_Integer       lvl = luaL_optinteger( L, 2, T_HTP_ZIP_LVL );
+	lua_Integer       mn  = luaL_optinteger( L, 3, (lua_Integer) s->zmn );
+	lua_Integer       cm  = luaL_optinteger( L, 4, (lua_Integer) s->zcm );
+
+	luaL_argcheck( L, lvl >= 0 && lvl <= 9, 2, "compression level must be 0-9" );
+	luaL_argcheck( L, mn >= 0, 3, "size must not be negative" );
+	luaL_argcheck( L, cm >= 0, 4, "size must not be negative" );
+#ifndef T_HTP_ZIP
+	if (lvl > 0)
+		return t_push_error( L, T_HTP_SRV_TYPE" was built without compression" );
+#endif
+	s->zlv = (int) lvl;
+	s->zmn = (size_t) mn;
+	s->zcm = (size_t) cm;
+	return 0;
+}
@@ -27,7 +27,7 @@
 #include <sys/socket.h>
 #include <sys/select.h>
 #endif
-#include "t_net.h"
+#include "t_ael.h"         // t_ael_closefd(); includes t_net.h
 #include "t_buf.h"         // the ability to send and recv buffers
 
 
@@ -269,6 +269,7 @@ t_net_close( lua_State *L, struct t_net *s )
 {
 	if (-1 != s->fd)
 	{
+		t_ael_closefd( L, s->fd );
 		//printf( "closing socket: %d\n", s->fd );
 		if (-1 == close( s->fd ))
 			return t_push_error( L, "ERROR closing socket" );
@@ -73,10 +73,13 @@ int           t_net_connect     ( lua_State *L, enum t_net_t t );
 int          lt_net__tostring   ( lua_State *L );
 
 // t_net_tcp.c
+struct iovec;                    // sys/uio.h
 int           luaopen_t_net_tcp ( lua_State *L );
 struct t_net *t_net_tcp_check_ud( lua_State *L, int pos, int check );
 int           t_net_tcp_recv    ( lua_State *L, struct t_net *s, char* buff, size_t sz );
 int           t_net_tcp_send    ( lua_State *L, struct t_net *s, const char* buff, size_t sz );
+int           t_net_tcp_sendv   ( lua_State *L, struct t_net *s, const struct iovec *iov, int cnt );
+int           t_net_tcp_sendfile( lua_State *L, struct t_net *s, int fd, off_t *off, size_t sz );
 int           t_net_tcp_accept  ( lua_State *L, int pos );
 
 // t_net_udp.c
@@ -26,10 +26,19 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/uio.h>       // struct iovec
+#include <errno.h>         // errno, EAGAIN
+#ifdef __linux__
+#include <sys/sendfile.h>  // sendfile
+#endif
 #endif
 #include "t_net.h"
 #include "t_buf.h"         // the ability to send and recv buffers
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 
 /**--------------------------------------------------------------------------
  * construct a TCP Socket and return it.
@@ -173,6 +182,79 @@ t_net_tcp_send( lua_State *L, struct t_net *s, const char* buf, size_t sz )
 }
 
 
+/** -------------------------------------------------------------------------
+ * Send several buffers to a TCP socket in a single call.
+ * \detail  Meant for non-blocking sockets; a full socket buffer isn't an
+ *          error.  A peer which reset the connection doesn't raise SIGPIPE.
+ * \param   L      Lua state.
+ * \param   struct t_net  userdata.
+ * \param   struct iovec* buffers in the order to be sent.
+ * \param   int    number of buffers.
+ * \return  number of bytes sent out; may end inside any of the buffers.  0 if
+ *          the socket can't take data right now, -1 on failure (errno).
+ *-------------------------------------------------------------------------*/
+int
+t_net_tcp_sendv( lua_State *L, struct t_net *s, const struct iovec *iov, int cnt )
+{
+	struct msghdr mh;
+	ssize_t       rslt;
+
+	(void) L;
+	memset( &mh, 0, sizeof( mh ) );
+	mh.msg_iov    = (struct iovec *) iov;
+	mh.msg_iovlen = cnt;
+	if (-1 == (rslt = sendmsg( s->fd, &mh, MSG_NOSIGNAL )))
+		return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ? 0 : -1;
+
+	return (int) rslt;
+}
+
+
+/** -------------------------------------------------------------------------
+ * Send a part of a file to a TCP socket.
+ * \detail  Uses sendfile() where available, so the data doesn't get copied
+ *          through user space.  Elsewhere up to BUFSIZ bytes get read and sent.
+ *          Meant for non-blocking sockets like t_net_tcp_sendv().
+ * \param   L      Lua state.
+ * \param   struct t_net  userdata.
+ * \param   int    file descriptor to read from.
+ * \param   off_t* offset to read from; gets advanced by the bytes sent.
+ * \param   size_t most bytes to send.
+ * \return  number of bytes sent out.  0 if the socket can't take data right
+ *          now, -1 on failure (errno) or if the file ends before off.
+ *-------------------------------------------------------------------------*/
+int
+t_net_tcp_sendfile( lua_State *L, struct t_net *s, int fd, off_t *off, size_t sz )
+{
+	ssize_t rslt;
+#ifndef __linux__
+	char    buf[ BUFSIZ ];
+#endif
+
+	(void) L;
+	if (0 == sz)
+		return 0;
+#ifdef __linux__
+	rslt = sendfile( s->fd, fd, off, sz );
+#else
+	if (sz > sizeof( buf ))
+		sz = sizeof( buf );
+	if ((rslt = pread( fd, buf, sz, *off )) > 0 &&
+	    -1 != (rslt = send( s->fd, buf, rslt, MSG_NOSIGNAL )))
+		*off += rslt;
+#endif
+	if (-1 == rslt)
+		return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ? 0 : -1;
+	if (0 == rslt)
+	{
+		errno = EIO;              // the file got truncated
+		return -1;
+	}
+
+	return (int) rslt;
+}
+
+
 /** -------------------------------------------------------------------------
  * Send a message over a TCP socket.
  * \param   L      Lua state.
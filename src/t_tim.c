@@ -71,6 +71,28 @@ t_tim_since( struct timeval *tA )
 }
 
 
+/**--------------------------------------------------------------------------
+ * Sets tA to the current time of a monotonic clock.
+ * \detail  Unlike t_tim_now() this is unaffected by changes to the system
+ *          time which makes it the reference for deadlines.  The value has
+ *          no relation to the time since epoch.
+ * \param  *tA struct timeval pointer
+ * --------------------------------------------------------------------------*/
+void
+t_tim_mono( struct timeval *tA )
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	tA->tv_sec  = ts.tv_sec;
+	tA->tv_usec = ts.tv_nsec / 1000;
+#else
+	t_tim_now( tA, 0 );
+#endif
+}
+
+
 /**--------------------------------------------------------------------------
  * Gets milliseconds worth of timeval.
  * \param  struct timeval *t pointer.
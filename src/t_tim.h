@@ -11,6 +11,7 @@
 #include <time.h>
 #else
 #include <sys/time.h>    // gettimeofday()
+#include <time.h>        // clock_gettime()
 #endif
 
 
@@ -35,6 +36,7 @@ struct timeval *t_tim_create_ud( lua_State *L, long ms );
 void t_tim_add  ( struct timeval *tA, struct timeval *tB, struct timeval *tX );
 void t_tim_sub  ( struct timeval *tA, struct timeval *tB, struct timeval *tX );
 void t_tim_since( struct timeval *tA );
+void t_tim_mono ( struct timeval *tA );
 long t_tim_getms( struct timeval *tA );
 int   lt_tim_get( lua_State *L );
 
@@ -0,0 +1,111 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      test/t_ael_wak.c
+ * \brief     Unit test for posting jobs to a T.Loop from other threads
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>           // alarm
+
+#include "t_unittest.h"
+
+#define T_AEL_WAK_TST_N   1000
+
+static struct t_ael     *t_ael_wak_tst_ael;
+static struct t_ael_job  t_ael_wak_tst_jb[ T_AEL_WAK_TST_N ];
+static int               t_ael_wak_tst_ord[ T_AEL_WAK_TST_N ];
+static int               t_ael_wak_tst_n;      ///< jobs run so far
+static int               t_ael_wak_tst_thr;    ///< jobs run off the loop thread
+static pthread_t         t_ael_wak_tst_lp;     ///< the loop thread
+
+/// job; records its number and the thread running it
+static int
+t_ael_wak_tst_job( lua_State *L, void *ud )
+{
+	(void) L;
+	if (! pthread_equal( pthread_self( ), t_ael_wak_tst_lp ))
+		t_ael_wak_tst_thr++;
+	t_ael_wak_tst_ord[ t_ael_wak_tst_n++ ] = (int) (intptr_t) ud;
+	return 0;
+}
+
+/// thread posting all jobs to the loop
+static void
+*t_ael_wak_tst_poster( void *arg )
+{
+	int i;
+
+	(void) arg;
+	for (i=0; i < T_AEL_WAK_TST_N; i++)
+	{
+		t_ael_wak_tst_jb[ i ].cf = t_ael_wak_tst_job;
+		t_ael_wak_tst_jb[ i ].ud = (void *) (intptr_t) i;
+		if (0 != t_ael_post( t_ael_wak_tst_ael, &t_ael_wak_tst_jb[ i ] ))
+			return (void *) 1;
+	}
+	return NULL;
+}
+
+static int
+test_t_ael_wak_closed( )
+{
+	lua_State        *L   = luaL_newstate( );
+	struct t_ael     *ael = t_ael_create_ud( L, 8 );
+	struct t_ael_job  jb  = { NULL, t_ael_wak_tst_job, NULL };
+	int               fd;
+
+	_assert( -1 == t_ael_post( ael, &jb ) );
+	_assert( 0 == t_ael_wak_open( L, ael ) );
+	fd = ael->wk_rd;
+	_assert( NULL != ael->fd_set[ fd ] && T_AEL_RD == ael->fd_set[ fd ]->t );
+	t_ael_wak_close( L, ael );
+	_assert( -1 == t_ael_post( ael, &jb ) );
+	_assert( NULL == ael->fd_set[ fd ] );
+	lua_close( L );
+	return 0;
+}
+
+static int
+test_t_ael_wak_post( )
+{
+	lua_State  *L = luaL_newstate( );
+	pthread_t   pt;
+	void       *r;
+	int         i;
+
+	t_ael_wak_tst_ael = t_ael_create_ud( L, 8 );
+	t_ael_wak_tst_lp  = pthread_self( );
+	t_ael_wak_tst_n   = 0;
+	t_ael_wak_tst_thr = 0;
+	_assert( 0 == t_ael_wak_open( L, t_ael_wak_tst_ael ) );
+	_assert( 0 == pthread_create( &pt, NULL, t_ael_wak_tst_poster, NULL ) );
+	alarm( 10 );                              // a lost wakeup blocks forever
+	while (t_ael_wak_tst_n < T_AEL_WAK_TST_N)
+		_assert( 0 <= t_ael_poll_impl( L, t_ael_wak_tst_ael ) );
+	alarm( 0 );
+	pthread_join( pt, &r );
+	_assert( NULL == r );
+	_assert( 0 == t_ael_wak_tst_thr );
+	for (i=0; i < T_AEL_WAK_TST_N; i++)
+		_assert( i == t_ael_wak_tst_ord[ i ] );
+	t_ael_wak_close( L, t_ael_wak_tst_ael );
+	lua_close( L );
+	return 0;
+}
+
+// Add all testable functions to the array
+static const struct test_function all_tests [] = {
+	{ "Refusing jobs unless opened",              test_t_ael_wak_closed },
+	{ "Running posted jobs on the loop in order", test_t_ael_wak_post },
+	{ NULL, NULL }
+};
+
+int
+main()
+{
+	return test_execute( all_tests );
+}
@@ -0,0 +1,257 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      test/t_htp.c
+ * \brief     Unit test for the HTTP head parser and the chunk decoder
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+#include "t_unittest.h"
+
+static const char t_htp_req [] =
+	"GET /a/b?c=d HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"X-Dup: one\r\n"
+	"X-Dup:two \r\n"
+	"Content-Length: 5\r\n"
+	"\r\n";
+
+/// reset a stream as if it was new; rs tells if a response head follows
+static void
+t_htp_init( struct t_htp_str *s, int rs )
+{
+	memset( s, 0, sizeof( struct t_htp_str ) );
+	s->ps = (rs) ? T_HTP_P_RVR : T_HTP_P_MTH;
+}
+
+/// parse a head in one piece
+static int
+t_htp_head( struct t_htp_str *s, const char *b )
+{
+	t_htp_init( s, 0 );
+	return t_htp_pHead( s, b, strlen( b ) );
+}
+
+/// does header i of the head b have key k and value v?
+static int
+t_htp_hdr_is( struct t_htp_str *s, const char *b, int i, const char *k, const char *v )
+{
+	return i < s->hdn &&
+	       s->hdr[ i ].kl == strlen( k ) && 0 == memcmp( b + s->hdr[ i ].ko, k, strlen( k ) ) &&
+	       s->hdr[ i ].vl == strlen( v ) && 0 == memcmp( b + s->hdr[ i ].vo, v, strlen( v ) );
+}
+
+static int
+test_t_htp_pHead_whole( )
+{
+	struct t_htp_str s;
+
+	_assert( 1 == t_htp_head( &s, t_htp_req ) );
+	_assert( sizeof( t_htp_req ) - 1 == s.po );
+	_assert( T_HTP_MTH_GET == s.mth && 3 == s.ml );
+	_assert( 8 == s.ul && 0 == memcmp( t_htp_req + s.uo, "/a/b?c=d", 8 ) );
+	_assert( T_HTP_VER_11 == s.ver && 200 == s.kpAlv );
+	_assert( 4 == s.hdn );
+	_assert( t_htp_hdr_is( &s, t_htp_req, 0, "Host", "localhost" ) );
+	_assert( t_htp_hdr_is( &s, t_htp_req, 1, "X-Dup", "one" ) );
+	_assert( t_htp_hdr_is( &s, t_htp_req, 2, "X-Dup", "two" ) );
+	_assert( 1 == s.rqFr && 5 == s.rqCl );
+	return 0;
+}
+
+static int
+test_t_htp_pHead_split( )
+{
+	struct t_htp_str s;
+	size_t           n = sizeof( t_htp_req ) - 1;
+	size_t           i, k;
+
+	// the head arrives in pieces of k bytes each
+	for (k=1; k < n; k++)
+	{
+		t_htp_init( &s, 0 );
+		for (i=k; i < n; i+=k)
+			_assert( 0 == t_htp_pHead( &s, t_htp_req, i ) );
+		_assert( 1 == t_htp_pHead( &s, t_htp_req, n ) );
+		_assert( n == s.po && 4 == s.hdn && 5 == s.rqCl );
+		_assert( t_htp_hdr_is( &s, t_htp_req, 2, "X-Dup", "two" ) );
+	}
+	return 0;
+}
+
+static int
+test_t_htp_pHead_pipelined( )
+{
+	struct t_htp_str s;
+	const char       b [] =
+		"GET /1 HTTP/1.1\r\nHost: h\r\n\r\n"
+		"POST /2 HTTP/1.0\r\nContent-Length: 0\r\n\r\n";
+	size_t           n = sizeof( b ) - 1;
+
+	_assert( 1 == t_htp_head( &s, b ) );
+	_assert( 28 == s.po && 1 == s.hdn );
+	_assert( 2 == s.ul && 0 == memcmp( b + s.uo, "/1", 2 ) );
+	t_htp_init( &s, 0 );
+	_assert( 1 == t_htp_pHead( &s, b + 28, n - 28 ) );
+	_assert( n - 28 == s.po );
+	_assert( T_HTP_MTH_POST == s.mth && T_HTP_VER_10 == s.ver && 0 == s.kpAlv );
+	return 0;
+}
+
+static int
+test_t_htp_pHead_version( )
+{
+	struct t_htp_str s;
+
+	_assert( 1 == t_htp_head( &s, "GET / HTTP/1.0\r\n\r\n" ) && T_HTP_VER_10 == s.ver );
+	_assert( 1 == t_htp_head( &s, "GET / HTTP/1.1\n\n" ) && T_HTP_VER_11 == s.ver );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/2.1\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/2.0\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.2\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/0.9\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.10\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTX/1.1\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET /\r\n\r\n" ) );
+	return 0;
+}
+
+static int
+test_t_htp_pHead_malformed( )
+{
+	struct t_htp_str s;
+
+	_assert( -1 == t_htp_head( &s, "FETCH / HTTP/1.1\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET /a\tb HTTP/1.1\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.1\r\nHost: h\r\n folded\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.1\r\nBad Key: v\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.1\r\n: v\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.1\r\nX: a\001b\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.1\r\nX: a\rb\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "GET / HTTP/1.1\r\n\rX" ) );
+	return 0;
+}
+
+static int
+test_t_htp_pHead_framing( )
+{
+	struct t_htp_str s;
+
+	_assert( 1 == t_htp_head( &s, "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n" ) );
+	_assert( 2 == s.rqFr && T_HTP_CK_SZ0 == s.cs );
+	// ambiguous framing; request smuggling
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\n"
+		"Content-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\n"
+		"Transfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\n"
+		"Content-Length: 5\r\nContent-Length: 5\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\n"
+		"Transfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\nTransfer-Encoding: xchunked\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\nContent-Length: 5a\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\nContent-Length: -5\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\nContent-Length:\r\n\r\n" ) );
+	_assert( -1 == t_htp_head( &s, "POST / HTTP/1.1\r\n"
+		"Content-Length: 99999999999999999999\r\n\r\n" ) );
+	return 0;
+}
+
+static int
+test_t_htp_pHead_response( )
+{
+	struct t_htp_str s;
+	const char       b [] = "HTTP/1.1 204 No Content\r\nX: y\r\n\r\n";
+
+	t_htp_init( &s, 1 );
+	_assert( 1 == t_htp_pHead( &s, b, sizeof( b ) - 1 ) );
+	_assert( T_HTP_VER_11 == s.ver && 3 == s.ul && 0 == memcmp( b + s.uo, "204", 3 ) );
+	_assert( t_htp_hdr_is( &s, b, 0, "X", "y" ) );
+	t_htp_init( &s, 1 );
+	_assert( -1 == t_htp_pHead( &s, "HTTP/2.0 200 OK\r\n\r\n", 19 ) );
+	t_htp_init( &s, 1 );
+	_assert( -1 == t_htp_pHead( &s, "HTTP/1.1 20 OK\r\n\r\n", 18 ) );
+	t_htp_init( &s, 1 );
+	_assert( -1 == t_htp_pHead( &s, "HTTP/1.1 2000 OK\r\n\r\n", 20 ) );
+	return 0;
+}
+
+/// decode a chunked body the way t_htp_str_rcv() does, in pieces of k bytes
+static int
+t_htp_dechunk( const char *b, size_t n, size_t k, char *d, size_t *dl )
+{
+	struct t_htp_str s;
+	size_t           o = 0;     ///< bytes handed to the decoder
+	size_t           a;         ///< bytes available
+	size_t           l;
+	long             r;
+
+	memset( &s, 0, sizeof( struct t_htp_str ) );
+	s.rqFr = 2;
+	s.cs   = T_HTP_CK_SZ0;
+	*dl    = 0;
+	for (a = (k < n) ? k : n; ! T_HTP_STR_BODYDONE( &s ); a = (a+k < n) ? a+k : n)
+	{
+		while (o < a && ! T_HTP_STR_BODYDONE( &s ))
+		{
+			if (T_HTP_CK_DATA != s.cs)
+			{
+				if ((r = t_htp_pChunk( &s, b + o, a - o )) < 0)
+					return -1;
+				o += r;
+				continue;
+			}
+			l = ((long long) (a - o) > s.ck) ? (size_t) s.ck : a - o;
+			memcpy( d + *dl, b + o, l );
+			*dl += l;
+			o   += l;
+			if (0 == (s.ck -= l))
+				s.cs = T_HTP_CK_DCR;
+		}
+		if (a == n && ! T_HTP_STR_BODYDONE( &s ))
+			return 0;
+	}
+	return (int) o;
+}
+
+static int
+test_t_htp_pChunk( )
+{
+	const char  b [] = "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nTrailer: x\r\n\r\nGET";
+	size_t      n    = sizeof( b ) - 1;
+	char        d[ 64 ];
+	size_t      dl;
+	size_t      k;
+
+	for (k=1; k <= n; k++)
+	{
+		_assert( (int) n - 3 == t_htp_dechunk( b, n, k, d, &dl ) );
+		_assert( 11 == dl && 0 == memcmp( d, "hello world", 11 ) );
+	}
+	_assert( 0 == t_htp_dechunk( "5\r\nhel", 6, 6, d, &dl ) );
+	_assert( -1 == t_htp_dechunk( "x\r\n", 3, 3, d, &dl ) );
+	_assert( -1 == t_htp_dechunk( "5\r\nhelloX\r\n", 10, 10, d, &dl ) );
+	_assert( -1 == t_htp_dechunk( "5\nhello\r\n", 9, 9, d, &dl ) );
+	_assert( -1 == t_htp_dechunk( "fffffffffffffffff\r\n", 19, 19, d, &dl ) );
+	return 0;
+}
+
+// Add all testable functions to the array
+static const struct test_function all_tests [] = {
+	{ "Parsing a request head",                     test_t_htp_pHead_whole },
+	{ "Parsing a request head in pieces",           test_t_htp_pHead_split },
+	{ "Parsing pipelined request heads",            test_t_htp_pHead_pipelined },
+	{ "Accepting HTTP/1.0 and HTTP/1.1 only",       test_t_htp_pHead_version },
+	{ "Refusing malformed request heads",           test_t_htp_pHead_malformed },
+	{ "Refusing ambiguous body framing",            test_t_htp_pHead_framing },
+	{ "Parsing a response head",                    test_t_htp_pHead_response },
+	{ "Decoding chunked bodies",                    test_t_htp_pChunk },
+	{ NULL, NULL }
+};
+
+int
+main()
+{
+	return test_execute( all_tests );
+}
@@ -0,0 +1,94 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      test/t_htp_fil.c
+ * \brief     Unit test for the mapping of url paths to files of T.Http.Files
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+#include "t_unittest.h"
+
+/// does url path u map to the file path k?  NULL for refused paths
+static int
+t_htp_fil_maps( const char *u, const char *k )
+{
+	char   b[ 64 ];
+	size_t n = t_htp_fil_path( u, strlen( u ), b, sizeof( b ) );
+
+	if (NULL == k)
+		return 0 == n;
+	return n == strlen( k ) && 0 == memcmp( b, k, n );
+}
+
+static int
+test_t_htp_fil_path_plain( )
+{
+	_assert( t_htp_fil_maps( "/a/b.txt",   "a/b.txt" ) );
+	_assert( t_htp_fil_maps( "a/b.txt",    "a/b.txt" ) );
+	_assert( t_htp_fil_maps( "/a/./b//c",  "a/b/c" ) );
+	_assert( t_htp_fil_maps( "/..a/b..",   "..a/b.." ) );
+	return 0;
+}
+
+static int
+test_t_htp_fil_path_index( )
+{
+	_assert( t_htp_fil_maps( "",           T_HTP_FIL_IDX ) );
+	_assert( t_htp_fil_maps( "/",          T_HTP_FIL_IDX ) );
+	_assert( t_htp_fil_maps( "/dir/",      "dir/"T_HTP_FIL_IDX ) );
+	_assert( t_htp_fil_maps( "/dir/.",     "dir/"T_HTP_FIL_IDX ) );
+	return 0;
+}
+
+static int
+test_t_htp_fil_path_decode( )
+{
+	_assert( t_htp_fil_maps( "/a%20b",     "a b" ) );
+	_assert( t_htp_fil_maps( "/a%2fb",     "a/b" ) );
+	_assert( t_htp_fil_maps( "/a%2Fb",     "a/b" ) );
+	_assert( t_htp_fil_maps( "/a%2",       NULL ) );
+	_assert( t_htp_fil_maps( "/a%zz",      NULL ) );
+	_assert( t_htp_fil_maps( "/a%00b",     NULL ) );
+	return 0;
+}
+
+static int
+test_t_htp_fil_path_dotdot( )
+{
+	_assert( t_htp_fil_maps( "/..",             NULL ) );
+	_assert( t_htp_fil_maps( "/../etc/passwd",  NULL ) );
+	_assert( t_htp_fil_maps( "/a/../../etc",    NULL ) );
+	_assert( t_htp_fil_maps( "/a/..",           NULL ) );
+	_assert( t_htp_fil_maps( "/%2e%2e/etc",     NULL ) );
+	_assert( t_htp_fil_maps( "/.%2E/etc",       NULL ) );
+	_assert( t_htp_fil_maps( "/a%2f..%2fetc",   NULL ) );
+	return 0;
+}
+
+static int
+test_t_htp_fil_path_size( )
+{
+	char b[ 8 ];
+
+	_assert( 7 == t_htp_fil_path( "/abcdefg", 8, b, 8 ) );
+	_assert( 0 == t_htp_fil_path( "/abcdefgh", 9, b, 8 ) );
+	_assert( 0 == t_htp_fil_path( "/", 1, b, 8 ) );   // index.html won't fit
+	return 0;
+}
+
+// Add all testable functions to the array
+static const struct test_function all_tests [] = {
+	{ "Mapping plain paths",                  test_t_htp_fil_path_plain },
+	{ "Mapping directories to the index",     test_t_htp_fil_path_index },
+	{ "Decoding percent encoded paths",       test_t_htp_fil_path_decode },
+	{ "Refusing '..' segments",               test_t_htp_fil_path_dotdot },
+	{ "Refusing paths exceeding the buffer",  test_t_htp_fil_path_size },
+	{ NULL, NULL }
+};
+
+int
+main()
+{
+	return test_execute( all_tests );
+}
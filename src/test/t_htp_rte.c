@@ -0,0 +1,181 @@
+/* vim: ts=3 sw=3 sts=3 tw=80 sta noet list
+*/
+/**
+ * \file      test/t_htp_rte.c
+ * \brief     Unit test for the route matching of T.Http.Router
+ * \author    tkieslich
+ * \copyright See Copyright notice at the end of t.h
+ */
+
+#include "t_unittest.h"
+
+/// add a route to the table as lt_htp_rte_add() does; no Lua errors expected
+static struct t_htp_rtn *
+t_htp_rte_route( struct t_htp_rte *r, const char *p )
+{
+	int               cn = 0;
+	struct t_htp_rtn *n  = t_htp_rte_insert( NULL, r->rt, p, p + strlen( p ), &cn );
+
+	n->hn++;
+	r->n++;
+	return n;
+}
+
+/// does capture i of a match equal v?
+static int
+t_htp_rte_cap( const char **cp, int i, const char *v )
+{
+	return strlen( v ) == (size_t) (cp[ 2*i+1 ] - cp[ 2*i ]) &&
+	       0 == memcmp( cp[ 2*i ], v, strlen( v ) );
+}
+
+/// match url u against the table
+static struct t_htp_rtn *
+t_htp_rte_url( struct t_htp_rte *r, const char *u, const char **cp, int *cn )
+{
+	return t_htp_rte_match( r, u, strlen( u ), cp, cn );
+}
+
+static void
+t_htp_rte_init( struct t_htp_rte *r )
+{
+	r->rt = t_htp_rte_node( NULL, "", 0 );
+	r->fR = LUA_NOREF;
+	r->n  = 0;
+}
+
+static int
+test_t_htp_rte_static( )
+{
+	struct t_htp_rte  r;
+	struct t_htp_rtn *rt, *us, *ul, *at;
+	const char       *cp[ 2*T_HTP_RTE_CPN ];
+	int               cn;
+
+	t_htp_rte_init( &r );
+	rt = t_htp_rte_route( &r, "/" );
+	us = t_htp_rte_route( &r, "/users" );
+	ul = t_htp_rte_route( &r, "/users/list" );
+	at = t_htp_rte_route( &r, "/about/team" );
+	_assert( rt == t_htp_rte_url( &r, "/", cp, &cn ) && 0 == cn );
+	_assert( us == t_htp_rte_url( &r, "/users", cp, &cn ) && 0 == cn );
+	_assert( ul == t_htp_rte_url( &r, "/users/list", cp, &cn ) && 0 == cn );
+	_assert( at == t_htp_rte_url( &r, "/about/team", cp, &cn ) && 0 == cn );
+	_assert( NULL == t_htp_rte_url( &r, "/user", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "/users/lis", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "/users/listx", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "/users/list/x", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "/about", cp, &cn ) );
+	t_htp_rte_free( NULL, r.rt );
+	return 0;
+}
+
+static int
+test_t_htp_rte_split( )
+{
+	struct t_htp_rte  r;
+	struct t_htp_rtn *v1, *v2, *ap;
+	const char       *cp[ 2*T_HTP_RTE_CPN ];
+	int               cn;
+
+	t_htp_rte_init( &r );
+	v1 = t_htp_rte_route( &r, "/api/v1/users" );
+	v2 = t_htp_rte_route( &r, "/api/v2" );
+	_assert( NULL == t_htp_rte_url( &r, "/api", cp, &cn ) );
+	ap = t_htp_rte_route( &r, "/api" );
+	_assert( v1 == t_htp_rte_url( &r, "/api/v1/users", cp, &cn ) );
+	_assert( v2 == t_htp_rte_url( &r, "/api/v2", cp, &cn ) );
+	_assert( ap == t_htp_rte_url( &r, "/api", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "/api/v1", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "/api/v", cp, &cn ) );
+	t_htp_rte_free( NULL, r.rt );
+	return 0;
+}
+
+static int
+test_t_htp_rte_capture( )
+{
+	struct t_htp_rte  r;
+	struct t_htp_rtn *id, *ps, *st;
+	const char       *cp[ 2*T_HTP_RTE_CPN ];
+	int               cn;
+
+	t_htp_rte_init( &r );
+	id = t_htp_rte_route( &r, "/users/:id" );
+	ps = t_htp_rte_route( &r, "/users/:id/posts/:pid" );
+	st = t_htp_rte_route( &r, "/static/*path" );
+	_assert( id == t_htp_rte_url( &r, "/users/42", cp, &cn ) );
+	_assert( 1 == cn && t_htp_rte_cap( cp, 0, "42" ) );
+	_assert( ps == t_htp_rte_url( &r, "/users/42/posts/7", cp, &cn ) );
+	_assert( 2 == cn && t_htp_rte_cap( cp, 0, "42" ) && t_htp_rte_cap( cp, 1, "7" ) );
+	_assert( st == t_htp_rte_url( &r, "/static/css/a.css", cp, &cn ) );
+	_assert( 1 == cn && t_htp_rte_cap( cp, 0, "css/a.css" ) );
+	_assert( NULL == t_htp_rte_url( &r, "/users/", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "/users/42/posts", cp, &cn ) );
+	t_htp_rte_free( NULL, r.rt );
+	return 0;
+}
+
+static int
+test_t_htp_rte_precedence( )
+{
+	struct t_htp_rte  r;
+	struct t_htp_rtn *me, *id, *wc, *xc, *bd;
+	const char       *cp[ 2*T_HTP_RTE_CPN ];
+	int               cn;
+
+	t_htp_rte_init( &r );
+	wc = t_htp_rte_route( &r, "/users/*rest" );
+	id = t_htp_rte_route( &r, "/users/:id" );
+	me = t_htp_rte_route( &r, "/users/me" );
+	xc = t_htp_rte_route( &r, "/a/:x/c" );
+	bd = t_htp_rte_route( &r, "/a/b/d" );
+	_assert( me == t_htp_rte_url( &r, "/users/me", cp, &cn ) && 0 == cn );
+	_assert( id == t_htp_rte_url( &r, "/users/you", cp, &cn ) && 1 == cn );
+	_assert( wc == t_htp_rte_url( &r, "/users/you/too", cp, &cn ) );
+	_assert( 1 == cn && t_htp_rte_cap( cp, 0, "you/too" ) );
+	// the static branch doesn't end at a route; backs off to :x
+	_assert( bd == t_htp_rte_url( &r, "/a/b/d", cp, &cn ) && 0 == cn );
+	_assert( xc == t_htp_rte_url( &r, "/a/b/c", cp, &cn ) );
+	_assert( 1 == cn && t_htp_rte_cap( cp, 0, "b" ) );
+	t_htp_rte_free( NULL, r.rt );
+	return 0;
+}
+
+static int
+test_t_htp_rte_url( )
+{
+	struct t_htp_rte  r;
+	struct t_htp_rtn *id;
+	const char       *cp[ 2*T_HTP_RTE_CPN ];
+	int               cn;
+
+	t_htp_rte_init( &r );
+	id = t_htp_rte_route( &r, "/users/:id" );
+	_assert( id == t_htp_rte_url( &r, "/users/42?x=1", cp, &cn ) );
+	_assert( 1 == cn && t_htp_rte_cap( cp, 0, "42" ) );
+	_assert( id == t_htp_rte_url( &r, "/users/42#top", cp, &cn ) );
+	_assert( 1 == cn && t_htp_rte_cap( cp, 0, "42" ) );
+	_assert( NULL == t_htp_rte_url( &r, "", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "?x=1", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "users/42", cp, &cn ) );
+	_assert( NULL == t_htp_rte_url( &r, "http://h/users/42", cp, &cn ) );
+	t_htp_rte_free( NULL, r.rt );
+	return 0;
+}
+
+// Add all testable functions to the array
+static const struct test_function all_tests [] = {
+	{ "Matching static routes",                  test_t_htp_rte_static },
+	{ "Splitting shared static segments",        test_t_htp_rte_split },
+	{ "Capturing :name and *name segments",      test_t_htp_rte_capture },
+	{ "Static before :name before *name",        test_t_htp_rte_precedence },
+	{ "Ignoring query and fragment",             test_t_htp_rte_url },
+	{ NULL, NULL }
+};
+
+int
+main()
+{
+	return test_execute( all_tests );
+}
@@ -0,0 +1,168 @@
+#!../out/bin/lua
+
+---
+-- \file    t_htp_srv.lua
+-- \brief   Test for the request parsing of T.Http.Server
+-- Requests get written to a server on the local host in pieces; the server
+-- answers each with its method, url and body.  Malformed requests make the
+-- server close the connection without an answer.  A cluster of the
+-- example/htp_hello.lua handler gets started and stopped.
+local   t      = require( 't' )
+local   Test   = t.Test
+local   port   = 8011
+
+local l = t.Loop( 16 )
+local h = t.Http.Server( l, function( s )
+	local answer = function( b )
+		s:finish( s.method .. ' ' .. s.url .. ' ' .. b )
+	end
+	if 'GET' == s.method then return answer( '' ) end
+	local b = { }
+	s:onBody( function( s, d )
+		if d then b[ #b+1 ] = d else answer( table.concat( b ) ) end
+	end )
+end )
+h:listen( port, 16 )
+
+-- write pieces to the server 5ms apart and collect what comes back until n
+-- responses arrived or the server closed the connection
+-- returns the responses, their bodies and whether the connection got closed
+local exchange = function( pieces, n )
+	local c      = t.Net.TCP.connect( '127.0.0.1', port )
+	local r      = { }
+	local i      = 0
+	local closed = false
+	local snd    = t.Time( 1 )
+	local grd    = t.Time( 2000 )
+	local count  = function( ) return select( 2, table.concat( r ):gsub( 'HTTP/1%.1 %d%d%d', '' ) ) end
+
+	l:addHandle( c, true, function( )
+		local ok, d = pcall( c.recv, c )
+		if ok and #d > 0 then
+			r[ #r+1 ] = d
+			if count( ) < n then return end
+		else
+			closed = true
+		end
+		l:stop( )
+	end )
+	l:addTimer( snd, function( )
+		i = i + 1
+		c:send( pieces[ i ] )
+		if i < #pieces then return t.Time( 5 ) end
+	end )
+	l:addTimer( grd, function( ) l:stop( ) end )
+	l:run( )
+	l:removeTimer( snd )
+	l:removeTimer( grd )
+	l:removeHandle( c, true )
+	c:close( )
+
+	local bodies = { }
+	for b in table.concat( r ):gmatch( '\r\n\r\n([^H]*)' ) do bodies[ #bodies+1 ] = b end
+	return table.concat( r ), bodies, closed
+end
+
+-- GET / from a server which may still be starting up; the answer or nil
+local get = function( p )
+	for i = 1, 200 do
+		local ok, c = pcall( t.Net.TCP.connect, '127.0.0.1', p )
+		if ok then
+			c:send( 'GET / HTTP/1.1\r\n\r\n' )
+			local r = c:recv( )
+			c:close( )
+			return r
+		end
+		l:addTimer( t.Time( 10 ), function( ) l:stop( ) end )
+		l:run( )
+	end
+end
+
+local tests = {
+	test_SplitHead = function( self )
+		-- #DESC:A request head arriving in pieces gets parsed as a whole
+		local r, b = exchange( { 'GE', 'T /a HT', 'TP/1.1\r', '\nHost: x\r\nX-A', ': 1\r\n\r', '\n' }, 1 )
+		assert( r:match( '^HTTP/1%.1 200 ' ), "Split request head must be answered" )
+		assert( 'GET /a ' == b[ 1 ], "Split request head must be parsed completely" )
+	end,
+
+	test_SplitBody = function( self )
+		-- #DESC:Content-Length and chunked bodies arriving in pieces get reassembled
+		local r, b = exchange( {
+			  'POST /cl HTTP/1.1\r\nContent-Length: 10\r\n\r\nabc', 'defg', 'hij'
+			, 'POST /ck HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r', '\nabc\r\n4;x=y\r\ndefg\r\n0\r\n\r\n'
+		}, 2 )
+		assert( 'POST /cl abcdefghij' == b[ 1 ], "Content-Length body must be reassembled" )
+		assert( 'POST /ck abcdefg' == b[ 2 ], "Chunked body must be decoded" )
+	end,
+
+	test_Pipelined = function( self )
+		-- #DESC:Pipelined requests get answered in order
+		local r, b = exchange( {
+			'GET /1 HTTP/1.1\r\n\r\n' ..
+			'POST /2 HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc' ..
+			'POST /3 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nde\r\n0\r\n\r\n' ..
+			'GET /4 HTTP/1.1\r\n\r\n'
+		}, 4 )
+		assert( 4 == #b, "Each pipelined request must be answered" )
+		assert( 'GET /1 '      == b[ 1 ], "First response must answer first request" )
+		assert( 'POST /2 abc'  == b[ 2 ], "Second response must answer second request" )
+		assert( 'POST /3 de'   == b[ 3 ], "Third response must answer third request" )
+		assert( 'GET /4 '      == b[ 4 ], "Fourth response must answer fourth request" )
+	end,
+
+	test_DuplicateHeaders = function( self )
+		-- #DESC:Repeated headers which don't frame the body are fine
+		local r, b = exchange( { 'GET /d HTTP/1.1\r\nX-A: 1\r\nX-A: 2\r\nHost: x\r\n\r\n' }, 1 )
+		assert( 'GET /d ' == b[ 1 ], "Repeated headers must be accepted" )
+	end,
+
+	test_Malformed = function( self )
+		-- #DESC:Malformed request heads close the connection without an answer
+		local bad = {
+			  'GET / HTTP/2.1\r\n\r\n'
+			, 'GET / HTTP/1.2\r\n\r\n'
+			, 'GET / HTTP/0.9\r\n\r\n'
+			, 'FETCH / HTTP/1.1\r\n\r\n'
+			, 'GET /a\tb HTTP/1.1\r\n\r\n'
+			, 'GET / HTTP/1.1\r\nHost: x\r\n folded\r\n\r\n'
+			, 'GET / HTTP/1.1\r\nBad Key: v\r\n\r\n'
+			, 'GET / HTTP/1.1\r\nX: a\1b\r\n\r\n'
+			, 'POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n'
+			, 'POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 1\r\n\r\n'
+			, 'POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 1\r\n\r\n'
+			, 'POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n'
+			, 'POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n'
+			, 'POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nx\r\n'
+		}
+		for _, q in ipairs( bad ) do
+			local r, b, closed = exchange( { q }, 1 )
+			assert( '' == r and closed, "Malformed request must close the connection: " .. q )
+		end
+	end,
+
+	test_MalformedPipelined = function( self )
+		-- #DESC:Requests ahead of a malformed one still get answered
+		local r, b, closed = exchange( {
+			'GET /ok HTTP/1.1\r\n\r\nGET / HTTP/2.1\r\n\r\nGET /never HTTP/1.1\r\n\r\n'
+		}, 2 )
+		assert( 1 == #b and 'GET /ok ' == b[ 1 ], "Request ahead of malformed one must be answered" )
+		assert( closed, "Malformed request must close the connection" )
+	end,
+
+	test_Cluster = function( self )
+		-- #DESC:A cluster answers requests until stopped
+		package.path = '../example/?.lua;' .. package.path
+		local c = t.Http.Server.cluster( 2, 'htp_hello', port+1 )
+		local r = get( port+1 )
+		c:stop( )
+		assert( r and r:match( '^HTTP/1%.1 200 ' ), "Cluster worker must answer" )
+		assert( not pcall( t.Net.TCP.connect, '127.0.0.1', port+1 ), "Stopped cluster must not accept connections" )
+		c:stop( )
+		c:join( )
+	end,
+}
+
+t_htp_srv = Test( tests )
+t_htp_srv( )
+print( t_htp_srv )